@@ -452,6 +452,43 @@ namespace
         }
     }
 
+    // Get the daemon properties used by renderValue() for a type, so the
+    // monitor command can subscribe to just those properties
+    QStringList valueProperties(const QString &type)
+    {
+        if(type == GetSetType::connectionState)
+            return {QStringLiteral("state.connectionState")};
+        else if(type == GetSetType::debugLogging)
+            return {QStringLiteral("settings.debugLogging")};
+        else if(type == GetSetType::portForward)
+            return {QStringLiteral("state.forwardedPort")};
+        else if(type == GetSetType::protocol)
+            return {QStringLiteral("settings.method")};
+        else if(type == GetSetType::requestPortForward)
+            return {QStringLiteral("settings.portForward")};
+        else if(type == GetSetType::region)
+        {
+            // renderLocation() also uses the metadata and grouped locations
+            return {QStringLiteral("state.vpnLocations"),
+                    QStringLiteral("state.regionsMetadata"),
+                    QStringLiteral("state.groupedLocations")};
+        }
+        else if(type == GetSetType::regions)
+        {
+            return {QStringLiteral("state.dedicatedIpLocations"),
+                    QStringLiteral("state.regionsMetadata"),
+                    QStringLiteral("state.groupedLocations")};
+        }
+        else if(type == GetSetType::vpnIp)
+            return {QStringLiteral("state.externalVpnIp")};
+        else if(type == GetSetType::pubIp)
+            return {QStringLiteral("state.externalIp")};
+        else if(type == GetSetType::allowLAN)
+            return {QStringLiteral("settings.allowLAN")};
+        // Anything else, don't restrict subscriptions
+        return {};
+    }
+
     // Check get/monitor parameters.  Prints an error and throws if the
     // parameters are not valid
     void checkParams(const QStringList &params, const std::map<QString, SupportedType> &types)
@@ -534,6 +571,9 @@ int MonitorCommand::exec(const QStringList &params, QCoreApplication &app)
     checkParams(params, _monitorSupportedTypes);
 
     CliClient client;
+    // Only the monitored value is needed, don't receive changes in any other
+    // properties
+    client.connection().setSubscriptions(valueProperties(params[1]));
     ValuePrinter printer{client, params[1]};
 
     return app.exec();
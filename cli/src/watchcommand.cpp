@@ -22,6 +22,7 @@
 #include "watchcommand.h"
 #include "cliclient.h"
 #include <common/src/output.h>
+#include <QMetaProperty>
 #include <unordered_set>
 
 class JsonChangePrinter : public QObject
@@ -40,6 +41,24 @@ public:
                 &JsonChangePrinter::printChange);
     }
 
+public:
+    // Get the paths of all properties that are printed, used to subscribe to
+    // them.  The blacklisted properties are large and change frequently, so
+    // they're not even sent by the daemon.
+    QStringList printedPropertyPaths() const
+    {
+        QStringList paths;
+        const QMetaObject *pMeta = _obj.metaObject();
+        for(int i = NativeJsonObject::staticMetaObject.propertyCount();
+            i < pMeta->propertyCount(); ++i)
+        {
+            QString propName = QString::fromLatin1(pMeta->property(i).name());
+            if(!propertyBlacklist.count(propName))
+                paths.push_back(_name + '.' + propName);
+        }
+        return paths;
+    }
+
 public:
     void printChange(const QString &propName)
     {
@@ -91,6 +110,9 @@ int WatchCommand::exec(const QStringList &params, QCoreApplication &app)
     JsonChangePrinter settings{client.connection().settings, QStringLiteral("settings")};
     JsonChangePrinter state{client.connection().state, QStringLiteral("state")};
     JsonChangePrinter account{client.connection().account, QStringLiteral("account")};
+    client.connection().setSubscriptions(data.printedPropertyPaths() +
+        settings.printedPropertyPaths() + state.printedPropertyPaths() +
+        account.printedPropertyPaths());
 
     return app.exec();
 }
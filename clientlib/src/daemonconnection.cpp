@@ -61,6 +61,16 @@ DaemonConnection::~DaemonConnection()
 
 }
 
+void DaemonConnection::setSubscriptions(const QStringList &paths)
+{
+    _subscriptions = paths;
+    if(_ipc && _ipc->isConnected())
+    {
+        _rpc->post(QStringLiteral("subscribeProperties"),
+            QJsonArray::fromStringList(_subscriptions));
+    }
+}
+
 void DaemonConnection::connectToDaemon()
 {
     if (_ipc)
@@ -92,6 +102,28 @@ void DaemonConnection::connectToDaemon()
     _ipc = new ThreadedLocalIPCConnection(this);
 
     connect(_ipc, &IPCConnection::connected, this, &DaemonConnection::socketConnected);
+    // Ask the daemon to send changes in large state properties as JSON
+    // patches (see RPC_data())
+    connect(_ipc, &IPCConnection::connected, this, [this]()
+    {
+        _rpc->post(QStringLiteral("setStatePatches"), true);
+        if(!_subscriptions.isEmpty())
+        {
+            _rpc->post(QStringLiteral("subscribeProperties"),
+                QJsonArray::fromStringList(_subscriptions));
+        }
+        // Switch to CBOR once the daemon has accepted it.  Messages received
+        // in either encoding are handled, so it doesn't matter when the
+        // daemon's messages switch to CBOR.
+        _rpc->call(QStringLiteral("setMessageEncoding"), QStringLiteral("cbor"))
+            ->notify(this, [this](const Error &error, const QJsonValue &)
+            {
+                if(error)
+                    qInfo() << "Daemon did not accept CBOR encoding, continuing with JSON -" << error;
+                else
+                    _rpc->setEncoding(JsonRPCEncoding::Cbor);
+            });
+    });
     connect(_ipc, &IPCConnection::disconnected, this, &DaemonConnection::socketDisconnected);
     connect(_ipc, &IPCConnection::error, this, &DaemonConnection::socketError);
 
@@ -111,9 +143,33 @@ void DaemonConnection::RPC_data(const QJsonObject &data)
     AssignObject(data);
     AssignObject(account);
     AssignObject(settings);
-    AssignObject(state);
 #undef AssignObject
 
+    // State properties can be given as complete values in "state" or as JSON
+    // patches relative to the current value in "statePatch".  Apply both in
+    // one assignment so the state changes atomically.
+    QJsonObject stateProps = data.value(QStringLiteral("state")).toObject();
+    const QJsonObject &statePatches = data.value(QStringLiteral("statePatch")).toObject();
+    bool patchFailed{false};
+    for(auto itPatch = statePatches.begin(); itPatch != statePatches.end(); ++itPatch)
+    {
+        QJsonValue value = state.get(itPatch.key());
+        if(applyJsonPatch(value, itPatch.value().toArray()))
+            stateProps.insert(itPatch.key(), value);
+        else
+        {
+            qWarning() << "Unable to apply patch to state property"
+                << itPatch.key();
+            patchFailed = true;
+        }
+    }
+    if(!stateProps.isEmpty())
+        state.assign(stateProps);
+    // If a patch couldn't be applied, our state has diverged from the daemon.
+    // Turn off patches, which causes the daemon to resend everything.
+    if(patchFailed)
+        _rpc->post(QStringLiteral("setStatePatches"), false);
+
     if (!_connected && _ipc->isConnected())
     {
         _connectionTimer.stop();
@@ -141,6 +197,8 @@ void DaemonConnection::socketDisconnected()
     }
     // Reject any requests that were sent before the connection was lost
     _rpc->connectionLost();
+    // A new connection starts out using JSON until CBOR is negotiated again
+    _rpc->setEncoding(JsonRPCEncoding::Json);
     if (_connected)
     {
         emit connectedChanged(_connected = false);
@@ -43,6 +43,16 @@ public:
     void connectToDaemon();
     bool isConnected() const { return _connected; }
 
+    // Receive changes only for specific properties, such as
+    // "state.connectionState" or "settings" (see
+    // Daemon::RPC_subscribeProperties()).  Properties that aren't subscribed
+    // are still populated with their initial values, but they won't be
+    // updated.  An empty list subscribes to everything (the default).
+    //
+    // This can be called before connecting; the subscriptions are sent each
+    // time the connection is established.
+    void setSubscriptions(const QStringList &paths);
+
 // Information gathered from the daemon to display in the client
 public:
     // List of server locations and certificate info
@@ -98,6 +108,7 @@ private:
     ClientSideInterface* _rpc;
     QTimer _connectionTimer;
     bool _connected;
+    QStringList _subscriptions;
 };
 
 #endif
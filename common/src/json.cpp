@@ -22,6 +22,7 @@
 #include "json.h"
 #include "builtin/path.h"
 #include "builtin/util.h"
+#include "jsonwriter.h"
 
 #include <QJsonDocument>
 #include <QFile>
@@ -336,6 +337,35 @@ QJsonObject NativeJsonObject::toJsonObject() const
     return result;
 }
 
+void NativeJsonObject::writeJson(JsonWriter &writer,
+                                 const std::unordered_set<QString> &omitProperties) const
+{
+    writer.beginObject();
+    auto m = this->metaObject();
+    // Unknown properties are written first, unless a property of the same name
+    // exists (the property value takes precedence, like toJsonObject())
+    for(auto it = _other.begin(); it != _other.end(); ++it)
+    {
+        if(omitProperties.count(it.key()) ||
+            m->indexOfProperty(it.key().toLatin1().constData()) >= m->propertyOffset())
+        {
+            continue;
+        }
+        writer.key(it.key());
+        writer.value(it.value());
+    }
+    for (int i = m->propertyOffset(), c = m->propertyCount(); i < c; i++)
+    {
+        auto p = m->property(i);
+        QString name = QString::fromLatin1(p.name());
+        if(omitProperties.count(name))
+            continue;
+        writer.key(kapps::core::StringSlice{p.name()});
+        writer.value(QJsonValue::fromVariant(p.read(this)));
+    }
+    writer.endObject();
+}
+
 bool NativeJsonObject::readJsonObject(const QJsonObject &obj)
 {
     reset();
@@ -354,6 +384,172 @@ QString jsonValueString(const QJsonValue &value)
     return str.mid(1, str.length() - 2);
 }
 
+namespace
+{
+    // Split an RFC 6901 JSON pointer into its unescaped reference tokens.
+    // Returns false if the pointer is not valid.
+    bool parseJsonPointer(const QString &pointer, QStringList &tokens)
+    {
+        tokens.clear();
+        if(pointer.isEmpty())
+            return true;    // Refers to the whole document
+        if(!pointer.startsWith('/'))
+            return false;
+        tokens = pointer.mid(1).split('/');
+        for(auto &token : tokens)
+        {
+            // Order matters - "~01" is "~1", not "/"
+            token.replace(QStringLiteral("~1"), QStringLiteral("/"));
+            token.replace(QStringLiteral("~0"), QStringLiteral("~"));
+        }
+        return true;
+    }
+
+    enum class PatchOp { Add, Remove, Replace };
+
+    // Apply one patch operation to the value referenced by tokens[idx...] in
+    // node.  Qt's JSON containers are values, so each level is modified and
+    // then written back to its parent.
+    bool applyJsonPatchOp(QJsonValue &node, const QStringList &tokens, int idx,
+                          PatchOp op, const QJsonValue &value)
+    {
+        if(idx == tokens.size())
+        {
+            // The whole document can be replaced, but not removed
+            if(op == PatchOp::Remove)
+                return false;
+            node = value;
+            return true;
+        }
+
+        const QString &token = tokens[idx];
+        bool last = idx == tokens.size() - 1;
+
+        if(node.isObject())
+        {
+            QJsonObject obj = node.toObject();
+            auto itChild = obj.find(token);
+            if(last)
+            {
+                if(op != PatchOp::Add && itChild == obj.end())
+                    return false;
+                if(op == PatchOp::Remove)
+                    obj.erase(itChild);
+                else
+                    obj.insert(token, value);
+            }
+            else
+            {
+                if(itChild == obj.end())
+                    return false;
+                QJsonValue child = itChild.value();
+                if(!applyJsonPatchOp(child, tokens, idx+1, op, value))
+                    return false;
+                itChild.value() = child;
+            }
+            node = obj;
+            return true;
+        }
+
+        if(node.isArray())
+        {
+            QJsonArray arr = node.toArray();
+            int index{};
+            if(token == QStringLiteral("-"))
+            {
+                // "-" refers to the position past the end, only valid to
+                // append a value
+                if(!last || op != PatchOp::Add)
+                    return false;
+                index = arr.size();
+            }
+            else
+            {
+                bool ok{false};
+                index = token.toInt(&ok);
+                if(!ok || index < 0)
+                    return false;
+            }
+
+            if(last && op == PatchOp::Add)
+            {
+                if(index > arr.size())
+                    return false;
+                arr.insert(index, value);
+            }
+            else
+            {
+                if(index >= arr.size())
+                    return false;
+                if(!last)
+                {
+                    QJsonValue child = arr.at(index);
+                    if(!applyJsonPatchOp(child, tokens, idx+1, op, value))
+                        return false;
+                    arr.replace(index, child);
+                }
+                else if(op == PatchOp::Remove)
+                    arr.removeAt(index);
+                else
+                    arr.replace(index, value);
+            }
+            node = arr;
+            return true;
+        }
+
+        // Can't refer into a scalar value
+        return false;
+    }
+}
+
+bool applyJsonPatch(QJsonValue &target, const QJsonArray &patch)
+{
+    QJsonValue result = target;
+    QStringList tokens;
+    for(const auto &opValue : patch)
+    {
+        const QJsonObject &opObj = opValue.toObject();
+        const QString &opName = opObj.value(QLatin1String("op")).toString();
+        PatchOp op;
+        if(opName == QStringLiteral("add"))
+            op = PatchOp::Add;
+        else if(opName == QStringLiteral("remove"))
+            op = PatchOp::Remove;
+        else if(opName == QStringLiteral("replace"))
+            op = PatchOp::Replace;
+        else
+        {
+            qWarning() << "Unsupported JSON patch operation" << opName;
+            return false;
+        }
+
+        const QJsonValue &path = opObj.value(QLatin1String("path"));
+        if(!path.isString() || !parseJsonPointer(path.toString(), tokens))
+        {
+            qWarning() << "Invalid JSON patch path" << path;
+            return false;
+        }
+
+        const QJsonValue &value = opObj.value(QLatin1String("value"));
+        if(op != PatchOp::Remove && value.isUndefined())
+        {
+            qWarning() << "JSON patch operation" << opName << "at"
+                << path.toString() << "has no value";
+            return false;
+        }
+
+        if(!applyJsonPatchOp(result, tokens, 0, op, value))
+        {
+            qWarning() << "Can't apply JSON patch operation" << opName << "at"
+                << path.toString();
+            return false;
+        }
+    }
+
+    target = std::move(result);
+    return true;
+}
+
 bool json_cast(const QJsonValue &from, NativeJsonObject &to)
 {
     if (!from.isObject()) return false;
@@ -26,7 +26,10 @@
 #include <vector>
 #include <deque>
 #include <unordered_map>
+#include <unordered_set>
 #include <set>
+#include <tuple>
+#include <type_traits>
 
 #include <QHash>
 #include <QJsonArray>
@@ -84,6 +87,7 @@ COMMON_EXPORT std::ostream &operator<<(std::ostream &os, const QJsonValue &val);
 
 // Forward declaration
 class COMMON_EXPORT NativeJsonObject;
+class COMMON_EXPORT JsonWriter;
 
 // Implementations of json_value(from, to) for basic types
 
@@ -297,6 +301,113 @@ COMMON_EXPORT bool json_cast(const QJsonValue& from, NativeJsonObject& to);
 // Cast from a NativeJsonObject
 COMMON_EXPORT bool json_cast(const NativeJsonObject& from, QJsonValue& to);
 
+// Value-type JSON objects
+//
+// NativeJsonObject is a QObject with dynamic properties and change signals,
+// which is needed for objects observed by QML, but that's a lot of overhead
+// for small objects used as plain values in containers.  A JSON value object
+// is an ordinary class that lists its fields at compile time with a static
+// jsonFields() method.  json_cast() and to_json()/from_json() work with any
+// such class, and classes with only trivially-copyable fields remain trivially
+// copyable.
+//
+// JsonValueField() declares a field with NativeJsonObject-style accessors:
+//
+//     class Transport
+//     {
+//     public:
+//         JsonValueField(QString, protocol, QStringLiteral("udp"))
+//         JsonValueField(uint, port, 0)
+//
+//     public:
+//         static auto jsonFields()
+//         {
+//             return std::make_tuple(jsonValueField("protocol", &Transport::_protocol),
+//                                    jsonValueField("port", &Transport::_port));
+//         }
+//     };
+//
+// Plain public data members can also be listed in jsonFields().
+//
+// When reading JSON, fields missing from the JSON object keep their default
+// values, and the result is not modified if any field is invalid.
+template<class ObjectT, class FieldT>
+struct JsonValueFieldInfo
+{
+    const char *name;
+    FieldT ObjectT::*pMember;
+};
+
+template<class ObjectT, class FieldT>
+constexpr JsonValueFieldInfo<ObjectT, FieldT> jsonValueField(const char *name,
+                                                             FieldT ObjectT::*pMember)
+{
+    return {name, pMember};
+}
+
+#define JsonValueField(type, name, defaultValue) \
+    public: const type &name() const {return _##name;} \
+    public: void name(type value) {_##name = std::move(value);} \
+    private: type _##name{defaultValue};
+
+template<class T, class = void>
+struct IsJsonValueObject : std::false_type {};
+template<class T>
+struct IsJsonValueObject<T, std::void_t<decltype(T::jsonFields())>> : std::true_type {};
+
+template<class ObjectT, class FieldT>
+bool readJsonValueField(const QJsonObject &from, ObjectT &to,
+                        const JsonValueFieldInfo<ObjectT, FieldT> &field)
+{
+    auto itValue = from.find(QLatin1String{field.name});
+    if(itValue == from.end())
+        return true;
+    return json_cast(itValue.value(), to.*field.pMember);
+}
+
+template<class ObjectT, class FieldT>
+bool writeJsonValueField(const ObjectT &from, QJsonObject &to,
+                         const JsonValueFieldInfo<ObjectT, FieldT> &field)
+{
+    QJsonValue value;
+    if(!json_cast(from.*field.pMember, value))
+        return false;
+    to.insert(QLatin1String{field.name}, std::move(value));
+    return true;
+}
+
+template<class T>
+std::enable_if_t<IsJsonValueObject<T>::value, bool> json_cast(const QJsonValue &from, T &to)
+{
+    if(!from.isObject())
+        return false;
+    const QJsonObject &fromObj = from.toObject();
+    T result{};
+    bool valid = true;
+    std::apply([&](const auto &...fields)
+    {
+        // Stops at the first invalid field
+        ((valid = valid && readJsonValueField(fromObj, result, fields)), ...);
+    }, T::jsonFields());
+    if(valid)
+        to = std::move(result);
+    return valid;
+}
+
+template<class T>
+std::enable_if_t<IsJsonValueObject<T>::value, bool> json_cast(const T &from, QJsonValue &to)
+{
+    QJsonObject toObj;
+    bool valid = true;
+    std::apply([&](const auto &...fields)
+    {
+        ((valid = valid && writeJsonValueField(from, toObj, fields)), ...);
+    }, T::jsonFields());
+    if(valid)
+        to = std::move(toObj);
+    return valid;
+}
+
 
 // Cast between a QJsonValue and a specific type; throws json_cast_exception
 // if the stored value is not a compatible type. Add additional conversions
@@ -320,6 +431,14 @@ template<typename To, typename From> static inline To json_cast(const From& from
 //
 COMMON_EXPORT QString jsonValueString(const QJsonValue& value);
 
+// Apply an RFC 6902 JSON patch to a QJsonValue.  This is used by clients to
+// apply incremental state changes from the daemon (see Daemon::notifyChanges()).
+//
+// Only the "add", "remove", and "replace" operations are supported; these are
+// the only operations produced by nlohmann::json::diff().  If any operation
+// can't be applied, this returns false and leaves 'target' unmodified.
+COMMON_EXPORT bool applyJsonPatch(QJsonValue &target, const QJsonArray &patch);
+
 // Base class for a QJsonObject-like class with fields accessible natively
 // as well as via Qt properties. All properties must be convertible to/from
 // QJsonValue via json_cast, and the reflected Qt properties are always
@@ -421,6 +540,11 @@ public:
 
     // Convert the properties to a QJsonObject (for serialization).
     QJsonObject toJsonObject() const;
+    // Write the properties as a JSON object directly to a JsonWriter; this
+    // produces the same object as toJsonObject() without building the
+    // QJsonObject.  Properties in omitProperties are not written.
+    void writeJson(JsonWriter &writer,
+                   const std::unordered_set<QString> &omitProperties = {}) const;
     // Reset and read all properties from a QJsonObject (for serialization);
     // returns true if all properties were assigned successfully.
     bool readJsonObject(const QJsonObject& obj);
@@ -823,6 +947,41 @@ void from_json(const JsonT &j, NativeJsonObject &o)
     }
 }
 
+// Convert between a JSON value object and nlohmann::json.  Unlike
+// NativeJsonObject, this converts the fields directly, without serializing
+// through Qt JSON.
+template<class JsonT, class T>
+std::enable_if_t<IsJsonValueObject<T>::value> to_json(JsonT &j, const T &o)
+{
+    j = JsonT::object();
+    std::apply([&](const auto &...fields)
+    {
+        ((j[fields.name] = o.*fields.pMember), ...);
+    }, T::jsonFields());
+}
+
+template<class JsonT, class T>
+std::enable_if_t<IsJsonValueObject<T>::value> from_json(const JsonT &j, T &o)
+{
+    // Missing fields keep their default values; invalid fields throw before
+    // 'o' is modified
+    T result{};
+    std::apply([&](const auto &...fields)
+    {
+        auto readField = [&](const auto &field)
+        {
+            auto itValue = j.find(field.name);
+            if(itValue != j.end())
+            {
+                using FieldT = std::decay_t<decltype(result.*field.pMember)>;
+                result.*field.pMember = itValue->template get<FieldT>();
+            }
+        };
+        (readField(fields), ...);
+    }, T::jsonFields());
+    o = std::move(result);
+}
+
 // Convert QJsonValue to kapps::core::JsonReadable.  This has to serialize the
 // JSON to transport between Qt and nlohmann::json.
 //
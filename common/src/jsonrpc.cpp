@@ -21,6 +21,9 @@
 
 #include "jsonrpc.h"
 
+#include <QCborMap>
+#include <QCborValue>
+
 namespace
 {
     // The "data" method is used from the daemon to provide updates to clients.
@@ -32,8 +35,28 @@ namespace
     }
 }
 
+QByteArray serializeJsonRPCMessage(const QJsonObject &msg, JsonRPCEncoding encoding)
+{
+    if(encoding == JsonRPCEncoding::Cbor)
+        return QCborMap::fromJsonObject(msg).toCborValue().toCbor();
+    return QJsonDocument(msg).toJson(QJsonDocument::Compact);
+}
+
 QJsonObject parseJsonRPCMessage(const QByteArray &msg) throws(Error)
 {
+    // A CBOR message starts with a map header (major type 5).  Those bytes
+    // can't begin JSON text, which must start with whitespace or '{' here.
+    if (!msg.isEmpty() && (static_cast<quint8>(msg[0]) & 0xE0) == 0xA0)
+    {
+        QCborParserError cborError;
+        QCborValue cbor = QCborValue::fromCbor(msg, &cborError);
+        if (cborError.error != QCborError::NoError)
+            throw JsonRPCParseError(HERE, cborError.errorString());
+        if (!cbor.isMap())
+            throw JsonRPCInvalidRequestError(HERE, "unrecognized message");
+        return cbor.toMap().toJsonObject();
+    }
+
     QJsonParseError error;
     QJsonDocument json = QJsonDocument::fromJson(msg, &error);
     if (error.error != QJsonParseError::NoError)
@@ -310,7 +333,7 @@ void LocalCallInterface::respondWithResult(const QJsonValue &id, const QJsonValu
         { QStringLiteral("id"), id },
         { QStringLiteral("result"), result.isUndefined() ? QJsonValue::Null : result },
     };
-    emit messageReady(QJsonDocument(msg).toJson(QJsonDocument::Compact));
+    emit messageReady(serializeJsonRPCMessage(msg, _encoding));
 }
 
 void LocalCallInterface::respondWithError(const QJsonValue &id, const Error &error)
@@ -325,7 +348,7 @@ void LocalCallInterface::respondWithError(const QJsonValue &id, const QJsonObjec
     msg[QStringLiteral("jsonrpc")] = QStringLiteral("2.0");
     msg[QStringLiteral("id")] = (id.isString() || id.isDouble()) ? id : QJsonValue(QJsonValue::Null);
     msg[QStringLiteral("error")] = error;
-    emit messageReady(QJsonDocument(msg).toJson(QJsonDocument::Compact));
+    emit messageReady(serializeJsonRPCMessage(msg, _encoding));
 }
 
 void RemoteNotificationInterface::postWithParams(const QString& method, const QJsonArray& params)
@@ -333,19 +356,48 @@ void RemoteNotificationInterface::postWithParams(const QString& method, const QJ
     request(QJsonValue::Undefined, method, params);
 }
 
-void RemoteNotificationInterface::request(const QJsonValue &id, const QString &method, const QJsonArray &params)
+QByteArray RemoteNotificationInterface::buildNotification(const QString &method, const QJsonArray &params,
+                                                          JsonRPCEncoding encoding)
+{
+    return buildRequest(QJsonValue::Undefined, method, params, encoding);
+}
+
+QByteArray RemoteNotificationInterface::buildJsonNotification(const QString &method,
+                                                              const std::function<void(JsonWriter&)> &writeParams)
+{
+    JsonWriter writer;
+    writer.beginObject();
+    writer.key(QStringLiteral("jsonrpc"));
+    writer.value(QStringLiteral("2.0"));
+    writer.key(QStringLiteral("method"));
+    writer.value(method);
+    writer.key(QStringLiteral("params"));
+    writer.beginArray();
+    writeParams(writer);
+    writer.endArray();
+    writer.endObject();
+    return writer.take();
+}
+
+QByteArray RemoteNotificationInterface::buildRequest(const QJsonValue &id, const QString &method,
+                                                     const QJsonArray &params, JsonRPCEncoding encoding)
 {
-    if(!suppressMethodTracing(method))
-    {
-        qInfo() << "Sending request" << id << "to invoke RPC method" << method;
-    }
     QJsonObject msg;
     msg[QStringLiteral("jsonrpc")] = QStringLiteral("2.0");
     if (id.isString() || id.isDouble())
         msg[QStringLiteral("id")] = id;
     msg[QStringLiteral("method")] = method;
     msg[QStringLiteral("params")] = params;
-    emit messageReady(QJsonDocument(msg).toJson(QJsonDocument::Compact));
+    return serializeJsonRPCMessage(msg, encoding);
+}
+
+void RemoteNotificationInterface::request(const QJsonValue &id, const QString &method, const QJsonArray &params)
+{
+    if(!suppressMethodTracing(method))
+    {
+        qInfo() << "Sending request" << id << "to invoke RPC method" << method;
+    }
+    emit messageReady(buildRequest(id, method, params, _encoding));
 }
 
 double RemoteCallInterface::getNextId()
@@ -519,6 +571,12 @@ ServerSideInterface::ServerSideInterface(LocalMethodRegistry *methods, QObject *
     connect(&_local, &LocalCallInterface::messageReady, this, &ServerSideInterface::messageReady);
 }
 
+void ServerSideInterface::setEncoding(JsonRPCEncoding encoding)
+{
+    RemoteNotificationInterface::setEncoding(encoding);
+    _local.setEncoding(encoding);
+}
+
 bool ServerSideInterface::processMessage(const QByteArray &msg)
 {
     return _local.processMessage(msg);
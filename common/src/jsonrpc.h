@@ -25,6 +25,7 @@
 
 #include "async.h"
 #include "json.h"
+#include "jsonwriter.h"
 
 #include <QHash>
 #include <QJsonArray>
@@ -35,9 +36,25 @@
 #include <QSet>
 
 #include <cmath>
+#include <functional>
 #include <initializer_list>
 
 
+// JSON-RPC messages can be encoded as UTF-8 JSON text, or as CBOR (RFC 8949).
+// CBOR avoids formatting and then re-parsing text (particularly numbers), which
+// is significant for the large "data" notifications from the daemon.
+//
+// parseJsonRPCMessage() detects the encoding of each message, so a sender can
+// switch to CBOR at any time once it knows the remote end supports it.  Nodes
+// always start out using JSON; the client negotiates CBOR with the daemon's
+// "setMessageEncoding" method.
+enum class JsonRPCEncoding
+{
+    Json,
+    Cbor,
+};
+
+COMMON_EXPORT QByteArray serializeJsonRPCMessage(const QJsonObject& msg, JsonRPCEncoding encoding);
 COMMON_EXPORT QJsonObject parseJsonRPCMessage(const QByteArray& msg) throws(Error);
 COMMON_EXPORT void parseJsonRPCRequest(const QJsonObject& request, QString& method, QJsonArray& params) throws(Error);
 
@@ -213,6 +230,11 @@ public slots:
     virtual bool processMessage(const QByteArray& msg) override;
     virtual bool processRequest(const QJsonObject& request) override;
 
+public:
+    // Encoding used for responses
+    JsonRPCEncoding encoding() const { return _encoding; }
+    void setEncoding(JsonRPCEncoding encoding) { _encoding = encoding; }
+
 protected:
     void respondWithResult(const QJsonValue& id, const QJsonValue& result);
     void respondWithError(const QJsonValue& id, const Error& error);
@@ -220,6 +242,9 @@ protected:
 
 signals:
     void messageReady(const QByteArray& response);
+
+private:
+    JsonRPCEncoding _encoding{JsonRPCEncoding::Json};
 };
 
 
@@ -239,11 +264,31 @@ public:
 
     void postWithParams(const QString& method, const QJsonArray& params);
 
+    // Serialize a Notification without sending it.  This allows the same
+    // message to be sent to many remote nodes while only serializing it once.
+    static QByteArray buildNotification(const QString& method, const QJsonArray& params,
+                                        JsonRPCEncoding encoding = JsonRPCEncoding::Json);
+    // Serialize a JSON-encoded Notification, writing the parameters directly
+    // with a JsonWriter.  writeParams writes each parameter value (they're
+    // written inside the params array).  This avoids building the parameters
+    // as a QJsonArray for very large notifications.
+    static QByteArray buildJsonNotification(const QString &method,
+                                            const std::function<void(JsonWriter&)> &writeParams);
+
+    // Encoding used for outgoing messages
+    JsonRPCEncoding encoding() const { return _encoding; }
+    virtual void setEncoding(JsonRPCEncoding encoding) { _encoding = encoding; }
+
 protected:
+    static QByteArray buildRequest(const QJsonValue& id, const QString& method,
+                                   const QJsonArray& params, JsonRPCEncoding encoding);
     void request(const QJsonValue& id, const QString& method, const QJsonArray& params);
 
 signals:
     void messageReady(const QByteArray& msg);
+
+private:
+    JsonRPCEncoding _encoding{JsonRPCEncoding::Json};
 };
 
 
@@ -305,6 +350,9 @@ class COMMON_EXPORT ServerSideInterface : public RemoteNotificationInterface
 public:
     explicit ServerSideInterface(LocalMethodRegistry* methods, QObject* parent = nullptr);
 
+    // Applies to both notifications and responses
+    virtual void setEncoding(JsonRPCEncoding encoding) override;
+
 public slots:
     bool processMessage(const QByteArray& msg);
 
@@ -20,7 +20,10 @@
 #include "common.h"
 #include <kapps_core/src/corejson.h>
 #include <kapps_core/src/coresignal.h>
+#include <algorithm>
+#include <cstdint>
 #include <unordered_map>
+#include <vector>
 
 // JsonState represents a set of state properties using JSON.  The properties
 // can individually signal changes, and they can be individually serialized.
@@ -79,6 +82,22 @@
 // To observe a specific property change, connect to that property's changed
 // signal:
 //     _serviceState.numberOfServers.changed = [this]{ /*number of servers changed*/ };
+//
+// Each property also has a dense index, assigned in declaration order (so the
+// indices are the same for every instance of a given JsonState type).  Code
+// that handles frequent changes can observe propertyIndexChanged() and track
+// changes in a PropertySet instead of hashing property names:
+//     ServiceState::PropertySet changes;
+//     _serviceState.propertyIndexChanged = [&](std::size_t index)
+//     {
+//         changes.insert(index);
+//     };
+//     // later...
+//     changes.forEach([&](std::size_t index)
+//     {
+//         incrementalChange.emplace(_serviceState.propertyName(index),
+//             _serviceState.getProperty(index));
+//     });
 
 // This macro is used to define a property inside a JsonState-derived object;
 // it declares a Property<>.  You can declare a Property<> yourself too, but the
@@ -106,7 +125,7 @@ public:
         PropertyBase(JsonState &parent, std::string name)
             : _parent{parent}, _name{std::move(name)}
         {
-            parent.addProperty(_name, *this);
+            _index = parent.addProperty(_name, *this);
         }
 
         // Not copiable since there is no way to figure out the new parent
@@ -121,10 +140,20 @@ public:
         // fails for any reason.
         virtual JsonT getJson() const = 0;
 
+        // The property's name in JSON
+        const std::string &name() const {return _name;}
+        // The property's index in its JsonState
+        std::size_t index() const {return _index;}
+
     protected:
-        // Tell JsonState to emit a signal indicating that this property has
+        // Tell JsonState to emit signals indicating that this property has
         // changed
-        void signalChange() { changed(); _parent.propertyChanged(_name); }
+        void signalChange()
+        {
+            changed();
+            _parent.propertyIndexChanged(_index);
+            _parent.propertyChanged(_name);
+        }
 
     public:
         // This property changed
@@ -135,6 +164,72 @@ public:
         JsonState &_parent;
         // The name of this field when represented in JSON
         std::string _name;
+        std::size_t _index;
+    };
+
+    // A set of properties identified by their indices (see
+    // PropertyBase::index()), used to track changes.  This is a dense bitset,
+    // so inserting and testing properties doesn't hash or allocate (once the
+    // set has grown to fit the properties).
+    class PropertySet
+    {
+    private:
+        using Word = std::uint64_t;
+        enum : std::size_t { WordBits = sizeof(Word) * 8 };
+
+    public:
+        // Insert a property; returns true if it wasn't already in the set.
+        bool insert(std::size_t index)
+        {
+            std::size_t word = index / WordBits;
+            if(word >= _words.size())
+                _words.resize(word + 1);
+            Word bit = Word{1} << (index % WordBits);
+            if(_words[word] & bit)
+                return false;
+            _words[word] |= bit;
+            ++_size;
+            return true;
+        }
+        // Remove a property; returns true if it was in the set.
+        bool erase(std::size_t index)
+        {
+            if(!contains(index))
+                return false;
+            _words[index / WordBits] &= ~(Word{1} << (index % WordBits));
+            --_size;
+            return true;
+        }
+        bool contains(std::size_t index) const
+        {
+            std::size_t word = index / WordBits;
+            return word < _words.size() &&
+                (_words[word] & (Word{1} << (index % WordBits)));
+        }
+        bool empty() const {return _size == 0;}
+        std::size_t size() const {return _size;}
+        // Clear the set; this keeps the storage allocated
+        void clear() {std::fill(_words.begin(), _words.end(), Word{0}); _size = 0;}
+
+        // Call func(std::size_t index) for each property in the set, in index
+        // order.  func must not modify the set.
+        template<class FuncT>
+        void forEach(FuncT &&func) const
+        {
+            for(std::size_t word = 0; word < _words.size(); ++word)
+            {
+                Word bits = _words[word];
+                for(std::size_t bit = 0; bits; ++bit, bits >>= 1)
+                {
+                    if(bits & 1)
+                        func(word * WordBits + bit);
+                }
+            }
+        }
+
+    private:
+        std::vector<Word> _words;
+        std::size_t _size{0};
     };
 
     template<class T>
@@ -211,10 +306,13 @@ public:
     ~JsonState() = default;
 
 private:
-    // Used by PropertyBase to connect itself to this JsonState
-    void addProperty(std::string name, const PropertyBase &property)
+    // Used by PropertyBase to connect itself to this JsonState; returns the
+    // property's index
+    std::size_t addProperty(std::string name, const PropertyBase &property)
     {
         _properties.emplace(std::move(name), property);
+        _propertiesByIndex.push_back(&property);
+        return _propertiesByIndex.size() - 1;
     }
 
 public:
@@ -225,6 +323,30 @@ public:
     {
         return _properties.at(name).getJson();
     }
+    // Get an individual property as JSON, by index.  Throws if the index is not
+    // valid, or if the serialization fails.
+    JsonT getProperty(std::size_t index) const
+    {
+        return _propertiesByIndex.at(index)->getJson();
+    }
+
+    // The number of properties; indices are 0 through propertyCount()-1.
+    std::size_t propertyCount() const {return _propertiesByIndex.size();}
+    // Get a property's name by index.  Throws if the index is not valid.
+    const std::string &propertyName(std::size_t index) const
+    {
+        return _propertiesByIndex.at(index)->name();
+    }
+    // Find a property's index by name.  Returns false if there is no such
+    // property.
+    bool findProperty(const std::string &name, std::size_t &index) const
+    {
+        auto itProperty = _properties.find(name);
+        if(itProperty == _properties.end())
+            return false;
+        index = itProperty->second.index();
+        return true;
+    }
 
     // Get the entire object as a JSON object.  If any individual property cannot be
     // serialized, that property is omitted (exceptions are not propagated).
@@ -250,9 +372,14 @@ public:
 public:
     // Emitted when a property is modified along with the property's name
     kapps::core::Signal<kapps::core::StringSlice> propertyChanged;
+    // Emitted when a property is modified along with the property's index
+    // (emitted before propertyChanged)
+    kapps::core::Signal<std::size_t> propertyIndexChanged;
 
 private:
     // All of the properties in this JsonState.  This is used to get the entire
     // object as JSON.
     std::unordered_map<std::string, const PropertyBase &> _properties;
+    // The same properties, in index order
+    std::vector<const PropertyBase *> _propertiesByIndex;
 };
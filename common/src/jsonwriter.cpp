@@ -0,0 +1,222 @@
+// Copyright (c) 2024 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line SOURCE_FILE("jsonwriter.cpp")
+
+#include "jsonwriter.h"
+#include <QLocale>
+#include <cmath>
+
+void JsonWriter::separate()
+{
+    if(_needComma)
+        _buffer.append(',');
+}
+
+void JsonWriter::writeString(kapps::core::StringSlice utf8)
+{
+    static const char hexDigits[]{"0123456789abcdef"};
+
+    _buffer.append('"');
+    for(char c : utf8)
+    {
+        switch(c)
+        {
+            case '"':
+                _buffer.append("\\\"", 2);
+                break;
+            case '\\':
+                _buffer.append("\\\\", 2);
+                break;
+            case '\b':
+                _buffer.append("\\b", 2);
+                break;
+            case '\f':
+                _buffer.append("\\f", 2);
+                break;
+            case '\n':
+                _buffer.append("\\n", 2);
+                break;
+            case '\r':
+                _buffer.append("\\r", 2);
+                break;
+            case '\t':
+                _buffer.append("\\t", 2);
+                break;
+            default:
+                // Other control characters must be escaped; everything else
+                // (including multibyte UTF-8 sequences) is written as-is
+                if(static_cast<unsigned char>(c) < 0x20)
+                {
+                    const char escape[]{'\\', 'u', '0', '0',
+                        hexDigits[(c >> 4) & 0x0F], hexDigits[c & 0x0F]};
+                    _buffer.append(escape, sizeof(escape));
+                }
+                else
+                    _buffer.append(c);
+                break;
+        }
+    }
+    _buffer.append('"');
+}
+
+void JsonWriter::beginObject()
+{
+    separate();
+    _buffer.append('{');
+    _needComma = false;
+}
+
+void JsonWriter::endObject()
+{
+    _buffer.append('}');
+    _needComma = true;
+}
+
+void JsonWriter::beginArray()
+{
+    separate();
+    _buffer.append('[');
+    _needComma = false;
+}
+
+void JsonWriter::endArray()
+{
+    _buffer.append(']');
+    _needComma = true;
+}
+
+void JsonWriter::key(const QString &name)
+{
+    QByteArray nameUtf8 = name.toUtf8();
+    key(kapps::core::StringSlice{nameUtf8.data(), nameUtf8.data() + nameUtf8.size()});
+}
+
+void JsonWriter::key(kapps::core::StringSlice name)
+{
+    separate();
+    writeString(name);
+    _buffer.append(':');
+    _needComma = false;
+}
+
+void JsonWriter::value(const QJsonValue &value)
+{
+    switch(value.type())
+    {
+        case QJsonValue::Bool:
+            this->value(value.toBool());
+            break;
+        case QJsonValue::Double:
+            this->value(value.toDouble());
+            break;
+        case QJsonValue::String:
+            this->value(value.toString());
+            break;
+        case QJsonValue::Array:
+            this->value(value.toArray());
+            break;
+        case QJsonValue::Object:
+            this->value(value.toObject());
+            break;
+        default:
+        case QJsonValue::Null:
+        case QJsonValue::Undefined:
+            // QJsonObject can't contain Undefined; treat it as null
+            nullValue();
+            break;
+    }
+}
+
+void JsonWriter::value(const QJsonObject &value)
+{
+    beginObject();
+    for(auto it = value.begin(); it != value.end(); ++it)
+    {
+        key(it.key());
+        this->value(it.value());
+    }
+    endObject();
+}
+
+void JsonWriter::value(const QJsonArray &value)
+{
+    beginArray();
+    for(const auto &element : value)
+        this->value(element);
+    endArray();
+}
+
+void JsonWriter::value(const QString &value)
+{
+    separate();
+    QByteArray valueUtf8 = value.toUtf8();
+    writeString({valueUtf8.data(), valueUtf8.data() + valueUtf8.size()});
+    _needComma = true;
+}
+
+void JsonWriter::value(bool value)
+{
+    separate();
+    if(value)
+        _buffer.append("true", 4);
+    else
+        _buffer.append("false", 5);
+    _needComma = true;
+}
+
+void JsonWriter::value(double value)
+{
+    // Like QJsonDocument, non-finite values can't be represented and are
+    // written as null
+    if(!std::isfinite(value))
+    {
+        nullValue();
+        return;
+    }
+
+    separate();
+    // Write integral values without an exponent or fraction, if they're
+    // exactly representable
+    if(std::trunc(value) == value && std::abs(value) < 9007199254740992.0)
+        _buffer.append(QByteArray::number(static_cast<qint64>(value)));
+    else
+        _buffer.append(QByteArray::number(value, 'g', QLocale::FloatingPointShortest));
+    _needComma = true;
+}
+
+void JsonWriter::nullValue()
+{
+    separate();
+    _buffer.append("null", 4);
+    _needComma = true;
+}
+
+void JsonWriter::rawValue(kapps::core::StringSlice json)
+{
+    separate();
+    _buffer.append(json.data(), static_cast<int>(json.size()));
+    _needComma = true;
+}
+
+QByteArray JsonWriter::take()
+{
+    _needComma = false;
+    return std::exchange(_buffer, {});
+}
@@ -0,0 +1,91 @@
+// Copyright (c) 2024 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line HEADER_FILE("jsonwriter.h")
+
+#ifndef JSONWRITER_H
+#define JSONWRITER_H
+
+#include <kapps_core/src/stringslice.h>
+#include <QByteArray>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QJsonValue>
+
+// JsonWriter writes compact JSON text directly into a buffer.  This is used to
+// build large messages (like the complete daemon data sent to new clients)
+// without first building a QJsonObject or nlohmann::json tree and then
+// serializing it.
+//
+// Values that are already encoded as JSON text (such as a cached property
+// value) can be inserted verbatim with rawValue().
+//
+// The writer doesn't validate the structure; the caller must balance
+// begin/end calls and write a key before each value in an object.
+//
+//     JsonWriter writer;
+//     writer.beginObject();
+//     writer.key(QStringLiteral("name"));
+//     writer.value(QStringLiteral("value"));
+//     writer.key(QStringLiteral("list"));
+//     writer.rawValue(listJsonText);      // std::string containing [1,2,3]
+//     writer.endObject();
+//     QByteArray json = writer.take();    // {"name":"value","list":[1,2,3]}
+class COMMON_EXPORT JsonWriter
+{
+public:
+    void beginObject();
+    void endObject();
+    void beginArray();
+    void endArray();
+
+    // Write a key in an object; the next value written is the key's value
+    void key(const QString &name);
+    void key(kapps::core::StringSlice name);
+
+    void value(const QJsonValue &value);
+    void value(const QJsonObject &value);
+    void value(const QJsonArray &value);
+    void value(const QString &value);
+    void value(bool value);
+    void value(double value);
+    // Would otherwise convert to bool; use QStringLiteral()
+    void value(const char *) = delete;
+    void nullValue();
+    // Write a value that is already encoded as JSON text
+    void rawValue(kapps::core::StringSlice json);
+
+    // Get the JSON written so far
+    const QByteArray &data() const {return _buffer;}
+    // Take the JSON written and reset the writer
+    QByteArray take();
+
+private:
+    // Write a comma if a prior value in the same object/array needs one
+    void separate();
+    void writeString(kapps::core::StringSlice utf8);
+
+private:
+    QByteArray _buffer;
+    // Whether the last thing written was a complete value (so a comma is
+    // needed before the next key/value)
+    bool _needComma{false};
+};
+
+#endif
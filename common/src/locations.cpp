@@ -22,7 +22,13 @@
 #include "locations.h"
 #include <kapps_regions/src/regionlist.h>
 #include <kapps_regions/src/metadata.h>
+#include <kapps_regions/src/snapshot.h>
+#include <QCryptographicHash>
+#include <QFile>
+#include <QJsonArray>
 #include <QJsonDocument>
+#include <QSaveFile>
+#include <unordered_set>
 
 namespace
 {
@@ -37,6 +43,97 @@ namespace
         QStringLiteral("ovpnudp"),
         QStringLiteral("wg")
     };
+
+    // Add a length-prefixed field to a snapshot key hash, so adjacent fields
+    // can't run together
+    void addKeyField(QCryptographicHash &hash, const QByteArray &field)
+    {
+        QByteArray length{QByteArray::number(field.size())};
+        length.append(':');
+        hash.addData(length);
+        hash.addData(field);
+    }
+
+    // Build the key identifying the inputs to buildModernLocations() for
+    // RegionsSnapshotFile.  (Latencies are not part of the key, they are
+    // applied to the Locations and aren't in the snapshot.)
+    QByteArray buildSnapshotKey(const QByteArray &regionsJson,
+                                const QByteArray &shadowsocksJson,
+                                const QByteArray &metadataJson,
+                                const std::vector<AccountDedicatedIp> &dedicatedIps,
+                                const ManualServer &manualServer)
+    {
+        QCryptographicHash hash{QCryptographicHash::Sha256};
+        addKeyField(hash, regionsJson);
+        addKeyField(hash, shadowsocksJson);
+        addKeyField(hash, metadataJson);
+        QJsonArray dipsJson;
+        for(const auto &dip : dedicatedIps)
+            dipsJson.append(dip.toJsonObject());
+        addKeyField(hash, QJsonDocument{dipsJson}.toJson(QJsonDocument::Compact));
+        addKeyField(hash, QJsonDocument{manualServer.toJsonObject()}.toJson(QJsonDocument::Compact));
+        return hash.result().toHex();
+    }
+}
+
+bool RegionsSnapshotFile::load(const QByteArray &key,
+                               kapps::regions::RegionList &regionList,
+                               kapps::regions::Metadata &metadata)
+{
+    _pendingSnapshot.clear();
+
+    QFile snapshotFile{_path};
+    if(!snapshotFile.open(QFile::ReadOnly))
+        return false;   // No snapshot yet, or it can't be read
+
+    // Map the snapshot rather than reading it into memory; it's read once
+    // while building the regions
+    uchar *pSnapshotData = snapshotFile.map(0, snapshotFile.size());
+    if(!pSnapshotData)
+    {
+        qWarning() << "Unable to map regions snapshot" << _path << "-"
+            << snapshotFile.errorString();
+        return false;
+    }
+    kapps::core::StringSlice snapshot{reinterpret_cast<const char *>(pSnapshotData),
+        static_cast<std::size_t>(snapshotFile.size())};
+    kapps::core::StringSlice keySlice{key.data(), static_cast<std::size_t>(key.size())};
+    bool loaded = kapps::regions::readSnapshot(snapshot, keySlice, regionList, metadata);
+    snapshotFile.unmap(pSnapshotData);
+    if(loaded)
+        qInfo() << "Loaded regions from snapshot" << _path;
+    return loaded;
+}
+
+void RegionsSnapshotFile::update(const QByteArray &key,
+                                 const kapps::regions::RegionList &regionList,
+                                 const kapps::regions::Metadata &metadata)
+{
+    kapps::core::StringSlice keySlice{key.data(), static_cast<std::size_t>(key.size())};
+    _pendingSnapshot = kapps::regions::writeSnapshot(keySlice, regionList, metadata);
+}
+
+void RegionsSnapshotFile::save()
+{
+    if(_pendingSnapshot.empty())
+        return;
+
+    // Write atomically, so a partial snapshot is never left behind
+    QSaveFile snapshotFile{_path};
+    if(snapshotFile.open(QFile::WriteOnly) &&
+        snapshotFile.write(_pendingSnapshot.data(), static_cast<qint64>(_pendingSnapshot.size())) ==
+            static_cast<qint64>(_pendingSnapshot.size()) &&
+        snapshotFile.commit())
+    {
+        qInfo() << "Wrote regions snapshot" << _path << "-"
+            << _pendingSnapshot.size() << "bytes";
+    }
+    else
+    {
+        qWarning() << "Unable to write regions snapshot" << _path << "-"
+            << snapshotFile.errorString();
+    }
+    _pendingSnapshot.clear();
 }
 
 const std::unordered_map<QString, QString> shadowsocksLegacyRegionMap
@@ -54,7 +151,8 @@ auto buildModernLocations(const LatencyMap &latencies,
                           const QJsonArray &shadowsocksObj,
                           const QJsonObject &metadataObj,
                           const std::vector<AccountDedicatedIp> &dedicatedIps,
-                          const ManualServer &manualServer)
+                          const ManualServer &manualServer,
+                          RegionsSnapshotFile *pSnapshot)
     -> std::pair<LocationsById, kapps::regions::Metadata>
 {
     QByteArray regionsJson = QJsonDocument{regionsObj}.toJson();
@@ -115,15 +213,36 @@ auto buildModernLocations(const LatencyMap &latencies,
                           manualServer.openvpnTcpPorts()});
     }
 
-    kapps::regions::RegionList regionlist{kapps::regions::RegionList::PIAv6,
-                                          regionsJsonSlice, shadowsocksJsonSlice,
-                                          dips, manual};
-    kapps::regions::Metadata metadata{regionsJsonSlice, metadataJsonSlice,
-                                      dips, manual};
+    kapps::regions::RegionList regionlist;
+    kapps::regions::Metadata metadata;
+    QByteArray snapshotKey;
+    if(pSnapshot)
+    {
+        snapshotKey = buildSnapshotKey(regionsJson, shadowsocksJson,
+                                       metadataJson, dedicatedIps, manualServer);
+    }
+    if(!pSnapshot || !pSnapshot->load(snapshotKey, regionlist, metadata))
+    {
+        // The PIAv6 regions list is always read from a DOM (the streaming
+        // parser only handles the v7 format), but the Shadowsocks list is
+        // streamed, and the regions are built on all hardware threads.
+        kapps::regions::BuildOptions options;
+        options.threads = kapps::core::AutoThreads;
+        options.streaming = true;
+        regionlist = kapps::regions::RegionList{kapps::regions::RegionList::PIAv6,
+                                                regionsJsonSlice, shadowsocksJsonSlice,
+                                                dips, manual, options};
+        metadata = kapps::regions::Metadata{regionsJsonSlice, metadataJsonSlice,
+                                            dips, manual};
+        if(pSnapshot)
+            pSnapshot->update(snapshotKey, regionlist, metadata);
+    }
 
     LocationsById newLocations;
-    for(const auto &pRegion : regionlist.regions())
+    const auto &pServerTable = regionlist.serverTable();
+    for(std::size_t regionIdx=0; regionIdx<regionlist.regions().size(); ++regionIdx)
     {
+        const auto &pRegion = regionlist.regions()[regionIdx];
         if(!pRegion)
             continue;
         QString regionId{qs::toQString(pRegion->id())};
@@ -133,7 +252,7 @@ auto buildModernLocations(const LatencyMap &latencies,
             latency.emplace(itLatency->second);
 
         newLocations.emplace(pRegion->id().to_string(),
-            QSharedPointer<Location>::create(pRegion->shared_from_this(), latency));
+            QSharedPointer<Location>::create(pServerTable, regionIdx, latency));
     }
 
     return {std::move(newLocations), std::move(metadata)};
@@ -162,6 +281,32 @@ bool compareEntries(const Location &first, const Location &second)
     return first.id().compare(second.id(), Qt::CaseSensitivity::CaseInsensitive) < 0;
 }
 
+namespace
+{
+    // Sort locations in a country (or dedicated IP locations) by latency, then
+    // id
+    bool compareLocationPtrs(const QSharedPointer<const Location> &pFirst,
+                             const QSharedPointer<const Location> &pSecond)
+    {
+        Q_ASSERT(pFirst);
+        Q_ASSERT(pSecond);
+
+        return compareEntries(*pFirst, *pSecond);
+    }
+
+    // Sort countries by the lowest latency for each country, then region ID if
+    // the latencies are the same
+    bool compareCountryGroups(const CountryLocations &first,
+                              const CountryLocations &second)
+    {
+        // Groups are always created with at least 1 location
+        Q_ASSERT(!first.locations().empty());
+        Q_ASSERT(!second.locations().empty());
+        return compareLocationPtrs(first.locations().front(),
+                                   second.locations().front());
+    }
+}
+
 void buildGroupedLocations(const LocationsById &locations,
                            const kapps::regions::Metadata &metadata,
                            std::vector<CountryLocations> &groupedLocations,
@@ -187,22 +332,13 @@ void buildGroupedLocations(const LocationsById &locations,
     }
 
     // Sort each countries' locations by latency, then id
-    auto sortLocations = [](const QSharedPointer<const Location> &pFirst,
-                             const QSharedPointer<const Location> &pSecond)
-    {
-        Q_ASSERT(pFirst);
-        Q_ASSERT(pSecond);
-
-        return compareEntries(*pFirst, *pSecond);
-    };
-
     for(auto &group : countryGroups)
     {
-        std::sort(group.second.begin(), group.second.end(), sortLocations);
+        std::sort(group.second.begin(), group.second.end(), compareLocationPtrs);
     }
 
     // Sort dedicated IP locations in the same way
-    std::sort(dedicatedIpLocations.begin(), dedicatedIpLocations.end(), sortLocations);
+    std::sort(dedicatedIpLocations.begin(), dedicatedIpLocations.end(), compareLocationPtrs);
 
     // Create country groups from the sorted lists
     groupedLocations.clear();
@@ -214,33 +350,112 @@ void buildGroupedLocations(const LocationsById &locations,
     }
 
     // Sort the countries by their lowest latency
-    std::sort(groupedLocations.begin(), groupedLocations.end(),
-        [](const auto &first, const auto &second)
+    std::sort(groupedLocations.begin(), groupedLocations.end(), compareCountryGroups);
+}
+
+LocationsById applyLocationLatencies(LocationsById &locations,
+                                     const LatencyMap &latencies)
+{
+    LocationsById changedLocations;
+    for(const auto &latency : latencies)
+    {
+        auto itLocation = locations.find(latency.first.toStdString());
+        if(itLocation == locations.end() || !itLocation->second)
+            continue;
+
+        const Location &oldLocation = *itLocation->second;
+        if(oldLocation.latency() && oldLocation.latency().get() == latency.second)
+            continue;   // No change
+
+        itLocation->second = QSharedPointer<Location>::create(oldLocation, latency.second);
+        changedLocations.emplace(itLocation->first, itLocation->second);
+    }
+    return changedLocations;
+}
+
+void updateGroupedLocations(const LocationsById &changedLocations,
+                            const kapps::regions::Metadata &metadata,
+                            std::vector<CountryLocations> &groupedLocations,
+                            std::vector<QSharedPointer<const Location>> &dedicatedIpLocations)
+{
+    // Find the countries affected by the changes, the same way
+    // buildGroupedLocations() groups the locations
+    std::unordered_set<kapps::core::StringSlice> changedCountries;
+    bool dedicatedIpsChanged{false};
+    for(const auto &locationEntry : changedLocations)
+    {
+        Q_ASSERT(locationEntry.second);
+        if(locationEntry.second->isDedicatedIp())
+            dedicatedIpsChanged = true;
+        else
+        {
+            kapps::core::StringSlice countryCode;
+            auto pRegionDisplay = metadata.getRegionDisplay(locationEntry.first);
+            if(pRegionDisplay)
+                countryCode = pRegionDisplay->country();
+            changedCountries.insert(countryCode);
+        }
+    }
+
+    // Replace changed locations in a sorted list and re-sort it.  Returns
+    // true if any location was replaced.
+    auto replaceLocations = [&](std::vector<QSharedPointer<const Location>> &locations)
+    {
+        bool replaced{false};
+        for(auto &pLocation : locations)
         {
-            // Consequence of above; groupedLocations created with at least 1 location
-            Q_ASSERT(!first.locations().empty());
-            Q_ASSERT(!second.locations().empty());
-            // Sort by the lowest latency for each country, then region ID if
-            // the latencies are the same
-            const auto &pFirstNearest = first.locations().front();
-            const auto &pSecondNearest = second.locations().front();
-
-            Q_ASSERT(pFirstNearest);
-            Q_ASSERT(pSecondNearest);
-            return compareEntries(*pFirstNearest, *pSecondNearest);
-        });
+            Q_ASSERT(pLocation);
+            auto itChanged = changedLocations.find(pLocation->id().toStdString());
+            if(itChanged != changedLocations.end())
+            {
+                pLocation = itChanged->second;
+                replaced = true;
+            }
+        }
+        if(replaced)
+            std::sort(locations.begin(), locations.end(), compareLocationPtrs);
+        return replaced;
+    };
+
+    bool countriesChanged{false};
+    for(auto &group : groupedLocations)
+    {
+        if(changedCountries.count(group.code()) == 0)
+            continue;
+
+        std::vector<QSharedPointer<const Location>> locations{
+            group.locations().begin(), group.locations().end()};
+        if(replaceLocations(locations))
+        {
+            group = CountryLocations{group.code().to_string(), std::move(locations)};
+            countriesChanged = true;
+        }
+    }
+    if(countriesChanged)
+        std::sort(groupedLocations.begin(), groupedLocations.end(), compareCountryGroups);
+
+    if(dedicatedIpsChanged)
+        replaceLocations(dedicatedIpLocations);
 }
 
-NearestLocations::NearestLocations(const LocationsById &allLocations)
+NearestLocations::NearestLocations(const LocationsById &allLocations,
+                                   const std::unordered_set<QString> &unreliableLocations)
 {
     _locations.reserve(allLocations.size());
     for(const auto &locationEntry : allLocations)
         _locations.push_back(locationEntry.second);
+    // Sort reliable locations before unreliable locations, then by latency.
+    // Each selection criterion finds the first matching location, so this
+    // prefers reliable locations within each criterion.
     std::sort(_locations.begin(), _locations.end(),
-                   [](const auto &pFirst, const auto &pSecond) {
+                   [&](const auto &pFirst, const auto &pSecond) {
                        Q_ASSERT(pFirst);
                        Q_ASSERT(pSecond);
 
+                       bool firstUnreliable = unreliableLocations.count(pFirst->id()) > 0;
+                       bool secondUnreliable = unreliableLocations.count(pSecond->id()) > 0;
+                       if(firstUnreliable != secondUnreliable)
+                           return secondUnreliable;
                        return compareEntries(*pFirst, *pSecond);
                    });
 }
@@ -24,17 +24,53 @@
 #include "settings/locations.h"
 #include "settings/dedicatedip.h"
 #include <kapps_regions/src/metadata.h>
+#include <kapps_regions/src/regionlist.h>
+#include <unordered_set>
 
+// A binary snapshot of the regions built by buildModernLocations(), stored in
+// a file (see kapps::regions::writeSnapshot()).  This allows the daemon to
+// skip parsing and building the regions lists at startup, or when rebuilding
+// the locations, as long as the regions lists haven't changed.
+//
+// The snapshot is keyed by a hash of the regions lists, DIPs, and manual
+// server.  A snapshot built from new data is held until save() is called, so
+// the caller can decide whether to keep the new regions first.
+class COMMON_EXPORT RegionsSnapshotFile
+{
+public:
+    explicit RegionsSnapshotFile(QString path) : _path{std::move(path)} {}
+
+public:
+    // Load the regions from the snapshot file if it was built from the inputs
+    // identified by key.  Discards any pending snapshot.
+    bool load(const QByteArray &key, kapps::regions::RegionList &regionList,
+              kapps::regions::Metadata &metadata);
+    // Serialize a snapshot of newly built regions; it's held until save() is
+    // called.
+    void update(const QByteArray &key, const kapps::regions::RegionList &regionList,
+                const kapps::regions::Metadata &metadata);
+    // Write the pending snapshot from update(), if there is one.
+    void save();
+
+private:
+    QString _path;
+    std::string _pendingSnapshot;
+};
 
 // Build Location and Server objects for the modern region infrastructure from
 // the latencies, modern regions list, and Shadowsocks regions list.
 // Dedicated IPs and the dev manual server are added as additional regions.
+//
+// If pSnapshot is given, the regions are loaded from the snapshot if it
+// matches the inputs; otherwise they're built from the JSON and a new snapshot
+// is held in pSnapshot.
 COMMON_EXPORT auto buildModernLocations(const LatencyMap &latencies,
                                         const QJsonObject &regionsObj,
                                         const QJsonArray &shadowsocksObj,
                                         const QJsonObject &metadataObj,
                                         const std::vector<AccountDedicatedIp> &dedicatedIps,
-                                        const ManualServer &manualServer)
+                                        const ManualServer &manualServer,
+                                        RegionsSnapshotFile *pSnapshot = nullptr)
     -> std::pair<LocationsById, kapps::regions::Metadata>;
 
 // Build the grouped and sorted locations from the flat locations.
@@ -43,10 +79,34 @@ COMMON_EXPORT void buildGroupedLocations(const LocationsById &locations,
                                          std::vector<CountryLocations> &groupedLocations,
                                          std::vector<QSharedPointer<const Location>> &dedicatedIpLocations);
 
+// Apply new latency measurements to locations built by
+// buildModernLocations(), without rebuilding them from the regions list.
+// Each location whose latency changed is replaced with a copy having the new
+// latency.  Measurements for unknown locations are ignored.
+//
+// Returns the replaced locations (only those that changed), so dependent data
+// can be updated with updateGroupedLocations().
+COMMON_EXPORT LocationsById applyLocationLatencies(LocationsById &locations,
+                                                   const LatencyMap &latencies);
+
+// Update grouped locations from buildGroupedLocations() after some locations
+// have been replaced by applyLocationLatencies().  Only the countries
+// containing a changed location are re-sorted, then the countries are re-sorted
+// by their nearest location.  Changed locations that aren't in the groups
+// (such as locations excluded from the groups) are ignored.
+COMMON_EXPORT void updateGroupedLocations(const LocationsById &changedLocations,
+                                          const kapps::regions::Metadata &metadata,
+                                          std::vector<CountryLocations> &groupedLocations,
+                                          std::vector<QSharedPointer<const Location>> &dedicatedIpLocations);
+
 class COMMON_EXPORT NearestLocations
 {
 public:
-    NearestLocations(const LocationsById &locations);
+    // unreliableLocations are the IDs of locations whose latency measurements
+    // indicate they're unreliable (high loss or jitter).  They're considered
+    // after reliable locations, see below.
+    NearestLocations(const LocationsById &locations,
+                     const std::unordered_set<QString> &unreliableLocations = {});
 
 public:
     // Find the closest server location that is safe to use with 'connect auto'.
@@ -72,6 +132,10 @@ public:
     //    The auto region selection would flutter since the latencies would be
     //    very close.
     //
+    // Within each of these criteria, reliable locations are preferred over
+    // unreliable locations even if they are farther away - a flaky location
+    // is only selected if no reliable location matches the same criteria.
+    //
     // If no locations match all criteria, the selection will fall back to try
     // to match the most important criteria. The precedence order for an auto
     // location selection is:
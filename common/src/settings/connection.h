@@ -23,55 +23,17 @@
 #include "../json.h"
 #include "locations.h"
 
-// Bandwidth measurements for one measurement interval, in bytes
-class COMMON_EXPORT IntervalBandwidth : public NativeJsonObject
-{
-    Q_OBJECT
-public:
-    IntervalBandwidth() {}
-    IntervalBandwidth(quint64 receivedVal, quint64 sentVal)
-    {
-        received(receivedVal);
-        sent(sentVal);
-    }
-    IntervalBandwidth(const IntervalBandwidth &other) {*this = other;}
-    IntervalBandwidth &operator=(const IntervalBandwidth &other)
-    {
-        received(other.received());
-        sent(other.sent());
-        return *this;
-    }
-    bool operator==(const IntervalBandwidth &other) const
-    {
-        return received() == other.received() && sent() == other.sent();
-    }
-    bool operator!=(const IntervalBandwidth &other) const
-    {
-        return !(*this == other);
-    }
-
-    JsonField(quint64, received, {})
-    JsonField(quint64, sent, {})
-};
-
 // Transport settings that might vary due to automatic failover.
-class COMMON_EXPORT Transport : public NativeJsonObject
+//
+// This is a JSON value object (not a NativeJsonObject) since it's copied
+// around as a value, such as the alternate transports in TransportSelector.
+class COMMON_EXPORT Transport
 {
-    Q_OBJECT
-
 public:
     Transport() {}
-    Transport(const QString &protocolVal, uint portVal)
-    {
-        protocol(protocolVal);
-        port(portVal);
-    }
-    Transport(const Transport &other) {*this = other;}
-    Transport &operator=(const Transport &other)
+    Transport(QString protocolVal, uint portVal)
+        : _protocol{std::move(protocolVal)}, _port{portVal}
     {
-        protocol(other.protocol());
-        port(other.port());
-        return *this;
     }
     bool operator==(const Transport &other) const
     {
@@ -82,8 +44,16 @@ public:
         return !(*this == other);
     }
 
-    JsonField(QString, protocol, QStringLiteral("udp"), { "udp", "tcp" })
-    JsonField(uint, port, 0)
+    // "udp" or "tcp"
+    JsonValueField(QString, protocol, QStringLiteral("udp"))
+    JsonValueField(uint, port, 0)
+
+public:
+    static auto jsonFields()
+    {
+        return std::make_tuple(jsonValueField("protocol", &Transport::_protocol),
+                               jsonValueField("port", &Transport::_port));
+    }
 
 public:
     // If this transport had port 0 ("use default"), and the actual protocol
@@ -21,6 +21,32 @@
 #include <QRandomGenerator>
 #include <kapps_core/src/corejson.h>
 #include <nlohmann/json.hpp>
+#include <limits>
+
+namespace
+{
+    kapps::regions::Service toRegionsService(Service service)
+    {
+        switch(service)
+        {
+            default:
+            {
+                Q_ASSERT(false);
+                return kapps::regions::Service::OpenVpnTcp;
+            }
+            case Service::OpenVpnTcp:
+                return kapps::regions::Service::OpenVpnTcp;
+            case Service::OpenVpnUdp:
+                return kapps::regions::Service::OpenVpnUdp;
+            case Service::WireGuard:
+                return kapps::regions::Service::WireGuard;
+            case Service::Shadowsocks:
+                return kapps::regions::Service::Shadowsocks;
+            case Service::Meta:
+                return kapps::regions::Service::Meta;
+        }
+    }
+}
 
 Server::Server(std::shared_ptr<const kapps::regions::Server> pImpl)
     : _pImpl{std::move(pImpl)}
@@ -30,17 +56,20 @@ Server::Server(std::shared_ptr<const kapps::regions::Server> pImpl)
 
 bool Server::hasService(Service service) const
 {
-    return !servicePorts(service).empty();
+    return _pImpl->hasService(toRegionsService(service));
 }
 
 bool Server::hasVpnService() const
 {
-    return hasService(Service::OpenVpnTcp) || hasService(Service::OpenVpnUdp) ||
-        hasService(Service::WireGuard);
+    return _pImpl->services() & kapps::regions::VpnServices;
 }
 
 bool Server::hasPort(Service service, quint16 port) const
 {
+    // Check the cached services first, most servers lacking the port don't
+    // have the service at all
+    if(!hasService(service))
+        return false;
     const auto &ports = servicePorts(service);
     return std::find(ports.begin(), ports.end(), port) != ports.end();
 }
@@ -85,11 +114,15 @@ quint16 Server::randomServicePort(Service service) const
     return ports[idx];
 }
 
-Location::Location(std::shared_ptr<const kapps::regions::Region> pImpl,
-                   nullable_t<double> latency)
-    : _pImpl{std::move(pImpl)}, _latency{std::move(latency)}
+Location::Location(std::shared_ptr<const kapps::regions::ServerTable> pServerTable,
+                   std::size_t regionIdx, nullable_t<double> latency)
+    : _latency{std::move(latency)}, _pServerTable{std::move(pServerTable)},
+      _regionIdx{regionIdx}
 {
-    Q_ASSERT(_pImpl);   // Ensured by caller
+    Q_ASSERT(_pServerTable);    // Ensured by caller
+    Q_ASSERT(_regionIdx < _pServerTable->regions().size());  // Ensured by caller
+    _pImpl = _pServerTable->regions()[_regionIdx];
+    Q_ASSERT(_pImpl);   // Guaranteed by ServerTable
     // Wrap the kapps::regions::Server objects with our Server wrapper; the idea
     // is to eventually eliminate this in the daemon and use the kapps::regions
     // types directly
@@ -97,10 +130,19 @@ Location::Location(std::shared_ptr<const kapps::regions::Region> pImpl,
     for(const auto &pServer : _pImpl->servers())
     {
         Q_ASSERT(pServer);  // Guaranteed by kapps::regions::Region
-        _servers.emplace_back(pServer->shared_from_this());
+        // Servers are owned by their Region, share ownership of the Region
+        _servers.emplace_back(std::shared_ptr<const kapps::regions::Server>{_pImpl, pServer});
     }
 }
 
+Location::Location(std::shared_ptr<const kapps::regions::Region> pImpl,
+                   nullable_t<double> latency)
+    : Location{std::make_shared<kapps::regions::ServerTable>(
+                    std::vector<std::shared_ptr<const kapps::regions::Region>>{std::move(pImpl)}),
+               0, std::move(latency)}
+{
+}
+
 QString Location::dedicatedIp() const
 {
     // The null address is represented as an empty string; indicates this is not
@@ -110,104 +152,67 @@ QString Location::dedicatedIp() const
     return qs::toQString(_pImpl->dipAddress().toString());
 }
 
-template<class PredicateFuncT>
-std::size_t Location::countServersFor(const PredicateFuncT &predicate) const
+const Server *Location::serverFromTable(kapps::core::ArraySlice<const std::uint32_t> tableIndices,
+                                        std::size_t index) const
 {
-    std::size_t matches = 0;
-    for(const auto &server : servers())
-    {
-        if(predicate(server))
-            ++matches;
-    }
-    return matches;
+    if(index >= tableIndices.size())
+        return nullptr;
+    // The table's servers for this region are in the same order as _servers
+    std::size_t serverIdx = tableIndices[index] - _pServerTable->regionBegin(_regionIdx);
+    Q_ASSERT(serverIdx < _servers.size());  // Class invariant
+    return &_servers[serverIdx];
 }
 
-template<class PredicateFuncT>
-const Server *Location::randomServerFor(const PredicateFuncT &predicate) const
+const Server *Location::randomServerFromTable(kapps::core::ArraySlice<const std::uint32_t> tableIndices) const
 {
-    // This implementation is O(N) in the number of servers in the region.  It
-    // could be O(1) if we kept separate lists of the servers that have each
-    // service / port, but the number of servers offered per region isn't very
-    // large.
-
-    // Count the matching servers
-    std::size_t matches = countServersFor(predicate);
-
-    if(matches >= 1)
-    {
-        std::size_t idx = QRandomGenerator::global()->bounded(static_cast<quint32>(matches));
-        // Count off that index among the matching servers
-        for(const auto &server : servers())
-        {
-            if(predicate(server))
-            {
-                if(idx == 0)
-                    return &server;
-                --idx;
-            }
-        }
-    }
-
-    // No servers match
-    return nullptr;
+    if(tableIndices.empty())
+        return nullptr;
+    std::size_t idx = QRandomGenerator::global()->bounded(static_cast<quint32>(tableIndices.size()));
+    return serverFromTable(tableIndices, idx);
 }
 
-template<class PredicateFuncT>
-const Server *Location::serverWithIndexFor(std::size_t desiredIndex, const PredicateFuncT &predicate) const
+bool Location::hasService(Service service) const
 {
-    // This implementation is O(N) in the number of servers in the region.  It
-    // could be O(1) if we kept separate lists of the servers that have each
-    // service / port, but the number of servers offered per region isn't very
-    // large.
-
-    // Count the matching servers
-    std::size_t matches = countServersFor(predicate);
-
-    if(matches >= 1)
-    {
-        std::size_t idx = 0;
-        // Count off that index among the matching servers
-        for(const auto &server : servers())
-        {
-            if(predicate(server))
-            {
-                if(idx == desiredIndex)
-                    return &server;
-                ++idx;
-            }
-        }
-    }
-
-    // No servers match
-    return nullptr;
+    return _pImpl->hasService(toRegionsService(service));
 }
 
-bool Location::hasService(Service service) const
+const Server *Location::randomIcmpLatencyServer() const
 {
-    for(const auto &server : servers())
+    // Scan this region's part of the services column for any VPN service
+    auto services = _pServerTable->services();
+    std::uint32_t begin = _pServerTable->regionBegin(_regionIdx);
+    std::uint32_t end = _pServerTable->regionEnd(_regionIdx);
+    std::size_t matches = 0;
+    for(std::uint32_t i=begin; i<end; ++i)
     {
-        if(server.hasService(service))
-            return true;
+        if(services[i] & kapps::regions::VpnServices)
+            ++matches;
     }
-    return false;
-}
+    if(matches == 0)
+        return nullptr;
 
-const Server *Location::randomIcmpLatencyServer() const
-{
-    return randomServerFor([](const Server &server)
+    std::size_t idx = QRandomGenerator::global()->bounded(static_cast<quint32>(matches));
+    for(std::uint32_t i=begin; i<end; ++i)
     {
-        return server.hasVpnService();
-    });
+        if(services[i] & kapps::regions::VpnServices)
+        {
+            if(idx == 0)
+                return &_servers[i - begin];
+            --idx;
+        }
+    }
+    Q_ASSERT(false);    // Counted above
+    return nullptr;
 }
 
 const Server *Location::randomServerForService(Service service) const
 {
-    return randomServerFor([service](const Server &server){return server.hasService(service);});
+    return randomServerFromTable(_pServerTable->serversFor(toRegionsService(service), _regionIdx));
 }
 
 const Server *Location::randomServerForPort(Service service, quint16 port) const
 {
-    return randomServerFor([service, port](const Server &server){return server.hasPort(service, port);});
+    return randomServerFromTable(_pServerTable->serversForPort(toRegionsService(service), port, _regionIdx));
 }
 
 const Server *Location::randomServer(Service service, quint16 tryPort) const
@@ -233,9 +238,17 @@ DescendingPortSet Location::allPortsForService(Service service) const
 
 void Location::allPortsForService(Service service, DescendingPortSet &ports) const
 {
-    for(const auto &server : servers())
+    auto regionsService = toRegionsService(service);
+    // Servers sharing a port set have the same ports; skip runs of the same
+    // port set
+    auto portSetIds = _pServerTable->portSetIds();
+    std::uint32_t lastPortSetId = std::numeric_limits<std::uint32_t>::max();
+    for(auto serverIdx : _pServerTable->serversFor(regionsService, _regionIdx))
     {
-        const auto &serverPorts{server.servicePorts(service)};
+        if(portSetIds[serverIdx] == lastPortSetId)
+            continue;
+        lastPortSetId = portSetIds[serverIdx];
+        const auto &serverPorts{_pServerTable->servicePorts(lastPortSetId, regionsService)};
         ports.insert(serverPorts.begin(), serverPorts.end());
     }
 }
@@ -259,22 +272,22 @@ const Server *Location::serverWithIndex(std::size_t index, Service service, quin
 
 const Server *Location::serverWithIndexForPort(std::size_t index, Service service, quint16 port) const
 {
-    return serverWithIndexFor(index, [service, port](const Server &server){return server.hasPort(service, port);});
+    return serverFromTable(_pServerTable->serversForPort(toRegionsService(service), port, _regionIdx), index);
 }
 
 const Server *Location::serverWithIndexForService(std::size_t index, Service service) const
 {
-    return serverWithIndexFor(index, [service](const Server &server){return server.hasService(service);});
+    return serverFromTable(_pServerTable->serversFor(toRegionsService(service), _regionIdx), index);
 }
 
 std::size_t Location::countServersForService(Service service) const
 {
-    return countServersFor([service](const Server &server){return server.hasService(service);});
+    return _pServerTable->serversFor(toRegionsService(service), _regionIdx).size();
 }
 
 std::size_t Location::countServersForPort(Service service, quint16 port) const
 {
-    return countServersFor([service, port](const Server &server){return server.hasPort(service, port);});
+    return _pServerTable->serversForPort(toRegionsService(service), port, _regionIdx).size();
 }
 
 ServiceLocations::ServiceLocations(QSharedPointer<const Location> pChosenLocation,
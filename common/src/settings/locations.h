@@ -22,6 +22,7 @@
 #include "../common.h"
 #include "../json.h"
 #include <kapps_regions/src/region.h>
+#include <kapps_regions/src/servertable.h>
 #include <kapps_regions/src/regiondisplay.h>
 #include <set>
 #include <unordered_map>
@@ -144,8 +145,22 @@ private:
 class COMMON_EXPORT Location
 {
 public:
+    // Create a Location for a region from a RegionList's server table (see
+    // RegionList::serverTable()); server lookups use the table's indices.
+    Location(std::shared_ptr<const kapps::regions::ServerTable> pServerTable,
+             std::size_t regionIdx, nullable_t<double> latency);
+    // Create a Location for a region by itself; this builds a server table
+    // with just this region.
     Location(std::shared_ptr<const kapps::regions::Region> pImpl,
              nullable_t<double> latency);
+    // Copy a Location with a new latency.  Locations are immutable once
+    // shared, this is used to apply new latency measurements without building
+    // the Location again from the regions list.
+    Location(const Location &other, nullable_t<double> latency)
+        : _pImpl{other._pImpl}, _latency{std::move(latency)},
+          _servers{other._servers}, _pServerTable{other._pServerTable},
+          _regionIdx{other._regionIdx}
+    {}
 
     bool operator==(const Location &other) const
     {
@@ -223,15 +238,12 @@ public:
     bool hasShadowsocks() const {return _pImpl->hasService(kapps::regions::Service::Shadowsocks);}
 
 private:
-    // Count the servers that satisfy a predicate
-    template<class PredicateFuncT>
-    std::size_t countServersFor(const PredicateFuncT &predicate) const;
-    // Get a random server that satisfies a predicate
-    template<class PredicateFuncT>
-    const Server *randomServerFor(const PredicateFuncT &predicate) const;
-
-    template<class PredicateFuncT>
-    const Server *serverWithIndexFor(std::size_t desiredIndex, const PredicateFuncT &predicate) const;
+    // Get the server with a given index from a list of server table indices
+    // for this region; nullptr if the index is out of range
+    const Server *serverFromTable(kapps::core::ArraySlice<const std::uint32_t> tableIndices,
+                                  std::size_t index) const;
+    // Get a random server from a list of server table indices for this region
+    const Server *randomServerFromTable(kapps::core::ArraySlice<const std::uint32_t> tableIndices) const;
 
 public:
     // Check if a given service is available in this location (whether any
@@ -284,6 +296,10 @@ private:
     std::shared_ptr<const kapps::regions::Region> _pImpl;
     nullable_t<double> _latency;
     std::vector<Server> _servers;
+    // The server table containing this region, and this region's index in it.
+    // _servers correspond to the table's servers for this region, in order.
+    std::shared_ptr<const kapps::regions::ServerTable> _pServerTable;
+    std::size_t _regionIdx;
 };
 
 // Compare QSharedPointer<Location>s by value; used by ServiceLocations
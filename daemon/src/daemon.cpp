@@ -91,6 +91,50 @@ namespace
     // Resource paths for IP Address
     const QString ipLookupResource{QStringLiteral("api/client/status")};
 
+    // Window used to coalesce changes in frequently-changing state properties
+    // before broadcasting them to clients
+    const std::chrono::milliseconds notifyCoalesceWindow{250};
+
+    // State properties that change frequently and aren't time-sensitive -
+    // changes in these are coalesced (see NotificationScheduler).  All other
+    // properties (connectionState, etc.) are broadcast immediately.
+    NotificationScheduler::Priority statePropertyPriority(const std::string &name)
+    {
+        static const std::unordered_set<std::string> coalescedProperties
+        {
+            // Byte counters, updated on every stats tick
+            "bytesReceived",
+            "bytesSent",
+            "intervalMeasurements",
+            // Locations with latencies, updated as latency measurements arrive
+            "availableLocations",
+            "groupedLocations",
+            "vpnLocations",
+            "dedicatedIpLocations",
+            "shadowsocksLocations",
+        };
+        return coalescedProperties.count(name) ?
+            NotificationScheduler::Priority::Coalesced :
+            NotificationScheduler::Priority::Immediate;
+    }
+
+    // Large state properties that only change when the regions list or
+    // latencies change.  The client JSON for these is cached until they change,
+    // so new clients and repeated broadcasts don't serialize them again.
+    bool isCachedStateProperty(const std::string &name)
+    {
+        static const std::unordered_set<std::string> cachedProperties
+        {
+            "availableLocations",
+            "regionsMetadata",
+            "groupedLocations",
+            "vpnLocations",
+            "dedicatedIpLocations",
+            "shadowsocksLocations",
+        };
+        return cachedProperties.count(name) > 0;
+    }
+
     // Old default debug logging setting, 1.0 (and earlier) until 1.2-beta.2
     const QStringList debugLogging10{QStringLiteral("*.debug=true"),
                                      QStringLiteral("qt*.debug=false"),
@@ -251,11 +295,11 @@ Daemon::Daemon(QObject* parent)
     , _stopping(false)
     , _server(nullptr)
     , _methodRegistry(new LocalMethodRegistry(this))
-    , _rpc(new RemoteNotificationInterface(this))
     , _connection(new VPNConnection(this))
     , _environment{_state}
     , _apiClient{}
     , _modernLatencyTracker{}
+    , _regionsSnapshot{Path::DaemonDataDir / "regions.snapshot"}
     , _portForwarder{_apiClient, _account, _state, _environment}
     , _modernRegionRefresher{QStringLiteral("modern regions"),
                              modernRegionsResource, regionsInitialLoadInterval,
@@ -271,6 +315,7 @@ Daemon::Daemon(QObject* parent)
                             publicIpLoadInterval, publicIpRefreshInterval}
     , _snoozeTimer(this)
     , _pendingSerializations(0)
+    , _notifyScheduler{notifyCoalesceWindow, [this](){notifyChanges();}}
 {
 #ifdef PIA_CRASH_REPORTING
     initCrashReporting(false);
@@ -337,24 +382,40 @@ Daemon::Daemon(QObject* parent)
         connect(&object, &NativeJsonObject::propertyChanged, this,
             [this, pSet](const QString& name)
             {
+                ++_dataGeneration;
                 auto &set = (*this).*pSet;
-                int size = set.size();
                 set += name;
-                if (set.size() > size)
-                    queueNotification(&Daemon::notifyChanges);
+                // Changes in data, account, and settings are infrequent, send
+                // them right away
+                _notifyScheduler.schedule(NotificationScheduler::Priority::Immediate);
             });
     };
     connectPropertyChanges(_data, &Daemon::_dataChanges);
     connectPropertyChanges(_account, &Daemon::_accountChanges);
     connectPropertyChanges(_settings, &Daemon::_settingsChanges);
-    _state.propertyChanged = [this](kapps::core::StringSlice name)
-    {
-        if(_stateChanges.insert(name.to_string()).second)
-            queueNotification(&Daemon::notifyChanges);
+    // State properties change frequently, especially while connecting.  Track
+    // them by index, and look up their notification priorities once.
+    _statePropertyInfo.reserve(_state.propertyCount());
+    for(std::size_t i=0; i<_state.propertyCount(); ++i)
+    {
+        const auto &name = _state.propertyName(i);
+        _statePropertyInfo.push_back({statePropertyPriority(name),
+                                      isCachedStateProperty(name), {}, {},
+                                      false});
+    }
+    _state.propertyIndexChanged = [this](std::size_t index)
+    {
+        ++_dataGeneration;
+        _stateChanges.insert(index);
+        auto &info = _statePropertyInfo[index];
+        info.cachedJson = QJsonValue{QJsonValue::Undefined};
+        info.cachedText.clear();
+        info.textCached = false;
+        _notifyScheduler.schedule(info.priority);
         // Update nextConfig unless it was nextConfig itself that changed.
         // (Even if it was nextConfig, updating would be a no-op since
         // nextConfig does not depend on itself, but ignore it for robustness)
-        if(name != "nextConfig")
+        if(index != _state.nextConfig.index())
             updateNextConfig();
     };
 
@@ -450,6 +511,9 @@ Daemon::Daemon(QObject* parent)
     _methodRegistry->add(RPC_METHOD(sendServiceQualityEvents));
     _methodRegistry->add(RPC_METHOD(notifyClientActivate));
     _methodRegistry->add(RPC_METHOD(notifyClientDeactivate));
+    _methodRegistry->add(RPC_METHOD(setStatePatches));
+    _methodRegistry->add(RPC_METHOD(setMessageEncoding));
+    _methodRegistry->add(RPC_METHOD(subscribeProperties));
     _methodRegistry->add(RPC_METHOD(emailLogin));
     _methodRegistry->add(RPC_METHOD(setToken));
     _methodRegistry->add(RPC_METHOD(login));
@@ -796,11 +860,13 @@ void Daemon::RPC_applySettings(const QJsonObject &settings, bool reconnectIfNeed
         rebuildActiveLocations();
     }
     // Otherwise, If the settings affect the location choices, recompute them.
-    // Port forwarding and method affect the "best" location selection.
+    // Port forwarding and method affect the "best" location selection, and
+    // favorites affect the latency measurement priorities.
     else if(settings.contains(QLatin1String("location")) ||
        settings.contains(QLatin1String("proxyShadowsocksLocation")) ||
        settings.contains(QLatin1String("portForward")) ||
-       settings.contains(QLatin1String("method")))
+       settings.contains(QLatin1String("method")) ||
+       settings.contains(QLatin1String("favoriteLocations")))
     {
         qInfo() << "Settings affect location choices, recalculate location preferences";
         calculateLocationPreferences();
@@ -898,7 +964,7 @@ void Daemon::RPC_resetSettings()
 
 QString Daemon::RPC_getCountryBestRegion(const QString &country)
 {
-    NearestLocations nearest{_state.availableLocations()};
+    NearestLocations nearest{_state.availableLocations(), _unreliableLocations};
     const auto &countryLower = country.toLower();
     const auto &pBestInCountry = nearest.getBestMatchingLocation(
         [&](const Location &loc)
@@ -1414,6 +1480,112 @@ void Daemon::RPC_notifyClientDeactivate()
         emit daemonDeactivated();
 }
 
+void Daemon::RPC_setStatePatches(bool enabled)
+{
+    ClientConnection *pClient = ClientConnection::getInvokingClient();
+
+    if(!pClient)
+    {
+        qWarning() << "Invalid invoking client in client RPC";
+        return;
+    }
+
+    if(pClient->getStatePatches() == enabled)
+        return;
+
+    qInfo() << "Client" << pClient << "set state patches to" << enabled;
+    pClient->setStatePatches(enabled);
+
+    // Enabling patches doesn't require anything else; the client has already
+    // received every value that future patches will be relative to.
+    //
+    // Disabling patches might mean the client could not apply one (its state
+    // has diverged), so resend everything.
+    if(!enabled)
+        sendClientData(*pClient);
+}
+
+void Daemon::RPC_setMessageEncoding(const QString &encoding)
+{
+    ClientConnection *pClient = ClientConnection::getInvokingClient();
+
+    if(!pClient)
+    {
+        qWarning() << "Invalid invoking client in client RPC";
+        return;
+    }
+
+    if(encoding == QStringLiteral("json"))
+        pClient->setEncoding(JsonRPCEncoding::Json);
+    else if(encoding == QStringLiteral("cbor"))
+        pClient->setEncoding(JsonRPCEncoding::Cbor);
+    else
+    {
+        qWarning() << "Client" << pClient << "requested unknown encoding"
+            << encoding;
+        throw JsonRPCInvalidParamsError{HERE, "unknown encoding"};
+    }
+    qInfo() << "Client" << pClient << "set message encoding to" << encoding;
+}
+
+void Daemon::RPC_subscribeProperties(const QJsonArray &paths)
+{
+    ClientConnection *pClient = ClientConnection::getInvokingClient();
+
+    if(!pClient)
+    {
+        qWarning() << "Invalid invoking client in client RPC";
+        return;
+    }
+
+    static const QStringList groups{QStringLiteral("data"),
+        QStringLiteral("account"), QStringLiteral("settings"),
+        QStringLiteral("state")};
+
+    QHash<QString, QSet<QString>> subscriptions;
+    for(const auto &pathValue : paths)
+    {
+        const QString &path = pathValue.toString();
+        int dot = path.indexOf('.');
+        const QString &group = path.left(dot);
+        if(!groups.contains(group))
+        {
+            qWarning() << "Client" << pClient << "can't subscribe to unknown path"
+                << pathValue;
+            throw JsonRPCInvalidParamsError{HERE, "unknown property group"};
+        }
+
+        // An empty set subscribes to the whole group
+        if(dot < 0)
+            subscriptions[group].clear();
+        else
+        {
+            auto itGroup = subscriptions.find(group);
+            if(itGroup == subscriptions.end())
+                subscriptions.insert(group, {path.mid(dot+1)});
+            else if(!itGroup->isEmpty())
+                itGroup->insert(path.mid(dot+1));
+        }
+    }
+
+    // Send pending changes using the prior subscriptions.  If the complete
+    // data are sent below, the values sent must be the ones that later state
+    // patches will be relative to.
+    if(_notifyScheduler.cancel())
+        notifyChanges();
+
+    bool hadSubscriptions = pClient->hasSubscriptions();
+    pClient->setSubscriptions(std::move(subscriptions));
+    qInfo() << "Client" << pClient << "subscribed to"
+        << (pClient->hasSubscriptions() ? pClient->subscriptionKey() : QStringLiteral("everything"));
+
+    // Clients start out subscribed to everything, so the first subscription
+    // only narrows what the client receives.  If the client had subscribed
+    // before, it may not have current values for properties it has now added.
+    if(hadSubscriptions)
+        sendClientData(*pClient);
+}
+
 Async<void> Daemon::RPC_emailLogin(const QString &email)
 {
     mustBeAwake(); // If this runs, the system must be awake
@@ -1713,7 +1885,6 @@ void Daemon::start()
 
     _server = new LocalSocketIPCServer(this);
     connect(_server, &IPCServer::newConnection, this, &Daemon::clientConnected);
-    connect(_rpc, &RemoteNotificationInterface::messageReady, _server, &IPCServer::sendMessageToAllClients);
     _server->listen();
 
     connect(&_account, &DaemonAccount::loggedInChanged, this, [this]() {
@@ -1802,24 +1973,72 @@ void Daemon::clientConnected(IPCConnection* connection)
         }
     });
 
-    QJsonObject all;
-    all.insert(QStringLiteral("data"), _data.toJsonObject());
-    QJsonObject accountJsonObj = _account.toJsonObject();
-    for(const auto &sensitiveProp : DaemonAccount::sensitiveProperties())
-        accountJsonObj.remove(sensitiveProp);
-    all.insert(QStringLiteral("account"), std::move(accountJsonObj));
-    all.insert(QStringLiteral("settings"), _settings.toJsonObject());
-    QJsonObject stateJson;
-    try
+    // If there are pending changes, send them to the existing clients now.
+    // The new client gets the current values in its initial data, and those
+    // values must be the ones that later JSON patches will be relative to (if
+    // it enables patches).
+    if(_notifyScheduler.cancel())
+        notifyChanges();
+
+    sendClientData(*client);
+}
+
+namespace
+{
+    // State properties that are sent as JSON patches to clients that enable
+    // them.  These are large and usually change only slightly (such as a few
+    // latency values changing in availableLocations); other properties are
+    // small enough that a patch would not be any smaller than the value.
+    bool isStatePatchProperty(const std::string &name)
     {
-        stateJson = adaptNljToQt(_state.getJsonObject());
+        static const std::unordered_set<std::string> patchProperties
+        {
+            "availableLocations",
+            "regionsMetadata",
+            "groupedLocations",
+            "dedicatedIpLocations",
+            "vpnLocations",
+            "shadowsocksLocations",
+            "intervalMeasurements",
+        };
+        return patchProperties.count(name) > 0;
     }
-    catch(const std::exception &ex)
+
+    // Remove the properties from a complete "data" notification that a client
+    // has not subscribed to.
+    QJsonObject filterClientData(const QJsonObject &all, const ClientConnection &client)
     {
-        KAPPS_CORE_WARNING() << "Unable to serialize state:" << ex.what();
+        if(!client.hasSubscriptions())
+            return all;
+
+        QJsonObject filtered;
+        for(auto itGroup = all.begin(); itGroup != all.end(); ++itGroup)
+        {
+            // State patches are subscribed along with the state properties
+            const QString &group = itGroup.key() == QStringLiteral("statePatch") ?
+                QStringLiteral("state") : itGroup.key();
+            if(!client.isSubscribed(group))
+                continue;
+            const auto &properties = client.subscribedProperties(group);
+            if(properties.isEmpty())
+            {
+                filtered.insert(itGroup.key(), itGroup.value());
+                continue;
+            }
+
+            const QJsonObject &groupObj = itGroup.value().toObject();
+            QJsonObject filteredGroup;
+            for(const auto &property : properties)
+            {
+                auto itProperty = groupObj.find(property);
+                if(itProperty != groupObj.end())
+                    filteredGroup.insert(property, itProperty.value());
+            }
+            if(!filteredGroup.isEmpty())
+                filtered.insert(itGroup.key(), filteredGroup);
+        }
+        return filtered;
     }
-    all.insert(QStringLiteral("state"), stateJson);
-    client->post(QStringLiteral("data"), all);
 }
 
 QJsonObject getProperties(const NativeJsonObject& object, const QSet<QString>& properties)
@@ -1833,41 +2052,423 @@ QJsonObject getProperties(const NativeJsonObject& object, const QSet<QString>& p
     return result;
 }
 
-QJsonObject getProperties(const JsonState<clientjson::json> &object,
-    const std::unordered_set<std::string> &properties)
+clientjson::json getProperties(const StateModel &object,
+    const StateModel::PropertySet &properties)
 {
-    try
+    clientjson::json result = clientjson::json::object();
+    properties.forEach([&](std::size_t index)
     {
-        clientjson::json result{};
-        for(const auto &name : properties)
+        // Individual properties can fail without failing everything
+        try
         {
-            // Individual properties can fail without failing everything
-            try
-            {
-                result.emplace(name, object.getProperty(name));
-            }
-            catch(const std::exception &ex)
+            result.emplace(object.propertyName(index), object.getProperty(index));
+        }
+        catch(const std::exception &ex)
+        {
+            KAPPS_CORE_WARNING() << "Unable to serialize property"
+                << object.propertyName(index) << "-" << ex.what();
+        }
+    });
+    return result;
+}
+
+void Daemon::sendClientData(ClientConnection &client)
+{
+    // Clients that have subscribed to specific properties or selected another
+    // encoding only get the complete data again if they change subscriptions
+    // or turn off state patches; don't bother caching that.
+    if(client.hasSubscriptions() || client.encoding() != JsonRPCEncoding::Json)
+    {
+        client.sendMessage(RemoteNotificationInterface::buildNotification(
+            QStringLiteral("data"), QJsonArray{buildClientData(&client)},
+            client.encoding()));
+        return;
+    }
+
+    // Reuse the last message if nothing has changed since it was built.
+    // Clients like "piactl get" connect and disconnect frequently, there's no
+    // need to rebuild the complete data for each one.
+    if(_clientDataMsg.isEmpty() || _clientDataMsgGeneration != _dataGeneration)
+    {
+        // Write the message directly rather than building a QJsonObject, this
+        // is the largest message sent by the daemon.
+        _clientDataMsg = RemoteNotificationInterface::buildJsonNotification(
+            QStringLiteral("data"), [this](JsonWriter &writer){writeClientData(writer);});
+        _clientDataMsgGeneration = _dataGeneration;
+    }
+    else
+    {
+        qInfo() << "Sending cached data to client" << &client;
+    }
+    client.sendMessage(_clientDataMsg);
+}
+
+QJsonObject Daemon::buildClientData(const ClientConnection *pClient) const
+{
+    // Get the properties that the client has subscribed to in a group, or an
+    // empty set for all properties (including if there's no client).
+    auto subscribedProperties = [pClient](const QString &group)
+    {
+        return pClient ? pClient->subscribedProperties(group) : QSet<QString>{};
+    };
+    auto isSubscribed = [pClient](const QString &group)
+    {
+        return !pClient || pClient->isSubscribed(group);
+    };
+
+    QJsonObject all;
+    if(isSubscribed(QStringLiteral("data")))
+    {
+        const auto &properties = subscribedProperties(QStringLiteral("data"));
+        all.insert(QStringLiteral("data"), properties.isEmpty() ?
+            _data.toJsonObject() : getProperties(_data, properties));
+    }
+    if(isSubscribed(QStringLiteral("account")))
+    {
+        const auto &properties = subscribedProperties(QStringLiteral("account"));
+        QJsonObject accountJsonObj = properties.isEmpty() ?
+            _account.toJsonObject() : getProperties(_account, properties);
+        for(const auto &sensitiveProp : DaemonAccount::sensitiveProperties())
+            accountJsonObj.remove(sensitiveProp);
+        all.insert(QStringLiteral("account"), std::move(accountJsonObj));
+    }
+    if(isSubscribed(QStringLiteral("settings")))
+    {
+        const auto &properties = subscribedProperties(QStringLiteral("settings"));
+        all.insert(QStringLiteral("settings"), properties.isEmpty() ?
+            _settings.toJsonObject() : getProperties(_settings, properties));
+    }
+    if(isSubscribed(QStringLiteral("state")))
+    {
+        const auto &properties = subscribedProperties(QStringLiteral("state"));
+        QJsonObject stateJson;
+        auto insertProperty = [&](std::size_t index)
+        {
+            QJsonValue value = statePropertyJson(index, nullptr);
+            if(!value.isUndefined())
+                stateJson.insert(QString::fromStdString(_state.propertyName(index)), value);
+        };
+        if(properties.isEmpty())
+        {
+            for(std::size_t i=0; i<_state.propertyCount(); ++i)
+                insertProperty(i);
+        }
+        else
+        {
+            std::size_t index{};
+            for(const auto &property : properties)
             {
-                KAPPS_CORE_WARNING() << "Unable to serialize property" << name
-                    << "-" << ex.what();
+                if(_state.findProperty(property.toStdString(), index))
+                    insertProperty(index);
             }
         }
-        return adaptNljToQt(result);
+        all.insert(QStringLiteral("state"), stateJson);
+    }
+    return all;
+}
+
+void Daemon::writeClientData(JsonWriter &writer) const
+{
+    writer.beginObject();
+    writer.key(QStringLiteral("data"));
+    _data.writeJson(writer);
+    writer.key(QStringLiteral("account"));
+    _account.writeJson(writer, DaemonAccount::sensitiveProperties());
+    writer.key(QStringLiteral("settings"));
+    _settings.writeJson(writer);
+    writer.key(QStringLiteral("state"));
+    writer.beginObject();
+    std::string text;
+    for(std::size_t i=0; i<_state.propertyCount(); ++i)
+    {
+        if(statePropertyText(i, nullptr, text))
+        {
+            writer.key(_state.propertyName(i));
+            writer.rawValue(text);
+        }
+    }
+    writer.endObject();
+    writer.endObject();
+}
+
+bool Daemon::statePropertyText(std::size_t index, const clientjson::json *pValue,
+                               std::string &text) const
+{
+    const auto &info = _statePropertyInfo[index];
+    if(info.cacheJson && info.textCached)
+    {
+        text = info.cachedText;
+        return true;
+    }
+
+    try
+    {
+        text = pValue ? pValue->dump() : _state.getProperty(index).dump();
     }
     catch(const std::exception &ex)
     {
-        KAPPS_CORE_WARNING() << "Unable to serialize properties" << properties
-            << "-" << ex.what();
+        KAPPS_CORE_WARNING() << "Unable to serialize property"
+            << _state.propertyName(index) << "-" << ex.what();
+        return false;
     }
-    return {};
+
+    if(info.cacheJson)
+    {
+        info.cachedText = text;
+        info.textCached = true;
+    }
+    return true;
+}
+
+QJsonValue Daemon::statePropertyJson(std::size_t index, const clientjson::json *pValue) const
+{
+    const auto &info = _statePropertyInfo[index];
+    if(info.cacheJson && !info.cachedJson.isUndefined())
+        return info.cachedJson;
+
+    QJsonValue value{QJsonValue::Undefined};
+    // adaptJsonTextToQJsonObject() only accepts objects, so wrap the property
+    // value in an object
+    std::string valueText;
+    if(!statePropertyText(index, pValue, valueText))
+        return value;
+    try
+    {
+        value = adaptJsonTextToQJsonObject("{\"v\":" + valueText + '}')
+            .value(QStringLiteral("v"));
+    }
+    catch(const std::exception &ex)
+    {
+        KAPPS_CORE_WARNING() << "Unable to serialize property"
+            << _state.propertyName(index) << "-" << ex.what();
+        return value;
+    }
+
+    if(info.cacheJson)
+        info.cachedJson = value;
+    return value;
+}
+
+QJsonObject Daemon::statePropertiesJson(const clientjson::json &stateValues) const
+{
+    QJsonObject stateJson;
+    std::size_t index{};
+    for(const auto &[name, value] : stateValues.items())
+    {
+        if(!_state.findProperty(name, index))
+            continue;
+        QJsonValue valueJson = statePropertyJson(index, &value);
+        if(!valueJson.isUndefined())
+            stateJson.insert(QString::fromStdString(name), valueJson);
+    }
+    return stateJson;
+}
+
+bool Daemon::anyClientSubscribed(const QString &group, const QString &property) const
+{
+    for(const auto &pClient : _clients)
+    {
+        if(pClient->isSubscribed(group, property))
+            return true;
+    }
+    return false;
+}
+
+void Daemon::discardUnsubscribedChanges(const QString &group, QSet<QString> &changes) const
+{
+    for(auto it = changes.begin(); it != changes.end(); )
+    {
+        if(anyClientSubscribed(group, *it))
+            ++it;
+        else
+            it = changes.erase(it);
+    }
+}
+
+void Daemon::discardUnsubscribedChanges(StateModel::PropertySet &changes)
+{
+    // If any client receives everything, there's nothing to discard; skip
+    // converting the property names
+    for(const auto &pClient : _clients)
+    {
+        if(!pClient->hasSubscriptions())
+            return;
+    }
+
+    StateModel::PropertySet subscribedChanges;
+    changes.forEach([&](std::size_t index)
+    {
+        const auto &name = _state.propertyName(index);
+        if(anyClientSubscribed(QStringLiteral("state"), QString::fromStdString(name)))
+            subscribedChanges.insert(index);
+        else
+        {
+            // Since this change isn't being broadcast, the last broadcast
+            // value is no longer valid.  Send the whole value next time.
+            _stateBroadcastValues.erase(name);
+        }
+    });
+    changes = std::move(subscribedChanges);
+}
+
+void Daemon::buildStatePatches(clientjson::json &stateValues, clientjson::json &patches)
+{
+    patches = clientjson::json::object();
+    for(auto it = stateValues.begin(); it != stateValues.end(); )
+    {
+        if(!isStatePatchProperty(it.key()))
+        {
+            ++it;
+            continue;
+        }
+
+        auto itLastValue = _stateBroadcastValues.find(it.key());
+        if(itLastValue == _stateBroadcastValues.end())
+        {
+            // Not sent since patches were enabled, send the whole value
+            _stateBroadcastValues.emplace(it.key(), it.value());
+            ++it;
+            continue;
+        }
+
+        auto patch = clientjson::buildArrayAppendPatch(itLastValue->second, it.value());
+        if(patch.is_null())
+            patch = clientjson::json::diff(itLastValue->second, it.value());
+        // If the patch touches more elements than the value has (such as when
+        // the grouped locations are reordered), or replaces the whole value,
+        // the complete value is smaller - send that instead.
+        if(patch.size() > it.value().size() ||
+            (patch.size() == 1 && patch[0].at("path") == ""))
+        {
+            itLastValue->second = it.value();
+            ++it;
+            continue;
+        }
+        itLastValue->second = std::move(it.value());
+        patches.emplace(it.key(), std::move(patch));
+        it = stateValues.erase(it);
+    }
+}
+
+bool Daemon::writeClientChanges(JsonWriter &writer, const ClientConnection &client,
+                                const QJsonObject &changes,
+                                const clientjson::json *pStateValues,
+                                const clientjson::json *pStatePatches) const
+{
+    // Like filterClientData(), a group the client subscribed to entirely is
+    // written even if it's empty, but a group filtered to specific properties
+    // is only written if one of them changed.
+    bool wroteGroup{false};
+    bool groupBegun{false};
+    auto beginGroup = [&](const QString &group)
+    {
+        if(!groupBegun)
+        {
+            writer.key(group);
+            writer.beginObject();
+            groupBegun = true;
+        }
+    };
+    auto endGroup = [&]()
+    {
+        if(groupBegun)
+        {
+            writer.endObject();
+            wroteGroup = true;
+            groupBegun = false;
+        }
+    };
+
+    writer.beginObject();
+    for(auto itGroup = changes.begin(); itGroup != changes.end(); ++itGroup)
+    {
+        if(!client.isSubscribed(itGroup.key()))
+            continue;
+        const auto &properties = client.subscribedProperties(itGroup.key());
+        if(properties.isEmpty())
+            beginGroup(itGroup.key());
+        const QJsonObject &groupObj = itGroup.value().toObject();
+        for(auto itProperty = groupObj.begin(); itProperty != groupObj.end(); ++itProperty)
+        {
+            if(!properties.isEmpty() && !properties.contains(itProperty.key()))
+                continue;
+            beginGroup(itGroup.key());
+            writer.key(itProperty.key());
+            writer.value(itProperty.value());
+        }
+        endGroup();
+    }
+
+    // State patches are subscribed along with the state properties
+    if(pStateValues && client.isSubscribed(QStringLiteral("state")))
+    {
+        const auto &properties = client.subscribedProperties(QStringLiteral("state"));
+        auto isIncluded = [&](const std::string &name)
+        {
+            return properties.isEmpty() || properties.contains(QString::fromStdString(name));
+        };
+
+        if(properties.isEmpty())
+            beginGroup(QStringLiteral("state"));
+        std::string text;
+        std::size_t index{};
+        for(const auto &[name, value] : pStateValues->items())
+        {
+            if(!isIncluded(name) || !_state.findProperty(name, index) ||
+                !statePropertyText(index, &value, text))
+            {
+                continue;
+            }
+            beginGroup(QStringLiteral("state"));
+            writer.key(name);
+            writer.rawValue(text);
+        }
+        endGroup();
+
+        if(pStatePatches)
+        {
+            for(const auto &[name, patch] : pStatePatches->items())
+            {
+                if(!isIncluded(name))
+                    continue;
+                try
+                {
+                    text = patch.dump();
+                }
+                catch(const std::exception &ex)
+                {
+                    KAPPS_CORE_WARNING() << "Unable to serialize patch for property"
+                        << name << "-" << ex.what();
+                    continue;
+                }
+                beginGroup(QStringLiteral("statePatch"));
+                writer.key(name);
+                writer.rawValue(text);
+            }
+            endGroup();
+        }
+    }
+    writer.endObject();
+
+    // Clients that subscribed to specific properties only get a message if
+    // one of those properties changed
+    return !client.hasSubscriptions() || wroteGroup;
 }
 
 void Daemon::notifyChanges()
 {
-    QJsonObject all;
+    // All pending changes are sent now, cancel any broadcast that was
+    // scheduled
+    _notifyScheduler.flushed();
+
+    // Changes that no client has subscribed to are not serialized at all.
+    // (Changes to data, account, and settings are still written to disk.)
+    QJsonObject changes;
     if (!_dataChanges.empty())
     {
-        all.insert(QStringLiteral("data"), getProperties(_data, std::exchange(_dataChanges, {})));
+        auto dataChanges = std::exchange(_dataChanges, {});
+        discardUnsubscribedChanges(QStringLiteral("data"), dataChanges);
+        changes.insert(QStringLiteral("data"), getProperties(_data, dataChanges));
         _pendingSerializations |= 1;
     }
     if (!_accountChanges.empty())
@@ -1878,20 +2479,123 @@ void Daemon::notifyChanges()
         // write them to disk
         for(const auto &sensitiveProp : DaemonAccount::sensitiveProperties())
             newAccountChanges.remove(sensitiveProp);
-        all.insert(QStringLiteral("account"), getProperties(_account, newAccountChanges));
+        discardUnsubscribedChanges(QStringLiteral("account"), newAccountChanges);
+        changes.insert(QStringLiteral("account"), getProperties(_account, newAccountChanges));
         _pendingSerializations |= 2;
     }
     if (!_settingsChanges.empty())
     {
-        all.insert(QStringLiteral("settings"), getProperties(_settings, std::exchange(_settingsChanges, {})));
+        auto settingsChanges = std::exchange(_settingsChanges, {});
+        discardUnsubscribedChanges(QStringLiteral("settings"), settingsChanges);
+        changes.insert(QStringLiteral("settings"), getProperties(_settings, settingsChanges));
         _pendingSerializations |= 4;
     }
-    if (!_stateChanges.empty())
+    serialize();
+
+    bool havePatchClients{false};
+    for(const auto &pClient : _clients)
     {
-        all.insert(QStringLiteral("state"), getProperties(_state, std::exchange(_stateChanges, {})));
+        if(pClient->getStatePatches())
+            havePatchClients = true;
+    }
+    // The last broadcast values are only valid if they were updated by every
+    // broadcast; discard them when no clients need them.
+    if(!havePatchClients)
+        _stateBroadcastValues.clear();
+
+    bool haveStateChanges = !_stateChanges.empty();
+    clientjson::json stateValues, statePatches;
+    if(haveStateChanges)
+    {
+        auto stateChanges = std::exchange(_stateChanges, {});
+        discardUnsubscribedChanges(stateChanges);
+        stateValues = getProperties(_state, stateChanges);
+    }
+
+    // Filter and serialize each variation once, regardless of the number of
+    // clients.  Clients with the same subscriptions, state patch setting, and
+    // encoding receive the same message.
+    //
+    // JSON messages are written directly from the serialized state values
+    // (and the cached text of large properties) - the state changes are the
+    // largest part of most broadcasts, and most clients use JSON.  A
+    // QJsonObject is only built if a client uses another encoding.
+    std::map<std::tuple<QString, bool, JsonRPCEncoding>, QByteArray> messages;
+    auto sendChanges = [&](bool statePatchClients)
+    {
+        const clientjson::json *pStateValues = haveStateChanges ? &stateValues : nullptr;
+        const clientjson::json *pStatePatches = statePatchClients ? &statePatches : nullptr;
+        QJsonObject all;
+        bool allBuilt{false};
+        for(const auto &pClient : _clients)
+        {
+            if(pClient->getStatePatches() != statePatchClients)
+                continue;
+            auto key = std::make_tuple(pClient->subscriptionKey(),
+                statePatchClients, pClient->encoding());
+            auto itMsg = messages.find(key);
+            if(itMsg == messages.end())
+            {
+                QByteArray msg;
+                if(pClient->encoding() == JsonRPCEncoding::Json)
+                {
+                    bool sendMsg{false};
+                    msg = RemoteNotificationInterface::buildJsonNotification(
+                        QStringLiteral("data"), [&](JsonWriter &writer)
+                        {
+                            sendMsg = writeClientChanges(writer, *pClient, changes,
+                                                         pStateValues, pStatePatches);
+                        });
+                    if(!sendMsg)
+                        msg.clear();
+                }
+                else
+                {
+                    if(!allBuilt)
+                    {
+                        all = changes;
+                        if(pStateValues)
+                            all.insert(QStringLiteral("state"), statePropertiesJson(*pStateValues));
+                        if(pStatePatches && !pStatePatches->empty())
+                        {
+                            try
+                            {
+                                all.insert(QStringLiteral("statePatch"), adaptNljToQt(*pStatePatches));
+                            }
+                            catch(const std::exception &ex)
+                            {
+                                KAPPS_CORE_WARNING() << "Unable to serialize state changes -" << ex.what();
+                            }
+                        }
+                        allBuilt = true;
+                    }
+                    const auto &clientData = filterClientData(all, *pClient);
+                    // Clients that subscribed to specific properties only get a
+                    // message if one of those properties changed
+                    if(!pClient->hasSubscriptions() || !clientData.isEmpty())
+                    {
+                        msg = RemoteNotificationInterface::buildNotification(
+                            QStringLiteral("data"), QJsonArray{clientData},
+                            pClient->encoding());
+                    }
+                }
+                itMsg = messages.emplace(key, std::move(msg)).first;
+            }
+            if(!itMsg->second.isEmpty())
+                pClient->sendMessage(itMsg->second);
+        }
+    };
+
+    // Clients getting the full state values are sent first; building the
+    // patches then moves the patched values out of stateValues without
+    // copying them.
+    sendChanges(false);
+    if(havePatchClients)
+    {
+        if(haveStateChanges)
+            buildStatePatches(stateValues, statePatches);
+        sendChanges(true);
     }
-    serialize();
-    _rpc->post(QStringLiteral("data"), all);
 }
 
 void Daemon::serialize()
@@ -2344,16 +3048,79 @@ void Daemon::newLatencyMeasurements(const LatencyTracker::Latencies &measurement
     LatencyMap newLatencies;
     newLatencies = _data.modernLatencies();
 
+    LatencyMap measuredLatencies;
+    measuredLatencies.reserve(measurements.size());
+    bool unreliableChanged{false};
     for(const auto &measurement : measurements)
     {
-        newLatencies[measurement.first] = static_cast<double>(msec(measurement.second));
+        double latency = static_cast<double>(msec(measurement.latency));
+        newLatencies[measurement.locationId] = latency;
+        measuredLatencies[measurement.locationId] = latency;
+
+        if(isUnreliableLatency(measurement))
+        {
+            if(_unreliableLocations.insert(measurement.locationId).second)
+            {
+                qInfo() << "Location" << measurement.locationId
+                    << "is unreliable - jitter" << msec(measurement.jitter)
+                    << "ms, loss" << measurement.loss;
+                unreliableChanged = true;
+            }
+        }
+        else if(_unreliableLocations.erase(measurement.locationId))
+        {
+            qInfo() << "Location" << measurement.locationId
+                << "is reliable again";
+            unreliableChanged = true;
+        }
     }
 
     _data.modernLatencies(newLatencies);
 
-    // Rebuild the locations, including the grouped locations and location
-    // choices, since the latencies changed
-    rebuildActiveLocations();
+    // Update the locations, including the grouped locations and location
+    // choices, since the latencies changed.  The regions list hasn't changed,
+    // so there's no need to rebuild the locations.
+    //
+    // If no latencies changed, the location choices still need to be
+    // recalculated if any location's reliability changed.
+    if(!applyLatencies(measuredLatencies) && unreliableChanged)
+        calculateLocationPreferences();
+}
+
+bool Daemon::applyLatencies(const LatencyMap &latencies)
+{
+    LocationsById changedLocations = applyLocationLatencies(_allLocations, latencies);
+    if(changedLocations.empty())
+        return false;
+
+    // Replace the changed locations in availableLocations (ignore locations
+    // that were excluded from it)
+    LocationsById availableLocations = _state.availableLocations();
+    for(auto itChanged = changedLocations.begin(); itChanged != changedLocations.end(); )
+    {
+        auto itAvailable = availableLocations.find(itChanged->first);
+        if(itAvailable == availableLocations.end())
+            itChanged = changedLocations.erase(itChanged);
+        else
+        {
+            itAvailable->second = itChanged->second;
+            ++itChanged;
+        }
+    }
+    if(changedLocations.empty())
+        return false;
+    _state.availableLocations(std::move(availableLocations));
+
+    std::vector<CountryLocations> groupedLocations = _state.groupedLocations();
+    std::vector<QSharedPointer<const Location>> dedicatedIpLocations = _state.dedicatedIpLocations();
+    updateGroupedLocations(changedLocations, _state.regionsMetadata(),
+                           groupedLocations, dedicatedIpLocations);
+    _state.groupedLocations(std::move(groupedLocations));
+    _state.dedicatedIpLocations(std::move(dedicatedIpLocations));
+
+    // Latencies affect the best location choices
+    calculateLocationPreferences();
+    return true;
 }
 
 void Daemon::portForwardUpdated(int port)
@@ -2365,6 +3132,17 @@ void Daemon::portForwardUpdated(int port)
 void Daemon::applyBuiltLocations(LocationsById newLocations,
                                  kapps::regions::Metadata metadata)
 {
+    // Forget unreliable locations that no longer exist, they'd never be
+    // measured again to clear them
+    for(auto itUnreliable = _unreliableLocations.begin();
+        itUnreliable != _unreliableLocations.end();)
+    {
+        if(newLocations.count(itUnreliable->toStdString()))
+            ++itUnreliable;
+        else
+            itUnreliable = _unreliableLocations.erase(itUnreliable);
+    }
+
     // The LatencyTrackers still ping all locations, so we have latency
     // measurements if the locations are re-enabled, but remove them from
     // availableLocations and groupedLocations so all parts of the program will
@@ -2373,6 +3151,7 @@ void Daemon::applyBuiltLocations(LocationsById newLocations,
     // - favorites/recents for geo locations are ignored
     // - piactl does not display or accept them
     // - the regions lists (both VPN and Shadowsocks) do not display them
+    _allLocations = newLocations;
     LocationsById nonGeoLocations;
     if(!_settings.includeGeoOnly())
     {
@@ -2479,7 +3258,8 @@ bool Daemon::rebuildModernLocations(const QJsonObject &regionsObj,
                                                  shadowsocksObj,
                                                  metadataObj,
                                                  _account.dedicatedIps(),
-                                                 _settings.manualServer());
+                                                 _settings.manualServer(),
+                                                 &_regionsSnapshot);
 
         // Like the legacy list, if no regions are found, treat this as an error
         // and keep the data we have (which might still be usable).
@@ -2496,6 +3276,10 @@ bool Daemon::rebuildModernLocations(const QJsonObject &regionsObj,
         applyBuiltLocations(std::move(newLocations.first),
                             std::move(newLocations.second));
 
+        // Keep a snapshot of the new regions, so they can be loaded without
+        // parsing the regions lists next time
+        _regionsSnapshot.save();
+
         return true;
     }
     catch(const std::exception &ex)
@@ -3383,8 +4167,8 @@ void Daemon::upgradeSettings(bool existingSettingsFile)
 
 void Daemon::calculateLocationPreferences()
 {
-    // Pick the best location
-    NearestLocations nearest{_state.availableLocations()};
+    // Pick the best location, avoiding unreliable locations if possible
+    NearestLocations nearest{_state.availableLocations(), _unreliableLocations};
 
     QSharedPointer<const Location> pVpnBest{nearest.getNearestSafeVpnLocation(_settings.portForward())};
 
@@ -3436,6 +4220,17 @@ void Daemon::calculateLocationPreferences()
         pSsNext = pSsChosen ? pSsChosen : pSsBest;
     }
 
+    // The chosen, best, and favorite locations are the most likely to be used,
+    // keep their latencies up to date
+    std::unordered_set<QString> priorityLocations{_settings.favoriteLocations().begin(),
+                                                  _settings.favoriteLocations().end()};
+    for(const auto &pLocation : {pVpnChosen, pVpnBest, pSsChosen, pSsBest})
+    {
+        if(pLocation)
+            priorityLocations.insert(pLocation->id());
+    }
+    _modernLatencyTracker.setPriorityLocations(std::move(priorityLocations));
+
     _state.vpnLocations({std::move(pVpnChosen), std::move(pVpnBest),
                          std::move(pVpnNext)});
     _state.shadowsocksLocations({std::move(pSsChosen), std::move(pSsBest),
@@ -3812,6 +4607,8 @@ void logProcessMemoryWindows(const QString &id, DWORD pid) {
 void Daemon::traceMemory()
 {
     qDebug () << "Tracing memory";
+    qInfo() << "Client notifications:" << _notifyScheduler.broadcasts()
+        << "broadcasts," << _notifyScheduler.mergedChanges() << "changes merged";
 #ifdef Q_OS_MACOS
     logProcessMemoryUnix(QStringLiteral("client"), QStringLiteral(BRAND_NAME));
     logProcessMemoryUnix(QStringLiteral("daemon"), QStringLiteral(BRAND_CODE "-daemon"));
@@ -3865,6 +4662,7 @@ ClientConnection::ClientConnection(IPCConnection *connection, LocalMethodRegistr
     , _rpc(new ServerSideInterface(registry, this))
     , _active(false)
     , _killed(false)
+    , _statePatches(false)
     , _state(Connected)
 {
     auto setDisconnected = [this]() {
@@ -3893,6 +4691,59 @@ ClientConnection::ClientConnection(IPCConnection *connection, LocalMethodRegistr
 }
 ClientConnection* ClientConnection::_invokingClient = nullptr;
 
+JsonRPCEncoding ClientConnection::encoding() const
+{
+    return _rpc->encoding();
+}
+
+void ClientConnection::setEncoding(JsonRPCEncoding encoding)
+{
+    _rpc->setEncoding(encoding);
+}
+
+bool ClientConnection::isSubscribed(const QString &group) const
+{
+    return _subscriptions.isEmpty() || _subscriptions.contains(group);
+}
+
+bool ClientConnection::isSubscribed(const QString &group, const QString &property) const
+{
+    if(_subscriptions.isEmpty())
+        return true;
+    auto itGroup = _subscriptions.find(group);
+    return itGroup != _subscriptions.end() &&
+        (itGroup->isEmpty() || itGroup->contains(property));
+}
+
+QSet<QString> ClientConnection::subscribedProperties(const QString &group) const
+{
+    return _subscriptions.value(group);
+}
+
+void ClientConnection::setSubscriptions(QHash<QString, QSet<QString>> subscriptions)
+{
+    _subscriptions = std::move(subscriptions);
+
+    // Build a canonical representation, like "settings:method;state:*"
+    QStringList groups = _subscriptions.keys();
+    groups.sort();
+    QStringList groupKeys;
+    for(const auto &group : groups)
+    {
+        QStringList properties = _subscriptions.value(group).values();
+        properties.sort();
+        groupKeys.push_back(group + ':' + (properties.isEmpty() ?
+            QStringLiteral("*") : properties.join(',')));
+    }
+    _subscriptionKey = groupKeys.join(';');
+}
+
+void ClientConnection::sendMessage(const QByteArray &msg)
+{
+    if (_connection)
+        _connection->sendMessage(msg);
+}
+
 void ClientConnection::kill()
 {
     if (_state < Disconnecting)
@@ -30,6 +30,7 @@
 #include <common/src/async.h>
 #include "environment.h"
 #include <common/src/jsonrpc.h>
+#include <common/src/locations.h>
 #include "latencytracker.h"
 #include "networkmonitor.h"
 #include "portforwarder.h"
@@ -39,6 +40,7 @@
 #include "vpn.h"
 #include "apiclient.h"
 #include "automation.h"
+#include "notificationscheduler.h"
 #include <kapps_net/src/firewallparams.h>
 
 #include <QCoreApplication>
@@ -96,6 +98,34 @@ public:
 
     bool getKilled() const {return _killed;}
 
+    // Whether the client has asked to receive changes in large state
+    // properties as JSON patches; see Daemon::RPC_setStatePatches().
+    bool getStatePatches() const {return _statePatches;}
+    void setStatePatches(bool statePatches) {_statePatches = statePatches;}
+
+    // Encoding of messages sent to this client; see
+    // Daemon::RPC_setMessageEncoding().
+    JsonRPCEncoding encoding() const;
+    void setEncoding(JsonRPCEncoding encoding);
+
+    // Property subscriptions; see Daemon::RPC_subscribeProperties().  Clients
+    // that haven't subscribed receive all properties.
+    bool hasSubscriptions() const {return !_subscriptions.isEmpty();}
+    // Whether the client is subscribed to any properties in a group
+    bool isSubscribed(const QString &group) const;
+    bool isSubscribed(const QString &group, const QString &property) const;
+    // The properties subscribed in a group - empty if the whole group is
+    // subscribed (or if the client hasn't subscribed at all)
+    QSet<QString> subscribedProperties(const QString &group) const;
+    // Canonical representation of the subscriptions; clients with the same key
+    // have the same subscriptions.  Empty if the client hasn't subscribed.
+    const QString &subscriptionKey() const {return _subscriptionKey;}
+    void setSubscriptions(QHash<QString, QSet<QString>> subscriptions);
+
+    // Send a message that was already serialized (used to send the same
+    // message to many clients).  The message must use this client's encoding.
+    void sendMessage(const QByteArray &msg);
+
     void kill();
 
 signals:
@@ -110,6 +140,11 @@ private:
     // active client connection unexpectedly exits, this affects the way the
     // daemon remains active (invalidClientExit vs. killedClient)
     bool _killed;
+    bool _statePatches;
+    // Subscribed properties in each group ("data", "account", "settings",
+    // "state").  An empty set subscribes to the whole group.
+    QHash<QString, QSet<QString>> _subscriptions;
+    QString _subscriptionKey;
     State _state;
 
 };
@@ -305,6 +340,28 @@ protected:
     void RPC_notifyClientActivate();
     void RPC_notifyClientDeactivate();
 
+    // Enable or disable JSON patches for large state properties for the
+    // invoking client.  When enabled, changes in those properties are sent in
+    // "statePatch" as RFC 6902 patches relative to the last value sent, instead
+    // of resending the whole value.
+    //
+    // Clients disable patches if a patch can't be applied, which causes the
+    // daemon to resend the complete data to that client.
+    void RPC_setStatePatches(bool enabled);
+    // Set the encoding of messages sent to the invoking client - "json" or
+    // "cbor".  The client can send messages in either encoding regardless of
+    // this setting.  Clients that don't call this receive JSON.
+    void RPC_setMessageEncoding(const QString &encoding);
+    // Subscribe the invoking client to specific properties.  Each path is
+    // either a group ("data", "account", "settings", "state") or a property in
+    // a group ("state.connectionState").  Changes in other properties are not
+    // sent to this client.  An empty array subscribes to everything again.
+    //
+    // Clients start out subscribed to everything, and the initial data is
+    // always complete.  If a client changes subscriptions again later, the
+    // complete data for the new subscriptions are resent.
+    void RPC_subscribeProperties(const QJsonArray &paths);
+
     // Sleep-related events for robust macOS sleep
     // Notify the daemon that the system is about to go to sleep
     void RPC_systemSleep();
@@ -387,6 +444,51 @@ public slots:
 
 private:
     void clientConnected(IPCConnection* connection);
+    // Send the complete data, account, settings, and state to a client
+    void sendClientData(ClientConnection &client);
+    // Build the complete data for a client's subscriptions, or for all
+    // properties if pClient is nullptr.
+    QJsonObject buildClientData(const ClientConnection *pClient) const;
+    // Write the complete data for all properties directly to a JsonWriter.
+    // This produces the same result as buildClientData(nullptr), but the
+    // largest properties are written from their cached JSON text without
+    // building a QJsonObject.
+    void writeClientData(JsonWriter &writer) const;
+    // Get the JSON text for a state property, like statePropertyJson().  For
+    // large properties, this uses the cached text if the property hasn't
+    // changed.  Returns false if the property can't be serialized.
+    bool statePropertyText(std::size_t index, const clientjson::json *pValue,
+                           std::string &text) const;
+    // Get the client JSON for a state property.  If the property's value has
+    // already been serialized, pass it in pValue, otherwise it's serialized
+    // from _state.  For large properties, this uses the cached value if the
+    // property hasn't changed.  Returns Undefined if the property can't be
+    // serialized.
+    QJsonValue statePropertyJson(std::size_t index, const clientjson::json *pValue) const;
+    // Convert serialized state property values to client JSON, using
+    // statePropertyJson()
+    QJsonObject statePropertiesJson(const clientjson::json &stateValues) const;
+    // Check whether any client is subscribed to a property
+    bool anyClientSubscribed(const QString &group, const QString &property) const;
+    // Remove changes that no client is subscribed to.  Unsubscribed state
+    // changes also invalidate _stateBroadcastValues.
+    void discardUnsubscribedChanges(const QString &group, QSet<QString> &changes) const;
+    void discardUnsubscribedChanges(StateModel::PropertySet &changes);
+    // Build the state changes for clients using JSON patches.  Properties that
+    // are sent as patches are moved from stateValues to patches, and they
+    // update _stateBroadcastValues.
+    void buildStatePatches(clientjson::json &stateValues, clientjson::json &patches);
+    // Write the changes broadcast to a JSON client, filtered by its
+    // subscriptions.  Data, account, and settings changes are in changes;
+    // state values and patches are written directly from the serialized
+    // values, using the cached text for large properties.  pStateValues is
+    // nullptr if there are no state changes, pStatePatches is nullptr for
+    // clients that don't use state patches.  Returns false if the client is
+    // subscribed to specific properties and none of them changed.
+    bool writeClientChanges(JsonWriter &writer, const ClientConnection &client,
+                            const QJsonObject &changes,
+                            const clientjson::json *pStateValues,
+                            const clientjson::json *pStatePatches) const;
     void notifyChanges();
     void serialize();
     Async<void> loadVpnIp();
@@ -418,11 +520,17 @@ private:
                                 const QJsonArray &shadowsocksObj,
                                 const QJsonObject &metadataObj);
 
-    // Rebuild either the legacy or modern locations from the cached data,
-    // depending on the infrastructure setting.  Used when latencies are updated
-    // or when initially building the regions list.
+    // Rebuild the modern locations from the cached data.  Used when
+    // initially building the regions list, or when settings that affect the
+    // locations change.  (Latency updates are applied to the existing
+    // locations by applyLatencies() instead.)
     void rebuildActiveLocations();
 
+    // Apply new latency measurements to the existing locations, then update
+    // the grouped locations and location choices.  Returns true if any
+    // location changed (meaning the location choices were recalculated).
+    bool applyLatencies(const LatencyMap &latencies);
+
     // Handle region list results from JsonRefresher
     void shadowsocksRegionsLoaded(const QJsonDocument &shadowsocksRegionsJsonDoc);
     void modernRegionsLoaded(const QJsonDocument &modernRegionsJsonDoc);
@@ -518,7 +626,6 @@ protected:
     IPCServer* _server;
     QHash<IPCConnection*, ClientConnection*> _clients;
     LocalMethodRegistry* _methodRegistry;
-    RemoteNotificationInterface* _rpc;
 
     VPNConnection* _connection;
 
@@ -547,6 +654,17 @@ protected:
     ApiClient _apiClient;
 
     LatencyTracker _modernLatencyTracker;
+    // All locations last built from the regions list, including those that
+    // are excluded from StateModel::availableLocations.  New latency
+    // measurements are applied to these without rebuilding the locations.
+    LocationsById _allLocations;
+    // IDs of locations whose latency measurements indicate they're unreliable
+    // (see isUnreliableLatency()).  Automatic location selection avoids these
+    // if possible.  Pruned to the current locations by applyBuiltLocations().
+    std::unordered_set<QString> _unreliableLocations;
+    // Snapshot of the regions built from the cached regions lists; see
+    // rebuildModernLocations()
+    RegionsSnapshotFile _regionsSnapshot;
     PortForwarder _portForwarder;
     JsonRefresher _modernRegionRefresher, _modernRegionMetaRefresher,
                   _shadowsocksRefresher, _publicIpRefresher;
@@ -561,11 +679,45 @@ protected:
     QSet<QString> _dataChanges;
     QSet<QString> _accountChanges;
     QSet<QString> _settingsChanges;
-    std::unordered_set<std::string> _stateChanges;
+    StateModel::PropertySet _stateChanges;
+    // Information about each state property, by index
+    struct StatePropertyInfo
+    {
+        // Notification priority for changes in this property
+        NotificationScheduler::Priority priority;
+        // Whether the client JSON for this property is cached
+        bool cacheJson;
+        // If cacheJson is set, the cached client JSON, or Undefined if the
+        // property has changed since it was last converted.  Mutable since
+        // this is filled in lazily by statePropertyJson().
+        mutable QJsonValue cachedJson;
+        // If cacheJson is set, the cached JSON text; valid if textCached is
+        // set.  Filled in lazily by statePropertyText().
+        mutable std::string cachedText;
+        mutable bool textCached;
+    };
+    std::vector<StatePropertyInfo> _statePropertyInfo;
+    // The last value sent to clients for each state property that is sent as
+    // a JSON patch.  These are only kept while at least one client is using
+    // state patches.
+    std::unordered_map<std::string, clientjson::json> _stateBroadcastValues;
+    // Incremented whenever any property in _data, _account, _settings, or
+    // _state changes.
+    quint64 _dataGeneration{0};
+    // The complete data last sent to a new client, serialized, and the
+    // _dataGeneration it was built at.  New clients share this as long as
+    // nothing has changed.  This is always JSON, since new clients haven't
+    // selected an encoding yet.
+    QByteArray _clientDataMsg;
+    quint64 _clientDataMsgGeneration{0};
 
     unsigned int _pendingSerializations;
     QTimer _serializationTimer;
 
+    // Schedules notifyChanges() when properties change.  Frequent changes in
+    // some state properties are coalesced.
+    NotificationScheduler _notifyScheduler;
+
     QTimer _accountRefreshTimer;
     QTimer _dedicatedIpRefreshTimer;
 
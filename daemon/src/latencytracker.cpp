@@ -31,12 +31,52 @@
 
 namespace
 {
+    // Locations are measured at least this often while their latency is
+    // changing, and always if they're a priority location.  Stable locations
+    // back off up to the maximum interval.
     const std::chrono::minutes latencyRefreshInterval{1};
+    const std::chrono::minutes latencyMaxRefreshInterval{16};
     const std::chrono::seconds latencyEchoTimeout{10};
     const std::chrono::milliseconds latencyBatchInterval{100};
 
-    //The number of measurements that LatencyHistory stores
-    const int measurementHistoryCount{5};
+#if !defined(Q_OS_WIN)
+    // PosixIcmpBatchPinger sweeps all servers from one socket.  Each server
+    // gets sweepProbeCount probes, sent in rounds.  Within a round, probes are
+    // sent in bursts of sweepBurstSize every sweepPacingInterval, with
+    // sweepRoundInterval between rounds, so they aren't sent in one burst.
+    const std::size_t sweepProbeCount{3};
+    const std::size_t sweepBurstSize{32};
+    const std::chrono::milliseconds sweepPacingInterval{5};
+    const std::chrono::milliseconds sweepRoundInterval{50};
+    // Replies received within this time after the last probe is sent are
+    // aggregated.  After that, a server that hasn't replied yet reports the
+    // first reply to any probe (until the echo timeout).
+    const std::chrono::milliseconds sweepReplyWindow{1000};
+#endif
+
+    //LatencyHistory ignores the highest and lowest measurements once it has at
+    //least this many
+    const std::size_t trimmedMeasurementCount{3};
+    //The jitter moving average moves 1/jitterGainDivisor of the way toward
+    //each new difference (the same gain RTP uses, RFC 3550 6.4.1)
+    const int jitterGainDivisor{16};
+    //LatencyHistory considers the latency stable once it has at least this
+    //many measurements, and they all fall within a range of the larger of
+    //stableSpreadMinimum or 1/stableSpreadDivisor of the latency.
+    const std::size_t stableMeasurementCount{3};
+    const std::chrono::milliseconds stableSpreadMinimum{10};
+    const int stableSpreadDivisor{5};
+
+    //Locations within this factor of the best latency are measured at the base
+    //refresh interval, since they're candidates for automatic selection.
+    const int nearBestLatencyFactor{2};
+
+    //Locations are unreliable if they lose more than this fraction of pings,
+    //or if their jitter exceeds both unreliableJitterMinimum and
+    //1/unreliableJitterDivisor of the latency.
+    const double unreliableLossThreshold{0.2};
+    const std::chrono::milliseconds unreliableJitterMinimum{20};
+    const int unreliableJitterDivisor{4};
 
     RegisterMetaType<std::chrono::milliseconds> rxChronoMilliseconds;
     RegisterMetaType<LatencyTracker::Latencies> rxLatencies;
@@ -100,7 +140,13 @@ namespace
     }
 
 #else
-    // Implementation of BatchPinger using ICMP echoes via raw sockets using PosixPing
+    // Implementation of BatchPinger using ICMP echoes via raw sockets using
+    // PosixPing.
+    //
+    // This sweeps all servers from one socket (see sweepProbeCount, etc.).
+    // Round-trip times come from PosixPing, which uses kernel receive
+    // timestamps, and the probes for each server are aggregated to the median
+    // to reduce the effect of a single delayed or lost echo.
     class PosixIcmpBatchPinger : public BatchPinger
     {
         Q_OBJECT
@@ -108,82 +154,364 @@ namespace
 
     public:
         // Create PosixIcmpBatchPinger with the locations to be pinged.
-        // PosixIcmpBatchPinger will insert all locations that were successfully
-        // pinged into pendingReplies (values are the location IDs).  Ports are
+        // PosixIcmpBatchPinger will insert all locations that will be pinged
+        // into pendingReplies (values are the location IDs).  Ports are
         // always 0 for PosixIcmpBatchPinger since it uses ICMP.
         PosixIcmpBatchPinger(const std::vector<QSharedPointer<const Location>> &locations,
                              PendingRepliesMap &pendingReplies);
 
+    private:
+        // Send the next burst of probes, and schedule the next burst or the
+        // end of the reply window
+        void sendProbes();
+        void onRoundTrip(quint32 address, std::chrono::microseconds roundTrip);
+        void onReplyWindowElapsed();
+
     private:
         PosixPing _ping;
+        // The distinct server addresses being pinged
+        std::vector<quint32> _servers;
+        // Index of the next probe to send - probe N goes to
+        // _servers[N % _servers.size()] in round N / _servers.size()
+        std::size_t _nextProbe;
+        QTimer _pacingTimer;
+        SweepAggregator _aggregator;
     };
 
     PosixIcmpBatchPinger::PosixIcmpBatchPinger(const std::vector<QSharedPointer<const Location>> &locations,
                                                PendingRepliesMap &pendingReplies)
+        : _nextProbe{0}, _aggregator{sweepProbeCount}
     {
-        //Ping each location.
+        _servers.reserve(locations.size());
         for(const auto &pLocation : locations)
         {
             quint32 echoAddr = selectIcmpPingAddress(pLocation);
-            if(echoAddr && _ping.sendEchoRequest(echoAddr))
-            {
-                // Pinged this location, put it in the pending replies.
-                pendingReplies[HostPortKey{QHostAddress{echoAddr}, 0}] = pLocation->id();
-            }
+            if(!echoAddr)
+                continue;
+            auto &pendingId = pendingReplies[HostPortKey{QHostAddress{echoAddr}, 0}];
+            // Two locations could select the same server; it's only pinged
+            // once
+            if(pendingId.isEmpty())
+                _servers.push_back(echoAddr);
+            pendingId = pLocation->id();
         }
 
-        connect(&_ping, &PosixPing::receivedReply, this,
-                [this](quint32 addr)
-                {
-                    receivedResponse(QHostAddress{addr}, 0);
-                });
+        connect(&_ping, &PosixPing::receivedRoundTrip, this,
+                &PosixIcmpBatchPinger::onRoundTrip);
+        _pacingTimer.setSingleShot(true);
+        connect(&_pacingTimer, &QTimer::timeout, this,
+                &PosixIcmpBatchPinger::sendProbes);
+
+        if(!_servers.empty())
+            sendProbes();
+    }
+
+    void PosixIcmpBatchPinger::sendProbes()
+    {
+        std::size_t serverIdx = _nextProbe % _servers.size();
+        std::size_t count = std::min(sweepBurstSize, _servers.size() - serverIdx);
+        std::vector<quint32> burst(_servers.begin() + serverIdx,
+                                   _servers.begin() + serverIdx + count);
+        std::size_t sent = _ping.sendEchoRequests(burst);
+        if(sent < count)
+        {
+            qWarning() << "Sent" << sent << "of" << count
+                << "latency probes in round" << (_nextProbe / _servers.size());
+        }
+        _nextProbe += count;
+
+        if(_nextProbe >= _servers.size() * sweepProbeCount)
+        {
+            QTimer::singleShot(msec32(sweepReplyWindow), this,
+                               &PosixIcmpBatchPinger::onReplyWindowElapsed);
+        }
+        else
+        {
+            // Leave more time between rounds so each server's probes are
+            // spread out
+            bool endOfRound = _nextProbe % _servers.size() == 0;
+            _pacingTimer.start(msec32(endOfRound ? sweepRoundInterval : sweepPacingInterval));
+        }
+    }
+
+    void PosixIcmpBatchPinger::onRoundTrip(quint32 address,
+                                           std::chrono::microseconds roundTrip)
+    {
+        auto aggregated = _aggregator.addRoundTrip(address, roundTrip);
+        if(aggregated)
+            emit receivedRoundTrip(QHostAddress{address}, 0, aggregated.get());
+    }
+
+    void PosixIcmpBatchPinger::onReplyWindowElapsed()
+    {
+        for(const auto &report : _aggregator.endReplyWindow())
+            emit receivedRoundTrip(QHostAddress{report.first}, 0, report.second);
     }
 
 #endif
 }
 
+LatencyHistory::LatencyHistory()
+    : _measurements{}, _next{0}, _count{0}, _jitter{0}, _lostPings{0}
+{
+}
+
 std::chrono::milliseconds LatencyHistory::updateLatency(std::chrono::milliseconds newMeasurement)
 {
-    //If we already have the maximum number of entries, discard the oldest one.
-    if(_lastMeasurements.size() >= measurementHistoryCount)
+    //Update the jitter with the difference from the last measurement.
+    if(_count > 0)
     {
-        _lastMeasurements.pop_front();
+        const auto &lastMeasurement = _measurements[(_next + MeasurementCount - 1) % MeasurementCount];
+        std::chrono::microseconds difference{newMeasurement - lastMeasurement};
+        if(difference.count() < 0)
+            difference = -difference;
+        _jitter += (difference - _jitter) / jitterGainDivisor;
     }
 
-    //Store the new one.
-    _lastMeasurements.push_back(newMeasurement);
+    //Store the new one.  If we already have the maximum number of entries, this
+    //overwrites the oldest one.
+    _measurements[_next] = newMeasurement;
+    _next = (_next + 1) % MeasurementCount;
+    if(_count < MeasurementCount)
+        ++_count;
+
+    //This ping was answered
+    _lostPings <<= 1;
+
+    return latency();
+}
+
+void LatencyHistory::addLoss()
+{
+    _lostPings = static_cast<quint16>((_lostPings << 1) | 1);
+}
 
-    //Compute the average latency over these measurements.
-    //An average is probably the best way to aggregate these (as opposed to min/
-    //max/etc.), because it'll reduce the effect of anomalous measurements at
-    //either end of the spectrum.
-    std::chrono::milliseconds sum = std::accumulate(_lastMeasurements.begin(),
-                                                    _lastMeasurements.end(),
+std::chrono::milliseconds LatencyHistory::latency() const
+{
+    Q_ASSERT(!empty());
+    //Compute the average latency over these measurements, ignoring the
+    //highest and lowest once there are enough.  A single anomalous measurement
+    //at either end of the spectrum then has no effect, and a few have a
+    //reduced effect.  (The order of the measurements doesn't matter, so the
+    //first _count entries of the ring are used no matter where it starts.)
+    auto begin = _measurements.begin();
+    auto end = begin + _count;
+    std::chrono::milliseconds sum = std::accumulate(begin, end,
                                                     std::chrono::milliseconds{0});
+    if(_count < trimmedMeasurementCount)
+        return sum / static_cast<int>(_count);
+
+    auto range = std::minmax_element(begin, end);
+    sum -= *range.first + *range.second;
+    return sum / static_cast<int>(_count - 2);
+}
+
+std::chrono::milliseconds LatencyHistory::jitter() const
+{
+    return std::chrono::round<std::chrono::milliseconds>(_jitter);
+}
+
+double LatencyHistory::loss() const
+{
+    int lostCount{0};
+    for(quint16 lostPings = _lostPings; lostPings; lostPings &= lostPings - 1)
+        ++lostCount;
+    return static_cast<double>(lostCount) / LossPingCount;
+}
+
+bool LatencyHistory::stable() const
+{
+    if(_count < stableMeasurementCount)
+        return false;
+
+    auto range = std::minmax_element(_measurements.begin(),
+                                     _measurements.begin() + _count);
+    std::chrono::milliseconds spread = *range.second - *range.first;
+    return spread <= std::max(stableSpreadMinimum, latency() / stableSpreadDivisor);
+}
 
-    return sum / _lastMeasurements.size();
+std::chrono::milliseconds nextLatencyInterval(std::chrono::milliseconds interval,
+                                              const LatencyHistory &history)
+{
+    if(!history.stable())
+        return latencyRefreshInterval;
+    return std::min<std::chrono::milliseconds>(interval * 2,
+                                               latencyMaxRefreshInterval);
+}
+
+bool isUnreliableLatency(const LatencyTracker::Measurement &measurement)
+{
+    if(measurement.loss > unreliableLossThreshold)
+        return true;
+    return measurement.jitter > unreliableJitterMinimum &&
+        measurement.jitter > measurement.latency / unreliableJitterDivisor;
+}
+
+SweepAggregator::SweepAggregator(std::size_t probeCount)
+    : _probeCount{probeCount}, _replyWindowElapsed{false}
+{
+}
+
+nullable_t<std::chrono::milliseconds> SweepAggregator::addRoundTrip(quint32 address,
+                                                                    std::chrono::microseconds roundTrip)
+{
+    if(_reported.count(address))
+        return {};
+
+    auto &samples = _samples[address];
+    samples.push_back(roundTrip);
+    // Report now if all probes have been answered, or if the reply window is
+    // over (just use the first reply in that case)
+    if(!_replyWindowElapsed && samples.size() < _probeCount)
+        return {};
+
+    auto median = medianRoundTrip(std::move(samples));
+    _samples.erase(address);
+    _reported.insert(address);
+    return median;
+}
+
+std::vector<SweepAggregator::Report> SweepAggregator::endReplyWindow()
+{
+    _replyWindowElapsed = true;
+    // Report servers that replied to at least one probe.  Servers that haven't
+    // replied at all can still report a late reply.
+    std::vector<Report> reports;
+    reports.reserve(_samples.size());
+    for(auto &serverSamples : _samples)
+    {
+        reports.push_back({serverSamples.first, medianRoundTrip(std::move(serverSamples.second))});
+        _reported.insert(serverSamples.first);
+    }
+    _samples.clear();
+    return reports;
+}
+
+std::chrono::milliseconds medianRoundTrip(std::vector<std::chrono::microseconds> samples)
+{
+    Q_ASSERT(!samples.empty());
+    std::sort(samples.begin(), samples.end());
+    std::size_t middle = samples.size() / 2;
+    std::chrono::microseconds median = samples[middle];
+    if(samples.size() % 2 == 0)
+        median = (samples[middle - 1] + samples[middle]) / 2;
+    return std::chrono::round<std::chrono::milliseconds>(median);
 }
 
 LatencyTracker::LatencyTracker()
+    : _enabled{false}
 {
-    _measureTrigger.setInterval(std::chrono::milliseconds(latencyRefreshInterval).count());
+    _measureTrigger.setSingleShot(true);
     connect(&_measureTrigger, &QTimer::timeout, this,
             &LatencyTracker::onMeasureTrigger);
 }
 
+bool LatencyTracker::isPriority(const QString &id, const LocationData &location,
+                                std::chrono::milliseconds bestLatency) const
+{
+    if(_priorityLocations.count(id))
+        return true;
+    return !location.latency.empty() &&
+        location.latency.latency() <= bestLatency * nearBestLatencyFactor;
+}
+
+std::chrono::milliseconds LatencyTracker::bestLatency() const
+{
+    std::chrono::milliseconds best{0};
+    bool found{false};
+    for(const auto &locationEntry : _locations)
+    {
+        const LatencyHistory &history = locationEntry.second.latency;
+        if(!history.empty() && (!found || history.latency() < best))
+        {
+            best = history.latency();
+            found = true;
+        }
+    }
+    return best;
+}
+
+std::chrono::steady_clock::time_point LatencyTracker::measurementDue(const QString &id,
+    const LocationData &location, std::chrono::milliseconds bestLatency) const
+{
+    if(!location.replied || isPriority(id, location, bestLatency))
+        return location.lastPing + latencyRefreshInterval;
+    return location.lastPing + location.interval;
+}
+
+void LatencyTracker::scheduleMeasurement()
+{
+    if(!_enabled)
+        return;
+
+    std::chrono::milliseconds best{bestLatency()};
+    bool anyScheduled{false};
+    std::chrono::steady_clock::time_point nextDue;
+    for(const auto &locationEntry : _locations)
+    {
+        const LocationData &location = locationEntry.second;
+        // Locations not yet attempted are measured by measureNewLocations()
+        if(!location.pingAttempted)
+            continue;
+        auto due = measurementDue(locationEntry.first, location, best);
+        if(!anyScheduled || due < nextDue)
+        {
+            nextDue = due;
+            anyScheduled = true;
+        }
+    }
+
+    if(!anyScheduled)
+    {
+        _measureTrigger.stop();
+        return;
+    }
+
+    auto delay = std::chrono::duration_cast<std::chrono::milliseconds>(
+        nextDue - std::chrono::steady_clock::now());
+    _measureTrigger.start(msec32(std::max(delay, std::chrono::milliseconds{0})));
+}
+
 void LatencyTracker::onMeasureTrigger()
 {
-    //Measure all known addresses (if there are any)
-    //This vector of PingLocations could in principle be built with _locations
-    //and stored, but it shouldn't be a significant cost to just build it here.
+    //Measure the locations that are due (see measurementDue()).
+    auto now = std::chrono::steady_clock::now();
+    std::chrono::milliseconds best{bestLatency()};
     std::vector<QSharedPointer<const Location>> measureLocations;
-    measureLocations.reserve(_locations.size());
-    for(auto itLocation = _locations.begin(); itLocation != _locations.end();
-        ++itLocation)
+    Latencies lossMeasurements;
+    for(auto &locationEntry : _locations)
     {
-        measureLocations.push_back(itLocation->second.pLocation);
+        LocationData &location = locationEntry.second;
+        if(!location.pingAttempted)
+            continue;
+
+        if(measurementDue(locationEntry.first, location, best) <= now)
+        {
+            // The last ping timed out long ago if it wasn't answered, count it
+            // as lost and return to the base interval.  Report the new loss
+            // rate if the location has been measured, so it's taken into
+            // account even if the location stops replying entirely.
+            if(!location.replied)
+            {
+                location.interval = latencyRefreshInterval;
+                location.latency.addLoss();
+                if(!location.latency.empty())
+                {
+                    lossMeasurements.push_back({locationEntry.first,
+                                                location.latency.latency(),
+                                                location.latency.jitter(),
+                                                location.latency.loss()});
+                }
+            }
+            location.lastPing = now;
+            location.replied = false;
+            measureLocations.push_back(location.pLocation);
+        }
     }
     beginMeasurement(measureLocations);
+    scheduleMeasurement();
+    if(!lossMeasurements.empty())
+        emit newMeasurements(lossMeasurements);
 }
 
 void LatencyTracker::onNewMeasurements(const Latencies &measurements)
@@ -193,25 +521,37 @@ void LatencyTracker::onNewMeasurements(const Latencies &measurements)
     for(const auto &measurement : measurements)
     {
         // Find this location
-        auto itLocation = _locations.find(measurement.first);
+        auto itLocation = _locations.find(measurement.locationId);
         // If it was found, store it and get the new aggregated value.  If it's
         // no longer present, there's nothing to do.
         if(itLocation != _locations.end())
         {
             // Store the new latency measurement, and get the current aggregate
             // value.
-            auto aggregateLatency = itLocation->second.latency.updateLatency(measurement.second);
-            aggregatedMeasurements.push_back({measurement.first, aggregateLatency});
+            LocationData &location = itLocation->second;
+            auto aggregateLatency = location.latency.updateLatency(measurement.latency);
+            aggregatedMeasurements.push_back({measurement.locationId,
+                                              aggregateLatency,
+                                              location.latency.jitter(),
+                                              location.latency.loss()});
+            location.replied = true;
+            location.interval = nextLatencyInterval(location.interval,
+                                                    location.latency);
         }
     }
 
     if(!aggregatedMeasurements.empty())
+    {
+        // The intervals and best latency may have changed
+        scheduleMeasurement();
         emit newMeasurements(aggregatedMeasurements);
+    }
 }
 
 void LatencyTracker::measureNewLocations()
 {
     std::vector<QSharedPointer<const Location>> newLocations;
+    auto now = std::chrono::steady_clock::now();
 
     for(auto &locationEntry : _locations)
     {
@@ -219,6 +559,8 @@ void LatencyTracker::measureNewLocations()
         if(!locationEntry.second.pingAttempted)
         {
             locationEntry.second.pingAttempted = true;
+            locationEntry.second.lastPing = now;
+            locationEntry.second.replied = false;
             newLocations.push_back(locationEntry.second.pLocation);
         }
     }
@@ -240,9 +582,9 @@ void LatencyTracker::beginMeasurement(const std::vector<QSharedPointer<const Loc
         //
         // This is a blocking call over to the worker thread, but we don't do
         // any long-running operations on the worker thread, so this is fine.
-        // Latency batches also time out before another batch would be
-        // scheduled, so there shouldn't be any activity at all on the worker
-        // thread when this is called.
+        // Earlier batches may still be waiting for replies (locations come due
+        // at different times, and new locations are measured immediately), but
+        // they only handle replies and timers, so this doesn't wait long.
         _measurementThread.invokeOnThread([&]()
         {
             //Create a LatencyBatch; parent it to this object so it is cleaned up if
@@ -271,37 +613,52 @@ void LatencyTracker::updateLocations(const LocationsById &serverLocations)
         // Create the location.  No pings have been attempted yet if we don't
         // find this location in oldLocations
         auto &newLocation = _locations[idQstr];
-        newLocation = {location.second, {}, false};
+        newLocation = {location.second, {}, false, {},
+                       latencyRefreshInterval, false};
 
         // Did we have this location before?
         auto itOldLocation = oldLocations.find(idQstr);
         if(itOldLocation != oldLocations.end())
         {
-            //It existed, so preserve its latency measurements
+            //It existed, so preserve its latency measurements and schedule
             newLocation.latency = std::move(itOldLocation->second.latency);
-            //Preserve pingAttempted
             newLocation.pingAttempted = itOldLocation->second.pingAttempted;
+            newLocation.lastPing = itOldLocation->second.lastPing;
+            newLocation.interval = itOldLocation->second.interval;
+            newLocation.replied = itOldLocation->second.replied;
         }
     }
 
     //If measurements are enabled, trigger a new measurement for the new
     //locations.  Otherwise, leave them in _locations to be attempted later.
-    if(_measureTrigger.isActive())
+    if(_enabled)
+    {
         measureNewLocations();
+        scheduleMeasurement();
+    }
+}
+
+void LatencyTracker::setPriorityLocations(std::unordered_set<QString> locationIds)
+{
+    _priorityLocations = std::move(locationIds);
+    // Priority locations may be due sooner now
+    scheduleMeasurement();
 }
 
 void LatencyTracker::start()
 {
-    if(!_measureTrigger.isActive())
+    if(!_enabled)
     {
-        _measureTrigger.start();
+        _enabled = true;
         //Trigger measurements for anything that hasn't been measured yet
         measureNewLocations();
+        scheduleMeasurement();
     }
 }
 
 void LatencyTracker::stop()
 {
+    _enabled = false;
     _measureTrigger.stop();
 }
 
@@ -325,6 +682,8 @@ LatencyBatch::LatencyBatch(const std::vector<QSharedPointer<const Location>> &lo
 
     connect(_pPinger.get(), &BatchPinger::receivedResponse, this,
             &LatencyBatch::onReceivedResponse);
+    connect(_pPinger.get(), &BatchPinger::receivedRoundTrip, this,
+            &LatencyBatch::onReceivedRoundTrip);
 
     if(_pendingReplies.size() >= 1)
     {
@@ -355,7 +714,12 @@ void LatencyBatch::onReceivedResponse(const QHostAddress &address, quint16 port)
 {
     // Get the roundtrip latency measurement.
     std::chrono::milliseconds roundtripLatency{_timeSincePing.elapsed()};
+    onReceivedRoundTrip(address, port, roundtripLatency);
+}
 
+void LatencyBatch::onReceivedRoundTrip(const QHostAddress &address, quint16 port,
+                                       std::chrono::milliseconds roundtripLatency)
+{
     //Look up this host in the pending replies.  Look for any possible
     //equivalent address - for example, an IPv4 address could now be represented
     //as an IPv4-mapped IPv6 address.
@@ -377,7 +741,7 @@ void LatencyBatch::onReceivedResponse(const QHostAddress &address, quint16 port)
 
     // Store a measurement for this host
     _batchedMeasurements.push_back({itHostPendingReply->second,
-                                    roundtripLatency});
+                                    roundtripLatency, {}, 0.0});
 
     //This host has been measured, so remove it from _pendingReplies
     _pendingReplies.erase(itHostPendingReply);
@@ -26,7 +26,9 @@
 #include <QHostAddress>
 #include <QTimer>
 #include <QUdpSocket>
+#include <array>
 #include <chrono>
+#include <unordered_set>
 
 namespace std
 {
@@ -57,22 +59,65 @@ using PendingRepliesMap = std::unordered_map<HostPortKey, QString, HashPair>;
 //LatencyHistory queues up latency measurements for a particular remote host.
 //As measurements are taken, they're queued up in LatencyHistory, which
 //computes a latency value based on those measurements.
+//
+//LatencyHistory also tracks the jitter of the measurements and the loss rate of
+//recent pings, so flaky locations can be identified even if their latency is
+//low.
 class LatencyHistory
 {
     CLASS_LOGGING_CATEGORY("latency");
 
+public:
+    //The number of measurements stored, and the number of recent pings used to
+    //compute the loss rate
+    enum : std::size_t
+    {
+        MeasurementCount = 5,
+        LossPingCount = 16,
+    };
+
+public:
+    LatencyHistory();
+
 public:
     //Add a new measurement and calculate the current latency based on all
-    //recent measurements.
+    //recent measurements.  This also counts a ping that was answered for the
+    //loss rate.
     std::chrono::milliseconds updateLatency(std::chrono::milliseconds newMeasurement);
+    //Count a ping that was not answered for the loss rate.
+    void addLoss();
+
+    //Whether any measurements have been taken
+    bool empty() const {return _count == 0;}
+    //The current latency based on all recent measurements (the value last
+    //returned by updateLatency()).  This is a trimmed mean - once there are
+    //enough measurements, the highest and lowest are ignored so a single
+    //outlier has little effect.  Only valid if !empty().
+    std::chrono::milliseconds latency() const;
+    //The jitter - a moving average of the difference between consecutive
+    //measurements (zero until at least two measurements are taken).
+    std::chrono::milliseconds jitter() const;
+    //The fraction of the last LossPingCount pings that weren't answered, from
+    //0 to 1.  Until that many pings have been sent, the remaining pings are
+    //assumed to have been answered.
+    double loss() const;
+    //Whether the recent measurements agree closely enough that the latency is
+    //unlikely to change soon.  This requires a few measurements; the location
+    //can be measured less often while it's stable.
+    bool stable() const;
 
 private:
-    //The last few measurements are stored here.  Qt doesn't have a deque,
-    //which would probably be ideal, but a QList should be OK.  It'll still have
-    //to copy the entire array when we run out of space in the back of its
-    //buffer, but it'll probably do better than a vector since it won't have to
-    //do it every time we delete something from the front.
-    QList<std::chrono::milliseconds> _lastMeasurements;
+    //The last few measurements are stored in this fixed-size ring buffer.
+    //_next is the position of the next measurement; the oldest measurement is
+    //overwritten once _count reaches MeasurementCount.
+    std::array<std::chrono::milliseconds, MeasurementCount> _measurements;
+    std::size_t _next, _count;
+    //Jitter moving average, in microseconds to avoid accumulating rounding
+    //errors
+    std::chrono::microseconds _jitter;
+    //Outcomes of the last LossPingCount pings - the low bit is the most recent
+    //ping, and set bits are pings that weren't answered.
+    quint16 _lostPings;
 };
 
 //LatencyTracker takes measurements of the latency to each location's "ping"
@@ -100,11 +145,31 @@ private:
         //Locations can sit in _locations without having been attempted if
         //measurements are not enabled.
         bool pingAttempted;
+        //When the location was last pinged (valid once pingAttempted is set)
+        std::chrono::steady_clock::time_point lastPing;
+        //Interval before the location is pinged again, unless it's a priority
+        //location or its last ping wasn't answered; see nextLatencyInterval()
+        //and measurementDue().
+        std::chrono::milliseconds interval;
+        //Whether the last ping was answered
+        bool replied;
     };
 
 public:
-    // Group of latency measurements - location IDs and latency values.
-    using Latencies = std::vector<QPair<QString, std::chrono::milliseconds>>;
+    // Latency measurement for one location.  LatencyBatch only provides the
+    // location ID and measured latency; LatencyTracker fills in the jitter and
+    // loss when it aggregates the measurements.
+    struct Measurement
+    {
+        QString locationId;
+        std::chrono::milliseconds latency;
+        std::chrono::milliseconds jitter;
+        // Fraction of recent pings that weren't answered, see
+        // LatencyHistory::loss()
+        double loss;
+    };
+    // Group of latency measurements
+    using Latencies = std::vector<Measurement>;
 
 public:
     // LatencyTracker begins with measurements stopped - call start() to enable
@@ -128,6 +193,24 @@ private:
     //attempted yet
     void measureNewLocations();
 
+    //Start _measureTrigger for the next time a location is due to be measured
+    void scheduleMeasurement();
+
+    //Whether a location is measured at the base refresh interval regardless of
+    //its stability - priority locations from setPriorityLocations(), and
+    //locations whose latency is near bestLatency
+    bool isPriority(const QString &id, const LocationData &location,
+                    std::chrono::milliseconds bestLatency) const;
+    //Get the lowest latency currently known for any location (or zero if none
+    //are known)
+    std::chrono::milliseconds bestLatency() const;
+    //When a location that has been attempted is next due to be measured.
+    //Priority locations and locations whose last ping wasn't answered are
+    //measured at the base refresh interval; others use their backoff interval.
+    std::chrono::steady_clock::time_point measurementDue(const QString &id,
+                                                         const LocationData &location,
+                                                         std::chrono::milliseconds bestLatency) const;
+
     //Begin a new measurement for a group of locations
     void beginMeasurement(const std::vector<QSharedPointer<const Location>> &locations);
 
@@ -139,6 +222,12 @@ public:
     //measured whenever measurements are re-enabled.
     void updateLocations(const LocationsById &serverLocations);
 
+    //Set the locations that are measured at the base refresh interval, even if
+    //their latency is stable.  Daemon passes the user's chosen and favorite
+    //locations and the current best locations, since these are the most
+    //likely to be used.  IDs of unknown locations are ignored.
+    void setPriorityLocations(std::unordered_set<QString> locationIds);
+
     //Enable latency measurements.
     //
     //If they were already enabled, this has no effect.  If they weren't
@@ -156,10 +245,13 @@ public:
 private:
     // Measurement batches are executed on this thread.
     RunningWorkerThread _measurementThread;
-    //This QTimer triggers when we need to refresh the measurements for all
-    //servers.  This timer is running if and only if measurements have been
-    //started.
+    //Whether measurements have been started
+    bool _enabled;
+    //This single-shot QTimer triggers when the next location is due to be
+    //measured.  It only runs when measurements have been started.
     QTimer _measureTrigger;
+    //Priority locations from setPriorityLocations()
+    std::unordered_set<QString> _priorityLocations;
     //All locations received from the last call to updateLocations() are
     //held here.  The rest of the location list isn't stored; we only keep track
     //of the distinct addresses that are pinged.
@@ -171,6 +263,53 @@ private:
     std::unordered_map<QString, LocationData> _locations;
 };
 
+//Calculate the interval before a (non-priority) location is measured again
+//after a reply is received.  While the location's latency is stable, the
+//interval doubles up to a maximum; otherwise it returns to the base refresh
+//interval.
+std::chrono::milliseconds nextLatencyInterval(std::chrono::milliseconds interval,
+                                              const LatencyHistory &history);
+
+//Whether a location's measurements indicate that it's unreliable - it's losing
+//too many pings, or its jitter is high relative to its latency.  Automatic
+//location selection avoids unreliable locations if possible.
+bool isUnreliableLatency(const LatencyTracker::Measurement &measurement);
+
+//Aggregates the round-trip times of the probes sent to each server in one ICMP
+//sweep (see PosixIcmpBatchPinger).  Each server is reported once - with the
+//median of its probes once they've all been answered or the reply window has
+//ended, or with the first reply after the reply window if it hadn't replied by
+//then.  Replies after a server has been reported are ignored.
+class SweepAggregator
+{
+public:
+    using Report = std::pair<quint32, std::chrono::milliseconds>;
+
+public:
+    explicit SweepAggregator(std::size_t probeCount);
+
+public:
+    //Add a round-trip time received from a server.  Returns the server's
+    //aggregated round-trip time if it's ready to be reported now.
+    nullable_t<std::chrono::milliseconds> addRoundTrip(quint32 address,
+                                                       std::chrono::microseconds roundTrip);
+    //End the reply window.  Returns the servers that have replied to at least
+    //one probe but haven't been reported yet.
+    std::vector<Report> endReplyWindow();
+
+private:
+    std::size_t _probeCount;
+    bool _replyWindowElapsed;
+    //Round-trip times received for servers that haven't been reported
+    std::unordered_map<quint32, std::vector<std::chrono::microseconds>> _samples;
+    //Servers that have been reported
+    std::unordered_set<quint32> _reported;
+};
+
+//The median of some round-trip times (the mean of the middle two if there's an
+//even number), rounded to milliseconds.  There must be at least one.
+std::chrono::milliseconds medianRoundTrip(std::vector<std::chrono::microseconds> samples);
+
 Q_DECLARE_METATYPE(std::chrono::milliseconds);
 Q_DECLARE_METATYPE(LatencyTracker::Latencies);
 
@@ -195,6 +334,12 @@ signals:
     // hosts that weren't pinged in this batch; the receiver of this signal
     // should ignore these.
     void receivedResponse(const QHostAddress &address, quint16 port);
+    // A server has responded, and the pinger measured the round-trip time
+    // itself.  This is used instead of receivedResponse() when the pinger can
+    // measure more accurately than LatencyBatch (which measures the time until
+    // the reply is processed).
+    void receivedRoundTrip(const QHostAddress &address, quint16 port,
+                           std::chrono::milliseconds roundTrip);
 };
 
 // LatencyBatch represents one batch of latency measurements.
@@ -236,6 +381,8 @@ private:
 
 private:
     void onReceivedResponse(const QHostAddress &address, quint16 port);
+    void onReceivedRoundTrip(const QHostAddress &address, quint16 port,
+                             std::chrono::milliseconds roundtripLatency);
     void onTimeoutElapsed();
     // The batch timer has elapsed, process the batched measurements
     void onBatchElapsed();
@@ -15,3 +15,45 @@
 // You should have received a copy of the GNU General Public License
 // along with the Private Internet Access Desktop Client.  If not, see
 // <https://www.gnu.org/licenses/>.
+
+#include <common/src/common.h>
+#include "clientjson.h"
+#include <algorithm>
+
+namespace clientjson
+{
+
+json buildArrayAppendPatch(const json &oldValue, const json &newValue)
+{
+    if(!oldValue.is_array() || !newValue.is_array() || oldValue.empty())
+        return nullptr;
+
+    // Find the number of elements removed from the front.  Prefer the
+    // smallest shift that works.
+    std::size_t removed = 0;
+    for(; removed <= oldValue.size(); ++removed)
+    {
+        std::size_t kept = oldValue.size() - removed;
+        if(kept > newValue.size())
+            continue;
+        if(std::equal(oldValue.begin() + removed, oldValue.end(),
+                      newValue.begin()))
+        {
+            break;
+        }
+    }
+    // Everything was removed - not a meaningful append; the regular diff
+    // handles this.
+    if(removed >= oldValue.size())
+        return nullptr;
+
+    json patch = json::array();
+    for(std::size_t i=0; i<removed; ++i)
+        patch.push_back({{"op", "remove"}, {"path", "/0"}});
+    std::size_t kept = oldValue.size() - removed;
+    for(auto itAdded = newValue.begin() + kept; itAdded != newValue.end(); ++itAdded)
+        patch.push_back({{"op", "add"}, {"path", "/-"}, {"value", *itAdded}});
+    return patch;
+}
+
+}
@@ -214,4 +214,12 @@ struct serializer<kapps::regions::Metadata>
     }
 };
 
+// If newValue is an array formed by removing elements from the front of
+// oldValue and appending elements to the end (like a sliding window of
+// measurements), build a JSON patch of just those removals and additions.  A
+// regular diff would replace every element, since all of them move.
+//
+// Returns null if the values aren't related this way.
+json buildArrayAppendPatch(const json &oldValue, const json &newValue);
+
 }
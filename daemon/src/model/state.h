@@ -26,6 +26,7 @@
 #include <common/src/settings/connection.h>
 #include <common/src/settings/automation.h>
 #include <nlohmann/json.hpp>
+#include <array>
 
 // Information about the current ongoing connection and the last successful
 // connection.  See DaemonState::connectingConfig and connectedConfig.
@@ -145,6 +146,98 @@ namespace clientjson
     };
 }
 
+// Bandwidth measurements for one measurement interval, in bytes
+struct IntervalBandwidth
+{
+    quint64 received;
+    quint64 sent;
+
+    bool operator==(const IntervalBandwidth &other) const
+    {
+        return received == other.received && sent == other.sent;
+    }
+    bool operator!=(const IntervalBandwidth &other) const {return !(*this == other);}
+
+    static auto jsonFields()
+    {
+        return std::make_tuple(jsonValueField("received", &IntervalBandwidth::received),
+                               jsonValueField("sent", &IntervalBandwidth::sent));
+    }
+};
+
+// History of the most recent interval measurements.  This is a fixed-capacity
+// ring buffer; appending a measurement when the history is full discards the
+// oldest measurement.  Copying the history does not allocate.
+//
+// Each append increments a sequence number, which is never reset (even when
+// the history is cleared).  Comparisons check the sequence number and size
+// before the measurements, so a changed copy of one history is usually
+// detected without comparing the measurements.
+class IntervalBandwidthHistory
+{
+public:
+    enum : std::size_t { Capacity = 32 };
+
+public:
+    void append(const IntervalBandwidth &measurement)
+    {
+        _measurements[(_first + _size) % Capacity] = measurement;
+        if(_size == Capacity)
+            _first = (_first + 1) % Capacity;
+        else
+            ++_size;
+        ++_sequence;
+    }
+    void clear() {_first = 0; _size = 0;}
+
+    std::size_t size() const {return _size;}
+    bool empty() const {return _size == 0;}
+    // Get a measurement - index 0 is the oldest measurement
+    const IntervalBandwidth &operator[](std::size_t i) const
+    {
+        Q_ASSERT(i < _size);
+        return _measurements[(_first + i) % Capacity];
+    }
+    // Total number of measurements ever appended
+    quint64 sequence() const {return _sequence;}
+
+    bool operator==(const IntervalBandwidthHistory &other) const
+    {
+        if(_sequence != other._sequence || _size != other._size)
+            return false;
+        for(std::size_t i=0; i<_size; ++i)
+        {
+            if((*this)[i] != other[i])
+                return false;
+        }
+        return true;
+    }
+    bool operator!=(const IntervalBandwidthHistory &other) const {return !(*this == other);}
+
+private:
+    std::array<IntervalBandwidth, Capacity> _measurements{};
+    std::size_t _first{0}, _size{0};
+    quint64 _sequence{0};
+};
+
+namespace clientjson
+{
+    // The history is sent to clients as an array of measurements, oldest
+    // first.  Since new measurements are appended and old ones removed from
+    // the front, clients using state patches receive only the new
+    // measurements (see Daemon::buildStatePatches()).
+    template<>
+    struct serializer<IntervalBandwidthHistory>
+    {
+        static void to_json(json &j, const IntervalBandwidthHistory &h)
+        {
+            j = json::array();
+            for(std::size_t i=0; i<h.size(); ++i)
+                j.push_back(h[i]);
+        }
+    };
+}
+
 // This is the Daemon's model of its own state expressed to clients.  The
 // internal model has strong invariants describing the daemon state, and can be
 // serialized to JSON (but not from JSON, as this isn't needed for DaemonState
@@ -323,7 +416,7 @@ public:
     // off the oldest value).  Older values are first.
     //
     // When not connected, this is an empty array.
-    JsonProperty(std::deque<IntervalBandwidth>, intervalMeasurements);
+    JsonProperty(IntervalBandwidthHistory, intervalMeasurements);
     // Timestamp when the VPN connection was established - ms since system
     // startup, using a monotonic clock.  0 if we are not connected.
     //
@@ -0,0 +1,95 @@
+// Copyright (c) 2024 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include <common/src/common.h>
+#line SOURCE_FILE("notificationscheduler.cpp")
+
+#include "notificationscheduler.h"
+
+NotificationScheduler::NotificationScheduler(std::chrono::milliseconds coalesceWindow,
+                                             std::function<void()> broadcast)
+    : _broadcast{std::move(broadcast)}, _immediatePosted{false},
+      _immediatePending{false}, _broadcasts{0}, _mergedChanges{0}
+{
+    Q_ASSERT(_broadcast);   // Ensured by caller
+    _coalesceTimer.setSingleShot(true);
+    _coalesceTimer.setInterval(msec32(coalesceWindow));
+    connect(&_coalesceTimer, &QTimer::timeout, this,
+            &NotificationScheduler::trigger);
+}
+
+void NotificationScheduler::schedule(Priority priority)
+{
+    // If an Immediate broadcast is already pending, this change will be
+    // included regardless of its priority.
+    if(_immediatePending)
+    {
+        ++_mergedChanges;
+        return;
+    }
+
+    if(priority == Priority::Immediate)
+    {
+        // If a coalesced broadcast was waiting, it's now sent sooner along
+        // with this change; count this as a merged change.
+        if(_coalesceTimer.isActive())
+        {
+            _coalesceTimer.stop();
+            ++_mergedChanges;
+        }
+        _immediatePending = true;
+        // Only post one invocation, even if the broadcast was canceled and
+        // rescheduled during the same event loop turn
+        if(!_immediatePosted)
+        {
+            _immediatePosted = true;
+            QMetaObject::invokeMethod(this, [this]()
+            {
+                _immediatePosted = false;
+                if(_immediatePending)
+                    trigger();
+            }, Qt::QueuedConnection);
+        }
+        return;
+    }
+
+    if(_coalesceTimer.isActive())
+        ++_mergedChanges;
+    else
+        _coalesceTimer.start();
+}
+
+bool NotificationScheduler::cancel()
+{
+    bool wasScheduled = _immediatePending || _coalesceTimer.isActive();
+    _immediatePending = false;
+    _coalesceTimer.stop();
+    return wasScheduled;
+}
+
+std::chrono::milliseconds NotificationScheduler::coalesceWindow() const
+{
+    return std::chrono::milliseconds{_coalesceTimer.interval()};
+}
+
+void NotificationScheduler::trigger()
+{
+    cancel();
+    ++_broadcasts;
+    _broadcast();
+}
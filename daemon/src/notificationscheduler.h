@@ -0,0 +1,94 @@
+// Copyright (c) 2024 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include <common/src/common.h>
+#line HEADER_FILE("notificationscheduler.h")
+
+#ifndef NOTIFICATIONSCHEDULER_H
+#define NOTIFICATIONSCHEDULER_H
+
+#include <QObject>
+#include <QTimer>
+#include <chrono>
+#include <functional>
+
+// NotificationScheduler decides when a batch of pending changes is broadcast
+// to clients.  Each change is scheduled with a priority:
+//
+// - Immediate changes are broadcast on the next event loop turn (like
+//   IMPLEMENT_NOTIFICATIONS, multiple requests during one turn are merged).
+// - Coalesced changes are delayed up to a fixed window, so frequent changes
+//   (byte counters, latencies, etc.) are broadcast at most once per window.
+//
+// Since a broadcast always sends all pending changes, an Immediate change also
+// flushes any Coalesced changes that are waiting.
+//
+// The owner must call flushed() whenever it broadcasts changes (including
+// when it broadcasts without being triggered by the scheduler), so any pending
+// trigger is canceled.
+class NotificationScheduler : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum class Priority
+    {
+        Immediate,
+        Coalesced,
+    };
+
+public:
+    // Create NotificationScheduler with the coalescing window and the function
+    // that broadcasts the pending changes.
+    NotificationScheduler(std::chrono::milliseconds coalesceWindow,
+                          std::function<void()> broadcast);
+
+public:
+    // Schedule a broadcast for a change with the given priority.
+    void schedule(Priority priority);
+    // Cancel a scheduled broadcast, returns true if one was scheduled.  The
+    // owner can use this to broadcast synchronously:
+    //     if(scheduler.cancel()) broadcastNow();
+    bool cancel();
+    // Indicate that the pending changes have been broadcast.
+    void flushed() {cancel();}
+    bool isScheduled() const {return _immediatePending || _coalesceTimer.isActive();}
+
+    std::chrono::milliseconds coalesceWindow() const;
+
+    // Statistics - the number of broadcasts triggered, and the number of
+    // changes that were merged into a broadcast already scheduled
+    quint64 broadcasts() const {return _broadcasts;}
+    quint64 mergedChanges() const {return _mergedChanges;}
+
+private:
+    void trigger();
+
+private:
+    std::function<void()> _broadcast;
+    QTimer _coalesceTimer;
+    // Whether a queued invocation of trigger() is pending for an Immediate
+    // change.  If cancel() is called, the queued invocation still occurs but
+    // does nothing.
+    bool _immediatePosted;
+    bool _immediatePending;
+    quint64 _broadcasts;
+    quint64 _mergedChanges;
+};
+
+#endif
@@ -28,6 +28,74 @@
 #include <unistd.h>
 #include <netinet/ip.h>
 #include <fcntl.h>
+#include <array>
+#include <cstring>
+
+namespace
+{
+    // Outstanding requests are forgotten if they haven't been answered within
+    // this time (the same as LatencyTracker's echo timeout).  A later reply is
+    // still signaled with receivedReply(), just without a round-trip time.
+    const std::chrono::seconds sentEchoTimeout{10};
+
+    std::chrono::nanoseconds toDuration(const timespec &time)
+    {
+        return std::chrono::seconds{time.tv_sec} + std::chrono::nanoseconds{time.tv_nsec};
+    }
+
+    // Find the kernel's receive timestamp in the control messages from
+    // recvmsg().  The timestamp uses CLOCK_REALTIME.
+    bool findReceiveTime(msghdr &message, timespec &rxTime)
+    {
+        for(cmsghdr *pCmsg = CMSG_FIRSTHDR(&message); pCmsg;
+            pCmsg = CMSG_NXTHDR(&message, pCmsg))
+        {
+            if(pCmsg->cmsg_level != SOL_SOCKET)
+                continue;
+#if defined(Q_OS_LINUX)
+            if(pCmsg->cmsg_type == SCM_TIMESTAMPNS)
+            {
+                std::memcpy(&rxTime, CMSG_DATA(pCmsg), sizeof(rxTime));
+                return true;
+            }
+#else
+            if(pCmsg->cmsg_type == SCM_TIMESTAMP)
+            {
+                timeval rxTimeval{};
+                std::memcpy(&rxTimeval, CMSG_DATA(pCmsg), sizeof(rxTimeval));
+                rxTime.tv_sec = rxTimeval.tv_sec;
+                rxTime.tv_nsec = rxTimeval.tv_usec * 1000;
+                return true;
+            }
+#endif
+        }
+        return false;
+    }
+
+    // Buffers for reading one packet with recvmsg() / recvmmsg()
+    struct ReadBuffer
+    {
+        alignas(std::uint32_t) std::array<quint8, 2048> packet;
+#if defined(Q_OS_LINUX)
+        alignas(cmsghdr) std::array<char, CMSG_SPACE(sizeof(timespec))> control;
+#else
+        alignas(cmsghdr) std::array<char, CMSG_SPACE(sizeof(timeval))> control;
+#endif
+        iovec packetVec;
+
+        // Set up a msghdr to read into this buffer
+        void prepare(msghdr &message)
+        {
+            packetVec.iov_base = packet.data();
+            packetVec.iov_len = packet.size();
+            message = {};
+            message.msg_iov = &packetVec;
+            message.msg_iovlen = 1;
+            message.msg_control = control.data();
+            message.msg_controllen = control.size();
+        }
+    };
+}
 
 PosixPing::PosixPing()
     : _identifier{static_cast<quint16>(QRandomGenerator::global()->bounded(std::numeric_limits<quint16>::max()))},
@@ -53,6 +121,17 @@ PosixPing::PosixPing()
     int oldFlags = ::fcntl(_icmpSocket.get(), F_GETFL);
     ::fcntl(_icmpSocket.get(), F_SETFL, oldFlags | O_NONBLOCK);
 
+    // Have the kernel timestamp replies, so round-trip times don't depend on
+    // how quickly the event loop reads them
+#if defined(Q_OS_LINUX)
+    if(setsockopt(_icmpSocket.get(), SOL_SOCKET, SO_TIMESTAMPNS, &val, sizeof(val)) < 0)
+#else
+    if(setsockopt(_icmpSocket.get(), SOL_SOCKET, SO_TIMESTAMP, &val, sizeof(val)) < 0)
+#endif
+    {
+        qWarning() << "Failed to enable receive timestamps on ICMP socket:" << errno;
+    }
+
     _pReadNotifier.emplace(_icmpSocket.get(), QSocketNotifier::Type::Read);
     connect(_pReadNotifier.ptr(), &QSocketNotifier::activated, this,
             &PosixPing::onReadyRead);
@@ -82,27 +161,12 @@ quint16 PosixPing::calcChecksum(const quint8 *data, std::size_t len) const
     return ~static_cast<quint16>(accum);
 }
 
-bool PosixPing::sendEchoRequest(quint32 address, int payloadSize, bool allowFragment)
+quint16 PosixPing::buildEchoRequest(quint32 address, int payloadSize,
+                                    std::vector<std::uint8_t> &rawPacket)
 {
-#ifdef UNIT_TEST
-    // Fake this in unit tests since we can't send real ICMP pings when not run
-    // as root.
-    // Unit tests use the IPv4 documentation range to test a lack of response,
-    // so check for that too (but act like a request was sent with no reply).
-    if((address & 0xFFFFFF00) != 0xC0000200)    // 192.0.2.0/24
-    {
-        qInfo() << "Mocking ping to" << QHostAddress{address};
-        QTimer::singleShot(30, this, [this, address]{emit receivedReply(address);});
-    }
-    return true;
-#endif
-    if(!_icmpSocket)
-        return false; // Can't do anything, failed to open raw socket - traced earlier
-
     // Build an ICMP echo request packet.
     int rawPacketSize = sizeof(IcmpEcho) + payloadSize + sizeof(struct ip);
     int packetSize = sizeof(IcmpEcho) + payloadSize;
-    std::vector<std::uint8_t> rawPacket;
     rawPacket.resize(rawPacketSize);
     quint8* pRawPacket = rawPacket.data();
     quint8* packet = pRawPacket + sizeof(struct ip);
@@ -124,11 +188,15 @@ bool PosixPing::sendEchoRequest(quint32 address, int payloadSize, bool allowFrag
     ip->ip_sum = 0;
     ip->ip_dst.s_addr = htonl(address);
 
+    quint16 sequence = _nextSequence;
+    // If the sequence numbers have wrapped around to a request that was never
+    // answered, forget it - a reply to it would look like a reply to this one
+    _sentEchoes.erase(sequence);
     pEcho->type = 8;
     pEcho->code = 0;
     pEcho->checksum = 0;
     pEcho->identifier = htons(_identifier);
-    pEcho->sequence = htons(_nextSequence);
+    pEcho->sequence = htons(sequence);
 
     ++_nextSequence;
     // The default payload on Mac/Linux is 56 bytes from 0x00 - 0x37.  The first
@@ -157,6 +225,34 @@ bool PosixPing::sendEchoRequest(quint32 address, int payloadSize, bool allowFrag
     // carries in.
     pEcho->checksum = calcChecksum(packet, packetSize);
 
+    return sequence;
+}
+
+bool PosixPing::sendEchoRequest(quint32 address, int payloadSize, bool allowFragment)
+{
+#ifdef UNIT_TEST
+    // Fake this in unit tests since we can't send real ICMP pings when not run
+    // as root.
+    // Unit tests use the IPv4 documentation range to test a lack of response,
+    // so check for that too (but act like a request was sent with no reply).
+    if((address & 0xFFFFFF00) != 0xC0000200)    // 192.0.2.0/24
+    {
+        qInfo() << "Mocking ping to" << QHostAddress{address};
+        QTimer::singleShot(30, this, [this, address]
+        {
+            emit receivedRoundTrip(address, std::chrono::milliseconds{30});
+            emit receivedReply(address);
+        });
+    }
+    return true;
+#endif
+    if(!_icmpSocket)
+        return false; // Can't do anything, failed to open raw socket - traced earlier
+
+    std::vector<std::uint8_t> rawPacket;
+    quint16 sequence = buildEchoRequest(address, payloadSize, rawPacket);
+    struct ip *ip = reinterpret_cast<struct ip *>(rawPacket.data());
+
     if (!allowFragment) {
 #if defined(Q_OS_MAC)
         ip->ip_off = IP_DF;
@@ -176,7 +272,9 @@ bool PosixPing::sendEchoRequest(quint32 address, int payloadSize, bool allowFrag
     to.sin_family = AF_INET;
     to.sin_port = 0;    // Not used for ICMP raw socket
     to.sin_addr.s_addr = htonl(address);
-    auto sent = ::sendto(_icmpSocket.get(), pRawPacket, rawPacketSize, 0,
+    SentEcho sentEcho{address, {}};
+    ::clock_gettime(CLOCK_REALTIME, &sentEcho.sentTime);
+    auto sent = ::sendto(_icmpSocket.get(), rawPacket.data(), rawPacket.size(), 0,
                          reinterpret_cast<sockaddr*>(&to), sizeof(to));
     if(sent < 0)
     {
@@ -192,17 +290,163 @@ bool PosixPing::sendEchoRequest(quint32 address, int payloadSize, bool allowFrag
         }
         return false;
     }
-    else if(sent != rawPacketSize)
+    else if(static_cast<std::size_t>(sent) != rawPacket.size())
     {
-        qWarning() << "Only sent" << sent << "/" << rawPacketSize
+        qWarning() << "Only sent" << sent << "/" << rawPacket.size()
             << "bytes in ping to" << QHostAddress{address}.toString();
         return false;
     }
 
+    expireSentEchoes(sentEcho.sentTime);
+    _sentEchoes[sequence] = sentEcho;
     return true;
 }
 
+std::size_t PosixPing::sendEchoRequests(const std::vector<quint32> &addresses)
+{
+#ifdef UNIT_TEST
+    // Mock each ping individually, as above
+    for(quint32 address : addresses)
+        sendEchoRequest(address);
+    return addresses.size();
+#endif
+    if(!_icmpSocket)
+        return 0; // Failed to open raw socket - traced earlier
+
+    std::vector<std::vector<std::uint8_t>> rawPackets;
+    std::vector<quint16> sequences;
+    std::vector<sockaddr_in> destinations;
+    rawPackets.resize(addresses.size());
+    sequences.reserve(addresses.size());
+    destinations.reserve(addresses.size());
+    for(std::size_t i=0; i<addresses.size(); ++i)
+    {
+        sequences.push_back(buildEchoRequest(addresses[i], DefaultPayloadSize,
+                                             rawPackets[i]));
+        sockaddr_in to{};
+        to.sin_family = AF_INET;
+        to.sin_port = 0;    // Not used for ICMP raw socket
+        to.sin_addr.s_addr = htonl(addresses[i]);
+        destinations.push_back(to);
+    }
+
+    timespec sentTime{};
+    ::clock_gettime(CLOCK_REALTIME, &sentTime);
+    std::size_t sent{0};
+#if defined(Q_OS_LINUX)
+    std::vector<iovec> packetVecs(addresses.size());
+    std::vector<mmsghdr> messages(addresses.size());
+    for(std::size_t i=0; i<addresses.size(); ++i)
+    {
+        packetVecs[i].iov_base = rawPackets[i].data();
+        packetVecs[i].iov_len = rawPackets[i].size();
+        messages[i] = {};
+        messages[i].msg_hdr.msg_name = &destinations[i];
+        messages[i].msg_hdr.msg_namelen = sizeof(destinations[i]);
+        messages[i].msg_hdr.msg_iov = &packetVecs[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+    }
+    while(sent < messages.size())
+    {
+        int result = ::sendmmsg(_icmpSocket.get(), messages.data() + sent,
+                                messages.size() - sent, 0);
+        if(result <= 0)
+        {
+            qWarning() << "Failed to send" << (messages.size() - sent)
+                << "pings -" << errno;
+            break;
+        }
+        sent += static_cast<std::size_t>(result);
+    }
+#else
+    // No sendmmsg() on Mac, send them individually
+    while(sent < addresses.size())
+    {
+        auto result = ::sendto(_icmpSocket.get(), rawPackets[sent].data(),
+                               rawPackets[sent].size(), 0,
+                               reinterpret_cast<sockaddr*>(&destinations[sent]),
+                               sizeof(destinations[sent]));
+        if(result < 0)
+        {
+            qWarning() << "Failed to ping" << QHostAddress{addresses[sent]}.toString()
+                << "-" << errno;
+            break;
+        }
+        ++sent;
+    }
+#endif
+
+    expireSentEchoes(sentTime);
+    for(std::size_t i=0; i<sent; ++i)
+        _sentEchoes[sequences[i]] = {addresses[i], sentTime};
+    return sent;
+}
+
+void PosixPing::expireSentEchoes(const timespec &now)
+{
+    auto itSentEcho = _sentEchoes.begin();
+    while(itSentEcho != _sentEchoes.end())
+    {
+        auto age = toDuration(now) - toDuration(itSentEcho->second.sentTime);
+        // Also expire requests from the future, in case the realtime clock
+        // went backwards
+        if(age >= sentEchoTimeout || age.count() < 0)
+            itSentEcho = _sentEchoes.erase(itSentEcho);
+        else
+            ++itSentEcho;
+    }
+}
+
 void PosixPing::onReadyRead()
+{
+#if defined(Q_OS_LINUX)
+    // Read all the replies that are ready with one call
+    std::array<ReadBuffer, ReadBatchSize> buffers;
+    std::array<mmsghdr, ReadBatchSize> messages;
+    for(std::size_t i=0; i<buffers.size(); ++i)
+    {
+        messages[i] = {};
+        buffers[i].prepare(messages[i].msg_hdr);
+    }
+    int read = ::recvmmsg(_icmpSocket.get(), messages.data(), messages.size(),
+                          MSG_DONTWAIT, nullptr);
+    if(read < 0)
+    {
+        // Shouldn't happen, socket said it was ready
+        qWarning() << "Failed to read from ICMP socket -" << read << "- err:"
+            << errno;
+        return;
+    }
+
+    for(int i=0; i<read; ++i)
+    {
+        timespec rxTime{};
+        bool haveRxTime = findReceiveTime(messages[i].msg_hdr, rxTime);
+        processPacket(buffers[i].packet.data(), messages[i].msg_len,
+                      haveRxTime ? &rxTime : nullptr);
+    }
+#else
+    ReadBuffer buffer;
+    msghdr message;
+    buffer.prepare(message);
+    auto read = ::recvmsg(_icmpSocket.get(), &message, 0);
+    if(read < 0)
+    {
+        // Shouldn't happen, socket said it was ready
+        qWarning() << "Failed to read from ICMP socket -" << read << "- err:"
+            << errno;
+        return;
+    }
+
+    timespec rxTime{};
+    bool haveRxTime = findReceiveTime(message, rxTime);
+    processPacket(buffer.packet.data(), static_cast<std::size_t>(read),
+                  haveRxTime ? &rxTime : nullptr);
+#endif
+}
+
+void PosixPing::processPacket(const quint8 *pPacket, std::size_t size,
+                              const timespec *pRxTime)
 {
     struct Ipv4
     {
@@ -218,28 +462,18 @@ void PosixPing::onReadyRead()
         quint32 dest;
     };
 
-    alignas(Ipv4) std::array<quint8, 2048> packet;
-    auto read = recv(_icmpSocket.get(), packet.data(), packet.size(), 0);
-    if(read < 0)
-    {
-        // Shouldn't happen, socket said it was ready
-        qWarning() << "Failed to read from ICMP socket -" << read << "- err:"
-            << errno;
-        return;
-    }
-
-    if(static_cast<std::size_t>(read) < sizeof(Ipv4))
+    if(size < sizeof(Ipv4))
     {
-        qWarning() << "Read incomplete packet of" << read << "bytes, expected"
+        qWarning() << "Read incomplete packet of" << size << "bytes, expected"
             << sizeof(Ipv4) << "bytes";
         return;
     }
 
-    const Ipv4 *pIpHdr = reinterpret_cast<const Ipv4*>(packet.data());
+    const Ipv4 *pIpHdr = reinterpret_cast<const Ipv4*>(pPacket);
 
     // Ignore the packet length from the IP header - the kernel has already
     // manipulated it (converted to host byte order and subtracted header
-    // length).  'read' tells us how long the packet is.
+    // length).  'size' tells us how long the packet is.
 
     if((pIpHdr->version_ihl >> 4) != 4)
     {
@@ -248,11 +482,11 @@ void PosixPing::onReadyRead()
     }
 
     std::size_t headerBytes = (pIpHdr->version_ihl & 0x0F) * 4;
-    if(headerBytes < 20 || static_cast<std::size_t>(read) < headerBytes ||
-       read - headerBytes < sizeof(IcmpEcho))
+    if(headerBytes < 20 || size < headerBytes ||
+       size - headerBytes < sizeof(IcmpEcho))
     {
         qWarning() << "Invalid IP header length:" << headerBytes
-            << "bytes (read" << read << "bytes)";
+            << "bytes (read" << size << "bytes)";
         return;
     }
 
@@ -264,14 +498,14 @@ void PosixPing::onReadyRead()
     }
 
     // Check ICMP checksum
-    if(calcChecksum(packet.data() + headerBytes, read - headerBytes))
+    if(calcChecksum(pPacket + headerBytes, size - headerBytes))
     {
         qWarning() << "Received corrupt ICMP packet from"
             << QHostAddress{ntohl(pIpHdr->src)}.toString();
     }
 
     // Find the ICMP header
-    const IcmpEcho *pEchoReply = reinterpret_cast<const IcmpEcho*>(packet.data() + headerBytes);
+    const IcmpEcho *pEchoReply = reinterpret_cast<const IcmpEcho*>(pPacket + headerBytes);
     // If it's not an echo reply, not ours, etc., just ignore it.
     if(pEchoReply->type != 0 || pEchoReply->code != 0 ||
        ntohs(pEchoReply->identifier) != _identifier)
@@ -280,6 +514,27 @@ void PosixPing::onReadyRead()
         return;
     }
 
-    // It's our reply - emit the response.
-    emit receivedReply(ntohl(pIpHdr->src));
+    // It's our reply - emit the response.  If it's a reply to an outstanding
+    // request, emit the round-trip time too.
+    quint32 address = ntohl(pIpHdr->src);
+    auto itSentEcho = _sentEchoes.find(ntohs(pEchoReply->sequence));
+    if(itSentEcho != _sentEchoes.end() && itSentEcho->second.address == address)
+    {
+        // Use the time now if the kernel didn't provide a receive timestamp
+        timespec now{};
+        if(!pRxTime)
+        {
+            ::clock_gettime(CLOCK_REALTIME, &now);
+            pRxTime = &now;
+        }
+        auto roundTrip = toDuration(*pRxTime) - toDuration(itSentEcho->second.sentTime);
+        _sentEchoes.erase(itSentEcho);
+        // The realtime clock could have been adjusted in between
+        if(roundTrip.count() >= 0)
+        {
+            emit receivedRoundTrip(address,
+                std::chrono::duration_cast<std::chrono::microseconds>(roundTrip));
+        }
+    }
+    emit receivedReply(address);
 }
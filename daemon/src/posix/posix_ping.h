@@ -22,6 +22,10 @@
 #include <common/src/common.h>
 #include <kapps_core/src/posix/posix_objects.h>
 #include <QSocketNotifier>
+#include <chrono>
+#include <unordered_map>
+#include <vector>
+#include <time.h>
 
 // Open an ICMP socket and send pings on Mac/Linux.
 // An identifier is chosen randomly when the object is created; responses are
@@ -29,6 +33,10 @@
 //
 // It is possible (but unlikely) that duplicate or spurious responses could be
 // emitted if they happen to have that identifier.
+//
+// Replies are timestamped by the kernel when possible (SO_TIMESTAMPNS on
+// Linux, SO_TIMESTAMP on Mac), so round-trip times don't include any delay in
+// processing the reply on the event loop.
 class PosixPing : public QObject
 {
     Q_OBJECT
@@ -37,7 +45,11 @@ private:
     enum
     {
         // Size of payload included in echoes
-        PayloadSize = 56
+        PayloadSize = 56,
+        // Default payload size used by sendEchoRequest()
+        DefaultPayloadSize = 32,
+        // Maximum number of packets read at once on Linux with recvmmsg()
+        ReadBatchSize = 32,
     };
     struct IcmpEcho
     {
@@ -53,17 +65,45 @@ public:
 
 private:
     quint16 calcChecksum(const quint8 *data, std::size_t len) const;
+    // Build an ICMP echo request to address, including the IP header, in
+    // rawPacket.  Returns the sequence number used.
+    quint16 buildEchoRequest(quint32 address, int payloadSize,
+                             std::vector<std::uint8_t> &rawPacket);
 
 public:
     // Send an ICMP echo request.  If a reply is received, it will be signaled
     // with receivedReply().
-    bool sendEchoRequest(quint32 address, int payloadSize = 32, bool allowFragment = true);
+    bool sendEchoRequest(quint32 address, int payloadSize = DefaultPayloadSize,
+                         bool allowFragment = true);
+
+    // Send ICMP echo requests to several addresses at once, with the default
+    // payload.  On Linux, they're sent with a single sendmmsg() call.
+    //
+    // Returns the number of requests that were sent - these are the first N
+    // addresses, sending stops at the first failure.
+    std::size_t sendEchoRequests(const std::vector<quint32> &addresses);
 
 private:
     void onReadyRead();
+    // Handle a packet read from the ICMP socket.  pRxTime is the kernel's
+    // receive timestamp, if there was one.
+    void processPacket(const quint8 *pPacket, std::size_t size,
+                       const timespec *pRxTime);
+    // Forget outstanding requests that have timed out as of 'now'
+    void expireSentEchoes(const timespec &now);
 
 signals:
     void receivedReply(quint32 address);
+    // Emitted along with receivedReply() when the reply matches an
+    // outstanding request, with the round-trip time of that request.
+    void receivedRoundTrip(quint32 address, std::chrono::microseconds roundTrip);
+
+private:
+    struct SentEcho
+    {
+        quint32 address;
+        timespec sentTime;  // CLOCK_REALTIME, like the receive timestamps
+    };
 
 private:
     kapps::core::PosixFd _icmpSocket;
@@ -72,6 +112,10 @@ private:
     nullable_t<QSocketNotifier> _pReadNotifier;
     quint16 _identifier;
     quint16 _nextSequence;
+    // Outstanding requests by sequence number, to calculate round-trip times.
+    // Requests that are never answered are expired when more requests are
+    // sent.
+    std::unordered_map<quint16, SentEcho> _sentEchoes;
 };
 
 #endif
@@ -64,9 +64,6 @@ static std::initializer_list<const char*> g_connectionSettingNames = {
 
 namespace
 {
-    // Maximum number of measurements in _intervalMeasurements
-    const std::size_t g_maxMeasurementIntervals{32};
-
     // This seed is run by PIA Ops, this is used in addition to hnsd's
     // hard-coded seeds.  It has a static IP address but it's also resolvable
     // as hsd.londontrustmedia.com.
@@ -1649,11 +1646,9 @@ void VPNConnection::updateByteCounts(quint64 received, quint64 sent)
     _receivedByteCount += intervalReceived;
     _sentByteCount += intervalSent;
 
-    // If we've reached the maximum number of measurements, discard one before
-    // adding a new one
-    if(_intervalMeasurements.size() == g_maxMeasurementIntervals)
-        _intervalMeasurements.pop_front();
-    _intervalMeasurements.push_back({intervalReceived, intervalSent});
+    // If we've reached the maximum number of measurements, this discards the
+    // oldest one
+    _intervalMeasurements.append({intervalReceived, intervalSent});
 
     // The interval measurements always change even if the perpetual totals do
     // not (we added a 0,0 entry).
@@ -536,7 +536,7 @@ public:
     State state() const { return _state; }
     quint64 bytesReceived() const { return _receivedByteCount; }
     quint64 bytesSent() const { return _sentByteCount; }
-    const std::deque<IntervalBandwidth> &intervalMeasurements() const {return _intervalMeasurements;}
+    const IntervalBandwidthHistory &intervalMeasurements() const {return _intervalMeasurements;}
     void activateMACE ();
 
     bool needsReconnect();
@@ -681,7 +681,7 @@ private:
     // Last traffic counts received from the current OpenVPN process
     quint64 _lastReceivedByteCount, _lastSentByteCount;
     // Interval measurements for the current OpenVPN process
-    std::deque<IntervalBandwidth> _intervalMeasurements;
+    IntervalBandwidthHistory _intervalMeasurements;
     // Time since the last bytecount measurement - if it comes in after the
     // abandon deadline, we assume the connection is lost and terminate it.  See
     // updateByteCounts().
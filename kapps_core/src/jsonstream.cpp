@@ -0,0 +1,179 @@
+// Copyright (c) 2024 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "jsonstream.h"
+#include <nlohmann/json.hpp>
+
+namespace kapps { namespace core {
+
+JsonStreamReader::JsonStreamReader()
+    : _skipDepth{0}
+{
+}
+
+JsonStreamReader::~JsonStreamReader() = default;
+
+bool JsonStreamReader::null()
+{
+    return scalar(nullptr);
+}
+
+bool JsonStreamReader::boolean(bool val)
+{
+    return scalar(val);
+}
+
+bool JsonStreamReader::number_integer(std::int64_t val)
+{
+    return scalar(val);
+}
+
+bool JsonStreamReader::number_unsigned(std::uint64_t val)
+{
+    return scalar(val);
+}
+
+bool JsonStreamReader::number_float(double val, const std::string &)
+{
+    return scalar(val);
+}
+
+bool JsonStreamReader::string(std::string &val)
+{
+    // Skipped strings are common (unused properties, etc.), don't bother
+    // building a value for them
+    if(_skipDepth)
+        return true;
+    return scalar(std::move(val));
+}
+
+bool JsonStreamReader::start_object(std::size_t)
+{
+    if(_skipDepth)
+        ++_skipDepth;
+    else if(_pCapture)
+        captureContainer(true);
+    else
+        beginContainer(true);
+    return true;
+}
+
+bool JsonStreamReader::key(std::string &val)
+{
+    if(_skipDepth)
+        return true;
+    if(_pCapture)
+        _captureKey = std::move(val);
+    else
+        _key = std::move(val);
+    return true;
+}
+
+bool JsonStreamReader::end_object()
+{
+    endAnyContainer();
+    return true;
+}
+
+bool JsonStreamReader::start_array(std::size_t)
+{
+    if(_skipDepth)
+        ++_skipDepth;
+    else if(_pCapture)
+        captureContainer(false);
+    else
+        beginContainer(false);
+    return true;
+}
+
+bool JsonStreamReader::end_array()
+{
+    endAnyContainer();
+    return true;
+}
+
+void JsonStreamReader::captureContainer(bool object)
+{
+    // (Don't brace-initialize, that would create an array containing the value)
+    nlohmann::json container = object ? nlohmann::json::object() : nlohmann::json::array();
+
+    // Starting a new capture
+    if(!_pCapture)
+    {
+        _pCapture = std::make_unique<nlohmann::json>(std::move(container));
+        _captureStack.push_back(_pCapture.get());
+        return;
+    }
+
+    // Add a container to the capture in progress
+    nlohmann::json &parent = *_captureStack.back();
+    if(parent.is_array())
+    {
+        parent.push_back(std::move(container));
+        _captureStack.push_back(&parent.back());
+    }
+    else
+    {
+        nlohmann::json &element = parent[_captureKey];
+        element = std::move(container);
+        _captureStack.push_back(&element);
+    }
+}
+
+bool JsonStreamReader::scalar(nlohmann::json val)
+{
+    if(_skipDepth)
+        return true;
+
+    if(_pCapture)
+    {
+        nlohmann::json &parent = *_captureStack.back();
+        if(parent.is_array())
+            parent.push_back(std::move(val));
+        else
+            parent[_captureKey] = std::move(val);
+    }
+    else
+        value(val);
+    return true;
+}
+
+void JsonStreamReader::endAnyContainer()
+{
+    if(_skipDepth)
+    {
+        --_skipDepth;
+        return;
+    }
+
+    if(_pCapture)
+    {
+        _captureStack.pop_back();
+        if(_captureStack.empty())
+        {
+            // Done - hand off the captured value, then discard it
+            auto pCapture = std::move(_pCapture);
+            captured(*pCapture);
+        }
+        return;
+    }
+
+    endContainer();
+}
+
+}}
@@ -0,0 +1,109 @@
+// Copyright (c) 2024 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include "corejson.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace kapps { namespace core {
+
+// Base for readers that interpret JSON from nlohmann::json::sax_parse()
+// events, without building a DOM of the whole document.
+//
+// Derived readers implement the hooks below to handle the containers and
+// values they're interested in.  When a container starts, the reader can also
+// skip it entirely (skipContainer()), or capture it as a small DOM value
+// (captureContainer()) to be interpreted with the normal JSON conversions -
+// this is handy for small elements whose validation is already implemented by
+// readJson().
+//
+// Syntax errors throw the same exceptions nlohmann::json::parse() would throw.
+// The hooks can also throw to abort the parse.
+class KAPPS_CORE_EXPORT JsonStreamReader
+{
+public:
+    JsonStreamReader();
+    virtual ~JsonStreamReader();
+
+public:
+    // SAX interface used by nlohmann::json::sax_parse()
+    bool null();
+    bool boolean(bool val);
+    bool number_integer(std::int64_t val);
+    bool number_unsigned(std::uint64_t val);
+    bool number_float(double val, const std::string &);
+    bool string(std::string &val);
+    // Binary values can't occur in JSON text; treat them as null if they
+    // somehow do
+    template<class BinaryT>
+    bool binary(BinaryT &) {return null();}
+    bool start_object(std::size_t);
+    bool key(std::string &val);
+    bool end_object();
+    bool start_array(std::size_t);
+    bool end_array();
+    template<class ExceptionT>
+    bool parse_error(std::size_t, const std::string &, const ExceptionT &ex)
+    {
+        throw ex;
+    }
+
+protected:
+    // A container (object or array) has started.  This can call
+    // skipContainer() or captureContainer() to handle the whole container;
+    // otherwise the container's contents are passed to the hooks, followed by
+    // endContainer().
+    virtual void beginContainer(bool object) = 0;
+    virtual void endContainer() = 0;
+    // A scalar value has been read; it can be moved from.
+    virtual void value(nlohmann::json &value) = 0;
+    // A container passed to captureContainer() has been read completely; it
+    // can be moved from.
+    virtual void captured(nlohmann::json &value) = 0;
+
+    // The key of the most recent value in the current object.  (Meaningless
+    // in arrays.)
+    const std::string &currentKey() const {return _key;}
+
+    // Ignore the container that's starting; only valid in beginContainer().
+    void skipContainer() {_skipDepth = 1;}
+    // Capture the container that's starting as a JSON value, then pass it to
+    // captured(); only valid in beginContainer().
+    void captureContainer(bool object);
+
+private:
+    bool scalar(nlohmann::json value);
+    void endAnyContainer();
+
+private:
+    std::string _key;
+    // Depth of the container being skipped, 0 if not skipping
+    std::size_t _skipDepth;
+    // When capturing, the captured value and the containers currently open in
+    // it - the pointers remain valid since values are only added to the
+    // innermost container.
+    std::unique_ptr<nlohmann::json> _pCapture;
+    std::vector<nlohmann::json*> _captureStack;
+    std::string _captureKey;
+};
+
+}}
@@ -0,0 +1,129 @@
+// Copyright (c) 2024 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "parallel.h"
+#include "workfunc.h"
+#include "workqueue.h"
+#include <algorithm>
+#include <exception>
+#include <system_error>
+#include <thread>
+
+namespace kapps { namespace core {
+
+void parallelChunks(std::size_t count, std::size_t threads,
+    std::size_t minChunk,
+    const std::function<void(std::size_t, std::size_t)> &func)
+{
+    WorkerPool pool{threads};
+    pool.parallelChunks(count, minChunk, func);
+}
+
+WorkerPool::WorkerPool(std::size_t threads)
+    : _threads{threads}
+{
+    if(_threads == AutoThreads)
+        _threads = std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Defined here since WorkThread is incomplete in the header
+WorkerPool::~WorkerPool() = default;
+
+void WorkerPool::parallelChunks(std::size_t count, std::size_t minChunk,
+    const std::function<void(std::size_t, std::size_t)> &func)
+{
+    // Don't use threads that would have less than minChunk items
+    std::size_t chunks = std::min(_threads, count / std::max<std::size_t>(minChunk, 1));
+    if(chunks <= 1)
+    {
+        if(count)
+            func(0, count);
+        return;
+    }
+
+    // Start any workers that haven't been needed yet.  The calling thread runs
+    // the first chunk.
+    while(_workers.size() < chunks - 1)
+    {
+        try
+        {
+            _workers.push_back(std::make_unique<WorkThread>([](Any){}));
+        }
+        catch(const std::system_error &)
+        {
+            // Couldn't start a thread, the remaining chunks are run here
+            break;
+        }
+    }
+
+    // Chunk boundaries - chunk i is [bounds[i], bounds[i+1])
+    std::vector<std::size_t> bounds;
+    bounds.reserve(chunks + 1);
+    for(std::size_t i=0; i<=chunks; ++i)
+        bounds.push_back(count * i / chunks);
+
+    // Chunk i (for i >= 1) runs on worker i-1 if it exists.  The WorkFuncs
+    // refer to their SyncWorkFunc, so these are never reallocated.
+    std::size_t queued = std::min(_workers.size(), chunks - 1);
+    std::vector<SyncWorkFunc> syncWork(queued);
+    for(std::size_t i=0; i<queued; ++i)
+    {
+        std::size_t chunk = i + 1;
+        _workers[i]->enqueue(syncWork[i].work<>(std::function<void()>{
+            [&func, &bounds, chunk]{func(bounds[chunk], bounds[chunk+1]);}}));
+    }
+
+    std::vector<std::exception_ptr> errors;
+    errors.resize(chunks);
+    auto runChunk = [&](std::size_t chunk)
+    {
+        try
+        {
+            func(bounds[chunk], bounds[chunk+1]);
+        }
+        catch(...)
+        {
+            errors[chunk] = std::current_exception();
+        }
+    };
+    runChunk(0);
+    for(std::size_t chunk=queued+1; chunk<chunks; ++chunk)
+        runChunk(chunk);
+
+    // Wait for every worker before rethrowing anything, the chunks refer to
+    // func and bounds
+    for(std::size_t i=0; i<queued; ++i)
+    {
+        try
+        {
+            syncWork[i].wait();
+        }
+        catch(...)
+        {
+            errors[i+1] = std::current_exception();
+        }
+    }
+
+    for(const auto &pError : errors)
+    {
+        if(pError)
+            std::rethrow_exception(pError);
+    }
+}
+
+}}
@@ -0,0 +1,82 @@
+// Copyright (c) 2024 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include <kapps_core/core.h>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace kapps { namespace core {
+
+class WorkThread;
+
+// Requests the number of threads supported by the hardware from
+// parallelChunks()
+constexpr std::size_t AutoThreads = static_cast<std::size_t>(-1);
+
+// Invoke func(begin, end) over the items [0, count), divided into contiguous
+// chunks run on up to `threads` threads (including the calling thread).
+// Returns once all chunks are done.
+//
+// Each thread gets at least minChunk items, so small inputs are just handled on
+// the calling thread.  If `threads` is 0 or 1, func(0, count) is invoked on the
+// calling thread.  AutoThreads uses std::thread::hardware_concurrency().
+//
+// If any chunk throws, the exception from the earliest chunk is rethrown after
+// all threads have finished.
+//
+// This starts the threads for this call only.  That's fine for a build that
+// has one parallel step; use a WorkerPool to run several steps on the same
+// threads.
+KAPPS_CORE_EXPORT void parallelChunks(std::size_t count, std::size_t threads,
+    std::size_t minChunk,
+    const std::function<void(std::size_t, std::size_t)> &func);
+
+// WorkerPool runs parallelChunks() on worker threads that are kept for the
+// life of the pool, so a build with several parallel steps (like the country
+// and region displays in Metadata) starts its threads once.  The threads are
+// started the first time they're needed, so a pool that only sees small
+// inputs never starts any.
+//
+// A WorkerPool is used from one thread; parallelChunks() isn't reentrant.
+class KAPPS_CORE_EXPORT WorkerPool
+{
+public:
+    // `threads` is the maximum number of threads used, including the calling
+    // thread, as in parallelChunks().
+    explicit WorkerPool(std::size_t threads);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool &operator=(const WorkerPool &) = delete;
+
+public:
+    std::size_t threads() const {return _threads;}
+
+    // Like core::parallelChunks(), using this pool's threads
+    void parallelChunks(std::size_t count, std::size_t minChunk,
+        const std::function<void(std::size_t, std::size_t)> &func);
+
+private:
+    std::size_t _threads;
+    std::vector<std::unique_ptr<WorkThread>> _workers;
+};
+
+}}
@@ -0,0 +1,90 @@
+// Copyright (c) 2024 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "anchor_model.h"
+
+template<class UpdateFunc>
+kapps::core::nullable_t<AnchorModel::IPVersion> AnchorModel::update(TableEnum tableType, IPVersion ip,
+                                                                    const std::string &anchorName,
+                                                                    UpdateFunc updateState)
+{
+    std::lock_guard<std::mutex> lock{_mutex};
+    bool changed4 = ip != IPVersion::IPv6 && updateState(_anchors[{tableType, IPVersion::IPv4, anchorName}]);
+    bool changed6 = ip != IPVersion::IPv4 && updateState(_anchors[{tableType, IPVersion::IPv6, anchorName}]);
+
+    if(!changed4 && !changed6)
+    {
+        ++_unchangedCount;
+        return {};
+    }
+    ++_changedCount;
+    if(changed4 && changed6)
+        return IPVersion::Both;
+    return changed4 ? IPVersion::IPv4 : IPVersion::IPv6;
+}
+
+kapps::core::nullable_t<AnchorModel::IPVersion> AnchorModel::updateEnabled(TableEnum tableType, IPVersion ip,
+                                                                           const std::string &anchorName,
+                                                                           bool enabled)
+{
+    return update(tableType, ip, anchorName, [&](AnchorState &state)
+    {
+        if(state.enabled == enabled)
+            return false;
+        state.enabled = enabled;
+        return true;
+    });
+}
+
+kapps::core::nullable_t<AnchorModel::IPVersion> AnchorModel::updateRules(TableEnum tableType, IPVersion ip,
+                                                                         const std::string &anchorName,
+                                                                         const std::vector<std::string> &newRules)
+{
+    return update(tableType, ip, anchorName, [&](AnchorState &state)
+    {
+        if(state.rules == newRules)
+            return false;
+        state.rules = newRules;
+        return true;
+    });
+}
+
+void AnchorModel::clear()
+{
+    std::lock_guard<std::mutex> lock{_mutex};
+    _anchors.clear();
+}
+
+unsigned AnchorModel::changedCount() const
+{
+    std::lock_guard<std::mutex> lock{_mutex};
+    return _changedCount;
+}
+
+unsigned AnchorModel::unchangedCount() const
+{
+    std::lock_guard<std::mutex> lock{_mutex};
+    return _unchangedCount;
+}
+
+void AnchorModel::resetCounts()
+{
+    std::lock_guard<std::mutex> lock{_mutex};
+    _changedCount = 0;
+    _unchangedCount = 0;
+}
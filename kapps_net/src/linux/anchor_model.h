@@ -0,0 +1,92 @@
+// Copyright (c) 2024 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include <kapps_core/core.h>
+#include <kapps_core/src/util.h>
+#include "iptables_firewall.h"
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+// Model of the state of each firewall anchor, as last requested.  Once an
+// update is committed, this is the state in the firewall, so IpTablesFirewall
+// skips changes that don't affect it - callers can request the complete state
+// of every anchor each time the rules are applied, and only the anchors that
+// actually changed are written.
+//
+// IpTablesFirewall clears the model whenever the firewall might no longer
+// match it (the anchors are installed or uninstalled, a change couldn't be
+// committed atomically, or a root chain had to be relinked).
+//
+// Changes can be made from the split tunnel thread, so the model is
+// thread-safe.
+class KAPPS_NET_EXPORT AnchorModel
+{
+public:
+    using IPVersion = IpTablesFirewall::IPVersion;
+
+public:
+    AnchorModel() : _changedCount{0}, _unchangedCount{0} {}
+
+public:
+    // Record a requested change to an anchor.  Returns the IP versions where
+    // the change affects the anchor (IPv4, IPv6, or Both), or an empty
+    // nullable_t if the anchor is already in that state, in which case the
+    // change doesn't need to be applied.
+    kapps::core::nullable_t<IPVersion> updateEnabled(TableEnum tableType, IPVersion ip,
+                                                     const std::string &anchorName, bool enabled);
+    kapps::core::nullable_t<IPVersion> updateRules(TableEnum tableType, IPVersion ip,
+                                                   const std::string &anchorName,
+                                                   const std::vector<std::string> &newRules);
+
+    // Forget the state of every anchor, so the next request for each one is
+    // applied.
+    void clear();
+
+    // Number of requests that changed an anchor / didn't change anything
+    // since the last resetCounts()
+    unsigned changedCount() const;
+    unsigned unchangedCount() const;
+    void resetCounts();
+
+private:
+    // Last requested state of an anchor in one IP version.  A field that
+    // isn't known (because the anchor hasn't been changed since the model was
+    // last cleared) is always applied.
+    struct AnchorState
+    {
+        kapps::core::nullable_t<bool> enabled;
+        kapps::core::nullable_t<std::vector<std::string>> rules;
+    };
+    // Keyed by table, IP version (IPv4 or IPv6), and anchor name
+    using AnchorStateKey = std::tuple<TableEnum, IPVersion, std::string>;
+
+    template<class UpdateFunc>
+    kapps::core::nullable_t<IPVersion> update(TableEnum tableType, IPVersion ip,
+                                              const std::string &anchorName,
+                                              UpdateFunc updateState);
+
+private:
+    mutable std::mutex _mutex;
+    std::map<AnchorStateKey, AnchorState> _anchors;
+    unsigned _changedCount;
+    unsigned _unchangedCount;
+};
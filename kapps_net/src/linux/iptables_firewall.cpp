@@ -17,13 +17,20 @@
 // <https://www.gnu.org/licenses/>.
 
 #include "iptables_firewall.h"
+#include "anchor_model.h"
 #include <kapps_core/src/newexec.h>
 #include "linux_cgroup.h"
 #include "linux_fwmark.h"
 #include "linux_routing.h"
+#include "linux_routemanager.h"
 #include <kapps_core/src/newexec.h>
+#include <atomic>
 #include <map>
 #include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <tuple>
 #include <unordered_map>
 #include "../originalnetworkscan.h"
 #include <kapps_core/src/util.h>
@@ -77,9 +84,34 @@ bool AnchorInfo::operator==(const AnchorInfo& rhs) const
 // applies the _last_ match in the absence of 'quick'.)
 using AnchorMap = std::map<std::string, AnchorInfo, std::greater<std::string>>;
 
+namespace iptables
+{
+    FirstRuleMap parseFirstRules(const std::string &savedRules)
+    {
+        FirstRuleMap firstRules;
+        std::istringstream lines{savedRules};
+        std::string line, table;
+        while(std::getline(lines, line))
+        {
+            if(line.size() > 1 && line[0] == '*')
+                table = line.substr(1);
+            else if(line.compare(0, 3, "-A ") == 0)
+            {
+                auto chainEnd = line.find(' ', 3);
+                std::string chain = line.substr(3, chainEnd == std::string::npos ? std::string::npos : chainEnd - 3);
+                // Keeps the existing value if this isn't the first rule
+                firstRules.emplace(std::make_pair(table, std::move(chain)), line);
+            }
+        }
+        return firstRules;
+    }
+}
+
 namespace
 {
     using IPVersion = IpTablesFirewall::IPVersion;
+    using iptables::FirstRuleMap;
+    using iptables::parseFirstRules;
 
     const std::unordered_map<ChainEnum, std::string, EnumClassHash> kChainMap =
     {
@@ -104,6 +136,16 @@ namespace
         return ip == IPVersion::IPv6 ? "ip6tables" : "iptables";
     }
 
+    std::string getRestoreCommand(IPVersion ip)
+    {
+        return ip == IPVersion::IPv6 ? "ip6tables-restore" : "iptables-restore";
+    }
+
+    std::string getSaveCommand(IPVersion ip)
+    {
+        return ip == IPVersion::IPv6 ? "ip6tables-save" : "iptables-save";
+    }
+
     std::string enumToString(ChainEnum enumVal)
     {
         return kChainMap.at(enumVal);
@@ -532,7 +574,9 @@ public:
         }
     }
 
-    void setAnchorEnabled(IPVersion ip, const std::string &anchorName, bool enabled)
+    // If 'defer' is set, the change is held until applyDeferred() or
+    // deferredRestoreSection() is used (see IpTablesFirewall::beginUpdate()).
+    void setAnchorEnabled(IPVersion ip, const std::string &anchorName, bool enabled, bool defer = false)
     {
         const auto &anchorInfo{getAnchorInfo(ip, anchorName)};
         if(anchorInfo == AnchorNotFound)
@@ -543,13 +587,19 @@ public:
             return;
         }
 
+        if(defer)
+        {
+            forEachPendingAnchor(ip, anchorName, [&](PendingAnchor &pending){pending.enabled = enabled;});
+            return;
+        }
+
         if(enabled)
             _iptInterface.enableAnchor(ip, anchorInfo);
         else
             _iptInterface.disableAnchor(ip, anchorInfo);
     }
 
-    void replaceAnchor(IPVersion ip, const std::string &anchorName, const std::vector<std::string> &newRules)
+    void replaceAnchor(IPVersion ip, const std::string &anchorName, const std::vector<std::string> &newRules, bool defer = false)
     {
         const auto& anchorInfo{getAnchorInfo(ip, anchorName)};
         if(anchorInfo == AnchorNotFound)
@@ -560,16 +610,121 @@ public:
             return;
         }
 
+        if(defer)
+        {
+            forEachPendingAnchor(ip, anchorName, [&](PendingAnchor &pending){pending.rules = newRules;});
+            return;
+        }
+
         _iptInterface.replaceAnchor(ip, anchorInfo, newRules);
     }
 
+    // Build the iptables-restore input to apply the deferred changes for one
+    // IP version (IPv4 or IPv6).  Returns an empty string if there are no
+    // deferred changes for that version.
+    //
+    // This is used with --noflush, so only the chains declared here are
+    // flushed.  Declaring a chain that already exists flushes it, so each
+    // chain is then populated with its complete new content:
+    // - an anchor chain has one jump to the content chain if it's enabled, or
+    //   is empty if it's disabled
+    // - a rule chain has the anchor's rules
+    // Since the whole table is committed at once, this replaces a rule chain
+    // atomically without the rename used by IptInterface::replaceAnchor().
+    std::string deferredRestoreSection(IPVersion ip) const
+    {
+        const auto &pendingMap = (ip == IPVersion::IPv4 ? _pending4 : _pending6);
+        if(pendingMap.empty())
+            return {};
+
+        std::string chains, rules;
+        for(const auto &pair : pendingMap)
+        {
+            const auto &anchorInfo{getAnchorInfo(ip, pair.first)};
+            const PendingAnchor &pending{pair.second};
+            if(pending.enabled)
+            {
+                chains += qs::format(":% - [0:0]\n", anchorInfo.anchorChain);
+                if(pending.enabled.get())
+                    rules += qs::format("-A % -j %\n", anchorInfo.anchorChain, anchorInfo.actualChain);
+            }
+            if(pending.rules)
+            {
+                chains += qs::format(":% - [0:0]\n", anchorInfo.ruleChain);
+                for(const auto &rule : pending.rules.get())
+                    rules += qs::format("-A % %\n", anchorInfo.ruleChain, rule);
+            }
+        }
+
+        return qs::format("*%\n%%COMMIT\n", _tableName, chains, rules);
+    }
+
+    // Apply the deferred changes for one IP version individually, as if they
+    // hadn't been deferred.  Used if iptables-restore fails.
+    void applyDeferred(IPVersion ip)
+    {
+        const auto &pendingMap = (ip == IPVersion::IPv4 ? _pending4 : _pending6);
+        for(const auto &pair : pendingMap)
+        {
+            const auto &anchorInfo{getAnchorInfo(ip, pair.first)};
+            const PendingAnchor &pending{pair.second};
+            if(pending.rules)
+                _iptInterface.replaceAnchor(ip, anchorInfo, pending.rules.get());
+            if(pending.enabled && pending.enabled.get())
+                _iptInterface.enableAnchor(ip, anchorInfo);
+            else if(pending.enabled)
+                _iptInterface.disableAnchor(ip, anchorInfo);
+        }
+    }
 
-    void ensureRootAnchorPriority()
+    void clearDeferred()
     {
+        _pending4.clear();
+        _pending6.clear();
+    }
+
+    // Ensure the root chains are linked first in the built-in chains for one IP
+    // version.  firstRules are the current first rules from iptables-save;
+    // root chains that are already first aren't touched.  Returns true if any
+    // root chain had to be relinked.
+    bool ensureRootAnchorPriority(IPVersion ip, const FirstRuleMap &firstRules)
+    {
+        bool relinked{false};
         for(auto rootChain : _rootChains)
         {
-            _iptInterface.linkChain(IPVersion::Both, rootChainNameFor(rootChain), kChainMap.at(rootChain), true);
+            const std::string &builtinChain{kChainMap.at(rootChain)};
+            auto itFirstRule = firstRules.find({_tableName, builtinChain});
+            if(itFirstRule != firstRules.end() &&
+                itFirstRule->second == qs::format("-A % -j %", builtinChain, rootChainNameFor(rootChain)))
+            {
+                continue;
+            }
+            _iptInterface.linkChain(ip, rootChainNameFor(rootChain), builtinChain, true);
+            relinked = true;
         }
+        return relinked;
+    }
+
+private:
+    // Deferred changes to an anchor.  Only the final state matters, so a
+    // later change replaces an earlier one.
+    struct PendingAnchor
+    {
+        kapps::core::nullable_t<bool> enabled;
+        kapps::core::nullable_t<std::vector<std::string>> rules;
+    };
+    // Keyed by anchor name like AnchorMap
+    using PendingMap = std::map<std::string, PendingAnchor, std::greater<std::string>>;
+
+    // Apply a deferred change to the anchor in each IP version where it's
+    // defined
+    template<class UpdateFunc>
+    void forEachPendingAnchor(IPVersion ip, const std::string &anchorName, UpdateFunc update)
+    {
+        if(ip != IPVersion::IPv6 && _anchorMap4.count(anchorName))
+            update(_pending4[anchorName]);
+        if(ip != IPVersion::IPv4 && _anchorMap6.count(anchorName))
+            update(_pending6[anchorName]);
     }
 
 private:
@@ -577,6 +732,8 @@ private:
     std::string _tableName;
     AnchorMap _anchorMap4;
     AnchorMap _anchorMap6;
+    PendingMap _pending4;
+    PendingMap _pending6;
     std::set<ChainEnum> _rootChains;
     IptInterface _iptInterface;
 };
@@ -611,6 +768,15 @@ public:
     void updateRules(const kapps::net::FirewallParams &params);
     void updateBypassSubnets(IPVersion ipVersion, const std::unordered_set<std::string> &bypassSubnets, std::unordered_set<std::string> &oldBypassSubnets);
 
+    void beginUpdate();
+    void commitUpdate();
+    // Whether anchor changes made on this thread should be deferred to
+    // commitUpdate()
+    bool deferUpdates() const {return _updateThread.load() == std::this_thread::get_id();}
+
+    // Model of the last requested state of each anchor
+    AnchorModel &anchorModel() {return _anchorModel;}
+
     std::string existingDNS();
 
 public:
@@ -618,6 +784,11 @@ public:
     const kapps::net::Routing &routing() const {return _cgroup.routing();}
     const std::string &hnsdGroupName() const { return _hnsdGroupName; }
 
+private:
+    // Add or delete the routing policy rules for LAN traffic and forwarded
+    // packets
+    void updatePolicyRules(bool add);
+
 private:
     // Last state used by updateRules(); allows us to detect when the rules must
     // be updated
@@ -635,6 +806,16 @@ private:
     Table<TableEnum::Nat> _natTable;
     Table<TableEnum::Mangle> _mangleTable;
     Table<TableEnum::Raw> _rawTable;
+
+    kapps::net::LinuxRouteManager _routeManager;
+
+    // Thread that called beginUpdate(), if an update is in progress.  (A
+    // default-constructed id doesn't match any thread.)
+    std::atomic<std::thread::id> _updateThread;
+
+    // Last requested state of each anchor, used to skip changes that don't
+    // affect the anchor
+    AnchorModel _anchorModel;
 };
 
 IpTablesFirewall::IpTablesFirewall(const kapps::net::FirewallConfig &config)
@@ -686,40 +867,62 @@ void IpTablesFirewall::ensureRootAnchorPriority(IPVersion ip)
 
 void IpTablesFirewall::setAnchorEnabled(TableEnum tableType, IPVersion ip, const std::string &anchorName, bool enabled) const
 {
+    // Only apply the change in the IP versions where it does something
+    auto changedIp = _pImpl->anchorModel().updateEnabled(tableType, ip, anchorName, enabled);
+    if(!changedIp)
+        return;
+    ip = changedIp.get();
+
     switch(tableType)
     {
         case TableEnum::Filter:
-            _pImpl->filterTable().setAnchorEnabled(ip, anchorName, enabled);
+            _pImpl->filterTable().setAnchorEnabled(ip, anchorName, enabled, _pImpl->deferUpdates());
             break;
         case TableEnum::Nat:
-            _pImpl->natTable().setAnchorEnabled(ip, anchorName, enabled);
+            _pImpl->natTable().setAnchorEnabled(ip, anchorName, enabled, _pImpl->deferUpdates());
             break;
         case TableEnum::Mangle:
-            _pImpl->mangleTable().setAnchorEnabled(ip, anchorName, enabled);
+            _pImpl->mangleTable().setAnchorEnabled(ip, anchorName, enabled, _pImpl->deferUpdates());
             break;
         case TableEnum::Raw:
-            _pImpl->rawTable().setAnchorEnabled(ip, anchorName, enabled);
+            _pImpl->rawTable().setAnchorEnabled(ip, anchorName, enabled, _pImpl->deferUpdates());
             break;
     }
 }
 
-void IpTablesFirewall::replaceAnchor(TableEnum tableType, IPVersion ip, const std::string &anchorName, const std::vector<std::string> &newRules) const
+bool IpTablesFirewall::replaceAnchor(TableEnum tableType, IPVersion ip, const std::string &anchorName, const std::vector<std::string> &newRules) const
 {
+    auto changedIp = _pImpl->anchorModel().updateRules(tableType, ip, anchorName, newRules);
+    if(!changedIp)
+        return false;
+    ip = changedIp.get();
+
     switch(tableType)
     {
         case TableEnum::Filter:
-            _pImpl->filterTable().replaceAnchor(ip, anchorName, newRules);
+            _pImpl->filterTable().replaceAnchor(ip, anchorName, newRules, _pImpl->deferUpdates());
             break;
         case TableEnum::Nat:
-            _pImpl->natTable().replaceAnchor(ip, anchorName, newRules);
+            _pImpl->natTable().replaceAnchor(ip, anchorName, newRules, _pImpl->deferUpdates());
             break;
         case TableEnum::Mangle:
-            _pImpl->mangleTable().replaceAnchor(ip, anchorName, newRules);
+            _pImpl->mangleTable().replaceAnchor(ip, anchorName, newRules, _pImpl->deferUpdates());
             break;
         case TableEnum::Raw:
-            _pImpl->rawTable().replaceAnchor(ip, anchorName, newRules);
+            _pImpl->rawTable().replaceAnchor(ip, anchorName, newRules, _pImpl->deferUpdates());
             break;
     }
+    return true;
+}
+
+void IpTablesFirewall::beginUpdate()
+{
+    _pImpl->beginUpdate();
+}
+
+void IpTablesFirewall::commitUpdate()
+{
+    _pImpl->commitUpdate();
 }
 
 IpTablesFirewall::Impl::Impl(const kapps::net::FirewallConfig &config)
@@ -871,11 +1074,13 @@ IpTablesFirewall::Impl::Impl(const kapps::net::FirewallConfig &config)
             // To be replaced at runtime
             "-j ACCEPT"
         });
+
 }
 
 void IpTablesFirewall::Impl::install()
 {
-    // Clean up any existing rules if they exist.
+    // Clean up any existing rules if they exist.  (This also clears the anchor
+    // model.)
     uninstall();
 
     _filterTable.install();
@@ -897,28 +1102,44 @@ void IpTablesFirewall::Impl::install()
     //
     // Note that we use "suppress_prefixlength 1", not 0 as is typical, because
     // we also suppress the /1 gateway override routes applied by OpenVPN.
-    kapps::core::Exec::bash(qs::format("ip rule add lookup main suppress_prefixlength 1 prio %", kapps::net::Routing::Priorities::suppressedMain));
-    kapps::core::Exec::bash(qs::format("ip -6 rule add lookup main suppress_prefixlength 1 prio %", kapps::net::Routing::Priorities::suppressedMain));
-
-    // Route forwarded packets
-    kapps::core::Exec::bash(qs::format("ip rule add from all fwmark % lookup % prio %", 
-        fwmark().forwardedPacketTag(), routing().forwardedTable(), kapps::net::Routing::Priorities::forwarded));
-    kapps::core::Exec::bash(qs::format("ip -6 rule add from all fwmark % lookup % prio %", 
-        fwmark().forwardedPacketTag(), routing().forwardedTable(), kapps::net::Routing::Priorities::forwarded));
+    //
+    // Forwarded packets are also routed with their own table.
+    updatePolicyRules(true);
 }
 
-void IpTablesFirewall::Impl::uninstall()
+void IpTablesFirewall::Impl::updatePolicyRules(bool add)
 {
-    namespace Exec = kapps::core::Exec;
+    using Family = kapps::net::LinuxRouteManager::Family;
+    using Rule = kapps::net::LinuxRouteManager::Rule;
+
+    kapps::net::LinuxRouteManager::Batch batch;
+    for(Family family : {Family::IPv4, Family::IPv6})
+    {
+        Rule lanRule{family, {}, {}, "main", kapps::net::Routing::Priorities::suppressedMain, 1};
+        Rule forwardedRule{family, {}, fwmark().forwardedPacketTag(), routing().forwardedTable(),
+                           kapps::net::Routing::Priorities::forwarded, -1};
+        if(add)
+        {
+            batch.addRule(std::move(lanRule));
+            batch.addRule(std::move(forwardedRule));
+        }
+        else
+        {
+            batch.deleteRule(std::move(lanRule));
+            batch.deleteRule(std::move(forwardedRule));
+        }
+    }
+    _routeManager.apply(batch);
+}
 
-    Exec::bash(qs::format("ip rule del lookup main suppress_prefixlength 1 prio %", kapps::net::Routing::Priorities::suppressedMain));
-    Exec::bash(qs::format("ip -6 rule del lookup main suppress_prefixlength 1 prio %", kapps::net::Routing::Priorities::suppressedMain));
+void IpTablesFirewall::Impl::uninstall()
+{
+    // The state of the anchors is no longer known; all changes will be applied
+    // after the anchors are reinstalled
+    _anchorModel.clear();
 
-    // Remove forwarded packets policy
-    Exec::bash(qs::format("ip rule del from all fwmark % lookup % prio %",
-        fwmark().forwardedPacketTag(), routing().forwardedTable(), kapps::net::Routing::Priorities::forwarded));
-    Exec::bash(qs::format("ip -6 rule del from all fwmark % lookup % prio %",
-        fwmark().forwardedPacketTag(), routing().forwardedTable(), kapps::net::Routing::Priorities::forwarded));
+    // Remove the LAN and forwarded packets policies
+    updatePolicyRules(false);
 
     _filterTable.uninstall();
     _natTable.uninstall();
@@ -938,10 +1159,87 @@ bool IpTablesFirewall::Impl::isInstalled() const
 
 void IpTablesFirewall::Impl::ensureRootAnchorPriority(IPVersion ip)
 {
-    _filterTable.ensureRootAnchorPriority();
-    _natTable.ensureRootAnchorPriority();
-    _mangleTable.ensureRootAnchorPriority();
-    _rawTable.ensureRootAnchorPriority();
+    if(ip == IPVersion::Both)
+    {
+        ensureRootAnchorPriority(IPVersion::IPv4);
+        ensureRootAnchorPriority(IPVersion::IPv6);
+        return;
+    }
+
+    // Check the current rules with one iptables-save, so root chains are only
+    // relinked if something has displaced them.  If this fails, nothing is
+    // found, and all root chains are relinked.
+    const FirstRuleMap firstRules{parseFirstRules(kapps::core::Exec::cmdWithOutput(getSaveCommand(ip), {}))};
+    bool relinked = _filterTable.ensureRootAnchorPriority(ip, firstRules);
+    relinked = _natTable.ensureRootAnchorPriority(ip, firstRules) || relinked;
+    relinked = _mangleTable.ensureRootAnchorPriority(ip, firstRules) || relinked;
+    relinked = _rawTable.ensureRootAnchorPriority(ip, firstRules) || relinked;
+
+    // Whatever displaced the root chains (another firewall reloading its
+    // rules, etc.) may have changed our chains too, so the anchors no longer
+    // necessarily match the model.  Apply every anchor again on the next
+    // update.
+    if(relinked)
+    {
+        KAPPS_CORE_INFO() << "Relinked root chains, clearing anchor model";
+        _anchorModel.clear();
+    }
+}
+
+void IpTablesFirewall::Impl::beginUpdate()
+{
+    _anchorModel.resetCounts();
+
+    assert(_updateThread.load() == std::thread::id{});  // Updates don't nest
+    _updateThread = std::this_thread::get_id();
+}
+
+void IpTablesFirewall::Impl::commitUpdate()
+{
+    KAPPS_CORE_INFO() << "Committing firewall update:" << _anchorModel.changedCount()
+        << "anchor changes," << _anchorModel.unchangedCount() << "unchanged";
+
+    assert(deferUpdates());
+    _updateThread = std::thread::id{};
+
+    for(IPVersion ip : {IPVersion::IPv4, IPVersion::IPv6})
+    {
+        std::string restoreInput = _filterTable.deferredRestoreSection(ip) +
+            _natTable.deferredRestoreSection(ip) +
+            _mangleTable.deferredRestoreSection(ip) +
+            _rawTable.deferredRestoreSection(ip);
+        if(restoreInput.empty())
+            continue;
+
+        // Pass the input in a here-document; the quoted delimiter prevents
+        // any expansion of the rules.
+        int result = execute(qs::format("% -w --noflush <<'KAPPS_IPTABLES_RESTORE'\n%KAPPS_IPTABLES_RESTORE",
+                                        getRestoreCommand(ip), restoreInput));
+        if(result != 0)
+        {
+            // iptables-restore commits each table's section separately, so the
+            // tables before the one that failed may have been applied already.
+            // This can happen if iptables-restore doesn't support -w or the
+            // anchors are missing; fall back to applying all of the changes
+            // individually.  Replacing, enabling, or disabling an anchor again
+            // leaves it in the same state, so this is fine for the tables that
+            // were committed.
+            KAPPS_CORE_WARNING() << getRestoreCommand(ip) << "failed with result"
+                << result << "- applying changes individually";
+            _filterTable.applyDeferred(ip);
+            _natTable.applyDeferred(ip);
+            _mangleTable.applyDeferred(ip);
+            _rawTable.applyDeferred(ip);
+            // Individual changes might fail too, so don't rely on the model
+            // for the next update
+            _anchorModel.clear();
+        }
+    }
+
+    _filterTable.clearDeferred();
+    _natTable.clearDeferred();
+    _mangleTable.clearDeferred();
+    _rawTable.clearDeferred();
 }
 
 int IpTablesFirewall::Impl::execute(const std::string &command, bool ignoreErrors)
@@ -24,8 +24,10 @@
 #include "../firewallparams.h"
 #include <kapps_core/src/util.h>
 #include <unordered_set>
+#include <map>
 #include <memory>
 #include <string>
+#include <utility>
 #include "../firewall.h"
 
 enum class TableEnum
@@ -38,6 +40,16 @@ enum class TableEnum
 
 template <TableEnum tableType> class Table;
 
+namespace iptables
+{
+    // The first rule in each chain from iptables-save output - keys are
+    // (table, chain), values are the rule as printed by iptables-save (i.e.
+    // "-A OUTPUT -j piavpn.OUTPUT").  Empty chains aren't included.
+    using FirstRuleMap = std::map<std::pair<std::string, std::string>, std::string>;
+
+    FirstRuleMap KAPPS_NET_EXPORT parseFirstRules(const std::string &savedRules);
+}
+
 class IpTablesFirewall
 {
 private:
@@ -61,8 +73,25 @@ public:
     void ensureRootAnchorPriority(IPVersion ip = Both);
     void updateRules(const kapps::net::FirewallParams &params);
     void updateBypassSubnets(IPVersion ipVersion, const std::unordered_set<std::string> &bypassSubnets, std::unordered_set<std::string> &oldBypassSubnets);
+    // Enable/disable or replace an anchor.  The last state requested for each
+    // anchor is kept, and changes that don't affect it are skipped, so callers
+    // can just request the state they want each time.  replaceAnchor()
+    // returns true if the request changed the anchor's rules.
     void setAnchorEnabled(TableEnum tableType, IPVersion ip, const std::string &anchorName, bool enabled) const;
-    void replaceAnchor(TableEnum tableType, IPVersion ip, const std::string &anchorName, const std::vector<std::string> &newRules) const;
+    bool replaceAnchor(TableEnum tableType, IPVersion ip, const std::string &anchorName, const std::vector<std::string> &newRules) const;
+
+    // Batch anchor changes.  Between beginUpdate() and commitUpdate(),
+    // setAnchorEnabled() and replaceAnchor() calls made on this thread only
+    // record the desired state of each anchor.  commitUpdate() applies all of
+    // them with one iptables-restore per IP version.  iptables-restore commits
+    // each table separately, so the changes within a table take effect
+    // together, but the filter, nat, mangle, and raw changes don't take effect
+    // at exactly the same time.  If nothing changed, nothing is run.
+    //
+    // Calls made from other threads (such as ProcTracker on the split tunnel
+    // thread) are still applied immediately.
+    void beginUpdate();
+    void commitUpdate();
 
 public:
     const std::string& hnsdGroupName() const;
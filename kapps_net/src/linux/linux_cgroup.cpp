@@ -20,10 +20,13 @@
 #include <kapps_core/src/logger.h>
 #include "linux_fwmark.h"
 #include "linux_routing.h"
+#include "linux_routemanager.h"
 #include "linux_proc_fs.h"
 #include <kapps_core/src/posix/posix_objects.h>
 #include <kapps_core/src/newexec.h>
 #include <kapps_core/src/fs.h>
+#include <unordered_set>
+#include <vector>
 
 namespace fs = kapps::core::fs;
 
@@ -31,21 +34,27 @@ namespace kapps { namespace net {
 
 namespace
 {
-    void setupCgroup(const std::string &cGroupDir, const std::string &cGroupId, const std::string &packetTag, const std::string &routingTableName, int priority)
+    LinuxRouteManager::Rule cgroupRule(const std::string &packetTag, const std::string &routingTableName, int priority)
+    {
+        return {LinuxRouteManager::Family::IPv4, {}, packetTag, routingTableName,
+                static_cast<std::uint32_t>(priority), -1};
+    }
+
+    void setupCgroup(LinuxRouteManager::Batch &routeBatch, const std::string &cGroupDir, const std::string &cGroupId, const std::string &packetTag, const std::string &routingTableName, int priority)
     {
         KAPPS_CORE_INFO() << "Attempting to set up cgroups in" << cGroupDir << "for traffic splitting";
 
         // Create the net_cls group
         core::Exec::bash(qs::format("if [ ! -d % ] ; then mkdir % ; sleep 0.1 ; echo % > %/net_cls.classid ; fi", cGroupDir, cGroupDir, cGroupId, cGroupDir));
-        core::Exec::bash(qs::format("if ! ip rule list | grep -q % ; then ip rule add from all fwmark % lookup % pri % ; fi", packetTag, packetTag, routingTableName, priority));
+        // Adding a rule that already exists has no effect
+        routeBatch.addRule(cgroupRule(packetTag, routingTableName, priority));
     }
 
-    void teardownCgroup(const std::string &packetTag, const std::string &routingTableName)
+    void teardownCgroup(LinuxRouteManager::Batch &routeBatch, const std::string &packetTag, const std::string &routingTableName, int priority)
     {
         KAPPS_CORE_INFO() << "Tearing down cgroup and routing rules";
-        core::Exec::bash(qs::format("if ip rule list | grep -q %; then ip rule del from all fwmark % lookup % 2> /dev/null ; fi", packetTag, packetTag, routingTableName));
-        core::Exec::bash(qs::format("ip route flush table %", routingTableName));
-        core::Exec::bash("ip route flush cache");
+        routeBatch.deleteRule(cgroupRule(packetTag, routingTableName, priority));
+        routeBatch.flushTable(LinuxRouteManager::Family::IPv4, routingTableName);
     }
 
     bool mountNetCls(const std::string &netClsDir)
@@ -58,21 +67,23 @@ namespace
         fs::writeString(cGroupPath, std::to_string(pid));
     }
 
-    void addChildPidsToCgroup(pid_t parentPid, const std::string &cGroupPath)
-    {
-        for(pid_t pid : ProcFs::childPidsOf(parentPid))
-        {
-            KAPPS_CORE_INFO() << "Adding child pid" << pid;
-            CGroup::addPidToCgroup(pid, cGroupPath);
-        }
-    }
-
-    void removeChildPidsFromCgroup(pid_t parentPid, const std::string &cGroupPath)
+    // Call func for each descendant of parentPid (children, children of
+    // children, etc.)
+    template<class Func_T>
+    void forEachDescendant(const ProcFs::ProcessTable &processes, pid_t parentPid, Func_T func)
     {
-        for(pid_t pid : ProcFs::childPidsOf(parentPid))
+        std::vector<pid_t> pending{processes.childPidsOf(parentPid)};
+        // Guards against a cycle if the table is out of date (a reused pid)
+        std::unordered_set<pid_t> visited{parentPid};
+        while(!pending.empty())
         {
-            KAPPS_CORE_INFO() << "Removing child pid" << pid << cGroupPath;
-            CGroup::removePidFromCgroup(pid, cGroupPath);
+            pid_t pid = pending.back();
+            pending.pop_back();
+            if(!visited.insert(pid).second)
+                continue;
+            func(pid);
+            for(pid_t childPid : processes.childPidsOf(pid))
+                pending.push_back(childPid);
         }
     }
 }
@@ -97,17 +108,24 @@ void CGroupIds::setupNetCls()
     // Split tunnel (exclusions) - we want the bypass rule to have lower priority than the vpnOnly rule (see Routing::Priorities)
     // so that an app set to vpnOnly has all its packets sent over the VPN even if a bypass rule (such as a subnet bypass) would otherwise
     // allow those packets to escape the VPN. "vpnOnly" should always win.
-    setupCgroup(bypassDir, _bypassId, _fwmark.excludePacketTag(), _routing.bypassTable(),
+    LinuxRouteManager::Batch routeBatch;
+    setupCgroup(routeBatch, bypassDir, _bypassId, _fwmark.excludePacketTag(), _routing.bypassTable(),
         Routing::Priorities::bypass);
     // Inverse split tunnel (vpn only)
-    setupCgroup(vpnOnlyDir, _vpnOnlyId, _fwmark.vpnOnlyPacketTag(), _routing.vpnOnlyTable(),
+    setupCgroup(routeBatch, vpnOnlyDir, _vpnOnlyId, _fwmark.vpnOnlyPacketTag(), _routing.vpnOnlyTable(),
         Routing::Priorities::vpnOnly);
+    LinuxRouteManager{}.apply(routeBatch);
 }
 
 void CGroupIds::teardownNetCls()
 {
-    teardownCgroup(_fwmark.excludePacketTag(), _routing.bypassTable());
-    teardownCgroup(_fwmark.vpnOnlyPacketTag(), _routing.vpnOnlyTable());
+    LinuxRouteManager::Batch routeBatch;
+    teardownCgroup(routeBatch, _fwmark.excludePacketTag(), _routing.bypassTable(),
+        Routing::Priorities::bypass);
+    teardownCgroup(routeBatch, _fwmark.vpnOnlyPacketTag(), _routing.vpnOnlyTable(),
+        Routing::Priorities::vpnOnly);
+    LinuxRouteManager{}.apply(routeBatch);
+    LinuxRouteManager::flushCache();
 }
 
 namespace CGroup
@@ -184,19 +202,27 @@ namespace CGroup
         }
     }
 
-    void addPidToCgroup(pid_t pid, const std::string &cGroupPath)
+    void addPidToCgroup(const ProcFs::ProcessTable &processes, pid_t pid, const std::string &cGroupPath)
     {
         writePidToCGroup(pid, cGroupPath);
         // Add child processes (NOTE: we also recurse through child processes of child processes)
-        addChildPidsToCgroup(pid, cGroupPath);
+        forEachDescendant(processes, pid, [&](pid_t childPid)
+        {
+            KAPPS_CORE_INFO() << "Adding child pid" << childPid;
+            writePidToCGroup(childPid, cGroupPath);
+        });
     }
 
-    void removePidFromCgroup(pid_t pid, const std::string &cGroupPath)
+    void removePidFromCgroup(const ProcFs::ProcessTable &processes, pid_t pid, const std::string &cGroupPath)
     {
         // We remove a PID from a cgroup by adding it to its parent cgroup
         writePidToCGroup(pid, cGroupPath);
         // Remove child processes (NOTE: we also recurse through child processes of child processes)
-        removeChildPidsFromCgroup(pid, cGroupPath);
+        forEachDescendant(processes, pid, [&](pid_t childPid)
+        {
+            KAPPS_CORE_INFO() << "Removing child pid" << childPid << cGroupPath;
+            writePidToCGroup(childPid, cGroupPath);
+        });
     }
 }
 
@@ -19,6 +19,7 @@
 #pragma once
 #include "linux_fwmark.h"
 #include "linux_routing.h"
+#include "linux_proc_fs.h"
 #include "../firewallconfig.h"
 #include <kapps_net/net.h>
 #include <kapps_core/src/util.h>
@@ -78,8 +79,10 @@ namespace CGroup
     // Actually make the net_cls cgroup directory and mount the VFS.
     // This function is only called if the host system does not already have a net_cls VFS
     bool KAPPS_NET_EXPORT createNetCls(const std::string &netClsDir, const std::string &mountsFile="/proc/mounts");
-    void KAPPS_NET_EXPORT addPidToCgroup(pid_t pid, const std::string &cGroupPath);
-    void KAPPS_NET_EXPORT removePidFromCgroup(pid_t pid, const std::string &cGroupPath);
+    // Add or remove a process and its descendants (found in the process
+    // table) to/from a cgroup
+    void KAPPS_NET_EXPORT addPidToCgroup(const ProcFs::ProcessTable &processes, pid_t pid, const std::string &cGroupPath);
+    void KAPPS_NET_EXPORT removePidFromCgroup(const ProcFs::ProcessTable &processes, pid_t pid, const std::string &cGroupPath);
 };
 
 }}
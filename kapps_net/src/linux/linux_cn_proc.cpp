@@ -27,6 +27,7 @@
 #include <sys/types.h>
 #include <kapps_core/src/newexec.h>
 #include <unistd.h>
+#include <cerrno>
 
 namespace kapps { namespace net {
 
@@ -164,7 +165,10 @@ void CnProc::readFromSocket()
 
     if(received < 0)
     {
-        KAPPS_CORE_WARNING() << "Failed receiving from socket -" << kapps::core::ErrnoTracer{};
+        int error = errno;
+        KAPPS_CORE_WARNING() << "Failed receiving from socket -" << kapps::core::ErrnoTracer{error};
+        if(error == ENOBUFS)
+            eventsLost();
         return;
     }
 
@@ -184,6 +188,11 @@ void CnProc::readFromSocket()
         KAPPS_CORE_INFO() << "Listening to process events";
         connected();
         break;
+    case proc_event::PROC_EVENT_FORK:
+        // Ignore new threads, a new process is its own thread group leader
+        if(eventData.fork.child_pid == eventData.fork.child_tgid)
+            fork(eventData.fork.parent_tgid, eventData.fork.child_pid);
+        break;
     case proc_event::PROC_EVENT_EXEC:
         exec(eventData.exec.process_pid);
         break;
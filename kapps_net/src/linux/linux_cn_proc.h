@@ -55,12 +55,20 @@ public:
     // not generate any events.
     core::Signal<> connected;
 
+    // A process has forked - (parent pid, child pid).  New threads are not
+    // reported.
+    core::Signal<pid_t, pid_t> fork;
+
     // A process exec() has occurred
     core::Signal<pid_t> exec;
 
     // A process exit has occurred
     core::Signal<pid_t> exit;
 
+    // Events were dropped because the socket's receive buffer overflowed, so
+    // any state tracked from events is out of date
+    core::Signal<> eventsLost;
+
 private:
     core::PosixFd _cnSock;
     core::PosixFdNotifier _cnSockNotifier;
@@ -31,12 +31,6 @@ namespace
 {
     // for convenience
     using IPVersion = IpTablesFirewall::IPVersion;
-
-    // Define the location of the rt_tables files
-    const std::string etcRoutingLocation{"/etc/iproute2/rt_tables"};
-    const std::string libRoutingLocation{"/usr/lib/iproute2/rt_tables"};
-    // Used by iproute2 versions >= 6.7.0
-    const std::string shareRoutingLocation{"/usr/share/iproute2/rt_tables"};
 }
 
 LinuxFirewall::LinuxFirewall(FirewallConfig config)
@@ -52,7 +46,7 @@ LinuxFirewall::LinuxFirewall(FirewallConfig config)
     // We do this here rather than in the installer as there is some complexity involved.
     RtTablesInitializer rtTablesInitializer{
         _config.brandInfo.code,
-        {etcRoutingLocation, {shareRoutingLocation, libRoutingLocation}}
+        RtTablesInitializer::RtLocations::system()
     };
     rtTablesInitializer.install();
 
@@ -79,6 +73,10 @@ void LinuxFirewall::applyRules(const FirewallParams &params)
 
     _pFilter->ensureRootAnchorPriority();
 
+    // Collect all anchor changes and apply them together (one iptables-restore
+    // per IP version) rather than running commands for each change
+    _pFilter->beginUpdate();
+
     _pFilter->setAnchorEnabled(TableEnum::Filter, IPVersion::Both, "999.allowLoopback", params.allowLoopback);
     _pFilter->setAnchorEnabled(TableEnum::Filter, IPVersion::Both, "100.blockAll", params.blockAll);
     _pFilter->setAnchorEnabled(TableEnum::Filter, IPVersion::Both, "200.allowVPN", params.allowVPN);
@@ -125,6 +123,8 @@ void LinuxFirewall::applyRules(const FirewallParams &params)
 
     updateRules(params);
 
+    _pFilter->commitUpdate();
+
     updateForwardedRoutes(params, params.enableSplitTunnel && !params.routedPacketsOnVPN);
 
     toggleSplitTunnel(params);
@@ -185,45 +185,46 @@ void LinuxFirewall::updateRules(const FirewallParams &params)
     KAPPS_CORE_INFO() << "VPN interface:" << adapterName;
     const std::string &ipAddress6 = params.netScan.ipAddress6();
 
+    // Every anchor is computed from the current parameters each time.
+    // IpTablesFirewall keeps the state of each anchor and skips changes that
+    // don't affect it, so nothing is written when nothing has changed.
+    // replaceAnchor() returns true only if the anchor changed, which is when
+    // the changes are logged.
+
     // These rules only depend on the adapter name
-    if(adapterName != _adapterName)
+    if(adapterName.empty())
     {
-        if(adapterName.empty())
-        {
-            // Don't know the adapter name, wipe out the rules
-            KAPPS_CORE_INFO() << "Clearing allowVPN and allowHnsd rules, adapter name is not known";
-            _pFilter->replaceAnchor(TableEnum::Filter, IPVersion::Both, ("200.allowVPN"), {});
-            _pFilter->replaceAnchor(TableEnum::Filter, IPVersion::Both, ("350.allowHnsd"), {});
-        }
-        else
-        {
-            _pFilter->replaceAnchor(TableEnum::Filter, IPVersion::Both, ("200.allowVPN"), { qs::format("-o % -j ACCEPT", adapterName) });
-            _pFilter->replaceAnchor(TableEnum::Filter, IPVersion::Both, ("350.allowHnsd"), {
-                qs::format("-m owner --gid-owner % -o % -p tcp --match multiport --dports 53,13038 -j ACCEPT", _pFilter->hnsdGroupName(), adapterName),
-                qs::format("-m owner --gid-owner % -o % -p udp --match multiport --dports 53,13038 -j ACCEPT", _pFilter->hnsdGroupName(), adapterName),
-                qs::format("-m owner --gid-owner % -j REJECT", _pFilter->hnsdGroupName()),
-            });
-        }
+        // Don't know the adapter name, wipe out the rules
+        bool changed = _pFilter->replaceAnchor(TableEnum::Filter, IPVersion::Both, ("200.allowVPN"), {});
+        changed = _pFilter->replaceAnchor(TableEnum::Filter, IPVersion::Both, ("350.allowHnsd"), {}) || changed;
+        if(changed)
+            KAPPS_CORE_INFO() << "Cleared allowVPN and allowHnsd rules, adapter name is not known";
+    }
+    else
+    {
+        _pFilter->replaceAnchor(TableEnum::Filter, IPVersion::Both, ("200.allowVPN"), { qs::format("-o % -j ACCEPT", adapterName) });
+        _pFilter->replaceAnchor(TableEnum::Filter, IPVersion::Both, ("350.allowHnsd"), {
+            qs::format("-m owner --gid-owner % -o % -p tcp --match multiport --dports 53,13038 -j ACCEPT", _pFilter->hnsdGroupName(), adapterName),
+            qs::format("-m owner --gid-owner % -o % -p udp --match multiport --dports 53,13038 -j ACCEPT", _pFilter->hnsdGroupName(), adapterName),
+            qs::format("-m owner --gid-owner % -j REJECT", _pFilter->hnsdGroupName()),
+        });
     }
 
-    if(ipAddress6 != _ipAddress6)
+    if(ipAddress6.empty())
     {
-        if(ipAddress6.empty())
-        {
-            KAPPS_CORE_INFO() << "Clearing out allowIPv6Prefix rule, no global IPv6 addresses found";
-            _pFilter->replaceAnchor(TableEnum::Filter, IPVersion::IPv6, ("299.allowIPv6Prefix"), {});
-        }
-        else
-        {
-            // First 64 bits is the IPv6 Network Prefix. This prefix is shared by all IPv6 hosts on the LAN,
-            // so whitelisting it allows those hosts to communicate
-            _pFilter->replaceAnchor(TableEnum::Filter, IPVersion::IPv6, ("299.allowIPv6Prefix"),
-                          { qs::format("-d %/64 -j ACCEPT", ipAddress6)});
-        }
+        if(_pFilter->replaceAnchor(TableEnum::Filter, IPVersion::IPv6, ("299.allowIPv6Prefix"), {}))
+            KAPPS_CORE_INFO() << "Cleared out allowIPv6Prefix rule, no global IPv6 addresses found";
+    }
+    else
+    {
+        // First 64 bits is the IPv6 Network Prefix. This prefix is shared by all IPv6 hosts on the LAN,
+        // so whitelisting it allows those hosts to communicate
+        _pFilter->replaceAnchor(TableEnum::Filter, IPVersion::IPv6, ("299.allowIPv6Prefix"),
+                      { qs::format("-d %/64 -j ACCEPT", ipAddress6)});
     }
 
-    updateBypassSubnets(IPVersion::IPv4, params.bypassIpv4Subnets, _bypassIpv4Subnets);
-    updateBypassSubnets(IPVersion::IPv6, params.bypassIpv6Subnets, _bypassIpv6Subnets);
+    updateBypassSubnets(IPVersion::IPv4, params.bypassIpv4Subnets);
+    updateBypassSubnets(IPVersion::IPv6, params.bypassIpv6Subnets);
 
     // Manage DNS for forwarded packets
     SplitDNSInfo::SplitDNSType routedDns = SplitDNSInfo::SplitDNSType::VpnOnly;
@@ -237,38 +238,38 @@ void LinuxFirewall::updateRules(const FirewallParams &params)
 
     // Since we can't control where routed DNS is addressed, always create rules
     // to force it to the DNS server specified.
-    if(routedDnsInfo != _routedDnsInfo)
+    if(routedDnsInfo.isValid())
     {
-        if(routedDnsInfo.isValid())
+        bool changed = _pFilter->replaceAnchor(TableEnum::Nat, IPVersion::IPv4, "90.fwdSnatDNS", {
+            qs::format("-p udp --match mark --mark % -m udp --dport 53 -j SNAT --to-source %",
+                _pFilter->fwmark().forwardedPacketTag(), routedDnsInfo.sourceIp()),
+            qs::format("-p tcp --match mark --mark % -m tcp --dport 53 -j SNAT --to-source %",
+                _pFilter->fwmark().forwardedPacketTag(), routedDnsInfo.sourceIp())
+            });
+
+        changed = _pFilter->replaceAnchor(TableEnum::Nat, IPVersion::IPv4, "80.fwdSplitDNS", {
+            qs::format("-p udp --match mark --mark % -m udp --dport 53 -j DNAT --to-destination %:53",
+                _pFilter->fwmark().forwardedPacketTag(), routedDnsInfo.dnsServer()),
+            qs::format("-p tcp --match mark --mark % -m tcp --dport 53 -j DNAT --to-destination %:53",
+                _pFilter->fwmark().forwardedPacketTag(), routedDnsInfo.dnsServer()),
+            }) || changed;
+
+        if(changed)
         {
             KAPPS_CORE_INFO() << "Sending routed DNS to DNS server"
                 << routedDnsInfo.dnsServer() << "via source IP" << routedDnsInfo.sourceIp();
-            _pFilter->replaceAnchor(TableEnum::Nat, IPVersion::IPv4, "90.fwdSnatDNS", {
-                qs::format("-p udp --match mark --mark % -m udp --dport 53 -j SNAT --to-source %",
-                    _pFilter->fwmark().forwardedPacketTag(), routedDnsInfo.sourceIp()),
-                qs::format("-p tcp --match mark --mark % -m tcp --dport 53 -j SNAT --to-source %",
-                    _pFilter->fwmark().forwardedPacketTag(), routedDnsInfo.sourceIp())
-                });
-
-            _pFilter->replaceAnchor(TableEnum::Nat, IPVersion::IPv4, "80.fwdSplitDNS", {
-                qs::format("-p udp --match mark --mark % -m udp --dport 53 -j DNAT --to-destination %:53",
-                    _pFilter->fwmark().forwardedPacketTag(), routedDnsInfo.dnsServer()),
-                qs::format("-p tcp --match mark --mark % -m tcp --dport 53 -j DNAT --to-destination %:53",
-                    _pFilter->fwmark().forwardedPacketTag(), routedDnsInfo.dnsServer()),
-                });
-
         }
-        else
-        {
-            KAPPS_CORE_INFO() << qs::format("Not creating routed packet DNS rules, received empty value dnsServer: %, sourceIp: %", routedDnsInfo.dnsServer(), routedDnsInfo.sourceIp());
-            _pFilter->replaceAnchor(TableEnum::Nat, IPVersion::IPv4, "90.fwdSnatDNS",
-                          {});
+    }
+    else
+    {
+        bool changed = _pFilter->replaceAnchor(TableEnum::Nat, IPVersion::IPv4, "90.fwdSnatDNS",
+                      {});
 
-            _pFilter->replaceAnchor(TableEnum::Nat, IPVersion::IPv4, "80.fwdSplitDNS",
-                          {});
-        }
+        changed = _pFilter->replaceAnchor(TableEnum::Nat, IPVersion::IPv4, "80.fwdSplitDNS",
+                      {}) || changed;
 
-        _routedDnsInfo = routedDnsInfo;
+        if(changed)
+            KAPPS_CORE_INFO() << qs::format("Not creating routed packet DNS rules, received empty value dnsServer: %, sourceIp: %", routedDnsInfo.dnsServer(), routedDnsInfo.sourceIp());
     }
 
     // Manage split tunnel DNS.
@@ -300,109 +301,109 @@ void LinuxFirewall::updateRules(const FirewallParams &params)
     //
     // appDnsInfo tells us which type of apps must be forced - whichever rule is
     // the opposite of the "all other apps" behavior.
-    if(appDnsInfo != _appDnsInfo)
+    if(appDnsInfo.isValid())
     {
-        if(appDnsInfo.isValid())
+        bool changed = _pFilter->replaceAnchor(TableEnum::Nat, IPVersion::IPv4, ("90.snatDNS"), {
+            qs::format("-p udp -m cgroup --cgroup % -m udp --dport 53 -j SNAT --to-source %", appDnsInfo.cGroupId(), appDnsInfo.sourceIp()),
+            qs::format("-p tcp -m cgroup --cgroup % -m tcp --dport 53 -j SNAT --to-source %", appDnsInfo.cGroupId(), appDnsInfo.sourceIp()),
+        });
+
+        changed = _pFilter->replaceAnchor(TableEnum::Nat, IPVersion::IPv4, ("80.splitDNS"), {
+            qs::format("-p udp -m cgroup --cgroup % -m udp --dport 53 -j DNAT --to-destination %:53", appDnsInfo.cGroupId(), appDnsInfo.dnsServer()),
+            qs::format("-p tcp -m cgroup --cgroup % -m tcp --dport 53 -j DNAT --to-destination %:53", appDnsInfo.cGroupId(), appDnsInfo.dnsServer()),
+        }) || changed;
+
+        if(changed)
         {
-            KAPPS_CORE_INFO() << qs::format("Updating split tunnel DNS due to network change: dnsServer: %, cgroupId %, sourceIp %",
+            KAPPS_CORE_INFO() << qs::format("Updated split tunnel DNS due to network change: dnsServer: %, cgroupId %, sourceIp %",
                 appDnsInfo.dnsServer(), appDnsInfo.cGroupId(), appDnsInfo.sourceIp());
-            _pFilter->replaceAnchor(TableEnum::Nat, IPVersion::IPv4, ("90.snatDNS"), {
-                qs::format("-p udp -m cgroup --cgroup % -m udp --dport 53 -j SNAT --to-source %", appDnsInfo.cGroupId(), appDnsInfo.sourceIp()),
-                qs::format("-p tcp -m cgroup --cgroup % -m tcp --dport 53 -j SNAT --to-source %", appDnsInfo.cGroupId(), appDnsInfo.sourceIp()),
-            });
+        }
+    }
+    else
+    {
+        bool changed = _pFilter->replaceAnchor(TableEnum::Nat, IPVersion::IPv4, "90.snatDNS", {});
 
-            _pFilter->replaceAnchor(TableEnum::Nat, IPVersion::IPv4, ("80.splitDNS"), {
-                qs::format("-p udp -m cgroup --cgroup % -m udp --dport 53 -j DNAT --to-destination %:53", appDnsInfo.cGroupId(), appDnsInfo.dnsServer()),
-                qs::format("-p tcp -m cgroup --cgroup % -m tcp --dport 53 -j DNAT --to-destination %:53", appDnsInfo.cGroupId(), appDnsInfo.dnsServer()),
-            });
+        changed = _pFilter->replaceAnchor(TableEnum::Nat, IPVersion::IPv4, "80.splitDNS", {}) || changed;
 
-        }
-        else
+        if(changed)
         {
-            KAPPS_CORE_INFO() << qs::format("Clear split tunnel DNS rules, don't have all information: dnsServer: %, cgroupId %, sourceIp %",
+            KAPPS_CORE_INFO() << qs::format("Cleared split tunnel DNS rules, don't have all information: dnsServer: %, cgroupId %, sourceIp %",
                 appDnsInfo.dnsServer(), appDnsInfo.cGroupId(), appDnsInfo.sourceIp());
-            _pFilter->replaceAnchor(TableEnum::Nat, IPVersion::IPv4, "90.snatDNS", {});
-
-            _pFilter->replaceAnchor(TableEnum::Nat, IPVersion::IPv4, "80.splitDNS", {});
         }
     }
 
-    // DNS rules depend on both adapters and DNS servers, update if either has
-    // changed
-    if(params.effectiveDnsServers != _dnsServers || adapterName != _adapterName || appDnsInfo != _appDnsInfo)
-    {
-        // If the adapter name isn't set, getDNSRules() returns an empty list
-        std::vector<std::string> effectiveDnsRules = getDNSRules(adapterName, params.effectiveDnsServers);
+    // DNS rules depend on the adapter, DNS servers, and split tunnel DNS.
+    // If the adapter name isn't set, getDNSRules() returns an empty list
+    std::vector<std::string> effectiveDnsRules = getDNSRules(adapterName, params.effectiveDnsServers);
 
-        std::vector<std::string> ruleList;
+    std::vector<std::string> ruleList;
 
-        // When DNS rules are being applied, and split tunnel DNS is enabled,
-        // create rules to permit forced apps to use the forced DNS.
-        // Also create leak protection rules to ensure apps do not leak to the
-        // wrong DNS.
-        //
-        // Without the leak protection rules, it is possible for apps to reuse a
-        // local port for a DNS request that was recently used by an app of a
-        // different type (within the conntrack timeout), which could allow an
-        // app to leak to the wrong DNS.
-        //
-        // (DNS rules are not applied when not connected, or when the DNS type
-        // is "use existing" - ST DNS has no effect with "use existing" since
-        // both VPN and non-VPN DNS are the same.)
-        if(!effectiveDnsRules.empty() && params.splitTunnelDnsEnabled)
-        {
-            // Only one server is used
-            const auto &forcedDnsServer = appDnsInfo.dnsServer();
-            const auto &forcedDnsCgroup = appDnsInfo.cGroupId();
+    // When DNS rules are being applied, and split tunnel DNS is enabled,
+    // create rules to permit forced apps to use the forced DNS.
+    // Also create leak protection rules to ensure apps do not leak to the
+    // wrong DNS.
+    //
+    // Without the leak protection rules, it is possible for apps to reuse a
+    // local port for a DNS request that was recently used by an app of a
+    // different type (within the conntrack timeout), which could allow an
+    // app to leak to the wrong DNS.
+    //
+    // (DNS rules are not applied when not connected, or when the DNS type
+    // is "use existing" - ST DNS has no effect with "use existing" since
+    // both VPN and non-VPN DNS are the same.)
+    if(!effectiveDnsRules.empty() && params.splitTunnelDnsEnabled)
+    {
+        // Only one server is used
+        const auto &forcedDnsServer = appDnsInfo.dnsServer();
+        const auto &forcedDnsCgroup = appDnsInfo.cGroupId();
 
-            if(!forcedDnsCgroup.empty())
+        if(!forcedDnsCgroup.empty())
+        {
+            // Permit forced apps to reach the forced DNS.
+            if(!forcedDnsServer.empty())
+            {
+                ruleList.push_back(qs::format("-p udp -m cgroup --cgroup % -m udp --dport 53 -d % -j ACCEPT", forcedDnsCgroup, forcedDnsServer));
+                ruleList.push_back(qs::format("-p tcp -m cgroup --cgroup % -m tcp --dport 53 -d % -j ACCEPT", forcedDnsCgroup, forcedDnsServer));
+            }
+            // Block forced apps from any other DNS.
+            // Doing this prevents a forced app re-using a port/route used
+            // by a different type of app
+            ruleList.push_back(qs::format("-p udp -m cgroup --cgroup % -m udp --dport 53 -j REJECT", forcedDnsCgroup));
+            ruleList.push_back(qs::format("-p tcp -m cgroup --cgroup % -m tcp --dport 53 -j REJECT", forcedDnsCgroup));
+
+            // Reject non-forced apps from using forced DNS (prevents a
+            // different type of app re-using a port/route from a forced app)
+            if(!forcedDnsServer.empty())
             {
-                // Permit forced apps to reach the forced DNS.
-                if(!forcedDnsServer.empty())
-                {
-                    ruleList.push_back(qs::format("-p udp -m cgroup --cgroup % -m udp --dport 53 -d % -j ACCEPT", forcedDnsCgroup, forcedDnsServer));
-                    ruleList.push_back(qs::format("-p tcp -m cgroup --cgroup % -m tcp --dport 53 -d % -j ACCEPT", forcedDnsCgroup, forcedDnsServer));
-                }
-                // Block forced apps from any other DNS.
-                // Doing this prevents a forced app re-using a port/route used
-                // by a different type of app
-                ruleList.push_back(qs::format("-p udp -m cgroup --cgroup % -m udp --dport 53 -j REJECT", forcedDnsCgroup));
-                ruleList.push_back(qs::format("-p tcp -m cgroup --cgroup % -m tcp --dport 53 -j REJECT", forcedDnsCgroup));
-
-                // Reject non-forced apps from using forced DNS (prevents a
-                // different type of app re-using a port/route from a forced app)
-                if(!forcedDnsServer.empty())
-                {
-                    // Use "not the forced cgroup" instead of "the other cgroup"
-                    // - When the VPN has the default route, VPN-only apps
-                    //   aren't placed into a cgroup.
-                    // - This also includes "default behavior" apps - although
-                    //   no leaks have been observed this way, this is most
-                    //   robust.
-                    ruleList.push_back(qs::format("-p udp -m cgroup ! --cgroup % -m udp --dport 53 -d % -j REJECT", forcedDnsCgroup, forcedDnsServer));
-                    ruleList.push_back(qs::format("-p tcp -m cgroup ! --cgroup % -m tcp --dport 53 -d % -j REJECT", forcedDnsCgroup, forcedDnsServer));
-                }
+                // Use "not the forced cgroup" instead of "the other cgroup"
+                // - When the VPN has the default route, VPN-only apps
+                //   aren't placed into a cgroup.
+                // - This also includes "default behavior" apps - although
+                //   no leaks have been observed this way, this is most
+                //   robust.
+                ruleList.push_back(qs::format("-p udp -m cgroup ! --cgroup % -m udp --dport 53 -d % -j REJECT", forcedDnsCgroup, forcedDnsServer));
+                ruleList.push_back(qs::format("-p tcp -m cgroup ! --cgroup % -m tcp --dport 53 -d % -j REJECT", forcedDnsCgroup, forcedDnsServer));
             }
         }
-
-        // Permit apps that get through all of the cgroup filters (above) to
-        // reach the configured DNS.
-        //
-        // This must occur after cgroup filtering when ST DNS is enabled.
-        // Otherwise, when not using systemd-resolved, this could defeat the
-        // leak protection above.
-        for(auto &dnsRule : effectiveDnsRules)
-            ruleList.push_back(std::move(dnsRule));
-
-        // Re-allow localhost DNS now we've plugged the leaks.
-        // localhost DNS is important for systemd which uses a 127.0.0.53 DNS proxy
-        // for all DNS traffic.
-        ruleList.push_back("-o lo+ -p udp -m udp --dport 53 -j ACCEPT");
-        ruleList.push_back("-o lo+ -p tcp -m tcp --dport 53 -j ACCEPT");
-
-        _pFilter->replaceAnchor(TableEnum::Filter, IPVersion::IPv4, "320.allowDNS", ruleList);
     }
 
+    // Permit apps that get through all of the cgroup filters (above) to
+    // reach the configured DNS.
+    //
+    // This must occur after cgroup filtering when ST DNS is enabled.
+    // Otherwise, when not using systemd-resolved, this could defeat the
+    // leak protection above.
+    for(auto &dnsRule : effectiveDnsRules)
+        ruleList.push_back(std::move(dnsRule));
+
+    // Re-allow localhost DNS now we've plugged the leaks.
+    // localhost DNS is important for systemd which uses a 127.0.0.53 DNS proxy
+    // for all DNS traffic.
+    ruleList.push_back("-o lo+ -p udp -m udp --dport 53 -j ACCEPT");
+    ruleList.push_back("-o lo+ -p tcp -m tcp --dport 53 -j ACCEPT");
+
+    _pFilter->replaceAnchor(TableEnum::Filter, IPVersion::IPv4, "320.allowDNS", ruleList);
+
     // Enable localhost routing
     // Without this option we cannot route our DNS packet if the source IP was
     // originally localhost, this is because the routing decision
@@ -411,11 +412,6 @@ void LinuxFirewall::updateRules(const FirewallParams &params)
         enableRouteLocalNet();
     else
         disableRouteLocalNet();
-
-    _appDnsInfo = appDnsInfo;
-    _adapterName = adapterName;
-    _ipAddress6 = ipAddress6;
-    _dnsServers = params.effectiveDnsServers;
 }
 
 bool LinuxFirewall::updateVpnTunOnlyAnchor(bool hasConnected, std::string tunnelDeviceName, std::string tunnelDeviceLocalAddress)
@@ -445,34 +441,43 @@ bool LinuxFirewall::updateVpnTunOnlyAnchor(bool hasConnected, std::string tunnel
 
 void LinuxFirewall::updateForwardedRoutes(const FirewallParams &params, bool shouldBypassVpn)
 {
+    using Family = LinuxRouteManager::Family;
     const auto &netScan = params.netScan;
+    const std::string &forwardedTable = _pFilter->routing().forwardedTable();
+
+    // All of the forwarded routes are updated with one netlink batch
+    LinuxRouteManager::Batch batch;
 
     // If routed traffic is configured to bypass, create the default gateway
     // route in this table all the time, which ensures that it isn't briefly
     // routed into the VPN while the connection is coming up.
     if(shouldBypassVpn)
-        kapps::core::Exec::bash(qs::format("ip route replace default via % dev % table %", netScan.gatewayIp(), netScan.interfaceName(), _pFilter->routing().forwardedTable()));
+        batch.replaceRoute({Family::IPv4, "default", netScan.gatewayIp(), netScan.interfaceName(), forwardedTable, 0, false});
     // Otherwise, create the VPN route for this traffic once connected.  This
     // doesn't need to be active while disconnected - the "use VPN" mode of
     // routed traffic intentionally permits traffic when disconnected, setting
     // KS=Always blocks it correctly with the blackhole route if desired.
     else if(params.hasConnected)
-        kapps::core::Exec::bash(qs::format("ip route replace default dev % table %", params.tunnelDeviceName, _pFilter->routing().forwardedTable()));
+        batch.replaceRoute({Family::IPv4, "default", {}, params.tunnelDeviceName, forwardedTable, 0, false});
     // Routed = Use VPN, and not connected
     else
-        kapps::core::Exec::bash(qs::format("ip route delete default table %", _pFilter->routing().forwardedTable()));
+        batch.deleteRoute({Family::IPv4, "default", {}, {}, forwardedTable, 0, false});
 
     // Add blackhole fall-back route to block all forwarded traffic if killswitch is on (and disconnected)
+    const LinuxRouteManager::Route blackhole4{Family::IPv4, "default", {}, {}, forwardedTable, 32000, true};
     if(params.leakProtectionEnabled)
-        kapps::core::Exec::bash(qs::format("ip route replace blackhole default metric 32000 table %", _pFilter->routing().forwardedTable()));
+        batch.replaceRoute(blackhole4);
     else
-        kapps::core::Exec::bash(qs::format("ip route delete blackhole default metric 32000 table %", _pFilter->routing().forwardedTable()));
+        batch.deleteRoute(blackhole4);
 
     // Blackhole IPv6 for forwarded connections too, for IPv6 leak protection and killswitch
+    const LinuxRouteManager::Route blackhole6{Family::IPv6, "default", {}, {}, forwardedTable, 32000, true};
     if(params.blockIPv6)
-        kapps::core::Exec::bash(qs::format("ip -6 route replace blackhole default metric 32000 table %", _pFilter->routing().forwardedTable()));
+        batch.replaceRoute(blackhole6);
     else
-        kapps::core::Exec::bash(qs::format("ip -6 route delete blackhole default metric 32000 table %", _pFilter->routing().forwardedTable()));
+        batch.deleteRoute(blackhole6);
+
+    _routeManager.apply(batch);
 }
 
 
@@ -546,64 +551,59 @@ void LinuxFirewall::disableRouteLocalNet()
     _routeLocalNet = "";
 }
 
-void LinuxFirewall::updateBypassSubnets(IPVersion ipVersion, const std::set<std::string> &bypassSubnets, std::set<std::string> &oldBypassSubnets)
+void LinuxFirewall::updateBypassSubnets(IPVersion ipVersion, const std::set<std::string> &bypassSubnets)
 {
-    if(bypassSubnets != oldBypassSubnets)
+    if(bypassSubnets.empty())
     {
-        if(bypassSubnets.empty())
-        {
-            std::string versionString = (ipVersion == IPVersion::IPv6 ? "IPv6" : "IPv4");
-            KAPPS_CORE_INFO() << "Clearing out" << versionString << "allowSubnets rule, no subnets found";
-            _pFilter->replaceAnchor(TableEnum::Filter, ipVersion, ("305.allowSubnets"), {});
+        std::string versionString = (ipVersion == IPVersion::IPv6 ? "IPv6" : "IPv4");
+        if(_pFilter->replaceAnchor(TableEnum::Filter, ipVersion, ("305.allowSubnets"), {}))
+            KAPPS_CORE_INFO() << "Cleared out" << versionString << "allowSubnets rule, no subnets found";
 
-            // Clear out the rules for tagging bypass subnet packets
-            if(ipVersion == IPVersion::IPv4)
-            {
-                KAPPS_CORE_INFO() << "Clearing out 90.tagSubnets";
-                _pFilter->replaceAnchor(TableEnum::Mangle, ipVersion, ("90.tagSubnets"), {});
-            }
-            KAPPS_CORE_INFO() << "Clearing out 200.tagFwdSubnets";
-            _pFilter->replaceAnchor(TableEnum::Mangle, ipVersion, ("200.tagFwdSubnets"), {});
-        }
-        else
+        // Clear out the rules for tagging bypass subnet packets
+        if(ipVersion == IPVersion::IPv4 &&
+            _pFilter->replaceAnchor(TableEnum::Mangle, ipVersion, ("90.tagSubnets"), {}))
         {
-            std::vector<std::string> subnetAcceptRules;
-            for(const auto &subnet : bypassSubnets)
-                subnetAcceptRules.push_back(qs::format("-d % -j ACCEPT", subnet));
-
-
-            // If there's any IPv6 addresses then we also need to whitelist link-local and broadcast
-            // as these address ranges are needed for IPv6 Neighbor Discovery.
-            if(ipVersion == IPVersion::IPv6)
-            {
-                subnetAcceptRules.push_back(qs::format("-d fe80::/10 -j ACCEPT"));
-                subnetAcceptRules.push_back(qs::format("-d ff00::/8 -j ACCEPT"));
-            }
+            KAPPS_CORE_INFO() << "Cleared out 90.tagSubnets";
+        }
+        if(_pFilter->replaceAnchor(TableEnum::Mangle, ipVersion, ("200.tagFwdSubnets"), {}))
+            KAPPS_CORE_INFO() << "Cleared out" << versionString << "200.tagFwdSubnets";
+    }
+    else
+    {
+        std::vector<std::string> subnetAcceptRules;
+        for(const auto &subnet : bypassSubnets)
+            subnetAcceptRules.push_back(qs::format("-d % -j ACCEPT", subnet));
 
-            _pFilter->replaceAnchor(TableEnum::Filter, ipVersion, "305.allowSubnets", subnetAcceptRules);
 
-            std::vector<std::string> subnetMarkRules;
-            for(const auto &subnet : bypassSubnets)
-            {
-                subnetMarkRules.push_back(qs::format("-d % -j MARK --set-mark %", subnet,
-                    _pFilter->fwmark().excludePacketTag()));
-            }
-            // We tag all packets heading towards a bypass subnet. This tag (excludePacketTag) is
-            // used by our routing policies to route traffic outside the VPN.
-            if(ipVersion == IPVersion::IPv4)
-            {
-                KAPPS_CORE_INFO() << "Setting 90.tagSubnets";
+        // If there's any IPv6 addresses then we also need to whitelist link-local and broadcast
+        // as these address ranges are needed for IPv6 Neighbor Discovery.
+        if(ipVersion == IPVersion::IPv6)
+        {
+            subnetAcceptRules.push_back(qs::format("-d fe80::/10 -j ACCEPT"));
+            subnetAcceptRules.push_back(qs::format("-d ff00::/8 -j ACCEPT"));
+        }
 
-                _pFilter->replaceAnchor(TableEnum::Mangle, ipVersion, "90.tagSubnets", subnetMarkRules);
-            }
+        _pFilter->replaceAnchor(TableEnum::Filter, ipVersion, "305.allowSubnets", subnetAcceptRules);
 
-            // For routed connections to bypassed subnets, apply the
-            // bypass mark so they will always be routed to the original
-            // gateway, regardless of the routed connection setting.
-            _pFilter->replaceAnchor(TableEnum::Mangle, ipVersion, "200.tagFwdSubnets", subnetMarkRules);
+        std::vector<std::string> subnetMarkRules;
+        for(const auto &subnet : bypassSubnets)
+        {
+            subnetMarkRules.push_back(qs::format("-d % -j MARK --set-mark %", subnet,
+                _pFilter->fwmark().excludePacketTag()));
         }
+        // We tag all packets heading towards a bypass subnet. This tag (excludePacketTag) is
+        // used by our routing policies to route traffic outside the VPN.
+        if(ipVersion == IPVersion::IPv4 &&
+            _pFilter->replaceAnchor(TableEnum::Mangle, ipVersion, "90.tagSubnets", subnetMarkRules))
+        {
+            KAPPS_CORE_INFO() << "Set 90.tagSubnets";
+        }
+
+        // For routed connections to bypassed subnets, apply the
+        // bypass mark so they will always be routed to the original
+        // gateway, regardless of the routed connection setting.
+        _pFilter->replaceAnchor(TableEnum::Mangle, ipVersion, "200.tagFwdSubnets", subnetMarkRules);
     }
-    oldBypassSubnets = bypassSubnets;
 }
 
 std::string SplitDNSInfo::existingDNS(const std::vector<uint32_t> &existingDNSServers)
@@ -26,6 +26,7 @@
 #include "linux_cgroup.h"
 #include "proc_tracker.h"
 #include "iptables_firewall.h"
+#include "linux_routemanager.h"
 #include "../originalnetworkscan.h"
 
 namespace kapps { namespace net {
@@ -94,7 +95,7 @@ private:
     void disableRouteLocalNet();
     bool updateVpnTunOnlyAnchor(bool hasConnected, std::string tunnelDeviceName, std::string tunnelDeviceLocalAddress);
     void updateForwardedRoutes(const FirewallParams &params, bool shouldBypassVpn);
-    void updateBypassSubnets(IpTablesFirewall::IPVersion ipVersion, const std::set<std::string> &bypassSubnets, std::set<std::string> &oldBypassSubnets);
+    void updateBypassSubnets(IpTablesFirewall::IPVersion ipVersion, const std::set<std::string> &bypassSubnets);
 
 protected:
     virtual void startSplitTunnel(const FirewallParams& params) override;
@@ -105,15 +106,9 @@ private:
     FirewallConfig _config;
     std::string _executableDir;
     core::nullable_t<IpTablesFirewall> _pFilter;
-    std::string _adapterName;
-    std::string _ipAddress6;
-    std::vector<std::string> _dnsServers;
     std::string _routeLocalNet;
-    std::set<std::string> _bypassIpv4Subnets;
-    std::set<std::string> _bypassIpv6Subnets;
     core::nullable_t<CGroupIds> _pCgroup;
-    SplitDNSInfo _routedDnsInfo;    // Last behavior applied for routed packet DNS
-    SplitDNSInfo _appDnsInfo;   // Last behavior applied for app DNS (either bypass or VPN only)
+    LinuxRouteManager _routeManager;
 
     // Split tunnel process tracker - only created when split tunnel is active.
     // This runs on _pSplitTunnelWorker, so we can only manipulate it by
@@ -17,19 +17,80 @@
 // <https://www.gnu.org/licenses/>.
 
 #include "linux_proc_fs.h"
+#include <kapps_core/src/logger.h>
+#include <kapps_core/src/posix/posix_objects.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
 #include <unistd.h>
+#include <cstdio>
+#include <cstring>
 
 namespace ProcFs
 {
 
-std::unordered_set<pid_t> pidsForPath(const std::string &path, bool silent)
+namespace
 {
-    return filterPids([&](pid_t pid) { return pathForPid(pid, silent) == path; });
-}
+    // Buffer size for getdents64(); each entry in /proc is about 24-32 bytes
+    constexpr std::size_t kDirentBufferSize{32768};
+    // Enough to hold /proc/<pid>/stat up to the parent pid - the command name
+    // is at most 16 characters
+    constexpr std::size_t kStatReadSize{128};
 
-std::unordered_set<pid_t> childPidsOf(pid_t parentPid, bool silent)
-{
-    return filterPids([&](pid_t pid) { return isChildOf(parentPid, pid, silent); });
+    // Parse a pid from a /proc directory name; returns 0 if the name isn't a
+    // pid (like "self" or "sys")
+    pid_t parsePid(const char *name)
+    {
+        pid_t pid{0};
+        for(; *name; ++name)
+        {
+            if(*name < '0' || *name > '9')
+                return 0;
+            pid = pid * 10 + (*name - '0');
+        }
+        return pid;
+    }
+
+    // List the pids in /proc.  getdents64() is used directly to list the whole
+    // directory in a few large reads without allocating a string per entry.
+    std::vector<pid_t> listPids()
+    {
+        std::vector<pid_t> pids;
+        kapps::core::PosixFd procDir{::open(kProcDirName.c_str(), O_RDONLY|O_DIRECTORY|O_CLOEXEC)};
+        if(!procDir)
+        {
+            KAPPS_CORE_WARNING() << "Unable to open" << kProcDirName << "-"
+                << kapps::core::ErrnoTracer{};
+            return pids;
+        }
+
+        pids.reserve(1024);
+        std::vector<unsigned char> buffer(kDirentBufferSize);
+        while(true)
+        {
+            long received = ::syscall(SYS_getdents64, procDir.get(), buffer.data(), buffer.size());
+            if(received < 0)
+            {
+                KAPPS_CORE_WARNING() << "Unable to list" << kProcDirName << "-"
+                    << kapps::core::ErrnoTracer{};
+                break;
+            }
+            if(received == 0)
+                break;
+
+            for(long offset = 0; offset < received;)
+            {
+                auto pEntry = reinterpret_cast<const dirent64*>(buffer.data() + offset);
+                offset += pEntry->d_reclen;
+                if(pEntry->d_type != DT_DIR)
+                    continue;
+                pid_t pid = parsePid(pEntry->d_name);
+                if(pid > 0)
+                    pids.push_back(pid);
+            }
+        }
+        return pids;
+    }
 }
 
 std::string pathForPid(pid_t pid, bool silent)
@@ -42,22 +103,190 @@ std::string mountNamespaceId(pid_t pid, bool silent)
     return kapps::core::fs::readLink(qs::format("%/%/ns/mnt", kProcDirName, pid), silent);
 }
 
-bool isChildOf(pid_t parentPid, pid_t pid, bool silent)
+pid_t parentPidOf(pid_t pid, bool silent)
+{
+    std::string statContent{kapps::core::fs::readString(qs::format("%/%/stat", kProcDirName, pid),
+                                                        kStatReadSize, silent)};
+    // The content is like "1234 (bash) S 1000 ...".  The command name can
+    // contain spaces and parentheses, so the fields start after the last ')'.
+    auto commEnd = statContent.rfind(')');
+    if(commEnd == std::string::npos)
+        return -1;
+
+    int parentPid{-1};
+    if(std::sscanf(statContent.c_str() + commEnd + 1, " %*c %d", &parentPid) != 1)
+        return -1;
+    return parentPid;
+}
+
+void ProcessTable::scan()
+{
+    _processes.clear();
+    _children.clear();
+    _pidsByPath.clear();
+
+    for(pid_t pid : listPids())
+    {
+        // Kernel threads don't have an executable, but they're still included
+        // so the tree is complete.  Processes that exit during the scan are
+        // skipped.
+        pid_t parentPid = parentPidOf(pid, true);
+        if(parentPid < 0)
+            continue;
+        add(pid, {parentPid, ProcFs::pathForPid(pid, true), {}});
+    }
+
+    KAPPS_CORE_INFO() << "Scanned" << _processes.size() << "processes";
+}
+
+void ProcessTable::processForked(pid_t parentPid, pid_t childPid)
+{
+    // The child is running the parent's executable until it execs.  If the
+    // parent isn't known, read the child's executable.
+    std::string path;
+    const Process *pParent = find(parentPid);
+    if(pParent)
+        path = pParent->path;
+    else
+        path = ProcFs::pathForPid(childPid, true);
+    // A new mount namespace can be created with clone(), so it's not
+    // inherited here
+    add(childPid, {parentPid, std::move(path), {}});
+}
+
+void ProcessTable::processExec(pid_t pid)
+{
+    auto itProcess = _processes.find(pid);
+    if(itProcess == _processes.end())
+    {
+        // Missed the fork, read the parent too
+        pid_t parentPid = parentPidOf(pid, true);
+        if(parentPid < 0)
+            return; // Already exited
+        add(pid, {parentPid, ProcFs::pathForPid(pid, true), {}});
+        return;
+    }
+
+    setPath(pid, itProcess->second, ProcFs::pathForPid(pid, true));
+    itProcess->second.mountNamespaceId.clear();
+}
+
+void ProcessTable::processExited(pid_t pid)
+{
+    auto itChildren = _children.find(pid);
+    if(itChildren != _children.end())
+    {
+        // The children have been reparented to init or a subreaper; read
+        // their new parent.  (Take the set, setParent() modifies _children.)
+        std::unordered_set<pid_t> orphans{std::move(itChildren->second)};
+        _children.erase(itChildren);
+        for(pid_t orphan : orphans)
+        {
+            auto itOrphan = _processes.find(orphan);
+            if(itOrphan != _processes.end())
+            {
+                pid_t newParentPid = parentPidOf(orphan, true);
+                setParent(orphan, itOrphan->second, newParentPid > 0 ? newParentPid : 0);
+            }
+        }
+    }
+
+    remove(pid);
+}
+
+auto ProcessTable::find(pid_t pid) const -> const Process *
+{
+    auto itProcess = _processes.find(pid);
+    return itProcess == _processes.end() ? nullptr : &itProcess->second;
+}
+
+std::string ProcessTable::pathForPid(pid_t pid) const
+{
+    const Process *pProcess = find(pid);
+    return pProcess ? pProcess->path : std::string{};
+}
+
+std::unordered_set<pid_t> ProcessTable::pidsForPath(const std::string &path) const
+{
+    auto itPids = _pidsByPath.find(path);
+    if(itPids == _pidsByPath.end())
+        return {};
+    return itPids->second;
+}
+
+std::vector<pid_t> ProcessTable::childPidsOf(pid_t parentPid) const
+{
+    auto itChildren = _children.find(parentPid);
+    if(itChildren == _children.end())
+        return {};
+    return {itChildren->second.begin(), itChildren->second.end()};
+}
+
+std::string ProcessTable::mountNamespaceId(pid_t pid)
 {
-    static const std::regex parentPidRegex{"PPid:\\s+([0-9]+)"};
+    auto itProcess = _processes.find(pid);
+    if(itProcess == _processes.end())
+        return ProcFs::mountNamespaceId(pid, true);
+
+    std::string &mountNamespaceId = itProcess->second.mountNamespaceId;
+    if(mountNamespaceId.empty())
+        mountNamespaceId = ProcFs::mountNamespaceId(pid, true);
+    return mountNamespaceId;
+}
 
-    std::string statusFile{qs::format("%/%/status", kProcDirName, pid)};
-    // 50 buffer size large enough to hold any pid
-    std::string statusContent{kapps::core::fs::readString(statusFile, 50, silent)};
-    std::smatch match;
+void ProcessTable::add(pid_t pid, Process process)
+{
+    // A pid can be reused if an exit was missed; replace the old process
+    remove(pid);
+    if(process.parentPid)
+        _children[process.parentPid].insert(pid);
+    if(!process.path.empty())
+        _pidsByPath[process.path].insert(pid);
+    _processes[pid] = std::move(process);
+}
 
-    std::regex_search(statusContent, match, parentPidRegex);
-    if(match.size() >= 2)
+void ProcessTable::remove(pid_t pid)
+{
+    auto itProcess = _processes.find(pid);
+    if(itProcess == _processes.end())
+        return;
+    setParent(pid, itProcess->second, 0);
+    setPath(pid, itProcess->second, {});
+    _processes.erase(itProcess);
+}
+
+void ProcessTable::setParent(pid_t pid, Process &process, pid_t parentPid)
+{
+    if(process.parentPid)
     {
-        auto foundParentPid = std::stoi(match.str(1));
-        return foundParentPid == parentPid;
+        auto itSiblings = _children.find(process.parentPid);
+        if(itSiblings != _children.end())
+        {
+            itSiblings->second.erase(pid);
+            if(itSiblings->second.empty())
+                _children.erase(itSiblings);
+        }
     }
+    process.parentPid = parentPid;
+    if(parentPid)
+        _children[parentPid].insert(pid);
+}
 
-    return false;
+void ProcessTable::setPath(pid_t pid, Process &process, std::string path)
+{
+    if(!process.path.empty())
+    {
+        auto itPids = _pidsByPath.find(process.path);
+        if(itPids != _pidsByPath.end())
+        {
+            itPids->second.erase(pid);
+            if(itPids->second.empty())
+                _pidsByPath.erase(itPids);
+        }
+    }
+    process.path = std::move(path);
+    if(!process.path.empty())
+        _pidsByPath[process.path].insert(pid);
 }
+
 }
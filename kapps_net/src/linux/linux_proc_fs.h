@@ -22,10 +22,10 @@
 #include <kapps_core/src/util.h>
 #include <string>
 #include <assert.h>
+#include <unordered_map>
 #include <unordered_set>
-#include <functional>
-#include <regex>
-#include <dirent.h>
+#include <vector>
+#include <sys/types.h>
 #include <kapps_core/src/fs.h>
 
 // Convenience functions for working with the Linux /proc VFS
@@ -33,12 +33,6 @@ namespace ProcFs
 {
     const std::string kProcDirName{"/proc"};
 
-    // Return all pids for the given executable path
-    std::unordered_set<pid_t> pidsForPath(const std::string &path, bool silent=false);
-
-    // Return all (immediate) children pids of parentPid
-    std::unordered_set<pid_t> childPidsOf(pid_t parentPid, bool silent=false);
-
     // Given a pid, return the launch path for the process.
     //
     // By default, errors from readlink() are traced, but this can be suppressed
@@ -54,29 +48,74 @@ namespace ProcFs
     // Currently, we only accept mount namespaces that match the mount namespace of pia-daemon
     std::string mountNamespaceId(pid_t pid, bool silent=false);
 
-    // Is pid a child of parentPid ?
-    bool isChildOf(pid_t parentPid, pid_t pid, bool silent=false);
+    // Given a pid, get the parent pid from /proc/<pid>/stat.  (init and
+    // kthreadd have parent pid 0.)  Returns -1 if it can't be read.
+    pid_t parentPidOf(pid_t pid, bool silent=false);
 
-    // Get all PIDs that satisfy a predicate.
-    template <typename Func_T>
-    std::unordered_set<pid_t> filterPids(Func_T filterFunc, bool silent=false)
+    // Snapshot of the process table - the path and parent of each process,
+    // with indices of each process's children and of the processes running
+    // each executable.
+    //
+    // scan() reads all of /proc in one pass; after that, the table is kept up
+    // to date with process events (from CnProc), so finding processes for an
+    // app or walking a process tree doesn't read /proc again.
+    //
+    // Threads aren't included, only processes (thread group leaders).
+    class KAPPS_NET_EXPORT ProcessTable
     {
-        static const std::regex pidRegex{"[1-9]+"};
-
-        std::unordered_set<pid_t> filteredPids;
-        // Filter the file list by directories
-        for(const auto &entry : kapps::core::fs::listFiles(kProcDirName, DT_DIR))
+    public:
+        struct Process
         {
-            // Filter by directories that represent a process (pid)
-            if(std::regex_search(entry, pidRegex))
-            {
-              pid_t pid = std::stoul(entry);
-              if(filterFunc(pid))
-                  filteredPids.insert(pid);
-            }
-        }
+            pid_t parentPid;    // 0 if the process has no parent
+            std::string path;
+            // Read when first needed (see mountNamespaceId()); empty if it
+            // hasn't been read
+            std::string mountNamespaceId;
+        };
+
+    public:
+        // Replace the table with the current content of /proc.  Errors for
+        // individual processes are not traced, transient processes often
+        // exit during the scan.
+        void scan();
+
+        // Process events.  A forked child has the same executable as its
+        // parent; exec re-reads the process's executable; processes that
+        // were children of an exiting process are reparented, so their parent
+        // is re-read.
+        void processForked(pid_t parentPid, pid_t childPid);
+        void processExec(pid_t pid);
+        void processExited(pid_t pid);
+
+        // Find a process, or nullptr if it's not in the table
+        const Process *find(pid_t pid) const;
+        std::size_t size() const {return _processes.size();}
+
+        // Executable path of a process, or "" if it isn't known
+        std::string pathForPid(pid_t pid) const;
+        // All pids for the given executable path
+        std::unordered_set<pid_t> pidsForPath(const std::string &path) const;
+        // The (immediate) children of parentPid
+        std::vector<pid_t> childPidsOf(pid_t parentPid) const;
+        // The mount namespace ID of a process.  This is read from /proc the
+        // first time it's needed after the process is added or execs, since
+        // it's only needed for processes that are split tunnel apps.
+        std::string mountNamespaceId(pid_t pid);
+
+    private:
+        void add(pid_t pid, Process process);
+        void remove(pid_t pid);
+        void setParent(pid_t pid, Process &process, pid_t parentPid);
+        void setPath(pid_t pid, Process &process, std::string path);
 
-        return filteredPids;
-    }
+    private:
+        std::unordered_map<pid_t, Process> _processes;
+        // Children of each process, by parent pid
+        std::unordered_map<pid_t, std::unordered_set<pid_t>> _children;
+        // Processes running each executable, by path.  Processes without a
+        // known path (kernel threads, or processes that exited before their
+        // path was read) aren't indexed.
+        std::unordered_map<std::string, std::unordered_set<pid_t>> _pidsByPath;
+    };
 
 } // namespace ProcFs
@@ -0,0 +1,474 @@
+// Copyright (c) 2024 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "linux_routemanager.h"
+#include "linux_rtnetlink.h"
+#include <kapps_core/core.h>
+#include <kapps_core/src/logger.h>
+#include <kapps_core/src/fs.h>
+#include <kapps_core/src/posix/posix_objects.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <cerrno>
+#include <cstring>
+#include <set>
+
+namespace kapps { namespace net {
+
+namespace
+{
+    using Family = LinuxRouteManager::Family;
+    using rtnetlink::Message;
+    using rtnetlink::Request;
+    using rtnetlink::addressFamily;
+    using rtnetlink::familyName;
+
+    // Timeout for each recv() while waiting for ACKs or a dump
+    constexpr int kReceiveTimeoutSec{5};
+    // Receive buffer size; dumps are split into messages of up to this size
+    constexpr std::size_t kReceiveBufferSize{65536};
+
+    // A NETLINK_ROUTE socket
+    class RtNetlinkSocket
+    {
+    public:
+        RtNetlinkSocket()
+            : _seq{0}
+        {
+            _sock = core::PosixFd{::socket(AF_NETLINK, SOCK_RAW|SOCK_CLOEXEC, NETLINK_ROUTE)};
+            if(!_sock)
+            {
+                KAPPS_CORE_WARNING() << "Failed to open rtnetlink socket -"
+                    << core::ErrnoTracer{};
+                return;
+            }
+
+            sockaddr_nl address{};
+            address.nl_family = AF_NETLINK;
+            if(::bind(_sock.get(), reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0)
+            {
+                KAPPS_CORE_WARNING() << "Failed to bind rtnetlink socket -"
+                    << core::ErrnoTracer{};
+                _sock = {};
+                return;
+            }
+
+            // Don't echo each request in its ACK, we only need the error code.
+            // Older kernels don't support this; the ACKs are just bigger.
+            int capAck{1};
+            ::setsockopt(_sock.get(), SOL_NETLINK, NETLINK_CAP_ACK, &capAck, sizeof(capAck));
+
+            timeval timeout{};
+            timeout.tv_sec = kReceiveTimeoutSec;
+            ::setsockopt(_sock.get(), SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        }
+
+        explicit operator bool() const {return static_cast<bool>(_sock);}
+
+    public:
+        // Send requests and wait for each ACK.  Returns true if all requests
+        // succeeded (or failed with a tolerated error).
+        bool send(const std::vector<Request> &requests)
+        {
+            bool success{true};
+            for(const auto &group : rtnetlink::sendGroups(requests.size()))
+            {
+                if(!sendGroup(requests, group.first, group.second))
+                    success = false;
+            }
+            return success;
+        }
+
+        // Dump all routes for an address family (in all tables).  Each
+        // element is a complete RTM_NEWROUTE message.
+        std::vector<std::vector<unsigned char>> dumpRoutes(Family family)
+        {
+            std::vector<std::vector<unsigned char>> routes;
+
+            rtmsg header{};
+            header.rtm_family = static_cast<unsigned char>(addressFamily(family));
+            Message dumpRequest{RTM_GETROUTE, NLM_F_DUMP, header};
+            std::vector<unsigned char> buffer;
+            std::uint32_t seq = ++_seq;
+            dumpRequest.appendTo(buffer, seq);
+            if(!sendBuffer(buffer))
+                return routes;
+
+            std::vector<unsigned char> response(kReceiveBufferSize);
+            while(true)
+            {
+                ssize_t received = ::recv(_sock.get(), response.data(), response.size(), 0);
+                if(received < 0)
+                {
+                    KAPPS_CORE_WARNING() << "Failed to receive" << familyName(family)
+                        << "route dump -" << core::ErrnoTracer{};
+                    return routes;
+                }
+
+                auto len = static_cast<std::uint32_t>(received);
+                for(auto pMsg = reinterpret_cast<nlmsghdr*>(response.data());
+                    NLMSG_OK(pMsg, len); pMsg = NLMSG_NEXT(pMsg, len))
+                {
+                    if(pMsg->nlmsg_seq != seq)
+                        continue;
+                    if(pMsg->nlmsg_type == NLMSG_DONE)
+                        return routes;
+                    if(pMsg->nlmsg_type == NLMSG_ERROR)
+                    {
+                        auto pErr = reinterpret_cast<nlmsgerr*>(NLMSG_DATA(pMsg));
+                        KAPPS_CORE_WARNING() << "Failed to dump" << familyName(family)
+                            << "routes -" << core::ErrnoTracer{-pErr->error};
+                        return routes;
+                    }
+                    if(pMsg->nlmsg_type == RTM_NEWROUTE)
+                    {
+                        auto pBegin = reinterpret_cast<unsigned char*>(pMsg);
+                        routes.emplace_back(pBegin, pBegin + pMsg->nlmsg_len);
+                    }
+                }
+            }
+        }
+
+    private:
+        bool sendBuffer(const std::vector<unsigned char> &buffer)
+        {
+            sockaddr_nl kernel{};
+            kernel.nl_family = AF_NETLINK;
+            kernel.nl_pid = 0;
+            if(::sendto(_sock.get(), buffer.data(), buffer.size(), 0,
+                        reinterpret_cast<sockaddr*>(&kernel), sizeof(kernel)) < 0)
+            {
+                KAPPS_CORE_WARNING() << "Failed to send rtnetlink request -"
+                    << core::ErrnoTracer{};
+                return false;
+            }
+            return true;
+        }
+
+        bool sendGroup(const std::vector<Request> &requests, std::size_t begin, std::size_t end)
+        {
+            // Sequence numbers in this group are firstSeq + (index - begin)
+            const std::uint32_t firstSeq = _seq + 1;
+            _seq += static_cast<std::uint32_t>(end - begin);
+            std::vector<unsigned char> buffer = rtnetlink::encodeGroup(requests, begin, end, firstSeq);
+
+            if(!sendBuffer(buffer))
+            {
+                for(std::size_t i = begin; i < end; ++i)
+                    KAPPS_CORE_WARNING() << "Not applied:" << requests[i].description;
+                return false;
+            }
+
+            bool success{true};
+            std::vector<bool> acked(end - begin);
+            std::size_t pending = end - begin;
+            std::vector<unsigned char> response(kReceiveBufferSize);
+            while(pending > 0)
+            {
+                ssize_t received = ::recv(_sock.get(), response.data(), response.size(), 0);
+                if(received < 0)
+                {
+                    KAPPS_CORE_WARNING() << "Failed to receive rtnetlink ACKs,"
+                        << pending << "changes unconfirmed -" << core::ErrnoTracer{};
+                    for(std::size_t i = 0; i < acked.size(); ++i)
+                    {
+                        if(!acked[i])
+                            KAPPS_CORE_WARNING() << "Unconfirmed:" << requests[begin + i].description;
+                    }
+                    return false;
+                }
+
+                auto len = static_cast<std::uint32_t>(received);
+                for(auto pMsg = reinterpret_cast<nlmsghdr*>(response.data());
+                    NLMSG_OK(pMsg, len); pMsg = NLMSG_NEXT(pMsg, len))
+                {
+                    if(pMsg->nlmsg_type != NLMSG_ERROR)
+                        continue;
+                    std::uint32_t index = pMsg->nlmsg_seq - firstSeq;
+                    if(index >= acked.size() || acked[index])
+                        continue;
+
+                    acked[index] = true;
+                    --pending;
+                    int error = -reinterpret_cast<nlmsgerr*>(NLMSG_DATA(pMsg))->error;
+                    const Request &request = requests[begin + index];
+                    if(error != 0 && request.toleratedErrors.count(error) == 0)
+                    {
+                        KAPPS_CORE_WARNING() << "Failed:" << request.description
+                            << "-" << core::ErrnoTracer{error};
+                        success = false;
+                    }
+                }
+            }
+            return success;
+        }
+
+    private:
+        core::PosixFd _sock;
+        std::uint32_t _seq;
+    };
+
+    std::string describeRoute(const char *operation, const LinuxRouteManager::Route &route)
+    {
+        std::string description = qs::format("% route %% %", familyName(route.family),
+                                             operation, route.blackhole ? " blackhole" : "",
+                                             route.subnet);
+        if(!route.gatewayIp.empty())
+            description += " via " + route.gatewayIp;
+        if(!route.interfaceName.empty())
+            description += " dev " + route.interfaceName;
+        if(route.metric != rtnetlink::NoMetric)
+            description += " metric " + std::to_string(route.metric);
+        description += " table " + (route.table.empty() ? std::string{"main"} : route.table);
+        return description;
+    }
+
+    std::string describeRule(const char *operation, const LinuxRouteManager::Rule &rule)
+    {
+        std::string description = qs::format("% rule % from %", familyName(rule.family),
+                                             operation, rule.from.empty() ? std::string{"all"} : rule.from);
+        if(!rule.fwmark.empty())
+            description += " fwmark " + rule.fwmark;
+        description += " lookup " + (rule.table.empty() ? std::string{"main"} : rule.table);
+        if(rule.suppressPrefixLength >= 0)
+            description += " suppress_prefixlength " + std::to_string(rule.suppressPrefixLength);
+        description += " prio " + std::to_string(rule.priority);
+        return description;
+    }
+}
+
+void LinuxRouteManager::Batch::replaceRoute(Route route)
+{
+    _changes.push_back({Operation::ReplaceRoute, std::move(route), {}});
+}
+
+void LinuxRouteManager::Batch::addRoute(Route route)
+{
+    _changes.push_back({Operation::AddRoute, std::move(route), {}});
+}
+
+void LinuxRouteManager::Batch::deleteRoute(Route route)
+{
+    _changes.push_back({Operation::DeleteRoute, std::move(route), {}});
+}
+
+void LinuxRouteManager::Batch::flushTable(Family family, std::string table)
+{
+    Route route{};
+    route.family = family;
+    route.table = std::move(table);
+    _changes.push_back({Operation::FlushTable, std::move(route), {}});
+}
+
+void LinuxRouteManager::Batch::addRule(Rule rule)
+{
+    _changes.push_back({Operation::AddRule, {}, std::move(rule)});
+}
+
+void LinuxRouteManager::Batch::deleteRule(Rule rule)
+{
+    _changes.push_back({Operation::DeleteRule, {}, std::move(rule)});
+}
+
+LinuxRouteManager::LinuxRouteManager(RtTablesInitializer::RtLocations rtLocations)
+    : _rtLocations{std::move(rtLocations)}
+{
+}
+
+bool LinuxRouteManager::apply(const Batch &batch) const
+{
+    if(batch.empty())
+        return true;
+
+    RtNetlinkSocket sock;
+    if(!sock)
+    {
+        KAPPS_CORE_WARNING() << "Can't apply" << batch._changes.size()
+            << "route/rule changes";
+        return false;
+    }
+
+    bool success{true};
+    std::vector<Request> requests;
+
+    for(const auto &change : batch._changes)
+    {
+        switch(change.operation)
+        {
+            case Batch::Operation::ReplaceRoute:
+            case Batch::Operation::AddRoute:
+            case Batch::Operation::DeleteRoute:
+            {
+                const Route &route = change.route;
+                const char *operationName = "replace";
+                rtnetlink::RouteOperation operation{rtnetlink::RouteOperation::Replace};
+                if(change.operation == Batch::Operation::AddRoute)
+                {
+                    operationName = "add";
+                    operation = rtnetlink::RouteOperation::Add;
+                }
+                else if(change.operation == Batch::Operation::DeleteRoute)
+                {
+                    operationName = "delete";
+                    operation = rtnetlink::RouteOperation::Delete;
+                }
+                std::string description = describeRoute(operationName, route);
+
+                auto table = rtnetlink::parseTable(_rtLocations, route.table);
+                if(!table)
+                {
+                    KAPPS_CORE_WARNING() << "Failed:" << description << "- unknown table";
+                    success = false;
+                    break;
+                }
+                std::uint32_t interfaceIndex{};
+                if(!route.interfaceName.empty())
+                {
+                    interfaceIndex = ::if_nametoindex(route.interfaceName.c_str());
+                    if(interfaceIndex == 0)
+                    {
+                        // Deleting a route through an interface that no longer
+                        // exists is fine - the route went away with it
+                        if(operation == rtnetlink::RouteOperation::Delete)
+                        {
+                            KAPPS_CORE_INFO() << "Skipped:" << description
+                                << "- interface does not exist";
+                        }
+                        else
+                        {
+                            KAPPS_CORE_WARNING() << "Failed:" << description << "-"
+                                << core::ErrnoTracer{};
+                            success = false;
+                        }
+                        break;
+                    }
+                }
+
+                auto request = rtnetlink::routeRequest(operation, route, table.get(), interfaceIndex);
+                if(!request)
+                {
+                    KAPPS_CORE_WARNING() << "Failed:" << description << "- invalid address";
+                    success = false;
+                    break;
+                }
+                request->description = std::move(description);
+                requests.push_back(std::move(request.get()));
+                break;
+            }
+            case Batch::Operation::AddRule:
+            case Batch::Operation::DeleteRule:
+            {
+                const Rule &rule = change.rule;
+                bool add = change.operation == Batch::Operation::AddRule;
+                std::string description = describeRule(add ? "add" : "delete", rule);
+
+                auto table = rtnetlink::parseTable(_rtLocations, rule.table);
+                if(!table)
+                {
+                    KAPPS_CORE_WARNING() << "Failed:" << description << "- unknown table";
+                    success = false;
+                    break;
+                }
+                auto request = rtnetlink::ruleRequest(add, rule, table.get());
+                if(!request)
+                {
+                    KAPPS_CORE_WARNING() << "Failed:" << description
+                        << "- invalid address or fwmark";
+                    success = false;
+                    break;
+                }
+                request->description = std::move(description);
+                requests.push_back(std::move(request.get()));
+                break;
+            }
+            case Batch::Operation::FlushTable:
+            {
+                const Route &route = change.route;
+                auto table = rtnetlink::parseTable(_rtLocations, route.table);
+                if(!table)
+                {
+                    KAPPS_CORE_WARNING() << "Failed:" << familyName(route.family)
+                        << "route flush table" << route.table << "- unknown table";
+                    success = false;
+                    break;
+                }
+
+                // The dump has to reflect the changes before this one
+                if(!sock.send(requests))
+                    success = false;
+                requests.clear();
+
+                // Delete each route in the table
+                for(const auto &routeMsg : sock.dumpRoutes(route.family))
+                {
+                    auto message = rtnetlink::flushRouteMessage(routeMsg, table.get());
+                    if(!message)
+                        continue;
+                    requests.push_back({std::move(message.get()),
+                                        qs::format("% route flush table %", familyName(route.family), route.table),
+                                        {ENOENT, ESRCH}});
+                }
+                break;
+            }
+        }
+    }
+
+    if(!sock.send(requests))
+        success = false;
+    return success;
+}
+
+void LinuxRouteManager::flushCache()
+{
+    // Same as "ip route flush cache".  There's no IPv4 route cache since Linux
+    // 3.6, but flushing still invalidates routes cached by sockets.
+    core::fs::writeString("/proc/sys/net/ipv4/route/flush", "-1", true);
+}
+
+void LinuxRouteManager::addRoute4(const std::string &subnet, const std::string &gatewayIp, const std::string &interfaceName, uint32_t metric) const
+{
+    Batch batch;
+    batch.replaceRoute({Family::IPv4, subnet, gatewayIp, interfaceName, {}, metric, false});
+    apply(batch);
+}
+
+void LinuxRouteManager::removeRoute4(const std::string &subnet, const std::string &gatewayIp, const std::string &interfaceName) const
+{
+    Batch batch;
+    batch.deleteRoute({Family::IPv4, subnet, gatewayIp, interfaceName, {}, rtnetlink::NoMetric, false});
+    apply(batch);
+}
+
+void LinuxRouteManager::addRoute6(const std::string &subnet, const std::string &gatewayIp, const std::string &interfaceName, uint32_t metric) const
+{
+    Batch batch;
+    batch.replaceRoute({Family::IPv6, subnet, gatewayIp, interfaceName, {}, metric, false});
+    apply(batch);
+}
+
+void LinuxRouteManager::removeRoute6(const std::string &subnet, const std::string &gatewayIp, const std::string &interfaceName) const
+{
+    Batch batch;
+    batch.deleteRoute({Family::IPv6, subnet, gatewayIp, interfaceName, {}, rtnetlink::NoMetric, false});
+    apply(batch);
+}
+
+}}
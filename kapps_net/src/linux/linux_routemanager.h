@@ -0,0 +1,150 @@
+// Copyright (c) 2024 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include "../routemanager.h"
+#include "rt_tables_initializer.h"
+#include <kapps_net/net.h>
+#include <kapps_core/src/util.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace kapps { namespace net {
+
+// Routes and routing policy rules on Linux, managed with rtnetlink instead of
+// the "ip" command.
+//
+// Changes are collected in a Batch and then applied with apply().  The whole
+// batch is sent to the kernel with one sendmsg() (up to a limit, large batches
+// are split), and each change is acknowledged by the kernel, so failures are
+// reported per change without running any processes or parsing any output.
+// (rtnetlink doesn't have transactions - changes are applied in order, and a
+// failed change doesn't prevent later changes from being applied.)
+//
+// Everything is specified with strings like the "ip" command: addresses and
+// subnets ("default" for the default route), interface names, table names
+// from rt_tables or table numbers, and fwmarks ("0x1234" or decimal).
+class KAPPS_NET_EXPORT LinuxRouteManager : public RouteManager
+{
+public:
+    enum class Family
+    {
+        IPv4,
+        IPv6
+    };
+
+    // A route, like "ip route ... <subnet> via <gatewayIp> dev
+    // <interfaceName> metric <metric> table <table>".  The gateway, interface,
+    // and metric are optional (empty or 0).
+    struct Route
+    {
+        Family family;
+        std::string subnet;
+        std::string gatewayIp;
+        std::string interfaceName;
+        std::string table;
+        std::uint32_t metric;
+        bool blackhole;
+    };
+
+    // A routing policy rule, like "ip rule ... from <from> fwmark <fwmark>
+    // lookup <table> suppress_prefixlength <suppressPrefixLength> prio
+    // <priority>".  'from' and 'fwmark' are optional (empty for "from all"
+    // and any fwmark), suppressPrefixLength is optional (-1).
+    struct Rule
+    {
+        Family family;
+        std::string from;
+        std::string fwmark;
+        std::string table;
+        std::uint32_t priority;
+        int suppressPrefixLength;
+    };
+
+    // A batch of route and rule changes.
+    //
+    // Adding a rule or route that already exists and deleting one that
+    // doesn't exist are not errors, so changes can be applied without checking
+    // the current state first.
+    class KAPPS_NET_EXPORT Batch
+    {
+    public:
+        // "ip route replace" - add the route, or replace an existing route to
+        // the same destination, table, and metric.
+        void replaceRoute(Route route);
+        // "ip route add" - add the route if it doesn't exist.
+        void addRoute(Route route);
+        // "ip route delete" - like "ip", fields that aren't set match any
+        // route.
+        void deleteRoute(Route route);
+        // "ip route flush table" - delete all routes in a table.
+        void flushTable(Family family, std::string table);
+        // "ip rule add" / "ip rule del"
+        void addRule(Rule rule);
+        void deleteRule(Rule rule);
+
+        bool empty() const {return _changes.empty();}
+
+    private:
+        friend class LinuxRouteManager;
+
+        enum class Operation
+        {
+            ReplaceRoute,
+            AddRoute,
+            DeleteRoute,
+            FlushTable,
+            AddRule,
+            DeleteRule,
+        };
+        struct Change
+        {
+            Operation operation;
+            Route route;    // For route operations and FlushTable
+            Rule rule;      // For rule operations
+        };
+
+        std::vector<Change> _changes;
+    };
+
+public:
+    // Table names are found in the rt_tables files given (etcPath, then each
+    // fallback path).
+    LinuxRouteManager(RtTablesInitializer::RtLocations rtLocations = RtTablesInitializer::RtLocations::system());
+
+public:
+    // Apply the changes in a batch.  Returns true if all changes were applied;
+    // each failure is traced.
+    bool apply(const Batch &batch) const;
+
+    // Flush the routing cache ("ip route flush cache"); cached routes held by
+    // sockets are dropped.
+    static void flushCache();
+
+    // RouteManager
+    virtual void addRoute4(const std::string &subnet, const std::string &gatewayIp, const std::string &interfaceName, uint32_t metric=0) const override;
+    virtual void removeRoute4(const std::string &subnet, const std::string &gatewayIp, const std::string &interfaceName) const override;
+    virtual void addRoute6(const std::string &subnet, const std::string &gatewayIp, const std::string &interfaceName, uint32_t metric=0) const override;
+    virtual void removeRoute6(const std::string &subnet, const std::string &gatewayIp, const std::string &interfaceName) const override;
+
+private:
+    RtTablesInitializer::RtLocations _rtLocations;
+};
+
+}}
@@ -0,0 +1,275 @@
+// Copyright (c) 2024 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "linux_rtnetlink.h"
+#include <linux/fib_rules.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+
+namespace kapps { namespace net { namespace rtnetlink {
+
+int addressFamily(Family family)
+{
+    return family == Family::IPv6 ? AF_INET6 : AF_INET;
+}
+
+const char *familyName(Family family)
+{
+    return family == Family::IPv6 ? "IPv6" : "IPv4";
+}
+
+core::nullable_t<Prefix> parsePrefix(Family family, const std::string &value)
+{
+    Prefix prefix{};
+    prefix.addressSize = family == Family::IPv6 ? 16 : 4;
+    if(value == "default")
+        return prefix;
+
+    auto slashPos = value.find('/');
+    std::string address = value.substr(0, slashPos);
+    if(::inet_pton(addressFamily(family), address.c_str(), prefix.address) != 1)
+        return {};
+
+    prefix.length = static_cast<unsigned>(prefix.addressSize * 8);
+    if(slashPos != std::string::npos)
+    {
+        const std::string lengthStr = value.substr(slashPos + 1);
+        char *pEnd{};
+        unsigned long length = std::strtoul(lengthStr.c_str(), &pEnd, 10);
+        if(lengthStr.empty() || *pEnd || length > prefix.length)
+            return {};
+        prefix.length = static_cast<unsigned>(length);
+    }
+    return prefix;
+}
+
+core::nullable_t<std::uint32_t> parseTable(const RtTablesInitializer::RtLocations &rtLocations,
+                                           const std::string &table)
+{
+    if(table.empty() || table == "main")
+        return TableMain;
+    if(table == "local")
+        return TableLocal;
+    if(table == "default")
+        return TableDefault;
+
+    char *pEnd{};
+    unsigned long value = std::strtoul(table.c_str(), &pEnd, 0);
+    if(!*pEnd && std::isdigit(static_cast<unsigned char>(table[0])))
+        return static_cast<std::uint32_t>(value);
+
+    int index = RtTablesInitializer::tableIndex(rtLocations, table);
+    if(index < 0)
+        return {};
+    return static_cast<std::uint32_t>(index);
+}
+
+core::nullable_t<std::uint32_t> parseFwmark(const std::string &fwmark)
+{
+    if(fwmark.empty() || !std::isdigit(static_cast<unsigned char>(fwmark[0])))
+        return {};
+    char *pEnd{};
+    unsigned long value = std::strtoul(fwmark.c_str(), &pEnd, 0);
+    if(*pEnd)
+        return {};
+    return static_cast<std::uint32_t>(value);
+}
+
+unsigned char headerTableId(std::uint32_t id)
+{
+    return id < 256 ? static_cast<unsigned char>(id) : static_cast<unsigned char>(RT_TABLE_UNSPEC);
+}
+
+void Message::addAttribute(std::uint16_t type, const void *pValue, std::size_t size)
+{
+    std::size_t offset = _data.size();
+    _data.resize(offset + RTA_SPACE(size));
+    auto pAttr = reinterpret_cast<rtattr*>(_data.data() + offset);
+    pAttr->rta_type = type;
+    pAttr->rta_len = static_cast<unsigned short>(RTA_LENGTH(size));
+    std::memcpy(RTA_DATA(pAttr), pValue, size);
+}
+
+void Message::addU32(std::uint16_t type, std::uint32_t value)
+{
+    addAttribute(type, &value, sizeof(value));
+}
+
+void Message::appendTo(std::vector<unsigned char> &buffer, std::uint32_t seq) const
+{
+    std::size_t offset = buffer.size();
+    buffer.insert(buffer.end(), _data.begin(), _data.end());
+    auto pNlHeader = reinterpret_cast<nlmsghdr*>(buffer.data() + offset);
+    pNlHeader->nlmsg_len = static_cast<std::uint32_t>(_data.size());
+    pNlHeader->nlmsg_seq = seq;
+}
+
+core::nullable_t<Request> routeRequest(RouteOperation operation,
+                                       const LinuxRouteManager::Route &route,
+                                       std::uint32_t table,
+                                       std::uint32_t interfaceIndex)
+{
+    auto dst = parsePrefix(route.family, route.subnet);
+    if(!dst)
+        return {};
+    Prefix gateway{};
+    if(!route.gatewayIp.empty())
+    {
+        auto parsedGateway = parsePrefix(route.family, route.gatewayIp);
+        if(!parsedGateway || parsedGateway->length != parsedGateway->addressSize * 8)
+            return {};
+        gateway = parsedGateway.get();
+    }
+
+    std::uint16_t type{RTM_NEWROUTE};
+    std::uint16_t flags{NLM_F_CREATE|NLM_F_REPLACE};
+    std::set<int> toleratedErrors;
+    if(operation == RouteOperation::Add)
+    {
+        flags = NLM_F_CREATE|NLM_F_EXCL;
+        toleratedErrors = {EEXIST};
+    }
+    else if(operation == RouteOperation::Delete)
+    {
+        type = RTM_DELROUTE;
+        flags = 0;
+        toleratedErrors = {ENOENT, ESRCH};
+    }
+
+    rtmsg header{};
+    header.rtm_family = static_cast<unsigned char>(addressFamily(route.family));
+    header.rtm_dst_len = static_cast<unsigned char>(dst->length);
+    header.rtm_table = headerTableId(table);
+    if(type == RTM_DELROUTE)
+    {
+        // Like "ip route delete" - match any scope, and any type unless this
+        // is a blackhole route
+        header.rtm_scope = RT_SCOPE_NOWHERE;
+        header.rtm_type = route.blackhole ? RTN_BLACKHOLE : RTN_UNSPEC;
+    }
+    else
+    {
+        header.rtm_protocol = RTPROT_BOOT;
+        header.rtm_type = route.blackhole ? RTN_BLACKHOLE : RTN_UNICAST;
+        // Routes directly through an interface have link scope
+        header.rtm_scope = (!route.blackhole && route.gatewayIp.empty() && interfaceIndex)
+            ? RT_SCOPE_LINK : RT_SCOPE_UNIVERSE;
+    }
+
+    Message message{type, flags, header};
+    message.addU32(RTA_TABLE, table);
+    if(dst->length > 0)
+        message.addAttribute(RTA_DST, dst->address, dst->addressSize);
+    if(!route.gatewayIp.empty())
+        message.addAttribute(RTA_GATEWAY, gateway.address, gateway.addressSize);
+    if(interfaceIndex)
+        message.addU32(RTA_OIF, interfaceIndex);
+    if(route.metric != NoMetric)
+        message.addU32(RTA_PRIORITY, route.metric);
+    return Request{std::move(message), {}, std::move(toleratedErrors)};
+}
+
+core::nullable_t<Request> ruleRequest(bool add, const LinuxRouteManager::Rule &rule,
+                                      std::uint32_t table)
+{
+    Prefix from{};
+    if(!rule.from.empty())
+    {
+        auto parsedFrom = parsePrefix(rule.family, rule.from);
+        if(!parsedFrom)
+            return {};
+        from = parsedFrom.get();
+    }
+    core::nullable_t<std::uint32_t> fwmark;
+    if(!rule.fwmark.empty())
+    {
+        fwmark = parseFwmark(rule.fwmark);
+        if(!fwmark)
+            return {};
+    }
+
+    fib_rule_hdr header{};
+    header.family = static_cast<unsigned char>(addressFamily(rule.family));
+    header.src_len = static_cast<unsigned char>(from.length);
+    header.table = headerTableId(table);
+    // Like "ip rule del", deleting matches any action
+    header.action = add ? FR_ACT_TO_TBL : FR_ACT_UNSPEC;
+
+    std::uint16_t flags = add ? NLM_F_CREATE|NLM_F_EXCL : 0;
+    Message message{add ? RTM_NEWRULE : RTM_DELRULE, flags, header};
+    message.addU32(FRA_TABLE, table);
+    message.addU32(FRA_PRIORITY, rule.priority);
+    if(fwmark)
+        message.addU32(FRA_FWMARK, fwmark.get());
+    if(from.length > 0)
+        message.addAttribute(FRA_SRC, from.address, from.addressSize);
+    if(rule.suppressPrefixLength >= 0)
+        message.addU32(FRA_SUPPRESS_PREFIXLEN, static_cast<std::uint32_t>(rule.suppressPrefixLength));
+    return Request{std::move(message), {}, add ? std::set<int>{EEXIST} : std::set<int>{ENOENT}};
+}
+
+core::nullable_t<Message> flushRouteMessage(const std::vector<unsigned char> &routeMsg,
+                                            std::uint32_t table)
+{
+    auto pNlHeader = reinterpret_cast<const nlmsghdr*>(routeMsg.data());
+    if(routeMsg.size() < NLMSG_SPACE(sizeof(rtmsg)) || pNlHeader->nlmsg_len > routeMsg.size())
+        return {};
+    auto pRtMsg = reinterpret_cast<const rtmsg*>(NLMSG_DATA(pNlHeader));
+
+    // The table attribute has the full ID if it's present
+    std::uint32_t routeTable = pRtMsg->rtm_table;
+    int attrLen = static_cast<int>(RTM_PAYLOAD(pNlHeader));
+    for(auto pAttr = RTM_RTA(pRtMsg); RTA_OK(pAttr, attrLen); pAttr = RTA_NEXT(pAttr, attrLen))
+    {
+        if(pAttr->rta_type == RTA_TABLE)
+            std::memcpy(&routeTable, RTA_DATA(pAttr), sizeof(routeTable));
+    }
+    if(routeTable != table)
+        return {};
+
+    // Send the route back as a delete request
+    Message message{RTM_DELROUTE, 0, *pRtMsg};
+    attrLen = static_cast<int>(RTM_PAYLOAD(pNlHeader));
+    for(auto pAttr = RTM_RTA(pRtMsg); RTA_OK(pAttr, attrLen); pAttr = RTA_NEXT(pAttr, attrLen))
+        message.addAttribute(pAttr->rta_type, RTA_DATA(pAttr), RTA_PAYLOAD(pAttr));
+    return message;
+}
+
+std::vector<std::pair<std::size_t, std::size_t>> sendGroups(std::size_t count)
+{
+    std::vector<std::pair<std::size_t, std::size_t>> groups;
+    for(std::size_t begin = 0; begin < count; begin += MaxMessagesPerSend)
+        groups.emplace_back(begin, std::min(count, begin + MaxMessagesPerSend));
+    return groups;
+}
+
+std::vector<unsigned char> encodeGroup(const std::vector<Request> &requests,
+                                       std::size_t begin, std::size_t end,
+                                       std::uint32_t firstSeq)
+{
+    std::vector<unsigned char> buffer;
+    for(std::size_t i = begin; i < end; ++i)
+        requests[i].message.appendTo(buffer, firstSeq + static_cast<std::uint32_t>(i - begin));
+    return buffer;
+}
+
+}}}
@@ -0,0 +1,155 @@
+// Copyright (c) 2024 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include "linux_routemanager.h"
+#include "rt_tables_initializer.h"
+#include <kapps_net/net.h>
+#include <kapps_core/src/util.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <cstdint>
+#include <cstring>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace kapps { namespace net {
+
+// Encoding of the rtnetlink requests sent by LinuxRouteManager.  Nothing here
+// touches a socket; LinuxRouteManager resolves interfaces, sends the requests,
+// and matches up the ACKs.
+namespace rtnetlink
+{
+    using Family = LinuxRouteManager::Family;
+
+    // Messages are sent to the kernel in groups of this size - the kernel
+    // handles each message in a sendmsg() before reading more, but the ACKs
+    // for a whole group have to fit in the socket's receive buffer.
+    constexpr std::size_t MaxMessagesPerSend{64};
+    // Metric used by "ip" when a route doesn't specify one - 0 means the
+    // attribute is omitted
+    constexpr std::uint32_t NoMetric{0};
+
+    // Builtin table IDs that don't appear in rt_tables on all distributions
+    constexpr std::uint32_t TableDefault{253};
+    constexpr std::uint32_t TableMain{254};
+    constexpr std::uint32_t TableLocal{255};
+
+    int addressFamily(Family family);
+    const char *familyName(Family family);
+
+    // An address or subnet parsed from a string - "default" is a 0-length
+    // prefix.  A single address has the full prefix length.
+    struct Prefix
+    {
+        unsigned char address[16];
+        std::size_t addressSize;
+        unsigned length;
+    };
+    core::nullable_t<Prefix> KAPPS_NET_EXPORT parsePrefix(Family family, const std::string &value);
+
+    // Find the ID of a routing table from its name or number ("main",
+    // "local", "default", a number, or a name from rt_tables).  Returns
+    // nullptr if the table isn't known.
+    core::nullable_t<std::uint32_t> KAPPS_NET_EXPORT parseTable(const RtTablesInitializer::RtLocations &rtLocations,
+                                                                const std::string &table);
+
+    // Parse an fwmark ("0x1234" or decimal).  Returns nullptr if it's not a
+    // number.
+    core::nullable_t<std::uint32_t> KAPPS_NET_EXPORT parseFwmark(const std::string &fwmark);
+
+    // Table IDs above 255 only fit in the table attribute; the header field
+    // is set to RT_TABLE_UNSPEC in that case, like "ip".
+    unsigned char KAPPS_NET_EXPORT headerTableId(std::uint32_t id);
+
+    // One request message, with the attributes that have been added so far.
+    // The length and sequence number are filled in by appendTo().
+    class KAPPS_NET_EXPORT Message
+    {
+    public:
+        template<class HeaderT>
+        Message(std::uint16_t type, std::uint16_t flags, const HeaderT &header)
+            : _data(NLMSG_SPACE(sizeof(HeaderT)))
+        {
+            auto pNlHeader = reinterpret_cast<nlmsghdr*>(_data.data());
+            pNlHeader->nlmsg_type = type;
+            pNlHeader->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | flags;
+            std::memcpy(NLMSG_DATA(pNlHeader), &header, sizeof(HeaderT));
+        }
+
+    public:
+        void addAttribute(std::uint16_t type, const void *pValue, std::size_t size);
+        void addU32(std::uint16_t type, std::uint32_t value);
+
+        // Append the message to a send buffer with the given sequence number
+        void appendTo(std::vector<unsigned char> &buffer, std::uint32_t seq) const;
+
+    private:
+        std::vector<unsigned char> _data;
+    };
+
+    // A message to send, with a description of the change for tracing and
+    // the errors that indicate the change was already in effect
+    struct Request
+    {
+        Message message;
+        std::string description;
+        std::set<int> toleratedErrors;
+    };
+
+    enum class RouteOperation
+    {
+        Replace,    // "ip route replace"
+        Add,        // "ip route add", tolerates EEXIST
+        Delete,     // "ip route delete", tolerates ENOENT/ESRCH
+    };
+
+    // Build the request for a route change.  The table and interface (0 for
+    // none) have already been resolved.  Returns nullptr if the subnet or
+    // gateway is not valid.
+    core::nullable_t<Request> KAPPS_NET_EXPORT routeRequest(RouteOperation operation,
+                                                            const LinuxRouteManager::Route &route,
+                                                            std::uint32_t table,
+                                                            std::uint32_t interfaceIndex);
+
+    // Build the request for "ip rule add" (tolerates EEXIST) or "ip rule del"
+    // (tolerates ENOENT).  The table has already been resolved.  Returns
+    // nullptr if the source address or fwmark is not valid.
+    core::nullable_t<Request> KAPPS_NET_EXPORT ruleRequest(bool add, const LinuxRouteManager::Rule &rule,
+                                                           std::uint32_t table);
+
+    // Given an RTM_NEWROUTE message from a route dump, build the request that
+    // deletes that route if it's in the given table.  Returns nullptr if the
+    // route is in a different table.
+    core::nullable_t<Message> KAPPS_NET_EXPORT flushRouteMessage(const std::vector<unsigned char> &routeMsg,
+                                                                 std::uint32_t table);
+
+    // Split a number of requests into the groups sent with each sendmsg() -
+    // each group is [first, second).
+    std::vector<std::pair<std::size_t, std::size_t>> KAPPS_NET_EXPORT sendGroups(std::size_t count);
+
+    // Encode the requests [begin, end) into one send buffer, with sequence
+    // numbers starting from firstSeq.
+    std::vector<unsigned char> KAPPS_NET_EXPORT encodeGroup(const std::vector<Request> &requests,
+                                                           std::size_t begin, std::size_t end,
+                                                           std::uint32_t firstSeq);
+}
+
+}}
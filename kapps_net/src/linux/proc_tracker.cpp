@@ -32,17 +32,30 @@ namespace
     using IPVersion = IpTablesFirewall::IPVersion;
 }
 
-void ProcTracker::showInvalidMountNamespaceWarning(const std::string &appName, pid_t pid) const
+void ProcTracker::showInvalidMountNamespaceWarning(const std::string &appName, pid_t pid)
 {
     KAPPS_CORE_WARNING() << "Process:" << pid << "with path" << appName << "has a split tunnel path but was rejected"
         << "as it belongs to the wrong mount namespace. Expected:" << _defaultMountNamespaceId
-        << "but got" << ProcFs::mountNamespaceId(pid);
+        << "but got" << _processTable.mountNamespaceId(pid);
 }
 
 void ProcTracker::initiateConnection(const FirewallParams &params, std::string tunnelDeviceName, std::string tunnelDeviceLocalAddress)
 {
-    _cnProc.exec = [this](pid_t pid) { addLaunchedApp(pid); };
-    _cnProc.exit = [this](pid_t pid) { removeTerminatedApp(pid); };
+    // Keep the process table up to date with process events, once we know
+    // they're being delivered
+    _cnProc.connected = [this]() { _processEventsActive = true; };
+    _cnProc.eventsLost = [this]() { _processTableStale = true; };
+    _cnProc.fork = [this](pid_t parentPid, pid_t childPid) { _processTable.processForked(parentPid, childPid); };
+    _cnProc.exec = [this](pid_t pid)
+    {
+        _processTable.processExec(pid);
+        addLaunchedApp(pid);
+    };
+    _cnProc.exit = [this](pid_t pid)
+    {
+        removeTerminatedApp(pid);
+        _processTable.processExited(pid);
+    };
 
     // setup cgroups + configure routing rules
     _cgroup.setupNetCls();
@@ -59,8 +72,10 @@ void ProcTracker::shutdownConnection()
     // Remove cgroup routing rules
     _cgroup.teardownNetCls();
     removeAllApps();
-    removeRoutingPolicyForSourceIp(_previousNetScan.ipAddress(), _cgroup.routing().bypassTable());
-    removeRoutingPolicyForSourceIp(_previousTunnelDeviceLocalAddress, _cgroup.routing().vpnOnlyTable());
+    LinuxRouteManager::Batch routeBatch;
+    removeRoutingPolicyForSourceIp(routeBatch, _previousNetScan.ipAddress(), _cgroup.routing().bypassTable());
+    removeRoutingPolicyForSourceIp(routeBatch, _previousTunnelDeviceLocalAddress, _cgroup.routing().vpnOnlyTable());
+    _routeManager.apply(routeBatch);
     teardownReversePathFiltering();
 
     // Clear out our network info
@@ -95,10 +110,7 @@ void ProcTracker::addApps(const std::vector<std::string> &apps, AppMap &appMap,
     {
         // Create the PID set for this app or get the existing one
         auto &appPids = appMap[app];
-        // Since this scans all PIDs, it's common for transient processes to
-        // cause errors as they exit before we get a chance to check them -
-        // silence these errors since this happens a lot.
-        for(pid_t pid : ProcFs::pidsForPath(app, true))
+        for(pid_t pid : _processTable.pidsForPath(app))
         {
             if(!isProcessInAllowedMountNamespace(pid))
             {
@@ -107,7 +119,7 @@ void ProcTracker::addApps(const std::vector<std::string> &apps, AppMap &appMap,
             }
 
             // Both these calls are no-ops if the PID is already excluded
-            CGroup::addPidToCgroup(pid, cGroupPath);
+            CGroup::addPidToCgroup(_processTable, pid, cGroupPath);
             appPids.insert(pid);
         }
     }
@@ -125,7 +137,7 @@ void ProcTracker::removeApps(const std::vector<std::string> &keepApps, AppMap &a
         if(itr == keepApps.end())
         {
             for(pid_t pid : itApp->second)
-                CGroup::removePidFromCgroup(pid, _defaultFile);
+                CGroup::removePidFromCgroup(_processTable, pid, _defaultFile);
 
             itApp = appMap.erase(itApp);
         }
@@ -163,16 +175,16 @@ void ProcTracker::teardownFirewall()
     _firewall.setAnchorEnabled(TableEnum::Mangle, IPVersion::Both, ("100.tagVpnOnly"), false);
 }
 
-void ProcTracker::addRoutingPolicyForSourceIp(std::string ipAddress, std::string routingTableName)
+void ProcTracker::addRoutingPolicyForSourceIp(LinuxRouteManager::Batch &batch, std::string ipAddress, std::string routingTableName)
 {
     if(!ipAddress.empty())
-        core::Exec::bash(qs::format("ip rule add from % lookup % pri %", ipAddress, routingTableName, Routing::Priorities::sourceIp));
+        batch.addRule({LinuxRouteManager::Family::IPv4, std::move(ipAddress), {}, std::move(routingTableName), Routing::Priorities::sourceIp, -1});
 }
 
-void ProcTracker::removeRoutingPolicyForSourceIp(std::string ipAddress, std::string routingTableName)
+void ProcTracker::removeRoutingPolicyForSourceIp(LinuxRouteManager::Batch &batch, std::string ipAddress, std::string routingTableName)
 {
     if(!ipAddress.empty())
-        core::Exec::bash(qs::format("ip rule del from % lookup % pri %", ipAddress, routingTableName, Routing::Priorities::sourceIp));
+        batch.deleteRule({LinuxRouteManager::Family::IPv4, std::move(ipAddress), {}, std::move(routingTableName), Routing::Priorities::sourceIp, -1});
 }
 
 void ProcTracker::removeTerminatedApp(pid_t pid)
@@ -194,9 +206,9 @@ void ProcTracker::removeTerminatedApp(pid_t pid)
 
 void ProcTracker::addLaunchedApp(pid_t pid)
 {
-    // Get the launch path associated with the PID.  This also tends to trace
-    // errors for transient processes; ignore those.
-    std::string appName = ProcFs::pathForPid(pid, true);
+    // Get the launch path associated with the PID (read by the process table
+    // for the exec event)
+    std::string appName = _processTable.pathForPid(pid);
 
     // May be empty if the process was so short-lived it exited before we had a chance to read its name
     // In this case we just early-exit and ignore it
@@ -224,7 +236,7 @@ void ProcTracker::addLaunchedApp(pid_t pid)
 
             // Add the PID to the cgroup so its network traffic goes out the
             // physical uplink
-            CGroup::addPidToCgroup(pid, _bypassFile);
+            CGroup::addPidToCgroup(_processTable, pid, _bypassFile);
         }
     }
     else if(_vpnOnlyMap.count(appName) > 0)
@@ -234,7 +246,7 @@ void ProcTracker::addLaunchedApp(pid_t pid)
 
         // Add the PID to the cgroup so its network traffic is forced out the
         // VPN
-        CGroup::addPidToCgroup(pid, _vpnOnlyFile);
+        CGroup::addPidToCgroup(_processTable, pid, _vpnOnlyFile);
     }
 }
 
@@ -256,7 +268,7 @@ void ProcTracker::updateMasquerade(std::string interfaceName, std::string tunnel
     }
 }
 
-void ProcTracker::updateRoutes(std::string gatewayIp, std::string interfaceName, std::string tunnelDeviceName)
+void ProcTracker::updateRoutes(LinuxRouteManager::Batch &batch, std::string gatewayIp, std::string interfaceName, std::string tunnelDeviceName)
 {
     // The bypass route can be left as-is if the configuration is not known,
     // even though the route may be out of date - we don't put any processes in
@@ -268,8 +280,8 @@ void ProcTracker::updateRoutes(std::string gatewayIp, std::string interfaceName,
     }
     else
     {
-        core::Exec::bash(qs::format("ip route replace default via % dev % table %",
-            gatewayIp, interfaceName, _cgroup.routing().bypassTable()));
+        batch.replaceRoute({LinuxRouteManager::Family::IPv4, "default", std::move(gatewayIp),
+            std::move(interfaceName), _cgroup.routing().bypassTable(), 0, false});
     }
 
     // The VPN-only route can be left as-is if we're not connected, VPN-only
@@ -281,11 +293,9 @@ void ProcTracker::updateRoutes(std::string gatewayIp, std::string interfaceName,
     }
     else
     {
-        core::Exec::bash(qs::format("ip route replace default dev % table %",
-            tunnelDeviceName, _cgroup.routing().vpnOnlyTable()));
+        batch.replaceRoute({LinuxRouteManager::Family::IPv4, "default", {},
+            std::move(tunnelDeviceName), _cgroup.routing().vpnOnlyTable(), 0, false});
     }
-
-    core::Exec::cmd(qs::format("ip"), {"route", "flush", "cache"});
 }
 
 void ProcTracker::updateNetwork(const FirewallParams &params, std::string tunnelDeviceName,
@@ -298,24 +308,29 @@ void ProcTracker::updateNetwork(const FirewallParams &params, std::string tunnel
     if(_previousNetScan.interfaceName() != params.netScan.interfaceName() || _previousTunnelDeviceName != tunnelDeviceName)
         updateMasquerade(params.netScan.interfaceName(), tunnelDeviceName);
 
+    // The routing policies and routes are all applied in one netlink batch
+    LinuxRouteManager::Batch routeBatch;
+
     // Ensure that packets with the source IP of the physical interface go out the physical interface
     if(_previousNetScan.ipAddress() != params.netScan.ipAddress())
     {
         // Remove the old one (if it exists) before adding a new one
-        removeRoutingPolicyForSourceIp(_previousNetScan.ipAddress(), _cgroup.routing().bypassTable());
-        addRoutingPolicyForSourceIp(params.netScan.ipAddress(), _cgroup.routing().bypassTable());
+        removeRoutingPolicyForSourceIp(routeBatch, _previousNetScan.ipAddress(), _cgroup.routing().bypassTable());
+        addRoutingPolicyForSourceIp(routeBatch, params.netScan.ipAddress(), _cgroup.routing().bypassTable());
     }
 
     // Ensure that packets with source IP of the tunnel go out the tunnel interface
     if(_previousTunnelDeviceLocalAddress !=  tunnelDeviceLocalAddress)
     {
         // Remove the old one (if it exists) before adding a new one
-        removeRoutingPolicyForSourceIp(_previousTunnelDeviceLocalAddress, _cgroup.routing().vpnOnlyTable());
-        addRoutingPolicyForSourceIp(tunnelDeviceLocalAddress, _cgroup.routing().vpnOnlyTable());
+        removeRoutingPolicyForSourceIp(routeBatch, _previousTunnelDeviceLocalAddress, _cgroup.routing().vpnOnlyTable());
+        addRoutingPolicyForSourceIp(routeBatch, tunnelDeviceLocalAddress, _cgroup.routing().vpnOnlyTable());
     }
 
     // always update the routes - as we use 'route replace' so we don't have to worry about adding the same route multiple times
-    updateRoutes(params.netScan.gatewayIp(), params.netScan.interfaceName(), tunnelDeviceName);
+    updateRoutes(routeBatch, params.netScan.gatewayIp(), params.netScan.interfaceName(), tunnelDeviceName);
+    _routeManager.apply(routeBatch);
+    LinuxRouteManager::flushCache();
 
     updateFirewall(params);
 
@@ -331,7 +346,10 @@ void ProcTracker::setVpnBlackHole()
 {
     // This fall-back route blocks all traffic that hits the vpnOnly routing table
     // The tunnel interface route disappears when the tunnel goes down, exposing this route
-    core::Exec::bash(qs::format("ip route replace blackhole default metric 32000 table %", _cgroup.routing().vpnOnlyTable()));
+    LinuxRouteManager::Batch routeBatch;
+    routeBatch.replaceRoute({LinuxRouteManager::Family::IPv4, "default", {}, {},
+        _cgroup.routing().vpnOnlyTable(), 32000, true});
+    _routeManager.apply(routeBatch);
 }
 
 void ProcTracker::setupReversePathFiltering()
@@ -371,6 +389,14 @@ void ProcTracker::teardownReversePathFiltering()
 void ProcTracker::updateApps(std::vector<std::string> excludedApps, std::vector<std::string> vpnOnlyApps)
 {
     KAPPS_CORE_INFO() << "ExcludedApps:" << excludedApps << "VPN Only Apps:" << vpnOnlyApps;
+
+    // Refresh the process table if process events aren't keeping it current
+    if(_processTableStale || !_processEventsActive)
+    {
+        _processTable.scan();
+        _processTableStale = false;
+    }
+
     // If we're not tracking excluded apps, remove everything
     if(!_previousNetScan.ipv4Valid())
         excludedApps = {};
@@ -27,6 +27,7 @@
 #include <unordered_map>
 #include "linux_cgroup.h"
 #include "linux_proc_fs.h"
+#include "linux_routemanager.h"
 
 namespace kapps { namespace net {
 
@@ -38,6 +39,8 @@ public:
     , _vpnOnlyFile{vpnOnlyFile}
     , _defaultFile{defaultFile}
     , _cgroup{std::move(cgroup)}
+    , _processEventsActive{false}
+    , _processTableStale{true}
     , _firewall{firewall}
     {
         // TODO: only need to pass params
@@ -77,12 +80,12 @@ private:
                     core::StringSlice traceName);
     void updateFirewall(const FirewallParams &params);
     void teardownFirewall();
-    void addRoutingPolicyForSourceIp(std::string ipAddress, std::string routingTableName);
-    void removeRoutingPolicyForSourceIp(std::string ipAddress, std::string routingTableName);
+    void addRoutingPolicyForSourceIp(LinuxRouteManager::Batch &batch, std::string ipAddress, std::string routingTableName);
+    void removeRoutingPolicyForSourceIp(LinuxRouteManager::Batch &batch, std::string ipAddress, std::string routingTableName);
     void removeTerminatedApp(pid_t pid);
     void addLaunchedApp(pid_t pid);
     void updateMasquerade(std::string interfaceName, std::string tunnelDeviceName);
-    void updateRoutes(std::string gatewayIp, std::string interfaceName, std::string tunnelDeviceName);
+    void updateRoutes(LinuxRouteManager::Batch &batch, std::string gatewayIp, std::string interfaceName, std::string tunnelDeviceName);
     void updateNetwork(const FirewallParams &params, std::string tunnelDeviceName,
                        std::string tunnelDeviceLocalAddres);
     void setVpnBlackHole();
@@ -93,12 +96,14 @@ private:
     // Whether a given process belongs to an allowed mount namespace
     // Currently the only mount namespace we allow is the one that pia-daemon
     // runs in.
-    bool isProcessInAllowedMountNamespace(pid_t pid) const { return ProcFs::mountNamespaceId(pid) == _defaultMountNamespaceId; }
+    bool isProcessInAllowedMountNamespace(pid_t pid) { return _processTable.mountNamespaceId(pid) == _defaultMountNamespaceId; }
 
-    void showInvalidMountNamespaceWarning(const std::string &appName, pid_t pid) const;
+    void showInvalidMountNamespaceWarning(const std::string &appName, pid_t pid);
 
 private:
     CnProc _cnProc;
+    // Snapshot of the process table, kept up to date with events from _cnProc
+    ProcFs::ProcessTable _processTable;
     OriginalNetworkScan _previousNetScan;
     std::string _previousRPFilter;
     std::string _bypassFile;
@@ -110,6 +115,12 @@ private:
     std::string _previousTunnelDeviceName;
     CGroupIds _cgroup;
     std::string _defaultMountNamespaceId;
+    LinuxRouteManager _routeManager;
+    // Whether _cnProc is delivering process events, so _processTable stays
+    // current.  If not, the table is rescanned for each update.
+    bool _processEventsActive;
+    // Set if events were lost, the table is rescanned for the next update
+    bool _processTableStale;
 
     // IpTablesFirewall provided by LinuxFirewall - used to update firewall
     // rules.
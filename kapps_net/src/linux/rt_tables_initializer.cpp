@@ -17,8 +17,13 @@
 // <https://www.gnu.org/licenses/>.
 
 #include "rt_tables_initializer.h"
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <cstdlib>
 #include <fstream>
-#include <kapps_core/src/newexec.h>
+#include <sstream>
+#include <kapps_core/src/logger.h>
 #include <kapps_core/src/fs.h>
 
 namespace kapps { namespace net {
@@ -33,6 +38,38 @@ namespace
 // For convenience
 namespace fs = core::fs;
 
+std::vector<RtTableEntry> readRtTables(const std::string &rtPath)
+{
+    std::vector<RtTableEntry> entries;
+    std::ifstream rtFile{rtPath};
+    std::string line;
+    while(std::getline(rtFile, line))
+    {
+        // Entries start with the index, like "100  piavpnrt"; this also skips
+        // comments and blank lines
+        if(line.empty() || !std::isdigit(static_cast<unsigned char>(line[0])))
+            continue;
+
+        std::istringstream fields{line};
+        std::string index, name;
+        fields >> index >> name;
+        // Indices can be decimal or hex, like iproute2
+        char *pEnd{};
+        long value = std::strtol(index.c_str(), &pEnd, 0);
+        if(*pEnd || value < 0 || value > INT_MAX)
+            continue;
+        entries.push_back({static_cast<int>(value), std::move(name)});
+    }
+    return entries;
+}
+
+auto RtTablesInitializer::RtLocations::system() -> RtLocations
+{
+    return {"/etc/iproute2/rt_tables",
+            // /usr/share is used by iproute2 versions >= 6.7.0
+            {"/usr/share/iproute2/rt_tables", "/usr/lib/iproute2/rt_tables"}};
+}
+
 RtTablesInitializer::RtTablesInitializer(const std::string &brandPrefix, RtTablesInitializer::RtLocations rtLocations)
     : _errorEpilogue{"The VPN may not work as expected!"}
     , _rtLocations(std::move(rtLocations))
@@ -97,15 +134,16 @@ int RtTablesInitializer::nextAvailableTableIndexFromFile(const std::string &rtPa
     // 70   myTable4
     // 200  myTable5
     // Note that the index (on the left) is not guaranteed to increment linearly or in order
-    // The awk snippet below finds the highest valued index.
-    // TODO: rewrite this in pure C++
-    std::string highestIndex = core::Exec::bashWithOutput(qs::format("awk '/^[0-9]/{print $1}' \"%\" | sort -n | tail -1", rtPath));
+    // so find the highest valued index.
+    int highestIndex{-1};
+    for(const auto &entry : readRtTables(rtPath))
+        highestIndex = std::max(highestIndex, entry.index);
 
-    if(highestIndex.empty())
+    if(highestIndex < 0)
         return -1; // Indicate no index was found
 
     // Add 1 for the next available index
-    return std::stoi(highestIndex) + 1;
+    return highestIndex + 1;
 }
 
 void RtTablesInitializer::appendRoutingTables(int availableIndex) const
@@ -131,7 +169,24 @@ void RtTablesInitializer::appendRoutingTables(int availableIndex) const
 
 bool RtTablesInitializer::isRoutingTableInstalled(const std::string &tableName) const
 {
-    return 0 == core::Exec::bash(qs::format("grep % %", tableName, _rtLocations.etcPath), true);
+    const auto entries = readRtTables(_rtLocations.etcPath);
+    return std::any_of(entries.begin(), entries.end(),
+        [&](const RtTableEntry &entry){return entry.name == tableName;});
+}
+
+int RtTablesInitializer::tableIndex(const RtLocations &rtLocations, const std::string &tableName)
+{
+    std::vector<std::string> paths{rtLocations.etcPath};
+    paths.insert(paths.end(), rtLocations.fallbackPaths.begin(), rtLocations.fallbackPaths.end());
+    for(const auto &path : paths)
+    {
+        for(const auto &entry : readRtTables(path))
+        {
+            if(entry.name == tableName)
+                return entry.index;
+        }
+    }
+    return -1;
 }
 
 bool RtTablesInitializer::prepareRtLocation() const
@@ -19,9 +19,23 @@
 #pragma once
 #include <kapps_core/src/util.h>
 #include <kapps_net/net.h>
+#include <string>
+#include <vector>
 
 namespace kapps { namespace net {
 
+// An entry in an rt_tables file, like "100  piavpnrt"
+struct KAPPS_NET_EXPORT RtTableEntry
+{
+    int index;
+    std::string name;
+};
+
+// Read the entries in an rt_tables file.  Comments and lines that don't start
+// with a table index are skipped.  Returns no entries if the file can't be
+// read.
+std::vector<RtTableEntry> KAPPS_NET_EXPORT readRtTables(const std::string &rtPath);
+
 // NOTE: since iproute2 6.7.0 they changed the fallback file to /usr/share/iproute2/rt_tables rather than
 // /usr/lib/iproute2/rt_tables
 //
@@ -55,6 +69,9 @@ public:
         // Current fallback paths are: /usr/share/iproute2/rt_tables
         // and /usr/lib/iproute2/rt_tables and should be searched in that order.
         std::vector<std::string> fallbackPaths;
+
+        // The locations used by iproute2
+        static RtLocations system();
     };
 
 public:
@@ -67,6 +84,10 @@ public:
     // Return our routing table names (based on the brandPrefix)
     std::vector<std::string> tableNames() const { return _tableNames; }
 
+    // Find the index of a routing table - the etc file is searched first,
+    // then each fallback.  Returns -1 if the table isn't found.
+    static int tableIndex(const RtLocations &rtLocations, const std::string &tableName);
+
 private:
     // Insert our routing tables at the end of rt_tables file
     void appendRoutingTables(int availableIndex) const;
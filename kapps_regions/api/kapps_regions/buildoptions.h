@@ -0,0 +1,53 @@
+// Copyright (c) 2024 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include "regions.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Use the number of hardware threads for KARBuildOptions::threads
+#define KAR_BUILD_THREADS_AUTO ((size_t)-1)
+
+// Options for building a region list or metadata.  Zero-initialize this to
+// get the default options.
+typedef struct KARBuildOptions
+{
+    // Maximum number of threads used to build regions, including the calling
+    // thread.  0 or 1 builds everything on the calling thread; use
+    // KAR_BUILD_THREADS_AUTO to use the number of hardware threads.
+    //
+    // Large lists can be built faster with more threads.  The result is the
+    // same regardless of the thread count - duplicate IDs, DIP regions, and
+    // manual regions are resolved in the order they appear.
+    size_t threads;
+
+    // Read the JSON with a streaming parser instead of building a DOM of the
+    // whole document first, which uses much less memory.  This applies to the
+    // regions list and the Shadowsocks list, but not the legacy PIAv6 regions
+    // list or metadata.  'threads' has no effect on a streamed regions list.
+    bool streaming;
+} KARBuildOptions;
+
+#ifdef __cplusplus
+}
+#endif
@@ -23,6 +23,7 @@
 #include "regiondisplay.h"
 #include "dedicatedip.h"
 #include "manualregion.h"
+#include "buildoptions.h"
 #include <kapps_core/stringslice.h>
 #include <kapps_core/arrayslice.h>
 
@@ -50,6 +51,14 @@ KAPPS_REGIONS_EXPORT
 const KARMetadata *KARMetadataCreate(KACStringSlice metadataJson,
                                      const KARDedicatedIP *pDIPs, size_t dipCount,
                                      const KARManualRegion *pManualRegions, size_t manualCount);
+// Build the metadata like KARMetadataCreate(), with build options - for
+// example, to parse large metadata using multiple threads.  pOptions can be
+// nullptr to use the default options.
+KAPPS_REGIONS_EXPORT
+const KARMetadata *KARMetadataCreateWithOptions(KACStringSlice metadataJson,
+                                                const KARDedicatedIP *pDIPs, size_t dipCount,
+                                                const KARManualRegion *pManualRegions, size_t manualCount,
+                                                const KARBuildOptions *pOptions);
 // Build the metadata from legacy PIA regions v6 and metadata v2 JSON.  Regions
 // is required in addition to metadata, because some metadata fields were in
 // the regions JSON in the legacy format.
@@ -20,6 +20,7 @@
 #include "regions.h"
 #include "dedicatedip.h"
 #include "manualregion.h"
+#include "buildoptions.h"
 #include "region.h"
 #include <kapps_core/stringslice.h>
 
@@ -129,6 +130,21 @@ const KARRegionList *KARRegionListCreatePiav6(KACStringSlice regionsv6Json,
                                               KACStringSlice shadowsocksJson,
                                               const KARDedicatedIP *pDIPs, size_t dipCount,
                                               const KARManualRegion *pManualRegions, size_t manualCount);
+// Build a region list like KARRegionListCreate() or KARRegionListCreatePiav6(),
+// with build options - for example, to build a large list using multiple
+// threads.  pOptions can be nullptr to use the default options.
+KAPPS_REGIONS_EXPORT
+const KARRegionList *KARRegionListCreateWithOptions(KACStringSlice regionsJson,
+                                                    KACStringSlice shadowsocksJson,
+                                                    const KARDedicatedIP *pDIPs, size_t dipCount,
+                                                    const KARManualRegion *pManualRegions, size_t manualCount,
+                                                    const KARBuildOptions *pOptions);
+KAPPS_REGIONS_EXPORT
+const KARRegionList *KARRegionListCreatePiav6WithOptions(KACStringSlice regionsv6Json,
+                                                         KACStringSlice shadowsocksJson,
+                                                         const KARDedicatedIP *pDIPs, size_t dipCount,
+                                                         const KARManualRegion *pManualRegions, size_t manualCount,
+                                                         const KARBuildOptions *pOptions);
 // Destroy a region list.
 KAPPS_REGIONS_EXPORT
 void KARRegionListDestroy(const KARRegionList *pRegionList);
@@ -72,6 +72,19 @@ namespace
     const KARRegionDisplay *toApi(const RegionDisplay *p) {return static_cast<const KARRegionDisplay *>(p);}
     const KARMetadata *toApi(const Metadata *p) {return static_cast<const KARMetadata *>(p);}
 
+    // Build options are optional; nullptr uses the defaults
+    BuildOptions fromApi(const KARBuildOptions *pOptions)
+    {
+        BuildOptions options;
+        if(pOptions)
+        {
+            options.threads = pOptions->threads == KAR_BUILD_THREADS_AUTO ?
+                kapps::core::AutoThreads : pOptions->threads;
+            options.streaming = pOptions->streaming;
+        }
+        return options;
+    }
+
     // KARDedicatedIP and KARManualRegion both contain KARStringSliceArrays;
     // to interpret these we allocate a vector<core::StringSlice> to populate
     // the core::ArraySlice<const core::StringSlice>.  Those have to be held
@@ -299,6 +312,40 @@ extern "C"
                 fromApi(shadowsocksJson), dips, manual});
         });
     }
+    const KARRegionList *KARRegionListCreateWithOptions(KACStringSlice regionsJson,
+                                                        KACStringSlice shadowsocksJson,
+                                                        const KARDedicatedIP *pDIPs,
+                                                        size_t dipCount,
+                                                        const KARManualRegion *pManualRegions,
+                                                        size_t manualCount,
+                                                        const KARBuildOptions *pOptions)
+    {
+        return guard([&]
+        {
+            ServiceGroupsStorage serviceGroupsStorage;
+            auto dips = fromApi(pDIPs, dipCount, serviceGroupsStorage);
+            auto manual = fromApi(pManualRegions, manualCount, serviceGroupsStorage);
+            return toApi(new RegionList{fromApi(regionsJson),
+                fromApi(shadowsocksJson), dips, manual, fromApi(pOptions)});
+        });
+    }
+    const KARRegionList *KARRegionListCreatePiav6WithOptions(KACStringSlice regionsv6Json,
+                                                             KACStringSlice shadowsocksJson,
+                                                             const KARDedicatedIP *pDIPs,
+                                                             size_t dipCount,
+                                                             const KARManualRegion *pManualRegions,
+                                                             size_t manualCount,
+                                                             const KARBuildOptions *pOptions)
+    {
+        return guard([&]
+        {
+            ServiceGroupsStorage serviceGroupsStorage;
+            auto dips = fromApi(pDIPs, dipCount, serviceGroupsStorage);
+            auto manual = fromApi(pManualRegions, manualCount, serviceGroupsStorage);
+            return toApi(new RegionList{RegionList::PIAv6, fromApi(regionsv6Json),
+                fromApi(shadowsocksJson), dips, manual, fromApi(pOptions)});
+        });
+    }
     void KARRegionListDestroy(const KARRegionList *pRegionList)
     {
         guard(pRegionList, [&]
@@ -425,6 +472,22 @@ extern "C"
             return toApi(new Metadata{fromApi(metadataJson), dips, manual});
         });
     }
+    const KARMetadata *KARMetadataCreateWithOptions(KACStringSlice metadataJson,
+                                                    const KARDedicatedIP *pDIPs,
+                                                    size_t dipCount,
+                                                    const KARManualRegion *pManualRegions,
+                                                    size_t manualCount,
+                                                    const KARBuildOptions *pOptions)
+    {
+        return guard([&]
+        {
+            ServiceGroupsStorage serviceGroupsStorage;
+            auto dips = fromApi(pDIPs, dipCount, serviceGroupsStorage);
+            auto manual = fromApi(pManualRegions, manualCount, serviceGroupsStorage);
+            return toApi(new Metadata{fromApi(metadataJson), dips, manual,
+                fromApi(pOptions)});
+        });
+    }
     const KARMetadata *KARMetadataCreatePiav6v2(KACStringSlice regionsv6Json,
                                                 KACStringSlice metadatav2Json,
                                                 const KARDedicatedIP *pDIPs,
@@ -19,31 +19,88 @@
 #include "metadata.h"
 #include <kapps_core/src/corejson.h>
 #include <nlohmann/json.hpp>
+#include <algorithm>
 
 namespace kapps::regions {
 
 namespace
 {
+    template<class T, class GetKeyT>
+    void insertSharedElements(std::vector<std::shared_ptr<const T>> elements,
+        GetKeyT getKey,
+        std::unordered_map<core::StringSlice, std::shared_ptr<const T>> &elementsById)
+    {
+        elementsById.clear();
+
+        elementsById.reserve(elements.size());
+        for(auto &pValue : elements)
+        {
+            assert(pValue); // Ensured by caller
+            if(elementsById.count(getKey(*pValue)))
+            {
+                KAPPS_CORE_WARNING() << "Duplicate" << core::typeName<T>()
+                    << "ID:" << getKey(*pValue);
+            }
+            else
+                elementsById.emplace(getKey(*pValue), std::move(pValue));
+        }
+    }
+
+    // Parsing an element is quick, don't start a thread for fewer elements
+    // than this
+    constexpr std::size_t MinElementsPerThread{64};
+
     template<class T, class GetKeyT, class JsonT>
     void readSharedElements(const JsonT &j, GetKeyT getKey,
-        std::unordered_map<core::StringSlice, std::shared_ptr<const T>> &elementsById)
+        std::unordered_map<core::StringSlice, std::shared_ptr<const T>> &elementsById,
+        core::WorkerPool *pPool = nullptr)
     {
         elementsById.clear();
 
         elementsById.reserve(j.size());
-        core::readJsonArrayTolerant<T>(j,[&](T value)
-            {
-                if(elementsById.count(getKey(value)))
+        if(!pPool || pPool->threads() <= 1)
+        {
+            core::readJsonArrayTolerant<T>(j,[&](T value)
                 {
-                    KAPPS_CORE_WARNING() << "Duplicate" << core::typeName<T>()
-                        << "ID:" << getKey(value);
-                }
-                else
+                    if(elementsById.count(getKey(value)))
+                    {
+                        KAPPS_CORE_WARNING() << "Duplicate" << core::typeName<T>()
+                            << "ID:" << getKey(value);
+                    }
+                    else
+                    {
+                        auto pValue = std::make_shared<T>(std::move(value));
+                        elementsById.emplace(getKey(*pValue), std::move(pValue));
+                    }
+                });
+            return;
+        }
+
+        // Parse the elements on worker threads, then insert them in order so
+        // duplicates are resolved the same way
+        const auto &jsonArray = core::jsonArray(j);
+        std::vector<std::shared_ptr<const T>> elements;
+        elements.resize(jsonArray.size());
+        pPool->parallelChunks(jsonArray.size(), MinElementsPerThread,
+            [&](std::size_t begin, std::size_t end)
+            {
+                for(std::size_t i=begin; i<end; ++i)
                 {
-                    auto pValue = std::make_shared<T>(std::move(value));
-                    elementsById.emplace(getKey(*pValue), std::move(pValue));
+                    try
+                    {
+                        elements[i] = std::make_shared<T>(jsonArray[i].template get<T>());
+                    }
+                    catch(const std::exception &ex)
+                    {
+                        KAPPS_CORE_WARNING() << "Unable to read" << core::typeName<T>()
+                            << "from array element" << i << "-" << jsonArray[i];
+                        // Ignore this value
+                    }
                 }
             });
+        elements.erase(std::remove(elements.begin(), elements.end(), nullptr),
+                       elements.end());
+        insertSharedElements(std::move(elements), getKey, elementsById);
     }
 
     template<class T>
@@ -104,7 +161,8 @@ namespace
 
 Metadata::Metadata(core::StringSlice metadataJson,
                    core::ArraySlice<const DedicatedIp> dips,
-                   core::ArraySlice<const ManualRegion> manual)
+                   core::ArraySlice<const ManualRegion> manual,
+                   const BuildOptions &options)
 {
     auto json = nlohmann::json::parse(metadataJson);
 
@@ -117,12 +175,14 @@ Metadata::Metadata(core::StringSlice metadataJson,
             _dynamicGroupsById);
     }
 
+    // Both display lists are parsed on the same worker threads
+    core::WorkerPool pool{options.threads};
     readSharedElements<CountryDisplay>(json.at("countries"),
         [](const CountryDisplay &value){return value.code();},
-        _countryDisplaysById);
+        _countryDisplaysById, &pool);
     readSharedElements<RegionDisplay>(json.at("regions"),
         [](const RegionDisplay &value){return value.id();},
-        _regionDisplaysById);
+        _regionDisplaysById, &pool);
 
     copyDipRegionDisplays(dips);
     buildManualRegionDisplays(manual);
@@ -132,6 +192,25 @@ Metadata::Metadata(core::StringSlice metadataJson,
     buildFlatVector(_regionDisplaysById, _regionDisplays);
 }
 
+Metadata::Metadata(std::vector<std::shared_ptr<const DynamicRole>> dynamicGroups,
+                   std::vector<std::shared_ptr<const CountryDisplay>> countryDisplays,
+                   std::vector<std::shared_ptr<const RegionDisplay>> regionDisplays)
+{
+    insertSharedElements(std::move(dynamicGroups),
+        [](const DynamicRole &value){return value.id();},
+        _dynamicGroupsById);
+    insertSharedElements(std::move(countryDisplays),
+        [](const CountryDisplay &value){return value.code();},
+        _countryDisplaysById);
+    insertSharedElements(std::move(regionDisplays),
+        [](const RegionDisplay &value){return value.id();},
+        _regionDisplaysById);
+
+    buildFlatVector(_dynamicGroupsById, _dynamicGroups);
+    buildFlatVector(_countryDisplaysById, _countryDisplays);
+    buildFlatVector(_regionDisplaysById, _regionDisplays);
+}
+
 Metadata::Metadata(core::StringSlice regionsv6Json, core::StringSlice metadatav2Json,
                    core::ArraySlice<const DedicatedIp> dips,
                    core::ArraySlice<const ManualRegion> manual)
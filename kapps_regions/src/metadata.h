@@ -43,9 +43,13 @@ public:
     // - For manual regions, Metadata fabricates a dummy CountryDisplay and
     //   RegionDisplay.  There are no translations, but there is en-US display
     //   text filled in (for example, the region name becomes "<cn> - <ip>")
+    //
+    // The country and region displays can be parsed on worker threads; see
+    // BuildOptions.
     Metadata(core::StringSlice metadataJson,
              core::ArraySlice<const DedicatedIp> dips,
-             core::ArraySlice<const ManualRegion> manual);
+             core::ArraySlice<const ManualRegion> manual,
+             const BuildOptions &options = {});
 
     // Like RegionList, the legacy PIA metadata v2 format can be loaded also.
     // This requires the regions v6 data too - some of the data were moved from
@@ -55,6 +59,13 @@ public:
              core::ArraySlice<const DedicatedIp> dips,
              core::ArraySlice<const ManualRegion> manual);
 
+    // Construct from elements that have already been built - used to restore
+    // a snapshot (see snapshot.h).  Duplicate IDs are ignored with a warning,
+    // like the JSON constructors.
+    Metadata(std::vector<std::shared_ptr<const DynamicRole>> dynamicGroups,
+             std::vector<std::shared_ptr<const CountryDisplay>> countryDisplays,
+             std::vector<std::shared_ptr<const RegionDisplay>> regionDisplays);
+
     // Like RegionList, we need to implement moves to ensure the
     // cross-referenced containers remain valid
     Metadata(Metadata &&other) : Metadata{} {*this = std::move(other);}
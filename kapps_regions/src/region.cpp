@@ -19,14 +19,83 @@
 #include "region.h"
 namespace kapps::regions {
 
-const Server *Region::firstServerFor(Service service) const
+Region::Region(std::shared_ptr<RegionStorage> pStorage, core::StringSlice id,
+               bool autoSafe, bool portForward, bool geoLocated,
+               core::Ipv4Address dipAddress, std::vector<Server> servers)
+    : _autoSafe{autoSafe}, _portForward{portForward}, _geoLocated{geoLocated},
+      _dipAddress{dipAddress}, _servers{std::move(servers)}
+{
+    // There are no other invariants to check - a region _could_ have zero
+    // servers, which makes it "offline"
+    assert(pStorage);   // Ensured by caller
+
+    _id = pStorage->intern(id);
+    _serversRaw.reserve(_servers.size());
+    for(auto &server : _servers)
+    {
+        server._commonName = pStorage->intern(server._commonName);
+        server._fqdn = pStorage->intern(server._fqdn);
+        server._pRegion = this;
+        _serversRaw.push_back(&server);
+    }
+    _pStorage = std::move(pStorage);
+
+    for(std::uint32_t i=0; i<_servers.size(); ++i)
+    {
+        _services |= _servers[i].services();
+        for(std::size_t service=0; service<ServiceCount; ++service)
+        {
+            if(_servers[i].hasService(static_cast<Service>(service)))
+                _serverIndices[service].push_back(i);
+        }
+    }
+}
+
+Region &Region::operator=(Region &&other)
 {
-    for(const auto &pServer : _servers)
+    _pStorage = std::move(other._pStorage);
+    _id = other._id;
+    _autoSafe = other._autoSafe;
+    _portForward = other._portForward;
+    _geoLocated = other._geoLocated;
+    _dipAddress = other._dipAddress;
+    _servers = std::move(other._servers);
+    _services = other._services;
+    // The indices are still valid since they're relative to _servers
+    _serverIndices = std::move(other._serverIndices);
+    _serversRaw.clear();
+    _serversRaw.reserve(_servers.size());
+    for(auto &server : _servers)
     {
-        if(pServer && pServer->hasService(service))
-            return pServer.get();
+        server._pRegion = this;
+        _serversRaw.push_back(&server);
     }
-    return nullptr;
+
+    // Leave other in a valid state (not violating its invariant that
+    // _serversRaw corresponds to _servers); just clear both containers.
+    other._id = {};
+    other._servers.clear();
+    other._serversRaw.clear();
+    other._services = {};
+    for(auto &indices : other._serverIndices)
+        indices.clear();
+    return *this;
+}
+
+const Server *Region::firstServerFor(Service service) const
+{
+    auto indices = serverIndicesFor(service);
+    if(indices.empty())
+        return nullptr;
+    return &_servers[indices[0]];
+}
+
+core::ArraySlice<const std::uint32_t> Region::serverIndicesFor(Service service) const
+{
+    auto serviceIdx = static_cast<std::size_t>(service);
+    if(serviceIdx >= _serverIndices.size())
+        return {};
+    return _serverIndices[serviceIdx];
 }
 
 }
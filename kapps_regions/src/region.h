@@ -18,6 +18,8 @@
 
 #pragma once
 #include "server.h"
+#include "regionstorage.h"
+#include <array>
 #include <kapps_core/src/retainshared.h>
 
 namespace kapps::regions {
@@ -26,45 +28,18 @@ class KAPPS_REGIONS_EXPORT Region : public core::RetainSharedFromThis<Region>
 {
 public:
     Region() = default;
-    Region(std::string id, bool autoSafe, bool portForward, bool geoLocated,
-           core::Ipv4Address dipAddress,
-           std::vector<std::shared_ptr<const Server>> servers)
-        : _id{std::move(id)}, _autoSafe{autoSafe}, _portForward{portForward},
-          _geoLocated{geoLocated}, _dipAddress{dipAddress},
-          _servers{std::move(servers)}
-    {
-        // There are no other invariants to check - a region _could_ have zero
-        // servers, which makes it "offline"
-
-        _serversRaw.reserve(_servers.size());
-        for(const auto &pServer : _servers)
-            _serversRaw.push_back(pServer.get());
-    }
+    // The region ID and the servers' strings are interned in pStorage, so they
+    // only need to remain valid for the constructor.  The servers' service
+    // groups must be owned by pStorage.
+    Region(std::shared_ptr<RegionStorage> pStorage, core::StringSlice id,
+           bool autoSafe, bool portForward, bool geoLocated,
+           core::Ipv4Address dipAddress, std::vector<Server> servers);
 
     // Like RegionList, we need to be sure the move constructor treats _servers
-    // and _serversRaw consistently
+    // and _serversRaw consistently.  The servers' back-pointers also have to be
+    // updated to refer to this Region.
     Region(Region &&other) : Region{} {*this = std::move(other);}
-    Region &operator=(Region &&other)
-    {
-        _id = std::move(other._id);
-        _autoSafe = std::move(other._autoSafe);
-        _portForward = std::move(other._portForward);
-        _geoLocated = std::move(other._geoLocated);
-        _dipAddress = std::move(other._dipAddress);
-        _servers = std::move(other._servers);
-        _serversRaw = std::move(other._serversRaw);
-
-        // To guarantee that other is in a valid state (not violating its
-        // invariant that _serversRaw corresponds to _servers); just clear both
-        // containers.  Although it's unlikely, vector's move assignment is
-        // allowed to make different choices moving _servers and _serversRaw;
-        // i.e. it could swap one and move+clear the other.  (Maybe it might
-        // if there was some sort of "small vector" optimization analogous to
-        // the "small string" optimization.)
-        other._servers.clear();
-        other._serversRaw.clear();
-        return *this;
-    }
+    Region &operator=(Region &&other);
 
 public:
     core::StringSlice id() const {return _id;}
@@ -77,20 +52,31 @@ public:
     bool isDedicatedIp() const {return dipAddress() != core::Ipv4Address{};}
     core::Ipv4Address dipAddress() const {return _dipAddress;}
 
-    bool hasService(Service service) const {return firstServerFor(service);}
+    // The services provided by any server in this region
+    ServiceMask services() const {return _services;}
+    bool hasService(Service service) const {return _services & serviceBit(service);}
     const Server *firstServerFor(Service service) const;
 
     core::ArraySlice<const Server * const> servers() const {return _serversRaw;}
+    // Indices (in servers()) of the servers providing a given service, in
+    // order.  These are built with the region so selecting a server for a
+    // service doesn't have to scan all servers.
+    core::ArraySlice<const std::uint32_t> serverIndicesFor(Service service) const;
 
 private:
-    std::string _id;
+    // Holds the string data and service groups referenced by this Region and
+    // its Servers; usually shared with all other Regions from the same
+    // RegionList.
+    std::shared_ptr<const RegionStorage> _pStorage;
+    core::StringSlice _id;
     bool _autoSafe;
     bool _portForward;
     bool _geoLocated;
     core::Ipv4Address _dipAddress;  // Zero if not a DIP region
-    std::vector<std::shared_ptr<const Server>> _servers;
+    std::vector<Server> _servers;
     // Raw pointer array to provide an array slice to API
     std::vector<const Server*> _serversRaw;
+    ServiceMask _services{};
+    std::array<std::vector<std::uint32_t>, ServiceCount> _serverIndices;
 };
-
 }
@@ -17,6 +17,7 @@
 // <https://www.gnu.org/licenses/>.
 
 #include "regionlist.h"
+#include "regionsjson.h"
 #include <kapps_core/src/logger.h>
 #include <nlohmann/json.hpp>
 
@@ -24,41 +25,63 @@ namespace kapps::regions {
 
 RegionList::PIAv6_t RegionList::PIAv6{};
 
+namespace
+{
+    // Building a region is quick, don't start a thread for fewer regions than
+    // this
+    constexpr std::size_t MinRegionsPerThread{32};
+}
+
+const std::shared_ptr<RegionList::Data> &RegionList::emptyData()
+{
+    static const std::shared_ptr<Data> pEmpty{std::make_shared<Data>()};
+    return pEmpty;
+}
+
+RegionList::RegionList()
+    : _pData{emptyData()}
+{
+}
+
 RegionList::RegionList(core::StringSlice regionsJson,
                        core::StringSlice shadowsocksJson,
                        core::ArraySlice<const DedicatedIp> dips,
-                       core::ArraySlice<const ManualRegion> manual)
+                       core::ArraySlice<const ManualRegion> manual,
+                       const BuildOptions &options)
+    : _pData{std::make_shared<Data>()}
 {
-    auto json = nlohmann::json::parse(regionsJson);
-    auto groups = readJsonServiceGroups(json);
-
-    // pubdns is optional; empty array if not provided.  If provided, all values
-    // must be IPv4 addresses.
-    auto itPubDns = json.find("pubdns");
-    if(itPubDns != json.end())
-        _publicDnsServers = itPubDns->get<std::vector<core::Ipv4Address>>();
+    _pData->pStorage = std::make_shared<RegionStorage>();
 
     // If a Shadowsocks list was given, read Shadowsocks servers so we can
-    // include them in the regions list.  Allow an empty shadowsocksJson for
-    // clients that don't use it.
-    ShadowsocksServers shadowsocksServers;
-    nlohmann::json shadowsocksJsonObj;
-    if(!shadowsocksJson.empty())
+    // include them in the regions list.
+    auto shadowsocksServers = readShadowsocksServers(shadowsocksJson, options);
+
+    ServiceGroups groups;
+    if(options.streaming)
+        groups = readStreamingJson(regionsJson, shadowsocksServers);
+    else
     {
-        shadowsocksJsonObj = nlohmann::json::parse(shadowsocksJson);
-        shadowsocksServers = readShadowsocksServers(shadowsocksJsonObj);
+        auto json = nlohmann::json::parse(regionsJson);
+        groups = readJsonServiceGroups(json);
+
+        // pubdns is optional; empty array if not provided.  If provided, all
+        // values must be IPv4 addresses.
+        auto itPubDns = json.find("pubdns");
+        if(itPubDns != json.end())
+            _pData->publicDnsServers = itPubDns->get<std::vector<core::Ipv4Address>>();
+
+        // The regions and servers don't use plain JSON conversions due to the
+        // "service group name" -> "service group" translation, which requires
+        // the service group map.  Read them manually.
+        const auto &jsonRegions = json.at("regions");
+        _pData->regionsById.reserve(jsonRegions.size() + dips.size() + manual.size());
+
+        readJsonRegions(jsonRegions, groups, shadowsocksServers, options);
     }
 
-    // The regions and servers don't use plain JSON conversions due to the
-    // "service group name" -> "service group" translation, which requires the
-    // service group map.  Read them manually.
-    const auto &jsonRegions = json.at("regions");
-    _regionsById.reserve(jsonRegions.size() + dips.size() + manual.size());
-
-    readJsonRegions(jsonRegions, groups, shadowsocksServers);
     StdRegionsById stdRegions;
-    stdRegions.reserve(_regionsById.size());
-    for(const auto &[id, pRegion] : _regionsById)
+    stdRegions.reserve(_pData->regionsById.size());
+    for(const auto &[id, pRegion] : _pData->regionsById)
         stdRegions.insert({id, pRegion.get()});
 
     // Add Dedicated IP regions.  These need to reference standard regions for
@@ -68,17 +91,34 @@ RegionList::RegionList(core::StringSlice regionsJson,
     // Add manual regions too.
     buildManualRegions(manual, groups, stdRegions);
 
-    // Set up _regions now that we've fully built _regionsById
-    _regions.reserve(_regionsById.size());
-    for(const auto &[id, pRegion] : _regionsById)
-        _regions.push_back(pRegion.get());
+    buildIndices();
+}
+
+RegionList::RegionList(std::vector<core::Ipv4Address> publicDnsServers,
+                       std::vector<std::shared_ptr<const Region>> regions)
+    : _pData{std::make_shared<Data>()}
+{
+    _pData->publicDnsServers = std::move(publicDnsServers);
+    _pData->regionsById.reserve(regions.size());
+    for(auto &pRegion : regions)
+    {
+        assert(pRegion);    // Ensured by caller
+        if(_pData->regionsById.count(pRegion->id()))
+            throw std::runtime_error("Duplicate region ID");
+        _pData->regionsById.emplace(pRegion->id(), std::move(pRegion));
+    }
+
+    buildIndices();
 }
 
 RegionList::RegionList(PIAv6_t, core::StringSlice regionsJson,
                        core::StringSlice shadowsocksJson,
                        core::ArraySlice<const DedicatedIp> dips,
-                       core::ArraySlice<const ManualRegion> manual)
+                       core::ArraySlice<const ManualRegion> manual,
+                       const BuildOptions &options)
+    : _pData{std::make_shared<Data>()}
 {
+    _pData->pStorage = std::make_shared<RegionStorage>();
     auto json = nlohmann::json::parse(regionsJson);
     // Read service groups.  The v6 service groups are just an array of services
     // (the "name" is the property key in "groups"), and the format is nearly
@@ -112,16 +152,16 @@ RegionList::RegionList(PIAv6_t, core::StringSlice regionsJson,
             // the group doesn't actually have any OpenVPN services, so we can
             // still look in either map when reading servers.)
             pssGroups.emplace(groupKey,
-                std::make_shared<ServiceGroup>(
+                _pData->pStorage->addServiceGroup({
                     newGroup.openVpnUdpPorts().to_vector(), false,
                     newGroup.openVpnTcpPorts().to_vector(), false,
                     newGroup.wireGuardPorts().to_vector(), newGroup.ikev2(),
                     newGroup.shadowsocksPorts().to_vector(),
                     newGroup.shadowsocksKey().to_string(),
                     newGroup.shadowsocksCipher().to_string(),
-                    newGroup.metaPorts().to_vector()));
+                    newGroup.metaPorts().to_vector()}));
             ncpGroups.emplace(groupKey,
-                std::make_shared<ServiceGroup>(std::move(newGroup)));
+                _pData->pStorage->addServiceGroup(std::move(newGroup)));
         }
         catch(const std::exception &ex)
         {
@@ -133,21 +173,16 @@ RegionList::RegionList(PIAv6_t, core::StringSlice regionsJson,
     // The v6 format does not provide pubdns.
 
     // If a Shadowsocks list was given, read Shadowsocks servers.
-    ShadowsocksServers shadowsocksServers;
-    nlohmann::json shadowsocksJsonObj;
-    if(!shadowsocksJson.empty())
-    {
-        shadowsocksJsonObj = nlohmann::json::parse(shadowsocksJson);
-        shadowsocksServers = readShadowsocksServers(shadowsocksJsonObj);
-    }
+    auto shadowsocksServers = readShadowsocksServers(shadowsocksJson, options);
 
     const auto &jsonRegions = json.at("regions");
-    _regionsById.reserve(jsonRegions.size() + dips.size() + manual.size());
+    _pData->regionsById.reserve(jsonRegions.size() + dips.size() + manual.size());
 
-    readPiav6JsonRegions(jsonRegions, ncpGroups, pssGroups, shadowsocksServers);
+    readPiav6JsonRegions(jsonRegions, ncpGroups, pssGroups,
+                         shadowsocksServers, options);
     StdRegionsById stdRegions;
-    stdRegions.reserve(_regionsById.size());
-    for(const auto &[id, pRegion] : _regionsById)
+    stdRegions.reserve(_pData->regionsById.size());
+    for(const auto &[id, pRegion] : _pData->regionsById)
         stdRegions.insert({id, pRegion.get()});
 
     // DIP and manual regions are assumed not to support NCP (use pssGroups).
@@ -155,10 +190,20 @@ RegionList::RegionList(PIAv6_t, core::StringSlice regionsJson,
     buildDipRegions(dips, pssGroups, stdRegions);
     buildManualRegions(manual, pssGroups, stdRegions);
 
-    // Set up _regions now that we've fully built _regionsById
-    _regions.reserve(_regionsById.size());
-    for(const auto &[id, pRegion] : _regionsById)
-        _regions.push_back(pRegion.get());
+    buildIndices();
+}
+
+void RegionList::buildIndices()
+{
+    std::vector<std::shared_ptr<const Region>> tableRegions;
+    tableRegions.reserve(_pData->regionsById.size());
+    _pData->regions.reserve(_pData->regionsById.size());
+    for(const auto &[id, pRegion] : _pData->regionsById)
+    {
+        _pData->regions.push_back(pRegion.get());
+        tableRegions.push_back(pRegion);
+    }
+    _pData->pServerTable = std::make_shared<ServerTable>(std::move(tableRegions));
 }
 
 auto RegionList::readJsonServiceGroups(const nlohmann::json &json)
@@ -168,51 +213,156 @@ auto RegionList::readJsonServiceGroups(const nlohmann::json &json)
     const auto &jsonGroups = json.at("service_configs");
     groups.reserve(jsonGroups.size());
     for(const auto &jsonGroup : core::jsonArray(jsonGroups))
+        readJsonServiceGroup(jsonGroup, groups);
+
+    return groups;
+}
+
+void RegionList::readJsonServiceGroup(const nlohmann::json &jsonGroup,
+                                      ServiceGroups &groups)
+{
+    // Malformed service groups, servers, regions, etc. are ignored
+    // individually; we still parse as much of the regions list as we can
+    core::StringSlice name;
+    try
     {
-        // Malformed service groups, servers, regions, etc. are ignored
-        // individually; we still parse as much of the regions list as we can
-        core::StringSlice name;
-        try
+        // Intern the name, the JSON may not outlive the group map when
+        // streaming
+        name = _pData->pStorage->intern(jsonGroup.at("name").get<core::StringSlice>());
+
+        // If it's a duplicate, ignore it.
+        if(groups.count(name))
         {
-            name = jsonGroup.at("name").get<core::StringSlice>();
+            KAPPS_CORE_WARNING() << "Duplicate service group" << name
+                << "in regions list";
+            throw std::runtime_error{"Duplicate service group in regions list"};
+        }
 
-            // If it's a duplicate, ignore it.
-            if(groups.count(name))
-            {
-                KAPPS_CORE_WARNING() << "Duplicate service group" << name
-                    << "in regions list";
-                throw std::runtime_error{"Duplicate service group in regions list"};
-            }
+        auto group = jsonGroup.get<ServiceGroup>();
+        groups.emplace(name, _pData->pStorage->addServiceGroup(std::move(group)));
+    }
+    catch(const std::exception &ex)
+    {
+        KAPPS_CORE_WARNING() << "Unable to read service group" << name << "-"
+            << ex.what();
+    }
+}
 
-            auto group = jsonGroup.get<ServiceGroup>();
-            groups.emplace(name, std::make_shared<ServiceGroup>(std::move(group)));
-        }
-        catch(const std::exception &ex)
+auto RegionList::readStreamingJson(core::StringSlice regionsJson,
+    const ShadowsocksServers &shadowsocksServers)
+    -> ServiceGroups
+{
+    ServiceGroups groups;
+    auto data = readRegionsJson(regionsJson, *_pData->pStorage,
+        [&](const nlohmann::json &jsonGroup)
         {
-            KAPPS_CORE_WARNING() << "Unable to read service group" << name << "-"
-                << ex.what();
+            readJsonServiceGroup(jsonGroup, groups);
+        });
+    _pData->publicDnsServers = std::move(data.publicDnsServers);
+
+    // The servers refer to service groups by name, so the regions are built
+    // once all service groups are known.
+    std::vector<std::shared_ptr<const Region>> regions;
+    regions.reserve(data.regions.size());
+    for(const auto &record : data.regions)
+    {
+        std::vector<Server> servers;
+        servers.reserve(record.servers.size());
+        int serverIdx{};    // Just for diagnostics
+        for(const auto &serverRecord : record.servers)
+        {
+            if(!serverRecord.valid)
+            {
+                KAPPS_CORE_WARNING() << "Unable to read server" << serverIdx
+                    << "of region" << record.id;
+            }
+            else if(auto pGroup = findServerGroup(groups,
+                serverRecord.serviceGroup, serverIdx, record.id))
+            {
+                servers.emplace_back(serverRecord.address,
+                    serverRecord.commonName, serverRecord.fqdn, pGroup);
+            }
+            ++serverIdx;
         }
+        // Add Shadowsocks if the region isn't offline
+        if(!servers.empty())
+            addShadowsocksServer(record.id, servers, shadowsocksServers);
+
+        regions.push_back(std::make_shared<Region>(_pData->pStorage, record.id,
+            record.autoSafe, record.portForward, record.geoLocated,
+            core::Ipv4Address{}, std::move(servers)));
     }
+    _pData->regionsById.reserve(regions.size());
+    addJsonRegions(std::move(regions));
 
     return groups;
 }
 
+template<class BuildRegionFuncT>
+void RegionList::buildJsonRegions(const nlohmann::json &jsonRegions,
+                                  const BuildOptions &options,
+                                  const BuildRegionFuncT &buildRegion)
+{
+    const auto &jsonArray = core::jsonArray(jsonRegions);
+    std::vector<std::shared_ptr<const Region>> regions;
+    regions.resize(jsonArray.size());
+
+    // Build the regions.  With more than one thread, each chunk interns strings
+    // in its own storage, since StringTable isn't thread-safe.
+    core::parallelChunks(jsonArray.size(), options.threads, MinRegionsPerThread,
+        [&](std::size_t begin, std::size_t end)
+        {
+            auto pStorage = _pData->pStorage;
+            if(begin > 0 || end < jsonArray.size())
+                pStorage = std::make_shared<RegionStorage>(_pData->pStorage);
+
+            for(std::size_t i=begin; i<end; ++i)
+            {
+                core::StringSlice id;
+                try
+                {
+                    regions[i] = buildRegion(jsonArray[i], pStorage, id);
+                }
+                catch(const std::exception &ex)
+                {
+                    KAPPS_CORE_WARNING() << "Unable to read region" << id << "-"
+                        << ex.what();
+                }
+            }
+        });
+
+    addJsonRegions(std::move(regions));
+}
+
+void RegionList::addJsonRegions(std::vector<std::shared_ptr<const Region>> regions)
+{
+    // Add the regions in order, so the first of any duplicate IDs is used
+    // regardless of how the regions were built
+    for(auto &pRegion : regions)
+    {
+        if(!pRegion)
+            continue;   // Ignored, already traced
+        if(_pData->regionsById.count(pRegion->id()))
+        {
+            KAPPS_CORE_WARNING() << "Duplicate region" << pRegion->id()
+                << "in regions list";
+            continue;
+        }
+        _pData->regionsById.emplace(pRegion->id(), std::move(pRegion));
+    }
+}
+
 void RegionList::readJsonRegions(const nlohmann::json &jsonRegions,
     const ServiceGroups &groups,
-    const ShadowsocksServers &shadowsocksServers)
+    const ShadowsocksServers &shadowsocksServers,
+    const BuildOptions &options)
 {
-    for(const auto &jsonRegion : core::jsonArray(jsonRegions))
-    {
-        core::StringSlice id;
-        try
+    buildJsonRegions(jsonRegions, options,
+        [&](const nlohmann::json &jsonRegion,
+            const std::shared_ptr<RegionStorage> &pStorage,
+            core::StringSlice &id)
         {
             id = jsonRegion.at("id").get<core::StringSlice>();
-            if(_regionsById.count(id))
-            {
-                KAPPS_CORE_WARNING() << "Duplicate region" << id
-                    << "in regions list";
-                throw std::runtime_error("Duplicate region ID");
-            }
 
             auto autoRegion = jsonRegion.at("auto_region").get<bool>();
             auto portForward = jsonRegion.at("port_forward").get<bool>();
@@ -223,24 +373,17 @@ void RegionList::readJsonRegions(const nlohmann::json &jsonRegions,
             if(!servers.empty())
                 addShadowsocksServer(id, servers, shadowsocksServers);
 
-            auto pRegion = std::make_shared<Region>(id.to_string(), autoRegion, portForward,
-                    geo, std::string{}, std::move(servers));
-            _regionsById.emplace(pRegion->id(), std::move(pRegion));
-        }
-        catch(const std::exception &ex)
-        {
-            KAPPS_CORE_WARNING() << "Unable to read region" << id << "-"
-                << ex.what();
-        }
-    }
+            return std::make_shared<Region>(pStorage, id, autoRegion,
+                portForward, geo, core::Ipv4Address{}, std::move(servers));
+        });
 }
 
 auto RegionList::readJsonRegionServers(const nlohmann::json &jsonRegion,
-    core::StringSlice id, const ServiceGroups &groups)
-    -> std::vector<std::shared_ptr<const Server>>
+    core::StringSlice id, const ServiceGroups &groups) const
+    -> std::vector<Server>
 {
     const auto &jsonServers = jsonRegion.at("servers");
-    std::vector<std::shared_ptr<const Server>> servers;
+    std::vector<Server> servers;
     servers.reserve(jsonServers.size());
     int serverIdx{};    // Just for diagnostics
     for(const auto &jsonServer : core::jsonArray(jsonServers))
@@ -248,29 +391,16 @@ auto RegionList::readJsonRegionServers(const nlohmann::json &jsonRegion,
         try
         {
             auto ip = jsonServer.at("ip").get<core::Ipv4Address>();
-            auto cn = jsonServer.at("cn").get<std::string>();
-            std::string fqdn;
+            auto cn = jsonServer.at("cn").get<core::StringSlice>();
+            core::StringSlice fqdn;
             // FQDN is optional; only used for IKEv2 on some platforms
             auto itFqdn = jsonServer.find("fqdn");
             if(itFqdn != jsonServer.end())
-                fqdn = itFqdn->get<std::string>();
+                fqdn = itFqdn->get<core::StringSlice>();
             auto group = jsonServer.at("service_config").get<core::StringSlice>();
 
-            // Find the group
-            auto itGroup = groups.find(group);
-            if(itGroup == groups.end())
-            {
-                KAPPS_CORE_WARNING() << "Unable to find service config" << group
-                    << "for server" << serverIdx << "in region" << id;
-            }
-            // Otherwise, it existed - if it had at least one service,
-            // store this server.  (If it had no known services, ignore
-            // this server.)
-            else if(itGroup->second && itGroup->second->hasAnyService())
-            {
-                servers.push_back(std::make_shared<Server>(ip, std::move(cn),
-                    std::move(fqdn), itGroup->second));
-            }
+            if(auto pGroup = findServerGroup(groups, group, serverIdx, id))
+                servers.emplace_back(ip, cn, fqdn, pGroup);
         }
         catch(const std::exception &ex)
         {
@@ -284,6 +414,24 @@ auto RegionList::readJsonRegionServers(const nlohmann::json &jsonRegion,
     return servers;
 }
 
+auto RegionList::findServerGroup(const ServiceGroups &groups,
+    core::StringSlice group, int serverIdx, core::StringSlice id) const
+    -> const ServiceGroup*
+{
+    auto itGroup = groups.find(group);
+    if(itGroup == groups.end())
+    {
+        KAPPS_CORE_WARNING() << "Unable to find service config" << group
+            << "for server" << serverIdx << "in region" << id;
+        return nullptr;
+    }
+    // Otherwise, it existed - if it had at least one service, use it.  (If it
+    // had no known services, the server is ignored.)
+    if(itGroup->second && itGroup->second->hasAnyService())
+        return itGroup->second;
+    return nullptr;
+}
+
 // Map from legacy Shadowsocks IDs (from legacy infrastructure) to
 // corresponding modern region IDs.  Legacy IDs from the list are replaced with
 // the new IDs.
@@ -297,50 +445,68 @@ const std::unordered_map<core::StringSlice, core::StringSlice> ssLegacyIds
     {"nl", "nl_amsterdam"}
 };
 
-auto RegionList::readShadowsocksServers(const nlohmann::json &json) const
+auto RegionList::readShadowsocksServers(core::StringSlice shadowsocksJson,
+    const BuildOptions &options)
     -> ShadowsocksServers
 {
     ShadowsocksServers servers;
-    int idx{0}; // For tracing
-    for(const auto &ssRegion : core::jsonArray(json))
+    // Allow an empty shadowsocksJson for clients that don't use it.
+    if(shadowsocksJson.empty())
+        return servers;
+
+    auto readServer = [&](std::size_t idx, const nlohmann::json &ssRegion)
     {
-        try
-        {
-            core::StringSlice id{ssRegion.at("region").get<core::StringSlice>()};
-            // If this is a legacy ID, use the new ID instead
-            auto itLegacyId = ssLegacyIds.find(id);
-            if(itLegacyId != ssLegacyIds.end())
-                id = itLegacyId->second;
-
-            // Create a service group - no attempt is made to actually deduplicate
-            // servers with identical configuration
-            auto pServiceGroup = std::make_shared<ServiceGroup>(
-                std::vector<std::uint16_t>{}, false,
-                std::vector<std::uint16_t>{}, false,
-                std::vector<std::uint16_t>{}, false,
-                std::vector<std::uint16_t>{ssRegion.at("port").get<std::uint16_t>()},
-                ssRegion.at("key").get<std::string>(),
-                ssRegion.at("cipher").get<std::string>(),
-                std::vector<std::uint16_t>{});
-            // Then make a server.  No common name is known for these servers,
-            // Shadowsocks doesn't need it
-            auto pServer = std::make_shared<Server>(
-                ssRegion.at("host").get<core::Ipv4Address>(),
-                std::string{}, std::string{}, std::move(pServiceGroup));
-            servers.emplace(id, std::move(pServer));
-        }
-        catch(const std::exception &ex)
-        {
-            KAPPS_CORE_WARNING() << "Couldn't read Shadowsocks location"
-                << idx << "-" << ex.what();
-        }
-        ++idx;
+        readShadowsocksServer(idx, ssRegion, servers);
+    };
+    if(options.streaming)
+        readShadowsocksJson(shadowsocksJson, readServer);
+    else
+    {
+        auto json = nlohmann::json::parse(shadowsocksJson);
+        std::size_t idx{0};
+        for(const auto &ssRegion : core::jsonArray(json))
+            readServer(idx++, ssRegion);
     }
     return servers;
 }
 
+void RegionList::readShadowsocksServer(std::size_t idx,
+    const nlohmann::json &ssRegion, ShadowsocksServers &servers)
+{
+    try
+    {
+        core::StringSlice id{ssRegion.at("region").get<core::StringSlice>()};
+        // If this is a legacy ID, use the new ID instead
+        auto itLegacyId = ssLegacyIds.find(id);
+        if(itLegacyId != ssLegacyIds.end())
+            id = itLegacyId->second;
+
+        // Create a service group - no attempt is made to actually deduplicate
+        // servers with identical configuration
+        auto pServiceGroup = _pData->pStorage->addServiceGroup({
+            std::vector<std::uint16_t>{}, false,
+            std::vector<std::uint16_t>{}, false,
+            std::vector<std::uint16_t>{}, false,
+            std::vector<std::uint16_t>{ssRegion.at("port").get<std::uint16_t>()},
+            ssRegion.at("key").get<std::string>(),
+            ssRegion.at("cipher").get<std::string>(),
+            std::vector<std::uint16_t>{}});
+        // Then make a server.  No common name is known for these servers,
+        // Shadowsocks doesn't need it.  The ID is interned since the JSON
+        // isn't kept.
+        servers.emplace(_pData->pStorage->intern(id),
+                        Server{ssRegion.at("host").get<core::Ipv4Address>(),
+                               {}, {}, pServiceGroup});
+    }
+    catch(const std::exception &ex)
+    {
+        KAPPS_CORE_WARNING() << "Couldn't read Shadowsocks location"
+            << idx << "-" << ex.what();
+    }
+}
+
 void RegionList::addShadowsocksServer(core::StringSlice id,
-    std::vector<std::shared_ptr<const Server>> &servers,
+    std::vector<Server> &servers,
     const ShadowsocksServers &shadowsocksServers) const
 {
     auto itSs = shadowsocksServers.find(id);
@@ -350,20 +516,15 @@ void RegionList::addShadowsocksServer(core::StringSlice id,
 
 void RegionList::readPiav6JsonRegions(const nlohmann::json &jsonRegions,
     const ServiceGroups &ncpGroups, const ServiceGroups &pssGroups,
-    const ShadowsocksServers &shadowsocksServers)
+    const ShadowsocksServers &shadowsocksServers,
+    const BuildOptions &options)
 {
-    for(const auto &jsonRegion : core::jsonArray(jsonRegions))
-    {
-        core::StringSlice id;
-        try
+    buildJsonRegions(jsonRegions, options,
+        [&](const nlohmann::json &jsonRegion,
+            const std::shared_ptr<RegionStorage> &pStorage,
+            core::StringSlice &id)
         {
             id = jsonRegion.at("id").get<core::StringSlice>();
-            if(_regionsById.count(id))
-            {
-                KAPPS_CORE_WARNING() << "Duplicate region" << id
-                    << "in regions list";
-                throw std::runtime_error("Duplicate region ID");
-            }
 
             auto autoRegion = jsonRegion.at("auto_region").get<bool>();
             auto portForward = jsonRegion.at("port_forward").get<bool>();
@@ -374,7 +535,7 @@ void RegionList::readPiav6JsonRegions(const nlohmann::json &jsonRegions,
             // * 'dns' is not used.
             auto offline = jsonRegion.at("offline").get<bool>();
 
-            std::vector<std::shared_ptr<const Server>> servers;
+            std::vector<Server> servers;
             // v6 has an explicit 'offline' flag for each region.  v7 just
             // indicates offline regions by providing no servers.  The 'offline'
             // flag was never used in lieu of just providing no servers, but
@@ -385,25 +546,18 @@ void RegionList::readPiav6JsonRegions(const nlohmann::json &jsonRegions,
             if(!servers.empty())
                 addShadowsocksServer(id, servers, shadowsocksServers);
 
-            auto pRegion = std::make_shared<Region>(id.to_string(), autoRegion,
-                    portForward, geo, std::string{}, std::move(servers));
-            _regionsById.emplace(pRegion->id(), std::move(pRegion));
-        }
-        catch(const std::exception &ex)
-        {
-            KAPPS_CORE_WARNING() << "Unable to read region" << id << "-"
-                << ex.what();
-        }
-    }
+            return std::make_shared<Region>(pStorage, id, autoRegion,
+                portForward, geo, core::Ipv4Address{}, std::move(servers));
+        });
 }
 
 auto RegionList::readPiav6JsonRegionServers(const nlohmann::json &jsonRegion,
     core::StringSlice id,
-    const ServiceGroups &ncpGroups, const ServiceGroups &pssGroups)
-    -> std::vector<std::shared_ptr<const Server>>
+    const ServiceGroups &ncpGroups, const ServiceGroups &pssGroups) const
+    -> std::vector<Server>
 {
     const auto &jsonServers = jsonRegion.at("servers");
-    std::vector<std::shared_ptr<const Server>> servers;
+    std::vector<Server> servers;
     int serverIdx{};    // Just for diagnostics
     // In v6, the servers are listed as an object containing a property for each
     // service group.  That in turn contains an array of servers for that
@@ -424,7 +578,7 @@ auto RegionList::readPiav6JsonRegionServers(const nlohmann::json &jsonRegion,
             try
             {
                 auto ip = jsonServer.at("ip").get<core::Ipv4Address>();
-                auto cn = jsonServer.at("cn").get<std::string>();
+                auto cn = jsonServer.at("cn").get<core::StringSlice>();
                 // * v6 does not have 'fqdn'.
                 // * "van" is optional:
                 //   - false indicates that the server requires pia-signal-settings
@@ -448,8 +602,8 @@ auto RegionList::readPiav6JsonRegionServers(const nlohmann::json &jsonRegion,
                 // this server.)
                 else if(itGroup->second && itGroup->second->hasAnyService())
                 {
-                    servers.push_back(std::make_shared<Server>(ip, std::move(cn),
-                        std::string{}, itGroup->second));
+                    servers.emplace_back(ip, cn, core::StringSlice{},
+                                         itGroup->second);
                 }
             }
             catch(const std::exception &ex)
@@ -472,7 +626,7 @@ void RegionList::buildDipRegions(const core::ArraySlice<const DedicatedIp> &dips
     for(const auto &dip : dips)
     {
         // Find the corresponding region
-        if(_regionsById.count(dip.dipRegionId))
+        if(_pData->regionsById.count(dip.dipRegionId))
         {
             KAPPS_CORE_WARNING() << "Duplicate region ID" << dip.dipRegionId;
             continue;
@@ -490,7 +644,7 @@ void RegionList::buildDipRegions(const core::ArraySlice<const DedicatedIp> &dips
         }
 
         // Build a Server for the service groups
-        std::vector<std::shared_ptr<const Server>> servers;
+        std::vector<Server> servers;
         servers.reserve(dip.serviceGroups.size());
         for(const auto &serviceGroup : dip.serviceGroups)
         {
@@ -506,20 +660,20 @@ void RegionList::buildDipRegions(const core::ArraySlice<const DedicatedIp> &dips
             }
             else
             {
-                servers.push_back(std::make_shared<Server>(dip.address,
-                    dip.commonName.to_string(), dip.fqdn.to_string(),
-                    itServiceGroup->second));
+                servers.emplace_back(dip.address, dip.commonName, dip.fqdn,
+                                     itServiceGroup->second);
             }
         }
 
         const Region &correspondingRegion{*itCorrespondingRegion->second};
-        auto pRegion = std::make_shared<Region>(dip.dipRegionId.to_string(),
+        auto pRegion = std::make_shared<Region>(_pData->pStorage,
+                                     dip.dipRegionId,
                                      false,  // DIP regions are not selected automatically
                                      correspondingRegion.portForward(),
                                      correspondingRegion.geoLocated(),
                                      dip.address,
                                      std::move(servers));
-        _regionsById.emplace(pRegion->id(), std::move(pRegion));
+        _pData->regionsById.emplace(pRegion->id(), std::move(pRegion));
     }
 }
 
@@ -530,7 +684,7 @@ void RegionList::buildManualRegions(const core::ArraySlice<const ManualRegion> &
     for(const auto &manual : manualRegions)
     {
         // Find the corresponding region
-        if(_regionsById.count(manual.manualRegionId))
+        if(_pData->regionsById.count(manual.manualRegionId))
         {
             KAPPS_CORE_WARNING() << "Duplicate region ID" << manual.manualRegionId;
             continue;
@@ -566,18 +720,18 @@ void RegionList::buildManualRegions(const core::ArraySlice<const ManualRegion> &
             // group is unchanged, but it's not really worth it since this is a
             // dev tool, and we usually only have at most 1 manual server
             // anyway.
-            effectiveGroups[groupEntry.first] = std::make_shared<ServiceGroup>(
+            effectiveGroups[groupEntry.first] = _pData->pStorage->addServiceGroup({
                     std::move(openVpnUdpPorts), openVpnUdpNcp,
                     std::move(openVpnTcpPorts), openVpnTcpNcp,
                     existing.wireGuardPorts().to_vector(),
                     existing.ikev2(),
                     existing.shadowsocksPorts().to_vector(), existing.shadowsocksKey().to_string(),
                     existing.shadowsocksCipher().to_string(),
-                    existing.metaPorts().to_vector());
+                    existing.metaPorts().to_vector()});
         }
 
         // Build a Server for the service group
-        std::vector<std::shared_ptr<const Server>> servers;
+        std::vector<Server> servers;
         // We only include meta servers from the corresponding region if it was
         // given, but use the full count to reserve for simplicity
         servers.reserve(manual.serviceGroups.size() +
@@ -596,9 +750,8 @@ void RegionList::buildManualRegions(const core::ArraySlice<const ManualRegion> &
             }
             else
             {
-                servers.push_back(std::make_unique<Server>(manual.address,
-                    manual.commonName.to_string(), manual.fqdn.to_string(),
-                    itServiceGroup->second));
+                servers.emplace_back(manual.address, manual.commonName,
+                                     manual.fqdn, itServiceGroup->second);
             }
         }
 
@@ -614,36 +767,36 @@ void RegionList::buildManualRegions(const core::ArraySlice<const ManualRegion> &
                     // don't copy other services.  This also makes unnecessary
                     // duplicates if there's more than one meta server, but
                     // again it's not significant for manual servers.
-                    auto pMetaGroup = std::make_shared<ServiceGroup>(
+                    auto pMetaGroup = _pData->pStorage->addServiceGroup({
                         std::vector<std::uint16_t>{}, true,
                         std::vector<std::uint16_t>{}, true,
                         std::vector<std::uint16_t>{}, false,
                         std::vector<std::uint16_t>{},
                         std::string{}, std::string{},
-                        pServer->metaPorts().to_vector());
-                    servers.push_back(std::make_shared<Server>(pServer->address(),
-                        pServer->commonName().to_string(), pServer->fqdn().to_string(),
-                        pMetaGroup));
+                        pServer->metaPorts().to_vector()});
+                    servers.emplace_back(pServer->address(), pServer->commonName(),
+                                         pServer->fqdn(), pMetaGroup);
                 }
             }
         }
 
         // Most of the flags for a manual region can be defaulted since this is
         // a dev tool
-        auto pRegion = std::make_shared<Region>(manual.manualRegionId.to_string(),
+        auto pRegion = std::make_shared<Region>(_pData->pStorage,
+                                     manual.manualRegionId,
                                      false,  // Manual regions are not selected automatically
                                      true,   // Always has port forwarding
                                      false,  // Never geo-located
-                                     std::string{},     // Not DIP
+                                     core::Ipv4Address{},   // Not DIP
                                      std::move(servers));
-        _regionsById.emplace(pRegion->id(), std::move(pRegion));
+        _pData->regionsById.emplace(pRegion->id(), std::move(pRegion));
     }
 }
 
 const Region *RegionList::getRegion(core::StringSlice id) const
 {
-    auto itRegion = _regionsById.find(id);
-    if(itRegion != _regionsById.end())
+    auto itRegion = _pData->regionsById.find(id);
+    if(itRegion != _pData->regionsById.end())
         return itRegion->second.get();
     return {};
 }
@@ -18,8 +18,10 @@
 
 #pragma once
 #include "region.h"
+#include "servertable.h"
 #include <kapps_regions/dedicatedip.h>
 #include <kapps_core/src/corejson.h>
+#include <kapps_core/src/parallel.h>
 #include <unordered_map>
 #include <vector>
 
@@ -90,11 +92,33 @@ struct ManualRegion
     core::ArraySlice<const std::uint16_t> openVpnTcpOverridePorts;
 };
 
+// Options for building a RegionList or Metadata.
+struct BuildOptions
+{
+    // Maximum number of threads used to build regions (including the calling
+    // thread).  The default of 1 builds everything on the calling thread;
+    // core::AutoThreads uses the number of hardware threads.
+    //
+    // The result is the same regardless of the thread count - duplicate IDs,
+    // DIP regions, and manual regions are resolved in the order they appear.
+    std::size_t threads{1};
+
+    // Read the JSON with a streaming parser, building regions directly from
+    // the parse events instead of building a DOM of the whole document first.
+    // This uses much less memory for a large regions list.
+    //
+    // This applies to the regions list (v7) and the Shadowsocks list; the
+    // legacy PIAv6 regions list is always read from a DOM.  The regions are
+    // built as they're parsed, so 'threads' has no effect when streaming.
+    bool streaming{false};
+};
+
 class KAPPS_REGIONS_EXPORT RegionList
 {
 private:
     // Service group map used when building regions
-    using ServiceGroups = std::unordered_map<core::StringSlice, std::shared_ptr<ServiceGroup>>;
+    // The service groups are owned by the RegionStorage.
+    using ServiceGroups = std::unordered_map<core::StringSlice, const ServiceGroup*>;
     // Region map used when building regions.  This _only_ includes standard
     // regions, because DIP/manual regions cannot reference another DIP/manual
     // region as the "corresponding region".
@@ -104,7 +128,7 @@ private:
     using StdRegionsById = std::unordered_map<core::StringSlice, const Region*>;
     // Map of Shadowsocks servers from region IDs, used to add them to the
     // regions
-    using ShadowsocksServers = std::unordered_map<core::StringSlice, std::shared_ptr<const Server>>;
+    using ShadowsocksServers = std::unordered_map<core::StringSlice, Server>;
 
 public:
     // RegionList can be created from the PIA regions list v6 format JSON as
@@ -113,76 +137,117 @@ public:
     static struct PIAv6_t {} PIAv6;
 
 public:
-    RegionList() = default; // Empty region list
+    RegionList();   // Empty region list
 
     RegionList(core::StringSlice regionsJson,
                core::StringSlice shadowsocksJson,
                core::ArraySlice<const DedicatedIp> dips,
-               core::ArraySlice<const ManualRegion> manual);
+               core::ArraySlice<const ManualRegion> manual,
+               const BuildOptions &options = {});
 
     // Construct from the legacy PIAv6 format; see RegionList::PIAv6 above
     RegionList(PIAv6_t, core::StringSlice regionsJson,
                core::StringSlice shadowsocksJson,
                core::ArraySlice<const DedicatedIp> dips,
-               core::ArraySlice<const ManualRegion> manual);
+               core::ArraySlice<const ManualRegion> manual,
+               const BuildOptions &options = {});
 
-    // Default copy and assign are fine - _regions and _regionsById in both
-    // *this and other will refer to the same objects after the copy.
+    // Construct from regions that have already been built - used to restore a
+    // snapshot (see snapshot.h).  If a region ID is duplicated, this throws.
+    RegionList(std::vector<core::Ipv4Address> publicDnsServers,
+               std::vector<std::shared_ptr<const Region>> regions);
+
+    // Default copy and assign are fine - the data is immutable once built, so
+    // copies just share it.
     RegionList(const RegionList &) = default;
     RegionList &operator=(const RegionList &) = default;
 
-    // Move must be implemented manually - default moves leave the moved-from
-    // object in an indeterminate state, so it's possible the moved-from
-    // _regions could be empty while _regionsById might hold swapped contents,
-    // etc.  Explicitly swapping both is fine.
+    // Move must be implemented manually so the moved-from object is left empty
+    // rather than holding a null _pData.
     RegionList(RegionList &&other) : RegionList{} {*this = std::move(other);}
     RegionList &operator=(RegionList &&other)
     {
-        _publicDnsServers = std::move(other._publicDnsServers);
-        _regions = std::move(other._regions);
-        _regionsById = std::move(other._regionsById);
-        // To guarantee that other is in a valid state (not violating its
-        // invariant that _regions corresponds to _regionsById); just clear both
-        // containers.
-        other._regions.clear();
-        other._regionsById.clear();
+        _pData.swap(other._pData);
+        other._pData = emptyData();
         return *this;
     }
 
 private:
-    // Read service groups from the regions list JSON object
+    // Set up regions() and serverTable() once all regions have been added to
+    // regionsById
+    void buildIndices();
+    // Read service groups into the RegionStorage from the regions list JSON
+    // object
     auto readJsonServiceGroups(const nlohmann::json &json)
         -> ServiceGroups;
+    // Read one service group from the regions list into the RegionStorage and
+    // add it to groups; traces and ignores it if it's invalid
+    void readJsonServiceGroup(const nlohmann::json &jsonGroup,
+                              ServiceGroups &groups);
+    // Read the service groups, public DNS servers, and regions from the
+    // regions list with a streaming parser (see BuildOptions::streaming).
+    // This reads the regions into _pData->regionsById.
+    auto readStreamingJson(core::StringSlice regionsJson,
+                           const ShadowsocksServers &shadowsocksServers)
+        -> ServiceGroups;
+    // Build a region from each element of the regions JSON array using
+    // buildRegion(), possibly on worker threads (see BuildOptions), then add
+    // them to _pData->regionsById in the order they were listed.
+    //
+    // buildRegion() is called as buildRegion(jsonRegion, pStorage, id); it sets
+    // id as soon as it is known (for tracing) and interns strings in pStorage.
+    // It may throw to ignore that region.
+    template<class BuildRegionFuncT>
+    void buildJsonRegions(const nlohmann::json &jsonRegions,
+                          const BuildOptions &options,
+                          const BuildRegionFuncT &buildRegion);
+    // Add regions built from the regions list to _pData->regionsById in order;
+    // null regions (that couldn't be read) and duplicates are skipped.
+    void addJsonRegions(std::vector<std::shared_ptr<const Region>> regions);
     // Read a regions from the regions list JSON object using the group map.
-    // This reads into _regions.  nullptr entries are added to _regionsById to
-    // identify duplicate region IDs.
+    // This reads into _pData->regionsById.
     void readJsonRegions(const nlohmann::json &json, const ServiceGroups &groups,
-        const ShadowsocksServers &shadowsocksServers);
-    // Read a region's servers from the region JSON using the group map
+        const ShadowsocksServers &shadowsocksServers,
+        const BuildOptions &options);
+    // Read a region's servers from the region JSON using the group map.  This
+    // may be called on worker threads, it must not modify the RegionList.
     auto readJsonRegionServers(const nlohmann::json &json, core::StringSlice id,
-                               const ServiceGroups &groups)
-        -> std::vector<std::shared_ptr<const Server>>;
+                               const ServiceGroups &groups) const
+        -> std::vector<Server>;
+    // Find the service group named by a server in the regions list.  Returns
+    // nullptr if it doesn't exist (traced), or if it has no known services
+    // (the server is ignored in that case).
+    auto findServerGroup(const ServiceGroups &groups, core::StringSlice group,
+                         int serverIdx, core::StringSlice id) const
+        -> const ServiceGroup*;
 
     // Build servers from the Shadowsocks server list for incorporation into
-    // regions.  The Shadowsocks list only provides one server per region.
-    auto readShadowsocksServers(const nlohmann::json &json) const
+    // regions.  The Shadowsocks list only provides one server per region.  If
+    // the JSON is empty, there are no Shadowsocks servers.
+    auto readShadowsocksServers(core::StringSlice shadowsocksJson,
+                                const BuildOptions &options)
         -> ShadowsocksServers;
+    // Read one Shadowsocks server into servers; traces and ignores it if it's
+    // invalid
+    void readShadowsocksServer(std::size_t idx, const nlohmann::json &ssRegion,
+                               ShadowsocksServers &servers);
 
     // Add a Shadowsocks server to a region's servers if that region has a
     // Shadowsocks server
     void addShadowsocksServer(core::StringSlice id,
-        std::vector<std::shared_ptr<const Server>> &servers,
+        std::vector<Server> &servers,
         const ShadowsocksServers &shadowsocksServers) const;
 
     // Support for legacy PIAv6 format
     void readPiav6JsonRegions(const nlohmann::json &jsonRegions,
         const ServiceGroups &ncpGroups, const ServiceGroups &pssGroups,
-        const ShadowsocksServers &shadowsocksServers);
+        const ShadowsocksServers &shadowsocksServers,
+        const BuildOptions &options);
     auto readPiav6JsonRegionServers(const nlohmann::json &jsonRegion,
                                     core::StringSlice id,
                                     const ServiceGroups &ncpGroups,
-                                    const ServiceGroups &pssGroups)
-        -> std::vector<std::shared_ptr<const Server>>;
+                                    const ServiceGroups &pssGroups) const
+        -> std::vector<Server>;
 
     // Build dedicated IP regions from the information given to the constructor
     void buildDipRegions(const core::ArraySlice<const DedicatedIp> &dips,
@@ -200,23 +265,45 @@ public:
     // DNS is needed.
     //
     // Some brands may not provide this, in which case the list is empty.
-    core::ArraySlice<const core::Ipv4Address> publicDnsServers() const {return _publicDnsServers;}
+    core::ArraySlice<const core::Ipv4Address> publicDnsServers() const {return _pData->publicDnsServers;}
 
     // Find a region by ID; returns nullptr if not found.
     const Region *getRegion(core::StringSlice id) const;
     // Get all regions
-    core::ArraySlice<const Region * const> regions() const {return _regions;}
+    core::ArraySlice<const Region * const> regions() const {return _pData->regions;}
+    // Get the table of all servers; region indices in the table refer to
+    // regions().  This is shared, so Locations can keep using it for their
+    // region's servers.
+    const std::shared_ptr<const ServerTable> &serverTable() const {return _pData->pServerTable;}
+
+private:
+    // The regions list data is built by the constructor and not modified after
+    // that, so it is shared among copies of the RegionList.
+    struct Data
+    {
+        // Storage for strings and service groups used by the regions built
+        // from JSON.  (Regions restored from a snapshot have their own
+        // storage; this is nullptr in that case.)
+        std::shared_ptr<RegionStorage> pStorage;
+
+        std::vector<core::Ipv4Address> publicDnsServers;
+
+        // Regions are held with shared_ptr so that callers can continue to use
+        // them even if the RegionList is destroyed.  This map is keyed by
+        // region IDs; the keys refer to string data from the Region.
+        std::unordered_map<core::StringSlice, std::shared_ptr<const Region>> regionsById;
+        // This vector of raw region points is held just to provide an
+        // ArraySlice from regions().  The Region objects are owned by the
+        // shared_ptrs above.
+        std::vector<const Region*> regions;
+        std::shared_ptr<const ServerTable> pServerTable{std::make_shared<ServerTable>()};
+    };
+
+    // Data shared by all empty RegionLists
+    static const std::shared_ptr<Data> &emptyData();
 
 private:
-    std::vector<core::Ipv4Address> _publicDnsServers;
-
-    // Regions are held with shared_ptr so that callers can continue to use them
-    // even if the RegionList is destroyed.  This map is keyed by region IDs;
-    // the keys refer to string data from the Region.
-    std::unordered_map<core::StringSlice, std::shared_ptr<const Region>> _regionsById;
-    // This vector of raw region points is held just to provide an ArraySlice
-    // from regions().  The Region objects are owned by the shared_ptrs above.
-    std::vector<const Region*> _regions;
+    std::shared_ptr<Data> _pData;
 };
 
 }
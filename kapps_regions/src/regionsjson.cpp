@@ -0,0 +1,417 @@
+// Copyright (c) 2024 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "regionsjson.h"
+#include <kapps_core/src/jsonstream.h>
+#include <kapps_core/src/logger.h>
+#include <nlohmann/json.hpp>
+#include <cassert>
+
+namespace kapps::regions {
+
+namespace
+{
+    // State of a property read from a region or server
+    enum class Field : std::uint8_t
+    {
+        Missing,
+        Valid,
+        Invalid,
+    };
+
+    Field readString(RegionStorage &storage, const nlohmann::json &value,
+                     core::StringSlice &result)
+    {
+        if(!value.is_string())
+            return Field::Invalid;
+        result = storage.intern(value.get_ref<const std::string&>());
+        return Field::Valid;
+    }
+
+    Field readBool(const nlohmann::json &value, bool &result)
+    {
+        if(!value.is_boolean())
+            return Field::Invalid;
+        result = value.get<bool>();
+        return Field::Valid;
+    }
+
+    Field readAddress(const nlohmann::json &value, core::Ipv4Address &result)
+    {
+        if(!value.is_string())
+            return Field::Invalid;
+        // Like from_json(), invalid addresses and 0.0.0.0 are not accepted
+        result = core::Ipv4Address{value.get_ref<const std::string&>()};
+        return result == core::Ipv4Address{} ? Field::Invalid : Field::Valid;
+    }
+
+    class RegionsJsonReader : public core::JsonStreamReader
+    {
+    private:
+        // The containers that can be read; each container being read is on
+        // _contexts.  Anything else is skipped or captured.
+        enum class Context
+        {
+            Root,
+            ServiceGroups,
+            Regions,
+            Region,
+            Servers,
+            Server,
+        };
+
+    public:
+        RegionsJsonReader(RegionStorage &storage,
+            const std::function<void(const nlohmann::json &)> &readServiceGroup)
+            : _storage{storage}, _readServiceGroup{readServiceGroup}
+        {}
+
+    public:
+        JsonRegionsData takeData();
+
+    protected:
+        void beginContainer(bool object) override;
+        void endContainer() override;
+        void value(nlohmann::json &value) override;
+        void captured(nlohmann::json &value) override;
+
+    private:
+        void beginRootProperty(bool object);
+        // Get the Field for the current key of a region or server; nullptr for
+        // properties that aren't used
+        Field *regionField();
+        Field *serverField();
+        void regionValue(const nlohmann::json &value);
+        void serverValue(const nlohmann::json &value);
+        void finishRegion();
+        void finishServer();
+
+    private:
+        RegionStorage &_storage;
+        const std::function<void(const nlohmann::json &)> &_readServiceGroup;
+        std::vector<Context> _contexts;
+        bool _hasServiceGroups{false}, _hasRegions{false};
+        JsonRegionsData _data;
+
+        // The region being read
+        JsonRegionRecord _region;
+        Field _id, _autoSafe, _portForward, _geoLocated, _servers;
+        // The server being read
+        JsonServerRecord _server;
+        Field _address, _commonName, _fqdn, _serviceGroup;
+    };
+
+    JsonRegionsData RegionsJsonReader::takeData()
+    {
+        // sax_parse() throws if the document ends early, so the root object
+        // was completed if we get here.
+        if(!_hasServiceGroups || !_hasRegions)
+            throw std::runtime_error{"Regions list requires service_configs and regions"};
+        return std::move(_data);
+    }
+
+    void RegionsJsonReader::beginContainer(bool object)
+    {
+        if(_contexts.empty())
+        {
+            if(!object)
+                throw std::runtime_error{"Regions list must be an object"};
+            _contexts.push_back(Context::Root);
+            return;
+        }
+
+        switch(_contexts.back())
+        {
+            case Context::Root:
+                beginRootProperty(object);
+                break;
+            case Context::ServiceGroups:
+                captureContainer(object);
+                break;
+            case Context::Regions:
+                if(object)
+                {
+                    _region = {};
+                    _id = _autoSafe = _portForward = _geoLocated = _servers = Field::Missing;
+                    _contexts.push_back(Context::Region);
+                }
+                else
+                {
+                    KAPPS_CORE_WARNING() << "Unable to read region - not an object";
+                    skipContainer();
+                }
+                break;
+            case Context::Region:
+                if(!object && currentKey() == "servers")
+                {
+                    _servers = Field::Valid;
+                    _region.servers.clear();
+                    _contexts.push_back(Context::Servers);
+                }
+                else
+                {
+                    if(Field *pField = regionField())
+                        *pField = Field::Invalid;
+                    skipContainer();
+                }
+                break;
+            case Context::Servers:
+                _server = {};
+                _address = _commonName = _fqdn = _serviceGroup = Field::Missing;
+                if(object)
+                    _contexts.push_back(Context::Server);
+                else
+                {
+                    // Add an invalid server so it's traced with its index
+                    _region.servers.push_back(_server);
+                    skipContainer();
+                }
+                break;
+            case Context::Server:
+                if(Field *pField = serverField())
+                    *pField = Field::Invalid;
+                skipContainer();
+                break;
+        }
+    }
+
+    void RegionsJsonReader::beginRootProperty(bool object)
+    {
+        const auto &key = currentKey();
+        if(key == "service_configs")
+        {
+            if(object)
+                throw std::runtime_error{"service_configs must be an array"};
+            _hasServiceGroups = true;
+            _contexts.push_back(Context::ServiceGroups);
+        }
+        else if(key == "regions")
+        {
+            if(object)
+                throw std::runtime_error{"regions must be an array"};
+            _hasRegions = true;
+            _data.regions.clear();
+            _contexts.push_back(Context::Regions);
+        }
+        else if(key == "pubdns")
+            captureContainer(object);
+        else
+            skipContainer();
+    }
+
+    void RegionsJsonReader::endContainer()
+    {
+        assert(!_contexts.empty()); // Ensured by sax_parse()
+        Context context = _contexts.back();
+        _contexts.pop_back();
+        if(context == Context::Region)
+            finishRegion();
+        else if(context == Context::Server)
+            finishServer();
+    }
+
+    void RegionsJsonReader::value(nlohmann::json &value)
+    {
+        if(_contexts.empty())
+            throw std::runtime_error{"Regions list must be an object"};
+
+        switch(_contexts.back())
+        {
+            case Context::Root:
+                // These throw for any scalar value, as intended
+                if(currentKey() == "pubdns")
+                    _data.publicDnsServers = value.get<std::vector<core::Ipv4Address>>();
+                else if(currentKey() == "service_configs" || currentKey() == "regions")
+                    core::jsonArray(value);
+                break;
+            case Context::ServiceGroups:
+                _readServiceGroup(value);
+                break;
+            case Context::Regions:
+                KAPPS_CORE_WARNING() << "Unable to read region - not an object";
+                break;
+            case Context::Region:
+                regionValue(value);
+                break;
+            case Context::Servers:
+                _region.servers.push_back({});  // Invalid, traced later
+                break;
+            case Context::Server:
+                serverValue(value);
+                break;
+        }
+    }
+
+    void RegionsJsonReader::captured(nlohmann::json &value)
+    {
+        assert(!_contexts.empty()); // Only captured in these contexts
+        if(_contexts.back() == Context::ServiceGroups)
+            _readServiceGroup(value);
+        else
+        {
+            assert(_contexts.back() == Context::Root);  // "pubdns"
+            _data.publicDnsServers = value.get<std::vector<core::Ipv4Address>>();
+        }
+    }
+
+    Field *RegionsJsonReader::regionField()
+    {
+        const auto &key = currentKey();
+        if(key == "id")
+            return &_id;
+        if(key == "auto_region")
+            return &_autoSafe;
+        if(key == "port_forward")
+            return &_portForward;
+        if(key == "geo")
+            return &_geoLocated;
+        if(key == "servers")
+            return &_servers;
+        return nullptr;
+    }
+
+    Field *RegionsJsonReader::serverField()
+    {
+        const auto &key = currentKey();
+        if(key == "ip")
+            return &_address;
+        if(key == "cn")
+            return &_commonName;
+        if(key == "fqdn")
+            return &_fqdn;
+        if(key == "service_config")
+            return &_serviceGroup;
+        return nullptr;
+    }
+
+    void RegionsJsonReader::regionValue(const nlohmann::json &value)
+    {
+        const auto &key = currentKey();
+        if(key == "id")
+            _id = readString(_storage, value, _region.id);
+        else if(key == "auto_region")
+            _autoSafe = readBool(value, _region.autoSafe);
+        else if(key == "port_forward")
+            _portForward = readBool(value, _region.portForward);
+        else if(key == "geo")
+            _geoLocated = readBool(value, _region.geoLocated);
+        else if(key == "servers")
+            _servers = Field::Invalid;
+        // Other properties are ignored
+    }
+
+    void RegionsJsonReader::serverValue(const nlohmann::json &value)
+    {
+        const auto &key = currentKey();
+        if(key == "ip")
+            _address = readAddress(value, _server.address);
+        else if(key == "cn")
+            _commonName = readString(_storage, value, _server.commonName);
+        else if(key == "fqdn")
+            _fqdn = readString(_storage, value, _server.fqdn);
+        else if(key == "service_config")
+            _serviceGroup = readString(_storage, value, _server.serviceGroup);
+        // Other properties are ignored
+    }
+
+    void RegionsJsonReader::finishRegion()
+    {
+        const std::pair<const char *, Field> fields[]
+        {
+            {"id", _id},
+            {"auto_region", _autoSafe},
+            {"port_forward", _portForward},
+            {"geo", _geoLocated},
+            {"servers", _servers},
+        };
+        for(const auto &[name, field] : fields)
+        {
+            if(field != Field::Valid)
+            {
+                KAPPS_CORE_WARNING() << "Unable to read region" << _region.id
+                    << "-" << (field == Field::Missing ? "missing" : "invalid")
+                    << name;
+                return;
+            }
+        }
+        _data.regions.push_back(std::move(_region));
+    }
+
+    void RegionsJsonReader::finishServer()
+    {
+        // FQDN is optional
+        _server.valid = _address == Field::Valid &&
+            _commonName == Field::Valid && _fqdn != Field::Invalid &&
+            _serviceGroup == Field::Valid;
+        _region.servers.push_back(_server);
+    }
+
+    class ShadowsocksJsonReader : public core::JsonStreamReader
+    {
+    public:
+        ShadowsocksJsonReader(const std::function<void(std::size_t, const nlohmann::json &)> &readServer)
+            : _readServer{readServer}
+        {}
+
+    protected:
+        void beginContainer(bool object) override
+        {
+            // Elements of the top-level array are captured
+            if(_inArray)
+                captureContainer(object);
+            else if(object)
+                throw std::runtime_error{"Shadowsocks list must be an array"};
+            else
+                _inArray = true;
+        }
+        void endContainer() override {}
+        void value(nlohmann::json &value) override
+        {
+            if(!_inArray)
+                throw std::runtime_error{"Shadowsocks list must be an array"};
+            _readServer(_index++, value);
+        }
+        void captured(nlohmann::json &value) override
+        {
+            _readServer(_index++, value);
+        }
+
+    private:
+        const std::function<void(std::size_t, const nlohmann::json &)> &_readServer;
+        bool _inArray{false};
+        std::size_t _index{0};
+    };
+}
+
+JsonRegionsData readRegionsJson(core::StringSlice regionsJson,
+    RegionStorage &storage,
+    const std::function<void(const nlohmann::json &)> &readServiceGroup)
+{
+    RegionsJsonReader reader{storage, readServiceGroup};
+    nlohmann::json::sax_parse(regionsJson.begin(), regionsJson.end(), &reader);
+    return reader.takeData();
+}
+
+void readShadowsocksJson(core::StringSlice shadowsocksJson,
+    const std::function<void(std::size_t, const nlohmann::json &)> &readServer)
+{
+    ShadowsocksJsonReader reader{readServer};
+    nlohmann::json::sax_parse(shadowsocksJson.begin(), shadowsocksJson.end(), &reader);
+}
+
+}
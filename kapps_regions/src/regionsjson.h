@@ -0,0 +1,84 @@
+// Copyright (c) 2024 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include "regionstorage.h"
+#include <kapps_core/src/corejson.h>
+#include <kapps_core/src/ipaddress.h>
+#include <functional>
+#include <vector>
+
+namespace kapps::regions {
+
+// Streaming readers for the regions list (v7) and the Shadowsocks list.  These
+// read the JSON with a SAX parser instead of building a DOM for the whole
+// document, which uses much less memory for the large regions list.
+//
+// Regions and servers - nearly all of the regions list - are read directly
+// from the parse events.  Service groups and Shadowsocks servers are small and
+// few, so each one is captured as a small JSON value and passed to a callback
+// to be read with the usual JSON conversions.
+//
+// Like the DOM-based reading in RegionList, malformed regions are traced and
+// skipped.  If the JSON can't be parsed, or a required top-level property is
+// missing or invalid, these throw.
+
+// A server read from the regions list.  Strings are interned in the
+// RegionStorage given to readRegionsJson().  The service group is identified
+// by name, since service groups may be listed after the regions.
+struct JsonServerRecord
+{
+    core::Ipv4Address address;
+    core::StringSlice commonName;
+    core::StringSlice fqdn;
+    core::StringSlice serviceGroup;
+    // Whether the server was valid - invalid servers are kept so they can be
+    // traced with their index
+    bool valid;
+};
+
+// A region read from the regions list
+struct JsonRegionRecord
+{
+    core::StringSlice id;
+    bool autoSafe;
+    bool portForward;
+    bool geoLocated;
+    std::vector<JsonServerRecord> servers;
+};
+
+struct JsonRegionsData
+{
+    // "pubdns" - empty if it wasn't present
+    std::vector<core::Ipv4Address> publicDnsServers;
+    // The regions that could be read, in the order they were listed
+    std::vector<JsonRegionRecord> regions;
+};
+
+// Read the regions list.  readServiceGroup() is called with each element of
+// "service_configs".
+JsonRegionsData readRegionsJson(core::StringSlice regionsJson,
+    RegionStorage &storage,
+    const std::function<void(const nlohmann::json &)> &readServiceGroup);
+
+// Read the Shadowsocks list, calling readServer() with the index and value of
+// each element of the array.
+void readShadowsocksJson(core::StringSlice shadowsocksJson,
+    const std::function<void(std::size_t, const nlohmann::json &)> &readServer);
+
+}
@@ -0,0 +1,69 @@
+// Copyright (c) 2024 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "regionstorage.h"
+#include <algorithm>
+#include <cstring>
+
+namespace kapps::regions {
+
+core::StringSlice StringTable::intern(core::StringSlice value)
+{
+    if(value.empty())
+        return {};
+
+    auto itExisting = _strings.find(value);
+    if(itExisting != _strings.end())
+        return *itExisting;
+
+    char *pStored{};
+    if(value.size() > _blockRemaining)
+    {
+        // Start a new block.  If the string is larger than a block, give it a
+        // block of its own and keep using the current block for later strings.
+        std::size_t newBlockSize = std::max(BlockSize, value.size());
+        _blocks.push_back(std::make_unique<char[]>(newBlockSize));
+        if(newBlockSize > BlockSize)
+        {
+            pStored = _blocks.back().get();
+            // Keep the current block at the end if it still has space
+            if(_blocks.size() > 1)
+                std::swap(_blocks.back(), _blocks[_blocks.size()-2]);
+        }
+        else
+            _blockRemaining = newBlockSize;
+    }
+    if(!pStored)
+    {
+        pStored = _blocks.back().get() + (BlockSize - _blockRemaining);
+        _blockRemaining -= value.size();
+    }
+
+    std::memcpy(pStored, value.data(), value.size());
+    core::StringSlice stored{pStored, value.size()};
+    _strings.insert(stored);
+    return stored;
+}
+
+const ServiceGroup *RegionStorage::addServiceGroup(ServiceGroup group)
+{
+    _serviceGroups.push_back(std::move(group));
+    return &_serviceGroups.back();
+}
+
+}
@@ -0,0 +1,100 @@
+// Copyright (c) 2024 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include "servicegroup.h"
+#include <kapps_core/src/stringslice.h>
+#include <deque>
+#include <memory>
+#include <unordered_set>
+#include <vector>
+
+namespace kapps::regions {
+
+// StringTable interns strings - each distinct string is stored once, and
+// callers get a StringSlice referring to the stored copy.  The slices remain
+// valid as long as the StringTable exists.
+//
+// Strings are copied into large blocks rather than allocated individually, so
+// building a table of thousands of strings only requires a handful of
+// allocations.
+class KAPPS_REGIONS_EXPORT StringTable
+{
+private:
+    // Size of each block; larger strings get a block of their own
+    static constexpr std::size_t BlockSize = 16384;
+
+public:
+    StringTable() = default;
+    // Slices refer to the table, so it can't be copied or moved
+    StringTable(const StringTable &) = delete;
+    StringTable &operator=(const StringTable &) = delete;
+
+public:
+    // Intern a string.  Empty strings are not stored.
+    core::StringSlice intern(core::StringSlice value);
+
+    // Number of distinct strings interned
+    std::size_t size() const {return _strings.size();}
+
+private:
+    std::vector<std::unique_ptr<char[]>> _blocks;
+    // Space remaining in the last block
+    std::size_t _blockRemaining{0};
+    // The interned strings; these refer to the data in _blocks
+    std::unordered_set<core::StringSlice> _strings;
+};
+
+// RegionStorage holds the data shared by the Regions and Servers built by a
+// RegionList - interned strings and service groups.  Servers are held by value
+// in their Regions and refer to this storage with slices and raw pointers;
+// each Region holds a reference to the storage.
+//
+// This avoids allocating (and reference counting) each Server and its strings
+// individually; a large regions list has thousands of servers, but only a few
+// service groups and a few hundred regions.
+class KAPPS_REGIONS_EXPORT RegionStorage
+{
+public:
+    RegionStorage() = default;
+    // Create storage that keeps a parent storage alive - used when regions are
+    // built on worker threads, each worker interns strings in its own storage
+    // while referring to the parent's service groups.
+    explicit RegionStorage(std::shared_ptr<const RegionStorage> pParent)
+        : _pParent{std::move(pParent)}
+    {}
+    RegionStorage(const RegionStorage &) = delete;
+    RegionStorage &operator=(const RegionStorage &) = delete;
+
+public:
+    core::StringSlice intern(core::StringSlice value) {return _strings.intern(value);}
+    // Add a service group; the returned pointer remains valid as long as the
+    // RegionStorage exists.
+    const ServiceGroup *addServiceGroup(ServiceGroup group);
+
+    const StringTable &strings() const {return _strings;}
+    std::size_t serviceGroupCount() const {return _serviceGroups.size();}
+
+private:
+    std::shared_ptr<const RegionStorage> _pParent;
+    StringTable _strings;
+    // std::deque doesn't move existing elements when adding more
+    std::deque<ServiceGroup> _serviceGroups;
+};
+
+}
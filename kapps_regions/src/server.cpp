@@ -17,48 +17,21 @@
 // <https://www.gnu.org/licenses/>.
 
 #include "server.h"
+#include "region.h"
 namespace kapps::regions {
 
-bool Server::hasService(Service service) const
+void Server::retain() const
 {
-    switch(service)
-    {
-        case Service::OpenVpnTcp:
-            return hasOpenVpnTcp();
-        case Service::OpenVpnUdp:
-            return hasOpenVpnUdp();
-        case Service::WireGuard:
-            return hasWireGuard();
-        case Service::Ikev2:
-            return hasIkev2();
-        case Service::Shadowsocks:
-            return hasShadowsocks();
-        case Service::Meta:
-            return hasMeta();
-        default:
-            return false;
-    }
+    if(!_pRegion)
+        throw std::runtime_error{"Server does not belong to a region"};
+    _pRegion->retain();
 }
 
-Ports Server::servicePorts(Service service) const
+void Server::release() const
 {
-    switch(service)
-    {
-        case Service::OpenVpnTcp:
-            return openVpnTcpPorts();
-        case Service::OpenVpnUdp:
-            return openVpnUdpPorts();
-        case Service::WireGuard:
-            return wireGuardPorts();
-        case Service::Ikev2:
-            return {};  // No ports for IKEv2
-        case Service::Shadowsocks:
-            return shadowsocksPorts();
-        case Service::Meta:
-            return metaPorts();
-        default:
-            return {};
-    }
+    if(!_pRegion)
+        throw std::runtime_error{"Server does not belong to a region"};
+    _pRegion->release();
 }
 
 }
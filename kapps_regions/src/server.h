@@ -20,7 +20,6 @@
 #include <kapps_core/src/ipaddress.h>
 #include <kapps_core/src/stringslice.h>
 #include "servicegroup.h"
-#include <kapps_core/src/retainshared.h>
 #include <kapps_regions/regions.h>
 #include <cassert>
 #include <string>
@@ -28,24 +27,44 @@
 
 namespace kapps::regions {
 
-class KAPPS_REGIONS_EXPORT Server : public core::RetainSharedFromThis<Server>
+class Region;
+
+// Servers are held by value in their Region, and their strings and service
+// group are held by the Region's RegionStorage (see regionstorage.h).  The
+// Server doesn't own any data itself.
+//
+// A Server can be constructed with any string slices, but they only need to
+// remain valid until the Server is passed to a Region - the Region interns them
+// in its storage.  The service group must already be owned by that storage.
+class KAPPS_REGIONS_EXPORT Server
 {
 public:
-    Server(core::Ipv4Address address, std::string commonName, std::string fqdn,
-           std::shared_ptr<ServiceGroup> pServiceGroup)
-        : _address{address}, _commonName{std::move(commonName)},
-          _fqdn{std::move(fqdn)}, _pServiceGroup{std::move(pServiceGroup)}
+    Server(core::Ipv4Address address, core::StringSlice commonName,
+           core::StringSlice fqdn, const ServiceGroup *pServiceGroup)
+        : _address{address}, _commonName{commonName}, _fqdn{fqdn},
+          _pServiceGroup{pServiceGroup}, _pRegion{}, _services{}
     {
         assert(_pServiceGroup); // Ensured by caller
+        _services = _pServiceGroup->services();
     }
 
 public:
+    // Servers don't have their own references; retaining a server retains its
+    // Region.  Throws if the Server does not belong to a Region.
+    void retain() const;
+    void release() const;
+
+    // The Region containing this server
+    const Region *region() const {return _pRegion;}
+
     core::Ipv4Address address() const {return _address;}
     core::StringSlice commonName() const {return _commonName;}
     core::StringSlice fqdn() const {return _fqdn;}
 
-    bool hasService(Service service) const;
-    Ports servicePorts(Service service) const;
+    // The services provided by this server; cached from the service group
+    ServiceMask services() const {return _services;}
+    bool hasService(Service service) const {return _services & serviceBit(service);}
+    Ports servicePorts(Service service) const {return _pServiceGroup->servicePorts(service);}
 
     bool hasOpenVpnUdp() const {return !openVpnUdpPorts().empty();}
     Ports openVpnUdpPorts() const {return _pServiceGroup->openVpnUdpPorts();}
@@ -68,11 +87,20 @@ public:
     bool hasMeta() const {return !metaPorts().empty();}
     Ports metaPorts() const {return _pServiceGroup->metaPorts();}
 
+    // The service group is shared by many servers; this is used to preserve
+    // that sharing when writing a snapshot (see snapshot.h).
+    const ServiceGroup *serviceGroup() const {return _pServiceGroup;}
+
 private:
+    // Region sets _pRegion and interns the strings when the server is added
+    friend class Region;
+
     core::Ipv4Address _address;
-    std::string _commonName;
-    std::string _fqdn;
-    std::shared_ptr<ServiceGroup> _pServiceGroup;
+    core::StringSlice _commonName;
+    core::StringSlice _fqdn;
+    const ServiceGroup *_pServiceGroup;
+    const Region *_pRegion;
+    ServiceMask _services;
 };
 
 }
@@ -0,0 +1,120 @@
+// Copyright (c) 2024 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "servertable.h"
+#include <algorithm>
+
+namespace kapps::regions {
+
+ServerTable::ServerTable(std::vector<std::shared_ptr<const Region>> regions)
+    : _regions{std::move(regions)}
+{
+    std::size_t serverCount{0};
+    for(const auto &pRegion : _regions)
+    {
+        assert(pRegion);    // Ensured by caller
+        serverCount += pRegion->servers().size();
+    }
+
+    _addresses.reserve(serverCount);
+    _regionIndices.reserve(serverCount);
+    _services.reserve(serverCount);
+    _portSetIds.reserve(serverCount);
+    _servers.reserve(serverCount);
+    _regionOffsets.reserve(_regions.size() + 1);
+
+    std::unordered_map<const ServiceGroup*, std::uint32_t> portSetIds;
+    for(std::uint32_t regionIdx=0; regionIdx<_regions.size(); ++regionIdx)
+    {
+        for(const auto &pServer : _regions[regionIdx]->servers())
+        {
+            auto emplaceResult = portSetIds.emplace(pServer->serviceGroup(),
+                static_cast<std::uint32_t>(_portSets.size()));
+            if(emplaceResult.second)
+                _portSets.push_back(pServer->serviceGroup());
+
+            auto serverIdx = static_cast<std::uint32_t>(_servers.size());
+            for(std::size_t serviceIdx=0; serviceIdx<ServiceCount; ++serviceIdx)
+            {
+                auto service = static_cast<Service>(serviceIdx);
+                if(!pServer->hasService(service))
+                    continue;
+                _serversByService[serviceIdx].push_back(serverIdx);
+                for(auto port : pServer->servicePorts(service))
+                    _serversByPort[portKey(service, port)].push_back(serverIdx);
+            }
+
+            _addresses.push_back(pServer->address());
+            _regionIndices.push_back(regionIdx);
+            _services.push_back(pServer->services());
+            _portSetIds.push_back(emplaceResult.first->second);
+            _servers.push_back(pServer);
+        }
+        _regionOffsets.push_back(static_cast<std::uint32_t>(_servers.size()));
+    }
+}
+
+Ports ServerTable::servicePorts(std::uint32_t portSetId, Service service) const
+{
+    assert(portSetId < _portSets.size());   // Ensured by caller
+    return _portSets[portSetId]->servicePorts(service);
+}
+
+core::ArraySlice<const std::uint32_t> ServerTable::serversFor(Service service) const
+{
+    auto serviceIdx = static_cast<std::size_t>(service);
+    if(serviceIdx >= _serversByService.size())
+        return {};
+    return _serversByService[serviceIdx];
+}
+
+core::ArraySlice<const std::uint32_t> ServerTable::serversForPort(Service service,
+                                                                  std::uint16_t port) const
+{
+    auto itServers = _serversByPort.find(portKey(service, port));
+    if(itServers == _serversByPort.end())
+        return {};
+    return itServers->second;
+}
+
+core::ArraySlice<const std::uint32_t> ServerTable::serversFor(Service service,
+                                                              std::size_t regionIdx) const
+{
+    return regionPart(serversFor(service), regionIdx);
+}
+
+core::ArraySlice<const std::uint32_t> ServerTable::serversForPort(Service service,
+                                                                  std::uint16_t port,
+                                                                  std::size_t regionIdx) const
+{
+    return regionPart(serversForPort(service, port), regionIdx);
+}
+
+core::ArraySlice<const std::uint32_t> ServerTable::regionPart(core::ArraySlice<const std::uint32_t> indices,
+                                                              std::size_t regionIdx) const
+{
+    assert(regionIdx < _regions.size());    // Ensured by caller
+    // The indices are in table order, and each region's servers are
+    // contiguous in the table
+    auto itBegin = std::lower_bound(indices.begin(), indices.end(),
+                                    regionBegin(regionIdx));
+    auto itEnd = std::lower_bound(itBegin, indices.end(), regionEnd(regionIdx));
+    return {itBegin, itEnd};
+}
+
+}
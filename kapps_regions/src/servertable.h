@@ -0,0 +1,127 @@
+// Copyright (c) 2024 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include "region.h"
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace kapps::regions {
+
+// ServerTable indexes all servers from a set of regions in columns - address,
+// region index, services, and port set - along with the indices of the servers
+// providing each service or each service port, and the servers belonging to
+// each region.
+//
+// Scans over the whole regions list (such as finding all servers providing a
+// service) only touch the columns they need, rather than visiting each Region
+// and Server and following their service group pointers.  Lookups by service
+// or by service and port use the precomputed indices, either for the whole
+// table or for one region.
+//
+// Servers are identified by their index in the table.  The servers for each
+// region are contiguous and in the same order as Region::servers(), and the
+// regions are in the order given to the constructor (the order of
+// RegionList::regions()).  The per-service and per-port indices are in table
+// order, so the indices for one region are a contiguous part of them.
+//
+// The table shares ownership of its regions, so the servers remain valid as
+// long as the table exists.
+class KAPPS_REGIONS_EXPORT ServerTable
+{
+public:
+    ServerTable() = default;
+    explicit ServerTable(std::vector<std::shared_ptr<const Region>> regions);
+
+public:
+    // Number of servers in the table
+    std::size_t size() const {return _servers.size();}
+    bool empty() const {return _servers.empty();}
+
+    // The regions in the table; region indices refer to these
+    core::ArraySlice<const std::shared_ptr<const Region>> regions() const {return _regions;}
+
+    // Columns - each is indexed by a server index
+    core::ArraySlice<const core::Ipv4Address> addresses() const {return _addresses;}
+    core::ArraySlice<const std::uint32_t> regionIndices() const {return _regionIndices;}
+    core::ArraySlice<const ServiceMask> services() const {return _services;}
+    core::ArraySlice<const std::uint32_t> portSetIds() const {return _portSetIds;}
+
+    // The Server for a server index
+    const Server &server(std::size_t idx) const {return *_servers[idx];}
+
+    // Port sets are identified by an ID; servers have the same port set ID if
+    // they share a service group.  (Port sets are not necessarily unique,
+    // different service groups might have the same ports.)
+    std::size_t portSetCount() const {return _portSets.size();}
+    Ports servicePorts(std::uint32_t portSetId, Service service) const;
+    // Ports for a server by server index
+    Ports serverPorts(std::size_t idx, Service service) const
+    {
+        return servicePorts(_portSetIds[idx], service);
+    }
+
+    // Indices of all servers providing a service, or providing a service on a
+    // specific port
+    core::ArraySlice<const std::uint32_t> serversFor(Service service) const;
+    core::ArraySlice<const std::uint32_t> serversForPort(Service service,
+                                                         std::uint16_t port) const;
+    // The same, limited to the servers of one region (by region index)
+    core::ArraySlice<const std::uint32_t> serversFor(Service service,
+                                                     std::size_t regionIdx) const;
+    core::ArraySlice<const std::uint32_t> serversForPort(Service service,
+                                                         std::uint16_t port,
+                                                         std::size_t regionIdx) const;
+
+    // Range of servers for a region by region index - the servers are
+    // [regionBegin(idx), regionEnd(idx)).
+    std::uint32_t regionBegin(std::size_t regionIdx) const {return _regionOffsets[regionIdx];}
+    std::uint32_t regionEnd(std::size_t regionIdx) const {return _regionOffsets[regionIdx+1];}
+
+private:
+    // Key for _serversByPort
+    static std::uint32_t portKey(Service service, std::uint16_t port)
+    {
+        return static_cast<std::uint32_t>(service) << 16 | port;
+    }
+    // Find the part of an index (in table order) belonging to a region
+    core::ArraySlice<const std::uint32_t> regionPart(core::ArraySlice<const std::uint32_t> indices,
+                                                     std::size_t regionIdx) const;
+
+private:
+    std::vector<std::shared_ptr<const Region>> _regions;
+    std::vector<core::Ipv4Address> _addresses;
+    std::vector<std::uint32_t> _regionIndices;
+    std::vector<ServiceMask> _services;
+    std::vector<std::uint32_t> _portSetIds;
+    std::vector<const Server*> _servers;
+    // Service groups identified by the port set IDs; owned by the regions'
+    // storage
+    std::vector<const ServiceGroup*> _portSets;
+    std::array<std::vector<std::uint32_t>, ServiceCount> _serversByService;
+    // Servers by service and port; keyed by portKey()
+    std::unordered_map<std::uint32_t, std::vector<std::uint32_t>> _serversByPort;
+    // Offset of the first server for each region, followed by the total number
+    // of servers - region i has servers [_regionOffsets[i], _regionOffsets[i+1])
+    std::vector<std::uint32_t> _regionOffsets{0};
+};
+
+}
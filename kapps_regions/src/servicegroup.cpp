@@ -110,11 +110,43 @@ void ServiceGroup::readJsonServiceOpenVpn(const nlohmann::json &service,
         ncp = itJsonNcp->get<bool>();
 }
 
-bool ServiceGroup::hasAnyService() const
+ServiceMask ServiceGroup::services() const
 {
-    return !openVpnUdpPorts().empty() || !openVpnTcpPorts().empty() ||
-        !wireGuardPorts().empty() || ikev2() || !shadowsocksPorts().empty() ||
-        !metaPorts().empty();
+    ServiceMask services{};
+    if(!openVpnTcpPorts().empty())
+        services |= serviceBit(Service::OpenVpnTcp);
+    if(!openVpnUdpPorts().empty())
+        services |= serviceBit(Service::OpenVpnUdp);
+    if(!wireGuardPorts().empty())
+        services |= serviceBit(Service::WireGuard);
+    if(ikev2())
+        services |= serviceBit(Service::Ikev2);
+    if(!shadowsocksPorts().empty())
+        services |= serviceBit(Service::Shadowsocks);
+    if(!metaPorts().empty())
+        services |= serviceBit(Service::Meta);
+    return services;
+}
+
+Ports ServiceGroup::servicePorts(Service service) const
+{
+    switch(service)
+    {
+        case Service::OpenVpnTcp:
+            return openVpnTcpPorts();
+        case Service::OpenVpnUdp:
+            return openVpnUdpPorts();
+        case Service::WireGuard:
+            return wireGuardPorts();
+        case Service::Ikev2:
+            return {};  // No ports for IKEv2
+        case Service::Shadowsocks:
+            return shadowsocksPorts();
+        case Service::Meta:
+            return metaPorts();
+        default:
+            return {};
+    }
 }
 
 void ServiceGroup::readJsonServicesArray(const nlohmann::json &services,
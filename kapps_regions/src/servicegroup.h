@@ -39,6 +39,23 @@ enum class Service
     Meta = KARServiceMeta
 };
 
+// Number of services, used to size per-service tables
+constexpr std::size_t ServiceCount = static_cast<std::size_t>(Service::Meta) + 1;
+
+// Bit mask of services, with bit (1 << service) set for each service provided.
+// Servers and regions cache this so service lookups don't have to inspect the
+// ports for each service.
+using ServiceMask = std::uint8_t;
+constexpr ServiceMask serviceBit(Service service)
+{
+    // Values from the API could be out of range; those are never provided
+    return static_cast<unsigned>(service) < ServiceCount ?
+        static_cast<ServiceMask>(1u << static_cast<unsigned>(service)) : 0;
+}
+// The VPN services (used to select servers for latency measurements)
+constexpr ServiceMask VpnServices = serviceBit(Service::OpenVpnTcp) |
+    serviceBit(Service::OpenVpnUdp) | serviceBit(Service::WireGuard);
+
 // This is a mock implementation of the API while the existing internals are
 // ported and adapted from PIA Desktop.
 
@@ -79,7 +96,12 @@ private:
 public:
     // Test whether this service group has any known service.  Used to ignore
     // empty service groups in RegionList.
-    bool hasAnyService() const;
+    bool hasAnyService() const {return services() != 0;}
+    // The services provided by this group
+    ServiceMask services() const;
+    // The ports for a service; empty if the service isn't provided (or has no
+    // ports, like IKEv2)
+    Ports servicePorts(Service service) const;
 
     Ports openVpnUdpPorts() const {return _openVpnUdpPorts;}
     bool openVpnUdpNcp() const {return _openVpnUdpNcp;}
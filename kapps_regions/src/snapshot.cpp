@@ -0,0 +1,365 @@
+// Copyright (c) 2024 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "snapshot.h"
+#include <kapps_core/src/logger.h>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+#include <unordered_map>
+
+namespace kapps::regions {
+
+namespace
+{
+    const char snapshotMagic[4]{'K', 'R', 'S', 'N'};
+    // Increment this when the snapshot format changes
+    const std::uint32_t snapshotVersion{1};
+
+    class SnapshotWriter
+    {
+    public:
+        template<class T>
+        void write(T value)
+        {
+            static_assert(std::is_arithmetic<T>::value, "only for primitive values");
+            _data.append(reinterpret_cast<const char *>(&value), sizeof(value));
+        }
+        void write(bool value) {write(static_cast<std::uint8_t>(value));}
+        void write(core::Ipv4Address address) {write(address.address());}
+        void write(core::StringSlice value)
+        {
+            write(static_cast<std::uint32_t>(value.size()));
+            _data.append(value.data(), value.size());
+        }
+        void write(Ports ports)
+        {
+            write(static_cast<std::uint32_t>(ports.size()));
+            for(auto port : ports)
+                write(port);
+        }
+        void write(const DisplayText &text)
+        {
+            write(static_cast<std::uint32_t>(text.texts().size()));
+            for(const auto &[language, value] : text.texts())
+            {
+                write(core::StringSlice{language.toString()});
+                write(core::StringSlice{value});
+            }
+        }
+
+        std::string &data() {return _data;}
+
+    private:
+        std::string _data;
+    };
+
+    // Reads values from a snapshot; throws if the snapshot is truncated
+    class SnapshotReader
+    {
+    public:
+        SnapshotReader(core::StringSlice data) : _data{data}, _pos{0} {}
+
+    private:
+        const char *take(std::size_t size)
+        {
+            if(size > _data.size() - _pos)
+                throw std::runtime_error{"Snapshot is truncated"};
+            const char *pValue = _data.data() + _pos;
+            _pos += size;
+            return pValue;
+        }
+
+    public:
+        template<class T>
+        T read()
+        {
+            static_assert(std::is_arithmetic<T>::value, "only for primitive values");
+            T value;
+            std::memcpy(&value, take(sizeof(value)), sizeof(value));
+            return value;
+        }
+        bool readBool() {return read<std::uint8_t>() != 0;}
+        core::Ipv4Address readAddress() {return {read<std::uint32_t>()};}
+        // Read a count of elements, each at least minSize bytes - ensures the
+        // count is plausible before anything is allocated
+        std::size_t readCount(std::size_t minSize)
+        {
+            std::size_t count = read<std::uint32_t>();
+            if(count > (_data.size() - _pos) / minSize)
+                throw std::runtime_error{"Snapshot is truncated"};
+            return count;
+        }
+        core::StringSlice readSlice()
+        {
+            std::size_t size = read<std::uint32_t>();
+            return {take(size), size};
+        }
+        std::string readString() {return readSlice().to_string();}
+        std::vector<std::uint16_t> readPorts()
+        {
+            std::vector<std::uint16_t> ports;
+            ports.resize(readCount(sizeof(std::uint16_t)));
+            for(auto &port : ports)
+                port = read<std::uint16_t>();
+            return ports;
+        }
+        DisplayText readDisplayText()
+        {
+            std::unordered_map<Bcp47Tag, std::string> texts;
+            std::size_t count = readCount(2 * sizeof(std::uint32_t));
+            texts.reserve(count);
+            while(count--)
+            {
+                Bcp47Tag language{readSlice()};
+                texts.emplace(std::move(language), readString());
+            }
+            return {std::move(texts)};
+        }
+
+        bool atEnd() const {return _pos == _data.size();}
+
+    private:
+        core::StringSlice _data;
+        std::size_t _pos;
+    };
+}
+
+std::string writeSnapshot(core::StringSlice key, const RegionList &regionList,
+                          const Metadata &metadata)
+{
+    SnapshotWriter writer;
+    writer.data().append(snapshotMagic, sizeof(snapshotMagic));
+    writer.write(snapshotVersion);
+    writer.write(key);
+
+    writer.write(static_cast<std::uint32_t>(regionList.publicDnsServers().size()));
+    for(const auto &address : regionList.publicDnsServers())
+        writer.write(address);
+
+    // Service groups are shared by many servers; write each one once and
+    // refer to it by index.
+    std::unordered_map<const ServiceGroup*, std::uint32_t> groupIndices;
+    std::vector<const ServiceGroup*> groups;
+    for(const auto &pRegion : regionList.regions())
+    {
+        for(const auto &pServer : pRegion->servers())
+        {
+            const ServiceGroup *pGroup = pServer->serviceGroup();
+            if(groupIndices.emplace(pGroup, static_cast<std::uint32_t>(groups.size())).second)
+                groups.push_back(pGroup);
+        }
+    }
+
+    writer.write(static_cast<std::uint32_t>(groups.size()));
+    for(const ServiceGroup *pGroup : groups)
+    {
+        writer.write(pGroup->openVpnUdpPorts());
+        writer.write(pGroup->openVpnUdpNcp());
+        writer.write(pGroup->openVpnTcpPorts());
+        writer.write(pGroup->openVpnTcpNcp());
+        writer.write(pGroup->wireGuardPorts());
+        writer.write(pGroup->ikev2());
+        writer.write(pGroup->shadowsocksPorts());
+        writer.write(pGroup->shadowsocksKey());
+        writer.write(pGroup->shadowsocksCipher());
+        writer.write(pGroup->metaPorts());
+    }
+
+    writer.write(static_cast<std::uint32_t>(regionList.regions().size()));
+    for(const auto &pRegion : regionList.regions())
+    {
+        writer.write(pRegion->id());
+        writer.write(pRegion->autoSafe());
+        writer.write(pRegion->portForward());
+        writer.write(pRegion->geoLocated());
+        writer.write(pRegion->dipAddress());
+        writer.write(static_cast<std::uint32_t>(pRegion->servers().size()));
+        for(const auto &pServer : pRegion->servers())
+        {
+            writer.write(pServer->address());
+            writer.write(pServer->commonName());
+            writer.write(pServer->fqdn());
+            writer.write(groupIndices.at(pServer->serviceGroup()));
+        }
+    }
+
+    writer.write(static_cast<std::uint32_t>(metadata.dynamicGroups().size()));
+    for(const auto &pRole : metadata.dynamicGroups())
+    {
+        writer.write(pRole->id());
+        writer.write(pRole->name());
+        writer.write(pRole->resource());
+        writer.write(pRole->winIcon());
+    }
+
+    writer.write(static_cast<std::uint32_t>(metadata.countryDisplays().size()));
+    for(const auto &pCountry : metadata.countryDisplays())
+    {
+        writer.write(pCountry->code());
+        writer.write(pCountry->name());
+        writer.write(pCountry->prefix());
+    }
+
+    writer.write(static_cast<std::uint32_t>(metadata.regionDisplays().size()));
+    for(const auto &pRegion : metadata.regionDisplays())
+    {
+        writer.write(pRegion->id());
+        writer.write(pRegion->country());
+        writer.write(pRegion->geoLatitude());
+        writer.write(pRegion->geoLongitude());
+        writer.write(pRegion->name());
+    }
+
+    return std::move(writer.data());
+}
+
+bool readSnapshot(core::StringSlice snapshot, core::StringSlice key,
+                  RegionList &regionList, Metadata &metadata)
+{
+    try
+    {
+        SnapshotReader reader{snapshot};
+        for(char magicChar : snapshotMagic)
+        {
+            if(reader.read<char>() != magicChar)
+            {
+                KAPPS_CORE_WARNING() << "Ignoring regions snapshot, not a snapshot file";
+                return false;
+            }
+        }
+        auto version = reader.read<std::uint32_t>();
+        if(version != snapshotVersion)
+        {
+            KAPPS_CORE_INFO() << "Ignoring regions snapshot with version"
+                << version << "- current version is" << snapshotVersion;
+            return false;
+        }
+        if(reader.readSlice() != key)
+        {
+            KAPPS_CORE_INFO() << "Ignoring regions snapshot, regions have changed";
+            return false;
+        }
+
+        std::vector<core::Ipv4Address> publicDnsServers;
+        publicDnsServers.resize(reader.readCount(sizeof(std::uint32_t)));
+        for(auto &address : publicDnsServers)
+            address = reader.readAddress();
+
+        // The restored regions share one RegionStorage, like those built by
+        // RegionList
+        auto pStorage = std::make_shared<RegionStorage>();
+        std::vector<const ServiceGroup*> groups;
+        groups.resize(reader.readCount(1));
+        for(auto &pGroup : groups)
+        {
+            auto openVpnUdpPorts = reader.readPorts();
+            bool openVpnUdpNcp = reader.readBool();
+            auto openVpnTcpPorts = reader.readPorts();
+            bool openVpnTcpNcp = reader.readBool();
+            auto wireGuardPorts = reader.readPorts();
+            bool ikev2 = reader.readBool();
+            auto shadowsocksPorts = reader.readPorts();
+            auto shadowsocksKey = reader.readString();
+            auto shadowsocksCipher = reader.readString();
+            auto metaPorts = reader.readPorts();
+            pGroup = pStorage->addServiceGroup({std::move(openVpnUdpPorts),
+                openVpnUdpNcp, std::move(openVpnTcpPorts), openVpnTcpNcp,
+                std::move(wireGuardPorts), ikev2, std::move(shadowsocksPorts),
+                std::move(shadowsocksKey), std::move(shadowsocksCipher),
+                std::move(metaPorts)});
+        }
+
+        std::vector<std::shared_ptr<const Region>> regions;
+        regions.resize(reader.readCount(1));
+        for(auto &pRegion : regions)
+        {
+            auto id = reader.readSlice();
+            bool autoSafe = reader.readBool();
+            bool portForward = reader.readBool();
+            bool geoLocated = reader.readBool();
+            auto dipAddress = reader.readAddress();
+            std::vector<Server> servers;
+            std::size_t serverCount = reader.readCount(1);
+            servers.reserve(serverCount);
+            while(serverCount--)
+            {
+                auto address = reader.readAddress();
+                auto commonName = reader.readSlice();
+                auto fqdn = reader.readSlice();
+                auto groupIndex = reader.read<std::uint32_t>();
+                if(groupIndex >= groups.size())
+                    throw std::runtime_error{"Invalid service group index"};
+                servers.emplace_back(address, commonName, fqdn, groups[groupIndex]);
+            }
+            pRegion = std::make_shared<Region>(pStorage, id, autoSafe,
+                portForward, geoLocated, dipAddress, std::move(servers));
+        }
+
+        std::vector<std::shared_ptr<const DynamicRole>> dynamicGroups;
+        dynamicGroups.resize(reader.readCount(1));
+        for(auto &pRole : dynamicGroups)
+        {
+            auto id = reader.readString();
+            auto name = reader.readDisplayText();
+            auto resource = reader.readString();
+            auto winIcon = reader.readString();
+            pRole = std::make_shared<DynamicRole>(std::move(id), std::move(name),
+                std::move(resource), std::move(winIcon));
+        }
+
+        std::vector<std::shared_ptr<const CountryDisplay>> countryDisplays;
+        countryDisplays.resize(reader.readCount(1));
+        for(auto &pCountry : countryDisplays)
+        {
+            auto code = reader.readString();
+            auto name = reader.readDisplayText();
+            auto prefix = reader.readDisplayText();
+            pCountry = std::make_shared<CountryDisplay>(std::move(code),
+                std::move(name), std::move(prefix));
+        }
+
+        std::vector<std::shared_ptr<const RegionDisplay>> regionDisplays;
+        regionDisplays.resize(reader.readCount(1));
+        for(auto &pRegion : regionDisplays)
+        {
+            auto id = reader.readString();
+            auto country = reader.readString();
+            double geoLatitude = reader.read<double>();
+            double geoLongitude = reader.read<double>();
+            auto name = reader.readDisplayText();
+            pRegion = std::make_shared<RegionDisplay>(std::move(id),
+                std::move(country), geoLatitude, geoLongitude, std::move(name));
+        }
+
+        if(!reader.atEnd())
+            throw std::runtime_error{"Unexpected data after snapshot"};
+
+        regionList = RegionList{std::move(publicDnsServers), std::move(regions)};
+        metadata = Metadata{std::move(dynamicGroups), std::move(countryDisplays),
+                            std::move(regionDisplays)};
+        return true;
+    }
+    catch(const std::exception &ex)
+    {
+        KAPPS_CORE_WARNING() << "Ignoring invalid regions snapshot -" << ex.what();
+    }
+    return false;
+}
+
+}
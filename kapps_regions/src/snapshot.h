@@ -0,0 +1,56 @@
+// Copyright (c) 2024 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include "regionlist.h"
+#include "metadata.h"
+#include <kapps_core/src/stringslice.h>
+#include <string>
+
+namespace kapps::regions {
+
+// Binary snapshots of a built RegionList and Metadata.
+//
+// Building RegionList and Metadata from the JSON regions lists is relatively
+// expensive - the lists are large, and every Region, Server, etc. is built
+// from the parsed JSON.  A snapshot stores the built objects in a compact
+// binary form that can be restored without parsing any JSON, for example when
+// the application starts and the regions lists haven't changed.
+//
+// Each snapshot has a format version and a caller-defined key identifying the
+// inputs it was built from (such as a hash of the JSON regions lists and any
+// DIPs/manual regions).  readSnapshot() rejects a snapshot with a different
+// version or key, then the caller should build from JSON again.
+//
+// Snapshots use the native byte order and are only meant to be cached
+// locally.
+
+// Serialize a RegionList and Metadata to a snapshot.
+KAPPS_REGIONS_EXPORT std::string writeSnapshot(core::StringSlice key,
+                                               const RegionList &regionList,
+                                               const Metadata &metadata);
+
+// Restore a RegionList and Metadata from a snapshot.  Returns false if the
+// snapshot's version or key do not match, or if the snapshot is invalid; the
+// RegionList and Metadata are not modified in that case.
+KAPPS_REGIONS_EXPORT bool readSnapshot(core::StringSlice snapshot,
+                                       core::StringSlice key,
+                                       RegionList &regionList,
+                                       Metadata &metadata);
+
+}
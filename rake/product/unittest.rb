@@ -24,6 +24,7 @@ module PiaUnitTest
         'networkmonitor',
         'networktaskwithretry',
         'nodelist',
+        'notificationscheduler',
         'nullable_t',
         'originalnetworkscan',
         'openssl',
@@ -35,6 +36,7 @@ module PiaUnitTest
         'semversion',
         'servicegroup',
         'settings',
+        'statepatch',
         'subnetbypass',
         'tasks',
         'transportselector',
@@ -46,9 +48,13 @@ module PiaUnitTest
         if Build.windows?
             t << 'wfp_filters'
         elsif Build.linux?
+            t << 'anchor_model'
             t << 'core_fs'
+            t << 'iptables_firewall'
+            t << 'linux_routemanager'
             t << 'splitdnsinfo'
             t << 'rt_tables_initializer'
+            t << 'proc_fs'
         elsif Build.macos?
            t << 'core_fs'
            t << 'constrainedhash'
@@ -56,6 +62,11 @@ module PiaUnitTest
         end
     end
 
+    # Benchmarks; built from tests/bench_<name>.cpp
+    Benchmarks = [
+        'regions'
+    ]
+
     def self.defineTargets(versionlib, deps, artifacts)
         # The all-tests-lib library compiles all client and daemon code once to
         # be shared by all unit tests.
@@ -135,35 +146,7 @@ module PiaUnitTest
         anyTestBin = nil
 
         Tests.each do |t|
-            testExec = Executable.new("test-#{t}", :executable)
-                .use(allTestsLib.export)
-                .useQt('Network') # Common
-                .useQt('Qml') # Client
-                .useQt('Quick')
-                .useQt('QuickControls2')
-                .useQt('Gui')
-                .useQt('Test') # Test
-                .define("TEST_MOC=\"tst_#{t}.moc\"")
-                .sourceFile("tests/tst_#{t}.cpp")
-                .include('.') # Some tests include headers using a path from the repo root due to historical QBS limitations
-                .forceLinkSymbol('forceLinkTestlogCpp') # See testlog.cpp, for static initializer
-                .coverage(true)
-            if(Build.windows?)
-                testExec
-                    .useQt('Xml')
-                    .useQt('WinExtras')
-                    .linkArgs(['/IGNORE:4099'])
-            elsif(Build.macos?)
-                testExec
-                    .framework('AppKit')
-                    .framework('CoreWLAN')
-                    .framework('Security')
-                    .framework('ServiceManagement')
-                    .framework('SystemConfiguration') # Daemon dependencies
-                    .useQt('MacExtras')
-            elsif(Build.linux?)
-                testExec.useQt('Widgets')
-            end
+            testExec = defineTestExecutable("test-#{t}", "tst_#{t}", allTestsLib, true)
 
             # Just grab the first test executable for this
             anyTestBin = testExec.target if anyTestBin == nil
@@ -176,30 +159,8 @@ module PiaUnitTest
             # coverage-raw directory.
             task "run-test-#{t}" => ["test-#{t}", coverageRawBuild.componentDir] do |task|
                 puts "test: #{t}"
-                testBin = testExec.target
-                cmd = ''
                 covData = coverageRawBuild.artifact("coverage_#{t}.raw")
-                opensslLibPath = File.absolute_path(File.join('deps/built',
-                                                              Build.selectDesktop('win', 'mac', 'linux'),
-                                                              Build::TargetArchitecture.to_s))
-                if Build.windows?
-                    # Don't bother with covData, not supported on MSVC
-                    path = [
-                        File.join(Executable::Qt.targetQtRoot, 'bin'),
-                        opensslLibPath,
-                        ENV['PATH']
-                    ]
-                    cmd = Util.cmd("set \"PATH=#{path.join(';')}\" & set \"UNIT_TEST_LIB=#{opensslLibPath}\" & \"#{testBin}\"")
-                elsif Build.macos?
-                    cmd = "LLVM_PROFILE_FILE=\"#{covData}\" UNIT_TEST_LIB=\"#{opensslLibPath}\" \"#{testBin}\""
-                elsif Build.linux?
-                    libPath = [
-                        File.join(Executable::Qt.targetQtRoot, 'lib'),
-                        opensslLibPath
-                    ]
-                    cmd = "LD_LIBRARY_PATH=\"#{libPath.join(':')}\" LLVM_PROFILE_FILE=\"#{covData}\" UNIT_TEST_LIB=\"#{opensslLibPath}\" \"#{testBin}\""
-                end
-               Util.shellRun cmd
+                Util.shellRun testCommand(testExec.target, covData)
             end
 
             task :build_tests_parallel => "test-#{t}"
@@ -207,6 +168,33 @@ module PiaUnitTest
             task :run_tests_parallel => "run-test-#{t}"
         end
 
+        # Benchmarks are built like the unit tests, but they aren't run by the
+        # test targets - the results are only meaningful from an optimized
+        # build on a quiet machine.  Results are written as XML to the
+        # benchmark build directory, and a summary is printed.
+        benchmarkBuild = Build.new('benchmark')
+        task :build_all_benchmarks => [allTestsLib.target]
+        task :run_all_benchmarks
+
+        Benchmarks.each do |b|
+            benchExec = defineTestExecutable("bench-#{b}", "bench_#{b}", allTestsLib, false)
+                .resource('tools', ['modern-servers-list-tests/*.json']) # Example regions lists
+
+            task "bench-#{b}" => [allTestsLib.target, benchExec.target]
+
+            task "run-bench-#{b}" => ["bench-#{b}", benchmarkBuild.componentDir] do |task|
+                puts "benchmark: #{b}"
+                results = benchmarkBuild.artifact("bench_#{b}.xml")
+                Util.shellRun testCommand(benchExec.target, nil, "-o \"#{results}\",xml -o -,txt")
+            end
+
+            task :build_all_benchmarks => "bench-#{b}"
+            task :run_all_benchmarks => "run-bench-#{b}"
+        end
+
+        desc "Build and run all benchmarks"
+        task :benchmark => :run_all_benchmarks
+
         desc "Build and run all unit tests (for cross targets, build only)"
         task :test
 
@@ -232,6 +220,68 @@ module PiaUnitTest
         end
     end
 
+    # Define an executable for a unit test or benchmark using allTestsLib.
+    # source is the name of the source file in tests/ (without extension).
+    def self.defineTestExecutable(name, source, allTestsLib, coverage)
+        testExec = Executable.new(name, :executable)
+            .use(allTestsLib.export)
+            .useQt('Network') # Common
+            .useQt('Qml') # Client
+            .useQt('Quick')
+            .useQt('QuickControls2')
+            .useQt('Gui')
+            .useQt('Test') # Test
+            .define("TEST_MOC=\"#{source}.moc\"")
+            .sourceFile("tests/#{source}.cpp")
+            .include('.') # Some tests include headers using a path from the repo root due to historical QBS limitations
+            .forceLinkSymbol('forceLinkTestlogCpp') # See testlog.cpp, for static initializer
+            .coverage(coverage)
+        if(Build.windows?)
+            testExec
+                .useQt('Xml')
+                .useQt('WinExtras')
+                .linkArgs(['/IGNORE:4099'])
+        elsif(Build.macos?)
+            testExec
+                .framework('AppKit')
+                .framework('CoreWLAN')
+                .framework('Security')
+                .framework('ServiceManagement')
+                .framework('SystemConfiguration') # Daemon dependencies
+                .useQt('MacExtras')
+        elsif(Build.linux?)
+            testExec.useQt('Widgets')
+        end
+        testExec
+    end
+
+    # Build the command to run a test or benchmark executable with the Qt and
+    # OpenSSL libraries.  If covData is given, coverage data is written there
+    # when possible.
+    def self.testCommand(testBin, covData, args = '')
+        opensslLibPath = File.absolute_path(File.join('deps/built',
+                                                      Build.selectDesktop('win', 'mac', 'linux'),
+                                                      Build::TargetArchitecture.to_s))
+        covEnv = covData ? "LLVM_PROFILE_FILE=\"#{covData}\" " : ''
+        if Build.windows?
+            # Don't bother with covData, not supported on MSVC
+            path = [
+                File.join(Executable::Qt.targetQtRoot, 'bin'),
+                opensslLibPath,
+                ENV['PATH']
+            ]
+            Util.cmd("set \"PATH=#{path.join(';')}\" & set \"UNIT_TEST_LIB=#{opensslLibPath}\" & \"#{testBin}\" #{args}")
+        elsif Build.macos?
+            "#{covEnv}UNIT_TEST_LIB=\"#{opensslLibPath}\" \"#{testBin}\" #{args}"
+        elsif Build.linux?
+            libPath = [
+                File.join(Executable::Qt.targetQtRoot, 'lib'),
+                opensslLibPath
+            ]
+            "LD_LIBRARY_PATH=\"#{libPath.join(':')}\" #{covEnv}UNIT_TEST_LIB=\"#{opensslLibPath}\" \"#{testBin}\" #{args}"
+        end
+    end
+
     def self.defineCoverageTargets(artifacts, coverageRawBuild, anyTestBin)
         # Merge and analyze coverage data if it was generated.  This depends on
         # all tests; it doesn't have specific file dependencies on the raw data
@@ -0,0 +1,577 @@
+// Copyright (c) 2024 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include <common/src/common.h>
+#include <common/src/locations.h>
+#include <daemon/src/model/clientjson.h>
+#include <kapps_regions/src/regionlist.h>
+#include <kapps_regions/src/metadata.h>
+#include "src/testresource.h"
+#include <QtTest>
+#include <nlohmann/json.hpp>
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#if defined(Q_OS_WIN)
+#include <kapps_core/src/winapi.h>
+#include <malloc.h>
+#include <psapi.h>
+#elif defined(Q_OS_MACOS)
+#include <malloc/malloc.h>
+#include <sys/resource.h>
+#else
+#include <malloc.h>
+#include <sys/resource.h>
+#endif
+
+// Benchmarks for building the regions lists, looking up regions, grouping
+// locations, and serializing them for clients.
+//
+// Each benchmark is run on the example lists in tools/modern-servers-list-tests
+// and on synthetic lists scaled up from tests/res/regions-v6.json.  Use
+// QtTest's output options for machine-readable results, such as
+// `-o results.xml,xml` or `-csv`; `rake run-bench-regions` writes XML results
+// to the benchmark build directory.
+
+namespace
+{
+    // Allocation counters, updated by the replacement operator new/delete
+    // below.  Only C++ allocations made through operator new are counted; Qt's
+    // implicitly-shared containers allocate with malloc() and aren't included.
+    //
+    // Block sizes are taken from the allocator rather than stored in a header,
+    // so blocks allocated or freed by other modules (with their own operator
+    // new/delete) are still safe to free; they just aren't counted.
+    std::atomic<std::uint64_t> allocationCount{0};
+    std::atomic<std::uint64_t> allocatedBytes{0};
+    std::atomic<std::int64_t> liveBytes{0};
+    std::atomic<std::int64_t> peakLiveBytes{0};
+
+    std::size_t blockSize(void *pBlock)
+    {
+#if defined(Q_OS_WIN)
+        return ::_msize(pBlock);
+#elif defined(Q_OS_MACOS)
+        return ::malloc_size(pBlock);
+#else
+        return ::malloc_usable_size(pBlock);
+#endif
+    }
+
+    // Peak resident set size of this process, in bytes
+    std::uint64_t peakRss()
+    {
+#if defined(Q_OS_WIN)
+        PROCESS_MEMORY_COUNTERS counters{};
+        counters.cb = sizeof(counters);
+        if(!::GetProcessMemoryInfo(::GetCurrentProcess(), &counters, counters.cb))
+            return 0;
+        return counters.PeakWorkingSetSize;
+#else
+        rusage usage{};
+        if(::getrusage(RUSAGE_SELF, &usage) != 0)
+            return 0;
+    #if defined(Q_OS_MACOS)
+        return static_cast<std::uint64_t>(usage.ru_maxrss);  // Bytes on macOS
+    #else
+        return static_cast<std::uint64_t>(usage.ru_maxrss) * 1024;  // KiB
+    #endif
+#endif
+    }
+
+    struct AllocationStats
+    {
+        std::uint64_t count;
+        std::uint64_t bytes;
+        std::uint64_t peakBytes;    // Peak live bytes above the starting level
+    };
+
+    // Measure the C++ allocations made by func()
+    template<class FuncT>
+    AllocationStats measureAllocations(const FuncT &func)
+    {
+        std::uint64_t startCount = allocationCount;
+        std::uint64_t startBytes = allocatedBytes;
+        std::int64_t startLive = liveBytes;
+        peakLiveBytes = startLive;
+        func();
+        std::int64_t peak = peakLiveBytes;
+        return {allocationCount - startCount, allocatedBytes - startBytes,
+                static_cast<std::uint64_t>(std::max<std::int64_t>(peak - startLive, 0))};
+    }
+}
+
+void *operator new(std::size_t size)
+{
+    void *pBlock = std::malloc(size ? size : 1);
+    if(!pBlock)
+        throw std::bad_alloc{};
+    std::int64_t actual = static_cast<std::int64_t>(blockSize(pBlock));
+    ++allocationCount;
+    allocatedBytes += actual;
+    std::int64_t live = liveBytes += actual;
+    std::int64_t peak = peakLiveBytes;
+    while(live > peak && !peakLiveBytes.compare_exchange_weak(peak, live));
+    return pBlock;
+}
+
+void operator delete(void *pBlock) noexcept
+{
+    if(!pBlock)
+        return;
+    liveBytes -= static_cast<std::int64_t>(blockSize(pBlock));
+    std::free(pBlock);
+}
+
+void operator delete(void *pBlock, std::size_t) noexcept
+{
+    ::operator delete(pBlock);
+}
+
+namespace kapps::regions
+{
+
+namespace
+{
+    const std::array<QString, 7> fixtures
+    {{
+        QStringLiteral("normal_bridge"),
+        QStringLiteral("normal_favored"),
+        QStringLiteral("normal_new_service"),
+        QStringLiteral("normal_regional_defaults"),
+        QStringLiteral("normal_regional_port"),
+        QStringLiteral("normal_renamed_groups"),
+        QStringLiteral("normal_split_groups")
+    }};
+
+    // The synthetic lists repeat regions-v6.json this many times
+    const std::array<int, 3> scales{{1, 10, 100}};
+
+    // Threads used for the parallel build rows
+    const std::size_t parallelThreads{4};
+
+    QByteArray dumpJson(const nlohmann::json &json)
+    {
+        return QByteArray::fromStdString(json.dump());
+    }
+
+    // The examples in tools/modern-servers-list-tests predate the
+    // "port_forward", "geo", and "offline" fields, which the PIAv6 parser
+    // requires.  Fill them in so the regions are actually built.
+    QByteArray normalizeFixture(const QByteArray &regionsJson)
+    {
+        auto json = nlohmann::json::parse(regionsJson.begin(), regionsJson.end());
+        for(auto &region : json.at("regions"))
+        {
+            for(const char *field : {"port_forward", "geo", "offline"})
+            {
+                if(!region.contains(field))
+                    region[field] = false;
+            }
+        }
+        return dumpJson(json);
+    }
+
+    // Repeat the regions in a regions list `scale` times.  Each copy of a
+    // region gets a unique ID and name, and each copied server gets a unique
+    // address, so the copies are distinct regions and servers.
+    QByteArray scaleRegions(const QByteArray &regionsJson, int scale)
+    {
+        auto json = nlohmann::json::parse(regionsJson.begin(), regionsJson.end());
+        auto scaledRegions = json.at("regions");
+        std::uint32_t nextAddress{core::Ipv4Address{10, 0, 0, 1}.address()};
+        for(int copy=1; copy<scale; ++copy)
+        {
+            for(auto region : json.at("regions"))
+            {
+                std::string suffix = "_copy" + std::to_string(copy);
+                region["id"] = region.at("id").get<std::string>() + suffix;
+                region["name"] = region.at("name").get<std::string>() + suffix;
+                for(auto &groupServers : region.at("servers").items())
+                {
+                    for(auto &server : groupServers.value())
+                        server["ip"] = core::Ipv4Address{nextAddress++}.toString();
+                }
+                scaledRegions.push_back(std::move(region));
+            }
+        }
+        json["regions"] = std::move(scaledRegions);
+        return dumpJson(json);
+    }
+
+    // Convert a PIAv6 regions list to the v7 format, so the v7 parser (DOM,
+    // parallel, and streaming) can be measured on the same inputs.  Each v6
+    // group becomes a service config, and each server in a group becomes a
+    // server entry using that config.
+    QByteArray convertToV7(const QByteArray &regionsJson)
+    {
+        auto json = nlohmann::json::parse(regionsJson.begin(), regionsJson.end());
+        nlohmann::json serviceConfigs = nlohmann::json::array();
+        for(const auto &group : json.at("groups").items())
+        {
+            nlohmann::json services = nlohmann::json::array();
+            for(const auto &service : group.value())
+                services.push_back({{"service", service.at("name")}, {"ports", service.at("ports")}});
+            serviceConfigs.push_back({{"name", group.key()}, {"services", std::move(services)}});
+        }
+
+        nlohmann::json regions = nlohmann::json::array();
+        for(auto region : json.at("regions"))
+        {
+            nlohmann::json servers = nlohmann::json::array();
+            for(const auto &groupServers : region.at("servers").items())
+            {
+                for(const auto &server : groupServers.value())
+                {
+                    servers.push_back({{"ip", server.at("ip")}, {"cn", server.at("cn")},
+                                       {"service_config", groupServers.key()}});
+                }
+            }
+            region["servers"] = std::move(servers);
+            regions.push_back(std::move(region));
+        }
+
+        return dumpJson({{"service_configs", std::move(serviceConfigs)},
+                         {"regions", std::move(regions)}});
+    }
+
+    // Assign a stable pseudo-random latency to each region, so grouping and
+    // sorting the locations does the same work as it does with real
+    // measurements.
+    LatencyMap makeLatencies(const RegionList &regionList)
+    {
+        LatencyMap latencies;
+        for(const auto &pRegion : regionList.regions())
+        {
+            std::size_t hash = std::hash<std::string>{}(pRegion->id().to_string());
+            latencies.emplace(qs::toQString(pRegion->id()),
+                              static_cast<double>(5 + hash % 300));
+        }
+        return latencies;
+    }
+}
+
+class bench_regions : public QObject
+{
+    Q_OBJECT
+
+private:
+    struct RegionsInput
+    {
+        QByteArray name;
+        QByteArray regionsJson;
+        QByteArray metadataJson;
+        QByteArray regionsV7Json;   // regionsJson converted to v7
+    };
+
+    // How the v7 regions list is built in the v7 benchmarks
+    enum class V7Build
+    {
+        Dom,
+        Parallel,
+        Streaming,
+    };
+
+    // Add a data row for each input list, in order of size
+    void addInputRows()
+    {
+        QTest::addColumn<int>("input");
+        for(std::size_t i=0; i<_inputs.size(); ++i)
+            QTest::newRow(_inputs[i].name.constData()) << static_cast<int>(i);
+    }
+
+    const RegionsInput &currentInput()
+    {
+        QFETCH(int, input);
+        return _inputs.at(static_cast<std::size_t>(input));
+    }
+
+    // Add a data row for each input list with each V7Build
+    void addV7Rows()
+    {
+        QTest::addColumn<int>("input");
+        QTest::addColumn<int>("build");
+        const std::array<std::pair<V7Build, const char *>, 3> builds
+        {{
+            {V7Build::Dom, "dom"},
+            {V7Build::Parallel, "parallel"},
+            {V7Build::Streaming, "streaming"}
+        }};
+        for(std::size_t i=0; i<_inputs.size(); ++i)
+        {
+            for(const auto &build : builds)
+            {
+                QTest::newRow((_inputs[i].name + ':' + build.second).constData())
+                    << static_cast<int>(i) << static_cast<int>(build.first);
+            }
+        }
+    }
+
+    BuildOptions currentV7Options()
+    {
+        QFETCH(int, build);
+        BuildOptions options;
+        switch(static_cast<V7Build>(build))
+        {
+            case V7Build::Dom:
+                break;
+            case V7Build::Parallel:
+                options.threads = parallelThreads;
+                break;
+            case V7Build::Streaming:
+                options.streaming = true;
+                break;
+        }
+        return options;
+    }
+
+    static RegionList buildRegionList(const RegionsInput &input)
+    {
+        return {RegionList::PIAv6, input.regionsJson.constData(), {}, {}, {}};
+    }
+
+    static RegionList buildV7RegionList(const RegionsInput &input,
+                                        const BuildOptions &options)
+    {
+        return {input.regionsV7Json.constData(), {}, {}, {}, options};
+    }
+
+    static Metadata buildMetadata(const RegionsInput &input)
+    {
+        return {input.regionsJson.constData(), input.metadataJson.constData(), {}, {}};
+    }
+
+    static auto buildLocations(const RegionsInput &input, const LatencyMap &latencies)
+        -> std::pair<LocationsById, Metadata>
+    {
+        return buildModernLocations(latencies,
+            QJsonDocument::fromJson(input.regionsJson).object(), {},
+            QJsonDocument::fromJson(input.metadataJson).object(), {}, {});
+    }
+
+private slots:
+    void initTestCase()
+    {
+        QByteArray metadatav2 = TestResource::load(QStringLiteral(":/metadata-v2.json"));
+        for(const auto &fixture : fixtures)
+        {
+            QByteArray regionsJson = TestResource::load(
+                QStringLiteral(":/modern-servers-list-tests/%1.json").arg(fixture));
+            QByteArray normalized = normalizeFixture(regionsJson);
+            _inputs.push_back({fixture.toUtf8(), normalized, metadatav2,
+                               convertToV7(normalized)});
+        }
+
+        QByteArray regionsv6 = TestResource::load(QStringLiteral(":/regions-v6.json"));
+        for(int scale : scales)
+        {
+            QByteArray scaled = scaleRegions(regionsv6, scale);
+            _inputs.push_back({QByteArrayLiteral("regions-v6-x") + QByteArray::number(scale),
+                               scaled, metadatav2, convertToV7(scaled)});
+        }
+
+        // Make sure every input actually builds regions, otherwise the
+        // results are meaningless
+        for(const auto &input : _inputs)
+        {
+            QVERIFY2(!buildRegionList(input).regions().empty(), input.name.constData());
+            QVERIFY2(!buildV7RegionList(input, {}).regions().empty(), input.name.constData());
+        }
+    }
+
+    // Parse and build the regions list
+    void benchParseRegions_data() {addInputRows();}
+    void benchParseRegions()
+    {
+        const auto &input = currentInput();
+        QBENCHMARK
+        {
+            RegionList regionList{buildRegionList(input)};
+        }
+    }
+
+    // Parse and build the v7 regions list with the DOM parser on one thread,
+    // on parallelThreads threads, and with the streaming parser
+    void benchParseRegionsV7_data() {addV7Rows();}
+    void benchParseRegionsV7()
+    {
+        const auto &input = currentInput();
+        BuildOptions options = currentV7Options();
+        QBENCHMARK
+        {
+            RegionList regionList{buildV7RegionList(input, options)};
+        }
+    }
+
+    // Peak heap usage while building the v7 regions list in each of the ways
+    // above - the streaming parser doesn't hold a DOM of the whole list
+    void benchParseRegionsV7PeakHeap_data() {addV7Rows();}
+    void benchParseRegionsV7PeakHeap()
+    {
+        const auto &input = currentInput();
+        BuildOptions options = currentV7Options();
+        auto stats = measureAllocations([&]
+        {
+            RegionList regionList{buildV7RegionList(input, options)};
+        });
+        QTest::setBenchmarkResult(static_cast<qreal>(stats.peakBytes),
+                                  QTest::BytesAllocated);
+    }
+
+    // Parse and build the metadata
+    void benchParseMetadata_data() {addInputRows();}
+    void benchParseMetadata()
+    {
+        const auto &input = currentInput();
+        QBENCHMARK
+        {
+            Metadata metadata{buildMetadata(input)};
+        }
+    }
+
+    // Number of allocations made to build the regions list and metadata
+    void benchBuildAllocations_data() {addInputRows();}
+    void benchBuildAllocations()
+    {
+        const auto &input = currentInput();
+        auto stats = measureAllocations([&]
+        {
+            RegionList regionList{buildRegionList(input)};
+            Metadata metadata{buildMetadata(input)};
+        });
+        QTest::setBenchmarkResult(static_cast<qreal>(stats.count), QTest::Events);
+    }
+
+    // Peak heap usage while building the regions list and metadata
+    void benchBuildPeakHeap_data() {addInputRows();}
+    void benchBuildPeakHeap()
+    {
+        const auto &input = currentInput();
+        auto stats = measureAllocations([&]
+        {
+            RegionList regionList{buildRegionList(input)};
+            Metadata metadata{buildMetadata(input)};
+        });
+        QTest::setBenchmarkResult(static_cast<qreal>(stats.peakBytes),
+                                  QTest::BytesAllocated);
+    }
+
+    // Peak RSS of the process after building the regions list and metadata.
+    // This is a process-wide high-water mark, so rows after the largest input
+    // can't be lower; run a single row (such as
+    // `benchPeakRss:regions-v6-x100`) for an isolated figure.
+    void benchPeakRss_data() {addInputRows();}
+    void benchPeakRss()
+    {
+        const auto &input = currentInput();
+        {
+            RegionList regionList{buildRegionList(input)};
+            Metadata metadata{buildMetadata(input)};
+        }
+        QTest::setBenchmarkResult(static_cast<qreal>(peakRss()),
+                                  QTest::BytesAllocated);
+    }
+
+    // Look up every region by ID (as well as one miss per region)
+    void benchRegionLookup_data() {addInputRows();}
+    void benchRegionLookup()
+    {
+        const auto &input = currentInput();
+        RegionList regionList{buildRegionList(input)};
+        std::vector<std::string> ids;
+        ids.reserve(regionList.regions().size() * 2);
+        for(const auto &pRegion : regionList.regions())
+        {
+            ids.push_back(pRegion->id().to_string());
+            ids.push_back(pRegion->id().to_string() + "_missing");
+        }
+
+        std::size_t found{0};
+        QBENCHMARK
+        {
+            found = 0;
+            for(const auto &id : ids)
+            {
+                if(regionList.getRegion(id))
+                    ++found;
+            }
+        }
+        QCOMPARE(found, regionList.regions().size());
+    }
+
+    // Build the daemon's locations from the regions lists
+    void benchBuildLocations_data() {addInputRows();}
+    void benchBuildLocations()
+    {
+        const auto &input = currentInput();
+        LatencyMap latencies = makeLatencies(buildRegionList(input));
+        QBENCHMARK
+        {
+            auto locations = buildLocations(input, latencies);
+        }
+    }
+
+    // Group and sort the locations by country
+    void benchGroupLocations_data() {addInputRows();}
+    void benchGroupLocations()
+    {
+        const auto &input = currentInput();
+        auto locations = buildLocations(input, makeLatencies(buildRegionList(input)));
+        std::vector<CountryLocations> groupedLocations;
+        std::vector<QSharedPointer<const Location>> dedicatedIpLocations;
+        QBENCHMARK
+        {
+            buildGroupedLocations(locations.first, locations.second,
+                                  groupedLocations, dedicatedIpLocations);
+        }
+        QVERIFY(!groupedLocations.empty());
+    }
+
+    // Serialize the locations and metadata for clients, as DaemonState does
+    // for availableLocations, regionsMetadata, and groupedLocations
+    void benchSerializeLocations_data() {addInputRows();}
+    void benchSerializeLocations()
+    {
+        const auto &input = currentInput();
+        auto locations = buildLocations(input, makeLatencies(buildRegionList(input)));
+        std::vector<CountryLocations> groupedLocations;
+        std::vector<QSharedPointer<const Location>> dedicatedIpLocations;
+        buildGroupedLocations(locations.first, locations.second,
+                              groupedLocations, dedicatedIpLocations);
+
+        std::string serialized;
+        QBENCHMARK
+        {
+            clientjson::json state = clientjson::json::object();
+            state["availableLocations"] = locations.first;
+            state["regionsMetadata"] = locations.second;
+            state["groupedLocations"] = groupedLocations;
+            serialized = state.dump();
+        }
+        QVERIFY(!serialized.empty());
+    }
+
+private:
+    std::vector<RegionsInput> _inputs;
+};
+
+}
+
+QTEST_GUILESS_MAIN(kapps::regions::bench_regions)
+#include TEST_MOC
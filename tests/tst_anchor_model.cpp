@@ -0,0 +1,111 @@
+// Copyright (c) 2024 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include <common/src/common.h>
+#include <QtTest>
+
+#include <kapps_net/src/linux/anchor_model.h>
+
+namespace
+{
+    using IPVersion = AnchorModel::IPVersion;
+    using Strings = std::vector<std::string>;
+    using ChangedIp = kapps::core::nullable_t<IPVersion>;
+}
+
+class tst_anchor_model : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    // The first request for an anchor is always applied, and the result is
+    // the IP versions that changed
+    void testChangedIpVersion()
+    {
+        AnchorModel model;
+        QCOMPARE(model.updateEnabled(TableEnum::Filter, IPVersion::Both, "100.blockAll", true),
+                 ChangedIp{IPVersion::Both});
+        QCOMPARE(model.updateEnabled(TableEnum::Filter, IPVersion::IPv6, "250.blockIPv6", false),
+                 ChangedIp{IPVersion::IPv6});
+
+        // Only IPv4 was enabled, so enabling both only changes IPv6
+        QCOMPARE(model.updateEnabled(TableEnum::Filter, IPVersion::IPv4, "300.allowLAN", true),
+                 ChangedIp{IPVersion::IPv4});
+        QCOMPARE(model.updateEnabled(TableEnum::Filter, IPVersion::Both, "300.allowLAN", true),
+                 ChangedIp{IPVersion::IPv6});
+
+        QCOMPARE(model.updateRules(TableEnum::Filter, IPVersion::Both, "200.allowVPN", {"-o tun0 -j ACCEPT"}),
+                 ChangedIp{IPVersion::Both});
+        QCOMPARE(model.updateRules(TableEnum::Filter, IPVersion::IPv4, "200.allowVPN", {"-o tun1 -j ACCEPT"}),
+                 ChangedIp{IPVersion::IPv4});
+        QCOMPARE(model.updateRules(TableEnum::Filter, IPVersion::Both, "200.allowVPN", {"-o tun1 -j ACCEPT"}),
+                 ChangedIp{IPVersion::IPv6});
+    }
+
+    // Requests that don't change the anchor are skipped, and the enabled
+    // state and rules are tracked separately for each table
+    void testSkipUnchanged()
+    {
+        AnchorModel model;
+        const Strings rules{"-d 10.0.0.0/8 -j ACCEPT"};
+
+        model.updateEnabled(TableEnum::Filter, IPVersion::Both, "305.allowSubnets", true);
+        model.updateRules(TableEnum::Filter, IPVersion::Both, "305.allowSubnets", rules);
+        QCOMPARE(model.changedCount(), 2u);
+        QCOMPARE(model.unchangedCount(), 0u);
+
+        QCOMPARE(model.updateEnabled(TableEnum::Filter, IPVersion::Both, "305.allowSubnets", true), ChangedIp{});
+        QCOMPARE(model.updateEnabled(TableEnum::Filter, IPVersion::IPv6, "305.allowSubnets", true), ChangedIp{});
+        QCOMPARE(model.updateRules(TableEnum::Filter, IPVersion::Both, "305.allowSubnets", rules), ChangedIp{});
+        QCOMPARE(model.changedCount(), 2u);
+        QCOMPARE(model.unchangedCount(), 3u);
+
+        // Same name in another table is a different anchor
+        QCOMPARE(model.updateEnabled(TableEnum::Mangle, IPVersion::Both, "305.allowSubnets", true),
+                 ChangedIp{IPVersion::Both});
+
+        // Clearing the rules is a change, and an empty rule list is then
+        // recorded like any other
+        QCOMPARE(model.updateRules(TableEnum::Filter, IPVersion::Both, "305.allowSubnets", {}),
+                 ChangedIp{IPVersion::Both});
+        QCOMPARE(model.updateRules(TableEnum::Filter, IPVersion::Both, "305.allowSubnets", {}), ChangedIp{});
+
+        model.resetCounts();
+        QCOMPARE(model.changedCount(), 0u);
+        QCOMPARE(model.unchangedCount(), 0u);
+    }
+
+    // After clear(), every request is applied again
+    void testClear()
+    {
+        AnchorModel model;
+        model.updateEnabled(TableEnum::Filter, IPVersion::Both, "100.blockAll", true);
+        model.updateRules(TableEnum::Nat, IPVersion::IPv4, "80.splitDNS", {"-j ACCEPT"});
+
+        model.clear();
+        QCOMPARE(model.updateEnabled(TableEnum::Filter, IPVersion::Both, "100.blockAll", true),
+                 ChangedIp{IPVersion::Both});
+        QCOMPARE(model.updateRules(TableEnum::Nat, IPVersion::IPv4, "80.splitDNS", {"-j ACCEPT"}),
+                 ChangedIp{IPVersion::IPv4});
+        // Not cleared again
+        QCOMPARE(model.updateEnabled(TableEnum::Filter, IPVersion::Both, "100.blockAll", true), ChangedIp{});
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_anchor_model)
+#include TEST_MOC
@@ -0,0 +1,137 @@
+// Copyright (c) 2024 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include <common/src/common.h>
+#include <QtTest>
+
+#include <kapps_net/src/linux/iptables_firewall.h>
+
+namespace
+{
+    using FirstRuleMap = iptables::FirstRuleMap;
+
+    // iptables-save output with our root chains and a few other firewalls'
+    // rules.  Our root chain has been displaced from the top of filter OUTPUT
+    // by ufw.
+    const std::string savedRules{R"(# Generated by iptables-save v1.8.7 on Sat Oct 17 12:00:00 2026
+*raw
+:PREROUTING ACCEPT [1024:65536]
+:OUTPUT ACCEPT [980:70000]
+:piavpn.PREROUTING - [0:0]
+:piavpn.a.100.vpnTunOnly - [0:0]
+-A PREROUTING -j piavpn.PREROUTING
+-A piavpn.PREROUTING -j piavpn.a.100.vpnTunOnly
+COMMIT
+# Completed on Sat Oct 17 12:00:00 2026
+# Generated by iptables-save v1.8.7 on Sat Oct 17 12:00:00 2026
+*mangle
+:PREROUTING ACCEPT [1024:65536]
+:INPUT ACCEPT [1000:64000]
+:FORWARD ACCEPT [0:0]
+:OUTPUT ACCEPT [980:70000]
+:POSTROUTING ACCEPT [980:70000]
+:piavpn.OUTPUT - [0:0]
+:piavpn.PREROUTING - [0:0]
+-A PREROUTING -j piavpn.PREROUTING
+-A OUTPUT -j piavpn.OUTPUT
+COMMIT
+# Completed on Sat Oct 17 12:00:00 2026
+# Generated by iptables-save v1.8.7 on Sat Oct 17 12:00:00 2026
+*nat
+:PREROUTING ACCEPT [12:900]
+:INPUT ACCEPT [0:0]
+:OUTPUT ACCEPT [40:2800]
+:POSTROUTING ACCEPT [40:2800]
+:DOCKER - [0:0]
+:piavpn.OUTPUT - [0:0]
+:piavpn.POSTROUTING - [0:0]
+-A PREROUTING -m addrtype --dst-type LOCAL -j DOCKER
+-A OUTPUT -j piavpn.OUTPUT
+-A OUTPUT ! -d 127.0.0.0/8 -m addrtype --dst-type LOCAL -j DOCKER
+-A POSTROUTING -j piavpn.POSTROUTING
+-A POSTROUTING -s 172.17.0.0/16 ! -o docker0 -j MASQUERADE
+-A DOCKER -i docker0 -j RETURN
+COMMIT
+# Completed on Sat Oct 17 12:00:00 2026
+# Generated by iptables-save v1.8.7 on Sat Oct 17 12:00:00 2026
+*filter
+:INPUT DROP [0:0]
+:FORWARD DROP [0:0]
+:OUTPUT ACCEPT [0:0]
+:ufw-before-output - [0:0]
+:piavpn.OUTPUT - [0:0]
+:piavpn.a.100.blockAll - [0:0]
+:piavpn.100.blockAll - [0:0]
+-A INPUT -j ufw-before-input
+-A FORWARD -j piavpn.FORWARD
+-A OUTPUT -j ufw-before-output
+-A OUTPUT -j piavpn.OUTPUT
+-A piavpn.OUTPUT -j piavpn.a.100.blockAll
+-A piavpn.100.blockAll -j REJECT --reject-with icmp-port-unreachable
+COMMIT
+# Completed on Sat Oct 17 12:00:00 2026
+)"};
+}
+
+class tst_iptables_firewall : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testParseFirstRules()
+    {
+        const FirstRuleMap firstRules{iptables::parseFirstRules(savedRules)};
+
+        const FirstRuleMap expected{
+            {{"raw", "PREROUTING"}, "-A PREROUTING -j piavpn.PREROUTING"},
+            {{"raw", "piavpn.PREROUTING"}, "-A piavpn.PREROUTING -j piavpn.a.100.vpnTunOnly"},
+            {{"mangle", "PREROUTING"}, "-A PREROUTING -j piavpn.PREROUTING"},
+            {{"mangle", "OUTPUT"}, "-A OUTPUT -j piavpn.OUTPUT"},
+            {{"nat", "PREROUTING"}, "-A PREROUTING -m addrtype --dst-type LOCAL -j DOCKER"},
+            {{"nat", "OUTPUT"}, "-A OUTPUT -j piavpn.OUTPUT"},
+            {{"nat", "POSTROUTING"}, "-A POSTROUTING -j piavpn.POSTROUTING"},
+            {{"nat", "DOCKER"}, "-A DOCKER -i docker0 -j RETURN"},
+            {{"filter", "INPUT"}, "-A INPUT -j ufw-before-input"},
+            {{"filter", "FORWARD"}, "-A FORWARD -j piavpn.FORWARD"},
+            // Our root chain is second - the first rule is ufw's
+            {{"filter", "OUTPUT"}, "-A OUTPUT -j ufw-before-output"},
+            {{"filter", "piavpn.OUTPUT"}, "-A piavpn.OUTPUT -j piavpn.a.100.blockAll"},
+            {{"filter", "piavpn.100.blockAll"}, "-A piavpn.100.blockAll -j REJECT --reject-with icmp-port-unreachable"},
+        };
+        QVERIFY(firstRules == expected);
+
+        // Empty chains aren't included
+        QCOMPARE(firstRules.count({"filter", "piavpn.a.100.blockAll"}), std::size_t{0});
+        QCOMPARE(firstRules.count({"mangle", "INPUT"}), std::size_t{0});
+    }
+
+    void testParseFirstRulesEmpty()
+    {
+        // If iptables-save fails, there's no output, and nothing is found
+        QVERIFY(iptables::parseFirstRules({}).empty());
+        // Rules outside of a table (shouldn't happen) have an empty table name
+        QVERIFY(iptables::parseFirstRules("-A OUTPUT -j ACCEPT\n") ==
+                (FirstRuleMap{{{"", "OUTPUT"}, "-A OUTPUT -j ACCEPT"}}));
+        // A rule with no arguments still identifies the chain
+        QVERIFY(iptables::parseFirstRules("*filter\n-A OUTPUT\nCOMMIT\n") ==
+                (FirstRuleMap{{{"filter", "OUTPUT"}, "-A OUTPUT"}}));
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_iptables_firewall)
+#include TEST_MOC
@@ -21,10 +21,13 @@
 #include <QSignalSpy>
 
 #include <common/src/json.h>
+#include <common/src/jsonwriter.h>
 
 #include <QJsonArray>
+#include <QJsonDocument>
 #include <QJsonObject>
 #include <QString>
+#include <limits>
 
 class TestSettings : public NativeJsonObject
 {
@@ -54,6 +57,34 @@ public:
     JsonField(QJsonArray, validatedArrayField, {}, &TestSettings::arrayValidatorFunc)
 };
 
+class TestValue
+{
+public:
+    JsonValueField(QString, name, QStringLiteral("default"))
+    JsonValueField(int, count, 0)
+    JsonValueField(std::vector<QString>, tags, {})
+
+public:
+    static auto jsonFields()
+    {
+        return std::make_tuple(jsonValueField("name", &TestValue::_name),
+                               jsonValueField("count", &TestValue::_count),
+                               jsonValueField("tags", &TestValue::_tags));
+    }
+};
+
+struct TestPod
+{
+    int x;
+    int y;
+
+    static auto jsonFields()
+    {
+        return std::make_tuple(jsonValueField("x", &TestPod::x),
+                               jsonValueField("y", &TestPod::y));
+    }
+};
+
 class tst_json : public QObject
 {
     Q_OBJECT
@@ -286,6 +317,156 @@ private slots:
         settings.validatedArrayField({ 1, 2, 3 });
         QVERIFY(!settings.error());
     }
+    void applyPatchOperations()
+    {
+        QJsonValue value{QJsonObject{
+            {"latency", 100},
+            {"ids", QJsonArray{"us_east", "us_west"}},
+            {"a/b", QJsonObject{{"c~d", 1}}}
+        }};
+        QJsonArray patch{
+            QJsonObject{{"op", "replace"}, {"path", "/latency"}, {"value", 50}},
+            QJsonObject{{"op", "add"}, {"path", "/ids/-"}, {"value", "ca_toronto"}},
+            QJsonObject{{"op", "remove"}, {"path", "/ids/0"}},
+            QJsonObject{{"op", "replace"}, {"path", "/a~1b/c~0d"}, {"value", 2}},
+            QJsonObject{{"op", "add"}, {"path", "/offline"}, {"value", false}}
+        };
+        QVERIFY(applyJsonPatch(value, patch));
+        QJsonValue expected{QJsonObject{
+            {"latency", 50},
+            {"ids", QJsonArray{"us_west", "ca_toronto"}},
+            {"a/b", QJsonObject{{"c~d", 2}}},
+            {"offline", false}
+        }};
+        QCOMPARE(value, expected);
+    }
+    void applyPatchFailure()
+    {
+        const QJsonValue original{QJsonArray{1, 2, 3}};
+        QJsonValue value{original};
+        // The first operation is valid, but the second is not - the value
+        // must not be modified at all
+        QJsonArray patch{
+            QJsonObject{{"op", "replace"}, {"path", "/0"}, {"value", 4}},
+            QJsonObject{{"op", "remove"}, {"path", "/3"}}
+        };
+        QVERIFY(!applyJsonPatch(value, patch));
+        QCOMPARE(value, original);
+
+        // Unsupported operations are rejected
+        QVERIFY(!applyJsonPatch(value, QJsonArray{QJsonObject{{"op", "move"}, {"from", "/0"}, {"path", "/1"}}}));
+        QCOMPARE(value, original);
+    }
+    void applyPatchFromDiff()
+    {
+        // Patches from the daemon are created with nlohmann::json::diff()
+        auto source = nlohmann::json::parse(R"({"locations":[{"id":"us_east","latency":30},{"id":"us_west","latency":70}],"code":"us"})");
+        auto target = nlohmann::json::parse(R"({"locations":[{"id":"us_east","latency":35}],"code":"us","dip":true})");
+        auto patch = nlohmann::json::diff(source, target);
+
+        QJsonValue value{adaptNljToQt(source)};
+        QVERIFY(applyJsonPatch(value, adaptJsonTextToQJsonObject(nlohmann::json{{"patch", patch}}.dump())
+                                        .value(QStringLiteral("patch")).toArray()));
+        QCOMPARE(value, QJsonValue{adaptNljToQt(target)});
+    }
+
+    void valueObjectCast()
+    {
+        TestValue value;
+        value.name(QStringLiteral("test"));
+        value.count(3);
+        value.tags({QStringLiteral("a"), QStringLiteral("b")});
+
+        QJsonValue json = json_cast<QJsonValue>(value, HERE);
+        QCOMPARE(json, QJsonValue{QJsonObject{{"name", "test"}, {"count", 3},
+                                              {"tags", QJsonArray{"a", "b"}}}});
+
+        auto readValue = json_cast<TestValue>(json, HERE);
+        QCOMPARE(readValue.name(), value.name());
+        QCOMPARE(readValue.count(), value.count());
+        QCOMPARE(readValue.tags(), value.tags());
+
+        // Missing fields take their default values
+        readValue = json_cast<TestValue>(QJsonValue{QJsonObject{{"count", 5}}}, HERE);
+        QCOMPARE(readValue.name(), QStringLiteral("default"));
+        QCOMPARE(readValue.count(), 5);
+
+        // Invalid fields fail the cast without modifying the result
+        QVERIFY(!json_cast(QJsonValue{QJsonObject{{"name", "other"}, {"count", "x"}}}, readValue));
+        QCOMPARE(readValue.name(), QStringLiteral("default"));
+        QVERIFY(!json_cast(QJsonValue{1}, readValue));
+
+        static_assert(std::is_trivially_copyable<TestPod>::value,
+                      "value objects with trivial fields are trivially copyable");
+        QCOMPARE(json_cast<QJsonValue>(TestPod{1, 2}, HERE),
+                 QJsonValue{QJsonObject{{"x", 1}, {"y", 2}}});
+    }
+
+    void valueObjectNlohmann()
+    {
+        TestValue value;
+        value.count(7);
+        nlohmann::json j = value;
+        QCOMPARE(j.dump(), std::string{R"({"count":7,"name":"default","tags":[]})"});
+
+        auto readValue = nlohmann::json::parse(R"({"name":"x","tags":["t"]})").get<TestValue>();
+        QCOMPARE(readValue.name(), QStringLiteral("x"));
+        QCOMPARE(readValue.count(), 0);
+        QCOMPARE(readValue.tags(), std::vector<QString>{QStringLiteral("t")});
+    }
+
+    void writerStructure()
+    {
+        JsonWriter writer;
+        writer.beginObject();
+        writer.key(QStringLiteral("a"));
+        writer.beginArray();
+        writer.value(1.0);
+        writer.value(true);
+        writer.nullValue();
+        writer.beginObject();
+        writer.endObject();
+        writer.endArray();
+        writer.key(QStringLiteral("b"));
+        std::string raw{R"({"x":[1,2]})"};
+        writer.rawValue(raw);
+        writer.endObject();
+        QCOMPARE(writer.take(), QByteArray{R"({"a":[1,true,null,{}],"b":{"x":[1,2]}})"});
+        QVERIFY(writer.data().isEmpty());
+    }
+
+    void writerValues()
+    {
+        JsonWriter writer;
+        writer.beginArray();
+        writer.value(QStringLiteral("q\"b\\n\nt\t\u0001\u00e9"));
+        writer.value(-42.0);
+        writer.value(0.5);
+        writer.value(std::numeric_limits<double>::infinity());
+        writer.value(QJsonValue{QJsonArray{1, "x"}});
+        writer.endArray();
+
+        auto doc = QJsonDocument::fromJson(writer.data());
+        QVERIFY(doc.isArray());
+        QCOMPARE(doc.array(), (QJsonArray{QStringLiteral("q\"b\\n\nt\t\u0001\u00e9"),
+                                          -42, 0.5, QJsonValue{},
+                                          QJsonArray{1, "x"}}));
+    }
+
+    void writeNativeJsonObject()
+    {
+        TestSettings settings;
+        settings.intField(5);
+        settings.set("unknown", QStringLiteral("u"));
+
+        JsonWriter writer;
+        settings.writeJson(writer, {QStringLiteral("boolField")});
+        auto written = QJsonDocument::fromJson(writer.data()).object();
+
+        QJsonObject expected = settings.toJsonObject();
+        expected.remove(QStringLiteral("boolField"));
+        QCOMPARE(written, expected);
+    }
 };
 
 QTEST_GUILESS_MAIN(tst_json)
@@ -76,6 +76,43 @@ private slots:
         QCOMPARE(call->result(), 12 + 34);
     }
 
+    // Test a call where each side uses a different encoding - each side
+    // detects the encoding of the messages it receives
+    void cborCall()
+    {
+        LocalMethodRegistry registry {
+            { QStringLiteral("test"), [&](QString param) { return param + QStringLiteral("-result"); } },
+        };
+        LocalCallInterface server(&registry);
+        server.setEncoding(JsonRPCEncoding::Cbor);
+        RemoteCallInterface client;
+        int cborMessages{0};
+        connect(&client, &RemoteCallInterface::messageReady, &server, &LocalCallInterface::processMessage);
+        connect(&server, &LocalCallInterface::messageReady, &client,
+            [&](const QByteArray &msg)
+            {
+                // Not JSON text
+                if(!msg.startsWith('{'))
+                    ++cborMessages;
+                client.processMessage(msg);
+            });
+        auto call = client.call(QStringLiteral("test"), QStringLiteral("param"));
+        QTRY_VERIFY(call->isResolved());
+        QCOMPARE(cborMessages, 1);
+        QCOMPARE(call->result(), QJsonValue{QStringLiteral("param-result")});
+    }
+
+    void cborParse()
+    {
+        QJsonObject msg{
+            {QStringLiteral("jsonrpc"), QStringLiteral("2.0")},
+            {QStringLiteral("method"), QStringLiteral("data")},
+            {QStringLiteral("params"), QJsonArray{QJsonObject{{"latency", 35}, {"offline", false}}}}
+        };
+        QCOMPARE(parseJsonRPCMessage(serializeJsonRPCMessage(msg, JsonRPCEncoding::Cbor)), msg);
+        QCOMPARE(parseJsonRPCMessage(serializeJsonRPCMessage(msg, JsonRPCEncoding::Json)), msg);
+    }
+
     // Test that a call() while disconnected is rejected
     void disconnectedCall()
     {
@@ -193,6 +193,53 @@ private slots:
         unchanged = duplicate;
         QCOMPARE(unchangedObs.take(), (Expected{"connectedServer", "intervalMeasurements"}));
     }
+
+    // Test property indices and tracking changes by index
+    void testPropertyIndices()
+    {
+        MockState state;
+        // Indices are assigned in declaration order
+        QCOMPARE(state.propertyCount(), std::size_t{3});
+        QCOMPARE(state.connectionState.index(), std::size_t{0});
+        QCOMPARE(state.intervalMeasurements.index(), std::size_t{2});
+        QCOMPARE(state.propertyName(1), std::string{"connectedServer"});
+        std::size_t index{};
+        QVERIFY(state.findProperty("intervalMeasurements", index));
+        QCOMPARE(index, std::size_t{2});
+        QVERIFY(!state.findProperty("bogus", index));
+
+        MockState::PropertySet changes;
+        state.propertyIndexChanged = [&](std::size_t changedIndex)
+        {
+            changes.insert(changedIndex);
+        };
+        state.intervalMeasurements({1, 2});
+        state.connectionState("Connected");
+        state.intervalMeasurements({1, 2, 3});
+        QCOMPARE(changes.size(), std::size_t{2});
+        QVERIFY(changes.contains(0));
+        QVERIFY(!changes.contains(1));
+        QVERIFY(changes.contains(2));
+
+        // forEach() visits in index order
+        std::deque<std::string> visited;
+        changes.forEach([&](std::size_t changedIndex)
+        {
+            visited.push_back(state.propertyName(changedIndex));
+        });
+        QCOMPARE(visited, (Expected{"connectionState", "intervalMeasurements"}));
+        QCOMPARE(state.getProperty(2), (nlohmann::json{1, 2, 3}));
+
+        QVERIFY(changes.erase(0));
+        QVERIFY(!changes.erase(0));
+        QCOMPARE(changes.size(), std::size_t{1});
+        changes.clear();
+        QVERIFY(changes.empty());
+        // Indices past the first word work too
+        QVERIFY(changes.insert(100));
+        QVERIFY(changes.contains(100));
+        QVERIFY(!changes.contains(36));
+    }
 };
 
 QTEST_GUILESS_MAIN(tst_jsonstate);
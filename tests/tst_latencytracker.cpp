@@ -42,12 +42,13 @@ public:
     MockPingServers(kapps::core::StringSlice prefix,
         std::uint8_t ip0, std::uint8_t ip1, std::uint8_t ip2)
     {
-        auto pServiceGroup = std::make_shared<kapps::regions::ServiceGroup>(
+        auto pStorage = std::make_shared<kapps::regions::RegionStorage>();
+        auto pServiceGroup = pStorage->addServiceGroup({
             std::vector<std::uint16_t>{}, false,
             std::vector<std::uint16_t>{}, false,
             std::vector<std::uint16_t>{1337}, false,
             std::vector<std::uint16_t>{}, std::string{}, std::string{},
-            std::vector<std::uint16_t>{});
+            std::vector<std::uint16_t>{}});
         // Create some mock servers to listen for pings from LatencyTracker
         _mockServerList.reserve(MockPingServerCount);
         while(_mockPingLocations.size() < MockPingServerCount)
@@ -56,12 +57,10 @@ public:
             // matter, just add any VPN server with the loopback address so it
             // will be selected for ICMP latency measurements.
             kapps::core::Ipv4Address ip{ip0, ip1, ip2, static_cast<std::uint8_t>(_mockServerList.size()+1)};
-            auto pServer = std::make_shared<kapps::regions::Server>(ip, "n/a",
-                std::string{}, pServiceGroup);
             auto regionId = qs::format("%-%", prefix, _mockServerList.size());
-            auto pRegion = std::make_shared<kapps::regions::Region>(regionId,
-                true, false, false, kapps::core::Ipv4Address{},
-                std::vector<std::shared_ptr<const kapps::regions::Server>>{pServer});
+            auto pRegion = std::make_shared<kapps::regions::Region>(pStorage,
+                regionId, true, false, false, kapps::core::Ipv4Address{},
+                std::vector<kapps::regions::Server>{{ip, "n/a", {}, pServiceGroup}});
 
             auto pLocation = QSharedPointer<Location>::create(
                 std::move(pRegion), nullable_t<double>{});
@@ -134,7 +133,7 @@ MeasurementSplitter::MeasurementSplitter(LatencyBatch &batch)
 void MeasurementSplitter::onNewMeasurements(const LatencyTracker::Latencies &measurements)
 {
     for(const auto &measurement : measurements)
-        emit newMeasurement(measurement.first, measurement.second);
+        emit newMeasurement(measurement.locationId, measurement.latency);
 }
 
 class tst_latencytracker : public QObject
@@ -290,32 +289,104 @@ private slots:
         QCOMPARE(measurementSpy.size(), MockPingServerCount);
     }
 
+#if !defined(Q_OS_WIN)
+    // Verify that the ICMP sweep reports the round-trip times measured by
+    // PosixPing (aggregated over several probes), not the time until the
+    // sweep finishes.  The mock pings always take 30 ms.
+    void sweepRoundTrips()
+    {
+        auto pBatch{new LatencyBatch{_mockServers.mockPingLocations(), this}};
+        MeasurementSplitter splitter{*pBatch};
+        QSignalSpy measurementSpy{&splitter, &MeasurementSplitter::newMeasurement};
+        QSignalSpy destroySpy{pBatch, &QObject::destroyed};
+
+        QVERIFY(destroySpy.wait());
+
+        QCOMPARE(measurementSpy.size(), MockPingServerCount);
+        auto pendingLocations = _mockServers.mockLocationIds();
+        for(const auto &signalArgs : measurementSpy)
+        {
+            QVERIFY(pendingLocations.erase(signalArgs[0].toString()) == 1);
+            QCOMPARE(signalArgs[1].value<std::chrono::milliseconds>(),
+                     std::chrono::milliseconds{30});
+        }
+    }
+#endif
+
+    // Verify the median used to aggregate each server's probes
+    void sweepMedian()
+    {
+        using us = std::chrono::microseconds;
+        using ms = std::chrono::milliseconds;
+        QCOMPARE(medianRoundTrip({us{30000}}), ms{30});
+        QCOMPARE(medianRoundTrip({us{90000}, us{20000}, us{30000}}), ms{30});
+        // One delayed probe doesn't affect the result
+        QCOMPARE(medianRoundTrip({us{20000}, us{900000}, us{21000}}), ms{21});
+        // Even counts use the mean of the middle two
+        QCOMPARE(medianRoundTrip({us{40000}, us{20000}}), ms{30});
+        QCOMPARE(medianRoundTrip({us{10000}, us{50000}, us{20000}, us{30000}}), ms{25});
+        // Rounded to the nearest millisecond
+        QCOMPARE(medianRoundTrip({us{20400}}), ms{20});
+        QCOMPARE(medianRoundTrip({us{20600}}), ms{21});
+    }
+
+    // Verify that the sweep reports each server once - when all its probes are
+    // answered, when the reply window ends, or on its first late reply
+    void sweepAggregation()
+    {
+        using us = std::chrono::microseconds;
+        using ms = std::chrono::milliseconds;
+        using Reports = std::vector<SweepAggregator::Report>;
+        const quint32 complete{0x0A000001}, partial{0x0A000002}, late{0x0A000003};
+
+        SweepAggregator aggregator{3};
+        // Servers aren't reported until all probes are answered
+        QVERIFY(!aggregator.addRoundTrip(complete, us{50000}));
+        QVERIFY(!aggregator.addRoundTrip(partial, us{70000}));
+        QVERIFY(!aggregator.addRoundTrip(complete, us{10000}));
+        QVERIFY(!aggregator.addRoundTrip(partial, us{90000}));
+        QCOMPARE(aggregator.addRoundTrip(complete, us{20000}), nullable_t<ms>{ms{20}});
+        // Duplicate or extra replies after that are ignored
+        QVERIFY(!aggregator.addRoundTrip(complete, us{20000}));
+
+        // When the reply window ends, servers that answered some probes are
+        // reported with the median of those probes
+        QCOMPARE(aggregator.endReplyWindow(), (Reports{{partial, ms{80}}}));
+        QVERIFY(!aggregator.addRoundTrip(partial, us{75000}));
+
+        // A server that hadn't replied at all reports its first late reply
+        QCOMPARE(aggregator.addRoundTrip(late, us{1500000}), nullable_t<ms>{ms{1500}});
+        QVERIFY(!aggregator.addRoundTrip(late, us{1400000}));
+        QVERIFY(aggregator.endReplyWindow().empty());
+    }
+
     // Verify that a LatencyBatch destroys itself correctly when none of the
     // addresses given are valid.  (It should be destroyed immediately, not after
     // the measurement timeout.)
     void invalidCleanup()
     {
         // Location whose server has a bogus IP address - should be ignored
-        auto pServiceGroup = std::make_shared<kapps::regions::ServiceGroup>(
+        auto pStorage = std::make_shared<kapps::regions::RegionStorage>();
+        auto pServiceGroup = pStorage->addServiceGroup({
             std::vector<std::uint16_t>{}, false,
             std::vector<std::uint16_t>{}, false,
             std::vector<std::uint16_t>{1337}, false,
             std::vector<std::uint16_t>{}, std::string{}, std::string{},
-            std::vector<std::uint16_t>{});
+            std::vector<std::uint16_t>{}});
 
-        auto pBogusServer = std::make_shared<kapps::regions::Server>(
-            kapps::core::Ipv4Address{}, "n/a", std::string{}, pServiceGroup);
-        auto pBogusRegion = std::make_shared<kapps::regions::Region>("mock-bogus-addr",
-            true, false, false, kapps::core::Ipv4Address{},
-            std::vector<std::shared_ptr<const kapps::regions::Server>>{pBogusServer});
+        kapps::regions::Server bogusServer{kapps::core::Ipv4Address{}, "n/a",
+            {}, pServiceGroup};
+        auto pBogusRegion = std::make_shared<kapps::regions::Region>(pStorage,
+            "mock-bogus-addr", true, false, false, kapps::core::Ipv4Address{},
+            std::vector<kapps::regions::Server>{bogusServer});
 
         auto pBogusAddr = QSharedPointer<Location>::create(
             std::move(pBogusRegion), nullable_t<double>{});
 
         // Location with no servers at all (offline)
-        auto pOfflineRegion = std::make_shared<kapps::regions::Region>("mock-bogus-offline",
-            true, false, false, kapps::core::Ipv4Address{},
-            std::vector<std::shared_ptr<const kapps::regions::Server>>{pBogusServer});
+        auto pOfflineRegion = std::make_shared<kapps::regions::Region>(pStorage,
+            "mock-bogus-offline", true, false, false, kapps::core::Ipv4Address{},
+            std::vector<kapps::regions::Server>{bogusServer});
 
         auto pNoServers = QSharedPointer<Location>::create(
             std::move(pOfflineRegion), nullable_t<double>{});
@@ -347,6 +418,107 @@ private slots:
         QCOMPARE(measurementSpy.size(), 0);
     }
 
+    // Verify that LatencyHistory only considers the latency stable once a few
+    // measurements agree closely
+    void latencyStability()
+    {
+        using ms = std::chrono::milliseconds;
+        LatencyHistory history;
+        QVERIFY(history.empty());
+        QVERIFY(!history.stable());
+
+        QCOMPARE(history.updateLatency(ms{100}), ms{100});
+        QCOMPARE(history.updateLatency(ms{104}), ms{102});
+        QVERIFY(!history.stable());    // Too few measurements
+        history.updateLatency(ms{102});
+        QVERIFY(history.stable());
+        QCOMPARE(history.latency(), ms{102});
+
+        // An outlier makes it unstable until it falls out of the history, but
+        // it's trimmed from the latency
+        QCOMPARE(history.updateLatency(ms{300}), ms{103});
+        QVERIFY(!history.stable());
+        for(int i=0; i<5; ++i)
+        {
+            QVERIFY(!history.stable());
+            history.updateLatency(ms{101});
+        }
+        QVERIFY(history.stable());
+
+        // Low latencies tolerate a minimum spread
+        LatencyHistory nearby;
+        nearby.updateLatency(ms{2});
+        nearby.updateLatency(ms{9});
+        nearby.updateLatency(ms{5});
+        QVERIFY(nearby.stable());
+    }
+
+    // Verify that LatencyHistory tracks jitter and loss, and that they're
+    // used to identify unreliable locations
+    void latencyJitterLoss()
+    {
+        using ms = std::chrono::milliseconds;
+        LatencyHistory history;
+        history.updateLatency(ms{100});
+        QCOMPARE(history.jitter(), ms{0});
+        QCOMPARE(history.loss(), 0.0);
+
+        // Alternating measurements increase the jitter gradually
+        history.updateLatency(ms{148});
+        QCOMPARE(history.jitter(), ms{3});    // 48ms / 16
+        for(int i=0; i<30; ++i)
+            history.updateLatency(ms{i % 2 ? 148 : 100});
+        QCOMPARE(history.jitter(), ms{42});
+        QCOMPARE(history.latency(), ms{132});  // 148, 100, 148 after trimming
+        QVERIFY(isUnreliableLatency({{}, history.latency(), history.jitter(),
+                                     history.loss()}));
+
+        // Lost pings are counted over the last LossPingCount pings
+        for(int i=0; i<4; ++i)
+        {
+            history.addLoss();
+            history.updateLatency(ms{100});
+        }
+        QCOMPARE(history.loss(), 0.25);
+        for(std::size_t i=0; i<LatencyHistory::LossPingCount - 2; ++i)
+            history.updateLatency(ms{100});
+        QCOMPARE(history.loss(), 0.0625);
+
+        QVERIFY(!isUnreliableLatency({{}, ms{100}, ms{10}, 0.0}));
+        QVERIFY(isUnreliableLatency({{}, ms{100}, ms{30}, 0.0}));
+        // Jitter is relative to the latency, with a minimum
+        QVERIFY(!isUnreliableLatency({{}, ms{200}, ms{30}, 0.0}));
+        QVERIFY(!isUnreliableLatency({{}, ms{10}, ms{15}, 0.0}));
+        QVERIFY(!isUnreliableLatency({{}, ms{100}, ms{0}, 0.125}));
+        QVERIFY(isUnreliableLatency({{}, ms{100}, ms{0}, 0.25}));
+    }
+
+    // Verify that stable locations back off up to the maximum interval, and
+    // return to the base interval when they're unstable
+    void latencyBackoff()
+    {
+        using ms = std::chrono::milliseconds;
+        using minutes = std::chrono::minutes;
+        LatencyHistory history;
+        history.updateLatency(ms{50});
+        QCOMPARE(nextLatencyInterval(minutes{1}, history), ms{minutes{1}});
+
+        history.updateLatency(ms{50});
+        history.updateLatency(ms{50});
+        ms interval{minutes{1}};
+        std::vector<ms> intervals;
+        for(int i=0; i<6; ++i)
+        {
+            interval = nextLatencyInterval(interval, history);
+            intervals.push_back(interval);
+        }
+        QCOMPARE(intervals, (std::vector<ms>{minutes{2}, minutes{4}, minutes{8},
+                                             minutes{16}, minutes{16}, minutes{16}}));
+
+        history.updateLatency(ms{200});
+        QCOMPARE(nextLatencyInterval(interval, history), ms{minutes{1}});
+    }
+
     //Verify that equivalent IP addresses are found correctly
     void equivalentIpAddresses()
     {
@@ -0,0 +1,358 @@
+// Copyright (c) 2024 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include <common/src/common.h>
+#include <QtTest>
+#include <kapps_net/src/linux/linux_rtnetlink.h>
+#include <linux/fib_rules.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <cerrno>
+#include <map>
+
+namespace kapps::net {
+
+namespace
+{
+    using Family = LinuxRouteManager::Family;
+    using Attributes = std::map<std::uint16_t, std::vector<unsigned char>>;
+    using Id = core::nullable_t<std::uint32_t>;
+
+    // A message decoded from its encoding
+    template<class HeaderT>
+    struct Decoded
+    {
+        std::size_t size;
+        nlmsghdr nlHeader;
+        HeaderT header;
+        Attributes attributes;
+    };
+
+    template<class HeaderT>
+    Decoded<HeaderT> decode(const std::vector<unsigned char> &buffer)
+    {
+        Decoded<HeaderT> decoded{};
+        decoded.size = buffer.size();
+        auto pNlHeader = reinterpret_cast<const nlmsghdr*>(buffer.data());
+        decoded.nlHeader = *pNlHeader;
+        std::memcpy(&decoded.header, NLMSG_DATA(pNlHeader), sizeof(HeaderT));
+        int attrLen = static_cast<int>(pNlHeader->nlmsg_len - NLMSG_SPACE(sizeof(HeaderT)));
+        auto pAttr = reinterpret_cast<rtattr*>(const_cast<unsigned char*>(buffer.data()) + NLMSG_SPACE(sizeof(HeaderT)));
+        for(; RTA_OK(pAttr, attrLen); pAttr = RTA_NEXT(pAttr, attrLen))
+        {
+            auto pData = reinterpret_cast<const unsigned char*>(RTA_DATA(pAttr));
+            decoded.attributes[pAttr->rta_type].assign(pData, pData + RTA_PAYLOAD(pAttr));
+        }
+        return decoded;
+    }
+
+    template<class HeaderT>
+    Decoded<HeaderT> decode(const rtnetlink::Message &message)
+    {
+        std::vector<unsigned char> buffer;
+        message.appendTo(buffer, 1);
+        return decode<HeaderT>(buffer);
+    }
+
+    std::vector<unsigned char> u32(std::uint32_t value)
+    {
+        auto pValue = reinterpret_cast<const unsigned char*>(&value);
+        return {pValue, pValue + sizeof(value)};
+    }
+
+    std::vector<unsigned char> address(int family, const char *value)
+    {
+        std::vector<unsigned char> result(family == AF_INET6 ? 16 : 4);
+        ::inet_pton(family, value, result.data());
+        return result;
+    }
+
+    LinuxRouteManager::Route route(std::string subnet, std::string gatewayIp,
+                                   std::uint32_t metric = 0, bool blackhole = false)
+    {
+        return {Family::IPv4, std::move(subnet), std::move(gatewayIp), {}, {},
+                metric, blackhole};
+    }
+
+    const int kRequestFlags = NLM_F_REQUEST | NLM_F_ACK;
+}
+
+class tst_linux_routemanager : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testParsePrefix()
+    {
+        auto defaultRoute = rtnetlink::parsePrefix(Family::IPv4, "default");
+        QVERIFY(defaultRoute);
+        QCOMPARE(defaultRoute->length, 0u);
+        QCOMPARE(defaultRoute->addressSize, std::size_t{4});
+
+        auto subnet = rtnetlink::parsePrefix(Family::IPv4, "10.8.0.0/16");
+        QVERIFY(subnet);
+        QCOMPARE(subnet->length, 16u);
+        QCOMPARE(std::vector<unsigned char>(subnet->address, subnet->address + 4),
+                 address(AF_INET, "10.8.0.0"));
+
+        auto host = rtnetlink::parsePrefix(Family::IPv6, "fd00::1");
+        QVERIFY(host);
+        QCOMPARE(host->length, 128u);
+        QCOMPARE(host->addressSize, std::size_t{16});
+
+        QVERIFY(!rtnetlink::parsePrefix(Family::IPv4, "10.8.0.0/33"));
+        QVERIFY(!rtnetlink::parsePrefix(Family::IPv4, "10.8.0.0/"));
+        QVERIFY(!rtnetlink::parsePrefix(Family::IPv4, "10.8.0.0/1x"));
+        QVERIFY(!rtnetlink::parsePrefix(Family::IPv4, "fd00::/8"));
+        QVERIFY(!rtnetlink::parsePrefix(Family::IPv6, "10.8.0.0/16"));
+        QVERIFY(!rtnetlink::parsePrefix(Family::IPv4, ""));
+    }
+
+    void testParseTable()
+    {
+        QTemporaryFile etcFile;
+        QVERIFY(etcFile.open());
+        {
+            QTextStream outEtc(&etcFile);
+            outEtc << "100\tvpnrt\n";
+            outEtc << "0x1000\tvpnOnlyrt\n";
+        }
+        RtTablesInitializer::RtLocations locations{etcFile.fileName().toStdString(), {}};
+
+        QCOMPARE(rtnetlink::parseTable(locations, ""), Id{rtnetlink::TableMain});
+        QCOMPARE(rtnetlink::parseTable(locations, "main"), Id{254});
+        QCOMPARE(rtnetlink::parseTable(locations, "local"), Id{255});
+        QCOMPARE(rtnetlink::parseTable(locations, "default"), Id{253});
+        QCOMPARE(rtnetlink::parseTable(locations, "42"), Id{42});
+        QCOMPARE(rtnetlink::parseTable(locations, "0x10"), Id{16});
+        QCOMPARE(rtnetlink::parseTable(locations, "vpnrt"), Id{100});
+        QCOMPARE(rtnetlink::parseTable(locations, "vpnOnlyrt"), Id{4096});
+        QVERIFY(!rtnetlink::parseTable(locations, "unknown"));
+        QVERIFY(!rtnetlink::parseTable(locations, "42x"));
+
+        QCOMPARE(rtnetlink::headerTableId(254), static_cast<unsigned char>(254));
+        QCOMPARE(rtnetlink::headerTableId(4096), static_cast<unsigned char>(RT_TABLE_UNSPEC));
+    }
+
+    void testParseFwmark()
+    {
+        QCOMPARE(rtnetlink::parseFwmark("0x1234"), Id{0x1234});
+        QCOMPARE(rtnetlink::parseFwmark("51820"), Id{51820});
+        QVERIFY(!rtnetlink::parseFwmark(""));
+        QVERIFY(!rtnetlink::parseFwmark("0x12g"));
+        QVERIFY(!rtnetlink::parseFwmark("-1"));
+        QVERIFY(!rtnetlink::parseFwmark("mark"));
+    }
+
+    void testReplaceRoute()
+    {
+        auto request = rtnetlink::routeRequest(rtnetlink::RouteOperation::Replace,
+                                               route("10.8.0.0/16", {}, 100), 254, 7);
+        QVERIFY(request);
+        QVERIFY(request->toleratedErrors.empty());
+
+        auto msg = decode<rtmsg>(request->message);
+        QCOMPARE(std::size_t{msg.nlHeader.nlmsg_len}, msg.size);
+        QCOMPARE(int{msg.nlHeader.nlmsg_type}, int{RTM_NEWROUTE});
+        QCOMPARE(int{msg.nlHeader.nlmsg_flags}, kRequestFlags | NLM_F_CREATE | NLM_F_REPLACE);
+        QCOMPARE(int{msg.header.rtm_family}, AF_INET);
+        QCOMPARE(int{msg.header.rtm_dst_len}, 16);
+        QCOMPARE(int{msg.header.rtm_table}, 254);
+        QCOMPARE(int{msg.header.rtm_protocol}, RTPROT_BOOT);
+        QCOMPARE(int{msg.header.rtm_type}, int{RTN_UNICAST});
+        // No gateway - the route is directly through the interface
+        QCOMPARE(int{msg.header.rtm_scope}, int{RT_SCOPE_LINK});
+        QCOMPARE(msg.attributes, (Attributes{{RTA_TABLE, u32(254)},
+                                             {RTA_DST, address(AF_INET, "10.8.0.0")},
+                                             {RTA_OIF, u32(7)},
+                                             {RTA_PRIORITY, u32(100)}}));
+    }
+
+    void testAddRoute()
+    {
+        auto ipv6Route = route("default", "fd00::1");
+        ipv6Route.family = Family::IPv6;
+        auto request = rtnetlink::routeRequest(rtnetlink::RouteOperation::Add,
+                                               ipv6Route, 4096, 0);
+        QVERIFY(request);
+        QCOMPARE(request->toleratedErrors, (std::set<int>{EEXIST}));
+
+        auto msg = decode<rtmsg>(request->message);
+        QCOMPARE(int{msg.nlHeader.nlmsg_type}, int{RTM_NEWROUTE});
+        QCOMPARE(int{msg.nlHeader.nlmsg_flags}, kRequestFlags | NLM_F_CREATE | NLM_F_EXCL);
+        QCOMPARE(int{msg.header.rtm_family}, AF_INET6);
+        QCOMPARE(int{msg.header.rtm_dst_len}, 0);
+        // The table only fits in the attribute
+        QCOMPARE(int{msg.header.rtm_table}, int{RT_TABLE_UNSPEC});
+        QCOMPARE(int{msg.header.rtm_scope}, int{RT_SCOPE_UNIVERSE});
+        // The default route has no destination, and no metric was given
+        QCOMPARE(msg.attributes, (Attributes{{RTA_TABLE, u32(4096)},
+                                             {RTA_GATEWAY, address(AF_INET6, "fd00::1")}}));
+
+        auto blackhole = rtnetlink::routeRequest(rtnetlink::RouteOperation::Add,
+                                                 route("0.0.0.0/1", {}, 0, true), 254, 0);
+        QVERIFY(blackhole);
+        auto blackholeMsg = decode<rtmsg>(blackhole->message);
+        QCOMPARE(int{blackholeMsg.header.rtm_type}, int{RTN_BLACKHOLE});
+        QCOMPARE(int{blackholeMsg.header.rtm_scope}, int{RT_SCOPE_UNIVERSE});
+    }
+
+    void testDeleteRoute()
+    {
+        auto request = rtnetlink::routeRequest(rtnetlink::RouteOperation::Delete,
+                                               route("192.0.2.0/24", "192.0.2.1"), 100, 3);
+        QVERIFY(request);
+        QCOMPARE(request->toleratedErrors, (std::set<int>{ENOENT, ESRCH}));
+
+        auto msg = decode<rtmsg>(request->message);
+        QCOMPARE(int{msg.nlHeader.nlmsg_type}, int{RTM_DELROUTE});
+        QCOMPARE(int{msg.nlHeader.nlmsg_flags}, kRequestFlags);
+        // Match any scope, type, and protocol
+        QCOMPARE(int{msg.header.rtm_scope}, int{RT_SCOPE_NOWHERE});
+        QCOMPARE(int{msg.header.rtm_type}, int{RTN_UNSPEC});
+        QCOMPARE(int{msg.header.rtm_protocol}, RTPROT_UNSPEC);
+        QCOMPARE(msg.attributes, (Attributes{{RTA_TABLE, u32(100)},
+                                             {RTA_DST, address(AF_INET, "192.0.2.0")},
+                                             {RTA_GATEWAY, address(AF_INET, "192.0.2.1")},
+                                             {RTA_OIF, u32(3)}}));
+
+        auto blackhole = rtnetlink::routeRequest(rtnetlink::RouteOperation::Delete,
+                                                 route("0.0.0.0/1", {}, 0, true), 254, 0);
+        QVERIFY(blackhole);
+        QCOMPARE(int{decode<rtmsg>(blackhole->message).header.rtm_type}, int{RTN_BLACKHOLE});
+    }
+
+    void testInvalidRoute()
+    {
+        using rtnetlink::RouteOperation;
+        QVERIFY(!rtnetlink::routeRequest(RouteOperation::Replace, route("10.8.0.0/40", {}), 254, 0));
+        QVERIFY(!rtnetlink::routeRequest(RouteOperation::Replace, route("default", "gateway"), 254, 0));
+        // The gateway has to be a single address
+        QVERIFY(!rtnetlink::routeRequest(RouteOperation::Replace, route("default", "10.8.0.0/16"), 254, 0));
+    }
+
+    void testAddRule()
+    {
+        LinuxRouteManager::Rule rule{Family::IPv4, "10.8.0.2", "0x3211", "vpnrt", 101, 0};
+        auto request = rtnetlink::ruleRequest(true, rule, 100);
+        QVERIFY(request);
+        QCOMPARE(request->toleratedErrors, (std::set<int>{EEXIST}));
+
+        auto msg = decode<fib_rule_hdr>(request->message);
+        QCOMPARE(std::size_t{msg.nlHeader.nlmsg_len}, msg.size);
+        QCOMPARE(int{msg.nlHeader.nlmsg_type}, int{RTM_NEWRULE});
+        QCOMPARE(int{msg.nlHeader.nlmsg_flags}, kRequestFlags | NLM_F_CREATE | NLM_F_EXCL);
+        QCOMPARE(int{msg.header.family}, AF_INET);
+        QCOMPARE(int{msg.header.src_len}, 32);
+        QCOMPARE(int{msg.header.table}, 100);
+        QCOMPARE(int{msg.header.action}, int{FR_ACT_TO_TBL});
+        QCOMPARE(msg.attributes, (Attributes{{FRA_TABLE, u32(100)},
+                                             {FRA_PRIORITY, u32(101)},
+                                             {FRA_FWMARK, u32(0x3211)},
+                                             {FRA_SRC, address(AF_INET, "10.8.0.2")},
+                                             {FRA_SUPPRESS_PREFIXLEN, u32(0)}}));
+    }
+
+    void testDeleteRule()
+    {
+        LinuxRouteManager::Rule rule{Family::IPv6, {}, {}, "vpnOnlyrt", 102, -1};
+        auto request = rtnetlink::ruleRequest(false, rule, 4096);
+        QVERIFY(request);
+        QCOMPARE(request->toleratedErrors, (std::set<int>{ENOENT}));
+
+        auto msg = decode<fib_rule_hdr>(request->message);
+        QCOMPARE(int{msg.nlHeader.nlmsg_type}, int{RTM_DELRULE});
+        QCOMPARE(int{msg.nlHeader.nlmsg_flags}, kRequestFlags);
+        QCOMPARE(int{msg.header.family}, AF_INET6);
+        QCOMPARE(int{msg.header.src_len}, 0);
+        QCOMPARE(int{msg.header.table}, int{RT_TABLE_UNSPEC});
+        // Deleting matches any action
+        QCOMPARE(int{msg.header.action}, int{FR_ACT_UNSPEC});
+        // "from all", any fwmark, and no suppress_prefixlength are omitted
+        QCOMPARE(msg.attributes, (Attributes{{FRA_TABLE, u32(4096)},
+                                             {FRA_PRIORITY, u32(102)}}));
+
+        QVERIFY(!rtnetlink::ruleRequest(false, {Family::IPv6, "10.0.0.1", {}, {}, 102, -1}, 254));
+        QVERIFY(!rtnetlink::ruleRequest(false, {Family::IPv4, {}, "0x1x", {}, 102, -1}, 254));
+    }
+
+    void testFlushRoute()
+    {
+        // Encode a route like the ones in a dump (the header has no table, the
+        // attribute does)
+        auto dumped = rtnetlink::routeRequest(rtnetlink::RouteOperation::Replace,
+                                              route("10.8.0.0/16", "10.8.0.1", 5), 4096, 2);
+        QVERIFY(dumped);
+        std::vector<unsigned char> routeMsg;
+        dumped->message.appendTo(routeMsg, 77);
+
+        QVERIFY(!rtnetlink::flushRouteMessage(routeMsg, 254));
+        QVERIFY(!rtnetlink::flushRouteMessage({routeMsg.begin(), routeMsg.begin() + 8}, 4096));
+
+        auto flush = rtnetlink::flushRouteMessage(routeMsg, 4096);
+        QVERIFY(flush);
+        auto msg = decode<rtmsg>(flush.get());
+        auto original = decode<rtmsg>(routeMsg);
+        QCOMPARE(int{msg.nlHeader.nlmsg_type}, int{RTM_DELROUTE});
+        QCOMPARE(int{msg.nlHeader.nlmsg_flags}, kRequestFlags);
+        QCOMPARE(int{msg.header.rtm_dst_len}, 16);
+        QCOMPARE(int{msg.header.rtm_type}, int{RTN_UNICAST});
+        QCOMPARE(msg.attributes, original.attributes);
+    }
+
+    void testSendGroups()
+    {
+        using Groups = std::vector<std::pair<std::size_t, std::size_t>>;
+        QVERIFY(rtnetlink::sendGroups(0).empty());
+        QCOMPARE(rtnetlink::sendGroups(64), (Groups{{0, 64}}));
+        QCOMPARE(rtnetlink::sendGroups(65), (Groups{{0, 64}, {64, 65}}));
+        QCOMPARE(rtnetlink::sendGroups(200), (Groups{{0, 64}, {64, 128}, {128, 192}, {192, 200}}));
+
+        std::vector<rtnetlink::Request> requests;
+        for(std::uint32_t i = 0; i < 70; ++i)
+        {
+            requests.push_back(rtnetlink::ruleRequest(true, {Family::IPv4, {}, {}, {}, i, -1},
+                                                      254).get());
+        }
+
+        // Encode the second group; its messages are numbered from firstSeq
+        auto buffer = rtnetlink::encodeGroup(requests, 64, 70, 1000);
+        std::uint32_t len = static_cast<std::uint32_t>(buffer.size());
+        std::uint32_t count{0};
+        for(auto pMsg = reinterpret_cast<nlmsghdr*>(buffer.data());
+            NLMSG_OK(pMsg, len); pMsg = NLMSG_NEXT(pMsg, len))
+        {
+            QCOMPARE(pMsg->nlmsg_seq, 1000 + count);
+            // FRA_PRIORITY follows FRA_TABLE
+            auto pTable = reinterpret_cast<rtattr*>(reinterpret_cast<unsigned char*>(pMsg) +
+                                                    NLMSG_SPACE(sizeof(fib_rule_hdr)));
+            auto pPriority = reinterpret_cast<rtattr*>(reinterpret_cast<unsigned char*>(pTable) +
+                                                       RTA_ALIGN(pTable->rta_len));
+            QCOMPARE(int{pPriority->rta_type}, int{FRA_PRIORITY});
+            QCOMPARE(*reinterpret_cast<std::uint32_t*>(RTA_DATA(pPriority)), 64 + count);
+            ++count;
+        }
+        QCOMPARE(count, 6u);
+        QCOMPARE(len, 0u);
+    }
+};
+
+}
+
+QTEST_GUILESS_MAIN(kapps::net::tst_linux_routemanager)
+#include TEST_MOC
@@ -429,6 +429,28 @@ private slots:
         QCOMPARE(nearest.id(), "ro");
     }
 
+    // Unreliable regions are avoided if a reliable region meets the same
+    // criteria, even if it's farther away
+    void testGetNearestSafeVpnLocationAvoidsUnreliable()
+    {
+        setLatencies();
+        buildRegions();
+
+        NearestLocations nearestLocations{locs, {QStringLiteral("us2")}};
+        QCOMPARE(nearestLocations.getNearestSafeVpnLocation(false)->id(), "us_california");
+        QCOMPARE(nearestLocations.getNearestSafeVpnLocation(true)->id(), "ro");
+
+        NearestLocations nearestPfLocations{locs, {QStringLiteral("ro")}};
+        QCOMPARE(nearestPfLocations.getNearestSafeVpnLocation(true)->id(), "poland");
+
+        // If all auto-safe regions are unreliable, the nearest one is still
+        // preferred over regions that aren't auto-safe
+        NearestLocations allUnreliable{locs, {QStringLiteral("us2"),
+            QStringLiteral("us_california"), QStringLiteral("ro"),
+            QStringLiteral("poland")}};
+        QCOMPARE(allUnreliable.getNearestSafeVpnLocation(false)->id(), "us2");
+    }
+
     // If we request PF regions but no PF regions available then fallback to fasted non-PF region
     void testGetNearestSafeVpnLocationWithPFButNoPFRegions()
     {
@@ -539,6 +561,59 @@ private slots:
         testLocations.erase("npf_nauto_ng");
         QCOMPARE(getBestId(), "npf_nauto_g");
     }
+
+    // Applying latencies to existing locations gives the same result as
+    // rebuilding the locations with the new latencies
+    void testApplyLatencies()
+    {
+        // List the grouped location IDs in order, to compare the order
+        auto groupedIds = [](const std::vector<CountryLocations> &grouped)
+        {
+            QStringList ids;
+            for(const auto &group : grouped)
+            {
+                for(const auto &pLocation : group.locations())
+                    ids.push_back(pLocation->id());
+            }
+            return ids;
+        };
+
+        setLatencies();
+        auto built = buildModernLocations(latencies, samples::locations,
+            samples::emptyShadowsocks, samples::metadata, {}, {});
+        LocationsById applied = built.first;
+        std::vector<CountryLocations> appliedGrouped;
+        std::vector<QSharedPointer<const Location>> appliedDips;
+        buildGroupedLocations(applied, built.second, appliedGrouped, appliedDips);
+
+        // Unchanged and unknown latencies don't replace anything
+        LatencyMap sameLatencies;
+        sameLatencies[QStringLiteral("us2")] = 600;
+        sameLatencies[QStringLiteral("nonexistent")] = 100;
+        QVERIFY(applyLocationLatencies(applied, sameLatencies).empty());
+
+        LatencyMap newLatencies;
+        newLatencies[QStringLiteral("poland")] = 100;
+        newLatencies[QStringLiteral("us2")] = 950;
+        auto changed = applyLocationLatencies(applied, newLatencies);
+        QCOMPARE(changed.size(), std::size_t{2});
+        QCOMPARE(applied.at("poland")->latency().get(), 100.0);
+        QCOMPARE(applied.at("us2")->latency().get(), 950.0);
+        // The originals weren't modified
+        QCOMPARE(built.first.at("poland")->latency().get(), 900.0);
+        updateGroupedLocations(changed, built.second, appliedGrouped, appliedDips);
+
+        latencies[QStringLiteral("poland")] = 100;
+        latencies[QStringLiteral("us2")] = 950;
+        buildRegions();
+        std::vector<CountryLocations> rebuiltGrouped;
+        std::vector<QSharedPointer<const Location>> rebuiltDips;
+        buildGroupedLocations(locs, built.second, rebuiltGrouped, rebuiltDips);
+
+        QCOMPARE(groupedIds(appliedGrouped), groupedIds(rebuiltGrouped));
+        QCOMPARE(NearestLocations{applied}.getNearestSafeVpnLocation(true)->id(),
+                 NearestLocations{locs}.getNearestSafeVpnLocation(true)->id());
+    }
 };
 
 QTEST_GUILESS_MAIN(tst_nearestlocations)
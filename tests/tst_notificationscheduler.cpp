@@ -0,0 +1,133 @@
+// Copyright (c) 2024 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include <common/src/common.h>
+#include <QtTest>
+
+#include "daemon/src/notificationscheduler.h"
+
+namespace
+{
+    // Long enough that the coalescing timer never elapses during a test that
+    // doesn't wait for it
+    const std::chrono::milliseconds longWindow{60000};
+    const std::chrono::milliseconds shortWindow{50};
+}
+
+class tst_notificationscheduler : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    // Immediate changes are broadcast on the next event loop turn, and
+    // changes during that turn are merged into the same broadcast
+    void testImmediate()
+    {
+        int broadcasts{0};
+        NotificationScheduler scheduler{longWindow, [&](){++broadcasts;}};
+
+        scheduler.schedule(NotificationScheduler::Priority::Immediate);
+        scheduler.schedule(NotificationScheduler::Priority::Immediate);
+        scheduler.schedule(NotificationScheduler::Priority::Coalesced);
+        QVERIFY(scheduler.isScheduled());
+        QCOMPARE(broadcasts, 0);
+
+        QCoreApplication::processEvents();
+        QCOMPARE(broadcasts, 1);
+        QVERIFY(!scheduler.isScheduled());
+        QCOMPARE(scheduler.broadcasts(), quint64{1});
+        QCOMPARE(scheduler.mergedChanges(), quint64{2});
+    }
+
+    // Coalesced changes within the window are broadcast once, when the window
+    // elapses
+    void testCoalesced()
+    {
+        int broadcasts{0};
+        NotificationScheduler scheduler{shortWindow, [&](){++broadcasts;}};
+        QCOMPARE(scheduler.coalesceWindow(), shortWindow);
+
+        QElapsedTimer elapsed;
+        elapsed.start();
+        scheduler.schedule(NotificationScheduler::Priority::Coalesced);
+        scheduler.schedule(NotificationScheduler::Priority::Coalesced);
+        scheduler.schedule(NotificationScheduler::Priority::Coalesced);
+        QCoreApplication::processEvents();
+        QVERIFY(scheduler.isScheduled());
+        QCOMPARE(broadcasts, 0);
+
+        QTRY_COMPARE(broadcasts, 1);
+        QVERIFY(elapsed.elapsed() >= shortWindow.count());
+        QVERIFY(!scheduler.isScheduled());
+        QCOMPARE(scheduler.broadcasts(), quint64{1});
+        QCOMPARE(scheduler.mergedChanges(), quint64{2});
+
+        // A change after the broadcast starts a new window
+        scheduler.schedule(NotificationScheduler::Priority::Coalesced);
+        QTRY_COMPARE(broadcasts, 2);
+        QCOMPARE(scheduler.broadcasts(), quint64{2});
+        QCOMPARE(scheduler.mergedChanges(), quint64{2});
+    }
+
+    // An Immediate change flushes Coalesced changes that are waiting for the
+    // window
+    void testImmediateFlushesCoalesced()
+    {
+        int broadcasts{0};
+        NotificationScheduler scheduler{longWindow, [&](){++broadcasts;}};
+
+        scheduler.schedule(NotificationScheduler::Priority::Coalesced);
+        scheduler.schedule(NotificationScheduler::Priority::Immediate);
+        QCoreApplication::processEvents();
+        QCOMPARE(broadcasts, 1);
+        // The coalescing timer was stopped, nothing else is pending
+        QVERIFY(!scheduler.isScheduled());
+        QCOMPARE(scheduler.broadcasts(), quint64{1});
+        QCOMPARE(scheduler.mergedChanges(), quint64{1});
+    }
+
+    // Canceling (or broadcasting without the scheduler) discards the pending
+    // trigger
+    void testCancel()
+    {
+        int broadcasts{0};
+        NotificationScheduler scheduler{longWindow, [&](){++broadcasts;}};
+
+        scheduler.schedule(NotificationScheduler::Priority::Immediate);
+        QVERIFY(scheduler.cancel());
+        QVERIFY(!scheduler.cancel());
+        QCoreApplication::processEvents();
+        QCOMPARE(broadcasts, 0);
+
+        scheduler.schedule(NotificationScheduler::Priority::Coalesced);
+        scheduler.flushed();
+        QVERIFY(!scheduler.isScheduled());
+
+        // Rescheduling during the same turn still broadcasts once
+        scheduler.schedule(NotificationScheduler::Priority::Immediate);
+        scheduler.cancel();
+        scheduler.schedule(NotificationScheduler::Priority::Immediate);
+        QCoreApplication::processEvents();
+        QCoreApplication::processEvents();
+        QCOMPARE(broadcasts, 1);
+        QCOMPARE(scheduler.broadcasts(), quint64{1});
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_notificationscheduler)
+#include TEST_MOC
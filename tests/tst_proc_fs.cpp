@@ -0,0 +1,110 @@
+// Copyright (c) 2024 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include <common/src/common.h>
+#include <QtTest>
+#include <algorithm>
+#include <unistd.h>
+
+#include <kapps_net/src/linux/linux_proc_fs.h>
+
+namespace
+{
+    using Pids = std::vector<pid_t>;
+
+    // Pids above the kernel's maximum pid_max (2^22), so they never exist in
+    // /proc
+    constexpr pid_t kParent{4200000};
+    constexpr pid_t kChild{4200001};
+    constexpr pid_t kGrandchild{4200002};
+}
+
+class tst_proc_fs : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testParentPid()
+    {
+        QCOMPARE(ProcFs::parentPidOf(getpid()), getppid());
+        QCOMPARE(ProcFs::parentPidOf(kParent, true), -1);
+    }
+
+    void testScan()
+    {
+        ProcFs::ProcessTable table;
+        table.scan();
+
+        const auto *pSelf = table.find(getpid());
+        QVERIFY(pSelf);
+        QCOMPARE(pSelf->parentPid, getppid());
+        QCOMPARE(pSelf->path, ProcFs::pathForPid(getpid()));
+        QVERIFY(table.pidsForPath(pSelf->path).count(getpid()));
+
+        const auto siblings = table.childPidsOf(getppid());
+        QVERIFY(std::find(siblings.begin(), siblings.end(), getpid()) != siblings.end());
+
+        QCOMPARE(table.mountNamespaceId(getpid()), ProcFs::mountNamespaceId(getpid()));
+    }
+
+    void testEvents()
+    {
+        ProcFs::ProcessTable table;
+        table.scan();
+        const std::string selfPath = table.pathForPid(getpid());
+
+        // Forked processes run the parent's executable
+        table.processForked(getpid(), kParent);
+        table.processForked(kParent, kChild);
+        table.processForked(kChild, kGrandchild);
+        QCOMPARE(table.childPidsOf(kParent), (Pids{kChild}));
+        QCOMPARE(table.childPidsOf(kChild), (Pids{kGrandchild}));
+        QCOMPARE(table.pathForPid(kGrandchild), selfPath);
+        QVERIFY(table.pidsForPath(selfPath).count(kGrandchild));
+
+        // Exec re-reads the executable (these processes don't exist, so it's
+        // empty)
+        table.processExec(kChild);
+        QCOMPARE(table.pathForPid(kChild), std::string{});
+        QCOMPARE(table.childPidsOf(kParent), (Pids{kChild}));
+        QVERIFY(!table.pidsForPath(selfPath).count(kChild));
+        QVERIFY(table.pidsForPath(selfPath).count(kParent));
+
+        // Orphans are reparented (to nothing here, since the new parent can't
+        // be read)
+        table.processExited(kChild);
+        QVERIFY(!table.find(kChild));
+        QVERIFY(table.childPidsOf(kParent).empty());
+        QVERIFY(table.childPidsOf(kChild).empty());
+        QVERIFY(table.find(kGrandchild));
+        QCOMPARE(table.find(kGrandchild)->parentPid, 0);
+
+        table.processExited(kGrandchild);
+        table.processExited(kParent);
+        QVERIFY(!table.find(kParent));
+        QVERIFY(!table.find(kGrandchild));
+        QVERIFY(!table.pidsForPath(selfPath).count(kParent));
+        QVERIFY(!table.pidsForPath(selfPath).count(kGrandchild));
+        QVERIFY(table.pidsForPath(selfPath).count(getpid()));
+        const auto siblings = table.childPidsOf(getpid());
+        QVERIFY(std::find(siblings.begin(), siblings.end(), kParent) == siblings.end());
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_proc_fs)
+#include TEST_MOC
@@ -18,10 +18,13 @@
 
 #include <kapps_regions/src/regionlist.h>
 #include <kapps_regions/src/metadata.h>
+#include <kapps_regions/src/snapshot.h>
 #include <kapps_core/src/logger.h>
 #include "src/testresource.h"
 #include <QtTest>
 #include <nlohmann/json.hpp>
+#include <algorithm>
+#include <optional>
 
 namespace kapps::regions
 {
@@ -33,9 +36,61 @@ class tst_regionlist : public QObject
 private:
     RegionList parseJson(core::StringSlice json)
     {
+        verifyStreaming(json);
         return {json, {}, {}, {}};
     }
 
+    // Verify that the streaming parser reads the same regions as the DOM
+    // parser, or throws if the DOM parser throws
+    void verifyStreaming(core::StringSlice json)
+    {
+        BuildOptions options;
+        options.streaming = true;
+        std::optional<RegionList> expected;
+        try
+        {
+            expected = RegionList{json, {}, {}, {}};
+        }
+        catch(const std::exception &)
+        {
+        }
+
+        if(!expected)
+        {
+            QVERIFY_EXCEPTION_THROWN((RegionList{json, {}, {}, {}, options}),
+                                     std::exception);
+            return;
+        }
+
+        RegionList streamed{json, {}, {}, {}, options};
+        QVERIFY(streamed.publicDnsServers() == expected->publicDnsServers());
+        QCOMPARE(streamed.regions().size(), expected->regions().size());
+        for(const Region *pExpected : expected->regions())
+        {
+            const Region *pStreamed = streamed.getRegion(pExpected->id());
+            QVERIFY(pStreamed);
+            QCOMPARE(pStreamed->autoSafe(), pExpected->autoSafe());
+            QCOMPARE(pStreamed->portForward(), pExpected->portForward());
+            QCOMPARE(pStreamed->geoLocated(), pExpected->geoLocated());
+            QCOMPARE(pStreamed->servers().size(), pExpected->servers().size());
+            for(std::size_t i=0; i<pExpected->servers().size(); ++i)
+            {
+                const Server &streamedServer = *pStreamed->servers()[i];
+                const Server &expectedServer = *pExpected->servers()[i];
+                QCOMPARE(streamedServer.address(), expectedServer.address());
+                QCOMPARE(streamedServer.commonName(), expectedServer.commonName());
+                QCOMPARE(streamedServer.fqdn(), expectedServer.fqdn());
+                QCOMPARE(streamedServer.services(), expectedServer.services());
+                for(std::size_t s=0; s<ServiceCount; ++s)
+                {
+                    auto service = static_cast<Service>(s);
+                    QVERIFY(streamedServer.servicePorts(service) ==
+                            expectedServer.servicePorts(service));
+                }
+            }
+        }
+    }
+
 private slots:
     void testSuccess()
     {
@@ -587,6 +642,73 @@ private slots:
             "pubdns":["1.2.3.4",9001]})"), std::exception);
     }
 
+    // Test Shadowsocks servers from the Shadowsocks list, with both parsers
+    void testShadowsocks()
+    {
+        core::StringSlice regionsJson = R"(
+            {
+              "service_configs": [
+                {
+                  "name": "vpn",
+                  "services": [{"service":"openvpn_udp", "ports":[8080]}]
+                }
+              ],
+              "regions": [
+                {
+                  "id": "us_south_west", "auto_region": true,
+                  "port_forward": false, "geo": false,
+                  "servers": [{"ip":"10.0.0.1", "cn":"texas401", "service_config":"vpn"}]
+                },
+                {
+                  "id": "japan", "auto_region": true,
+                  "port_forward": true, "geo": false,
+                  "servers": [{"ip":"10.0.1.1", "cn":"japan401", "service_config":"vpn"}]
+                },
+                {
+                  "id": "offline", "auto_region": true,
+                  "port_forward": true, "geo": false,
+                  "servers": []
+                }
+              ]
+            }
+        )";
+        core::StringSlice shadowsocksJson = R"(
+            [
+              {"region":"us_dal", "host":"10.0.0.2", "port":443, "key":"key1", "cipher":"aes-128-gcm"},
+              {"region":"japan", "host":"10.0.1.2", "port":8443, "key":"key2", "cipher":"aes-128-gcm"},
+              {"region":"offline", "host":"10.0.2.2", "port":443, "key":"key3", "cipher":"aes-128-gcm"},
+              {"region":"invalid", "host":"10.0.3.2", "port":443}
+            ]
+        )";
+
+        for(bool streaming : {false, true})
+        {
+            BuildOptions options;
+            options.streaming = streaming;
+            RegionList r{regionsJson, shadowsocksJson, {}, {}, options};
+
+            // us_dal is a legacy ID for us_south_west
+            const Region *pTexas = r.getRegion("us_south_west");
+            QVERIFY(pTexas);
+            QCOMPARE(pTexas->servers().size(), std::size_t{2});
+            const Server &texasSs = *pTexas->servers()[1];
+            QVERIFY(texasSs.hasShadowsocks());
+            QCOMPARE(texasSs.address(), (core::Ipv4Address{10, 0, 0, 2}));
+            QCOMPARE(texasSs.shadowsocksKey(), core::StringSlice{"key1"});
+
+            const Region *pJapan = r.getRegion("japan");
+            QVERIFY(pJapan);
+            QCOMPARE(pJapan->servers().size(), std::size_t{2});
+            QCOMPARE(pJapan->servers()[1]->shadowsocksPorts(),
+                     (std::vector<std::uint16_t>{8443}));
+
+            // Offline regions don't get a Shadowsocks server
+            const Region *pOffline = r.getRegion("offline");
+            QVERIFY(pOffline);
+            QVERIFY(pOffline->servers().empty());
+        }
+    }
+
     // Test legacy PIAv6 regions support
     void testPiav6()
     {
@@ -739,6 +861,246 @@ private slots:
         QCOMPARE(pUsChicago->name().getLanguageText({"zh-Hans"}), "芝加哥");
         QCOMPARE(pUsChicago->name().getLanguageText({"zh-Hant"}), "芝加哥");
     }
+
+    // Test writing and restoring a snapshot
+    void testSnapshot()
+    {
+        QByteArray regionsv6 = TestResource::load(QStringLiteral(":/regions-v6.json"));
+        QByteArray metadatav2 = TestResource::load(QStringLiteral(":/metadata-v2.json"));
+        RegionList r{RegionList::PIAv6, regionsv6.data(), {}, {}, {}};
+        Metadata m{regionsv6.data(), metadatav2.data(), {}, {}};
+
+        std::string snapshot = writeSnapshot("key", r, m);
+        KAPPS_CORE_INFO() << "snapshot:" << snapshot.size() << "bytes";
+
+        RegionList restored;
+        Metadata restoredMetadata;
+        // Wrong key, truncated snapshots, and garbage are all rejected
+        QVERIFY(!readSnapshot(snapshot, "other key", restored, restoredMetadata));
+        QVERIFY(!readSnapshot(core::StringSlice{snapshot.data(), snapshot.size()-1},
+                              "key", restored, restoredMetadata));
+        QVERIFY(!readSnapshot(regionsv6.data(), "key", restored, restoredMetadata));
+        QCOMPARE(restored.regions().size(), 0u);
+
+        QVERIFY(readSnapshot(snapshot, "key", restored, restoredMetadata));
+        QCOMPARE(restored.regions().size(), r.regions().size());
+        QVERIFY(restored.publicDnsServers() == r.publicDnsServers());
+        for(const auto &pRegion : r.regions())
+        {
+            const Region *pRestoredRegion = restored.getRegion(pRegion->id());
+            QVERIFY(pRestoredRegion);
+            QCOMPARE(pRestoredRegion->autoSafe(), pRegion->autoSafe());
+            QCOMPARE(pRestoredRegion->portForward(), pRegion->portForward());
+            QCOMPARE(pRestoredRegion->geoLocated(), pRegion->geoLocated());
+            QCOMPARE(pRestoredRegion->servers().size(), pRegion->servers().size());
+            for(std::size_t i=0; i<pRegion->servers().size(); ++i)
+            {
+                const auto &server = *pRegion->servers()[i];
+                const auto &restoredServer = *pRestoredRegion->servers()[i];
+                QCOMPARE(restoredServer.address(), server.address());
+                QCOMPARE(restoredServer.commonName(), server.commonName());
+                QVERIFY(restoredServer.openVpnUdpPorts() == server.openVpnUdpPorts());
+                QVERIFY(restoredServer.openVpnTcpPorts() == server.openVpnTcpPorts());
+                QVERIFY(restoredServer.wireGuardPorts() == server.wireGuardPorts());
+                QCOMPARE(restoredServer.hasIkev2(), server.hasIkev2());
+                QVERIFY(restoredServer.metaPorts() == server.metaPorts());
+            }
+        }
+
+        QCOMPARE(restoredMetadata.countryDisplays().size(), m.countryDisplays().size());
+        QCOMPARE(restoredMetadata.regionDisplays().size(), m.regionDisplays().size());
+        const auto *pUsChicago = restoredMetadata.getRegionDisplay("us_chicago");
+        QVERIFY(pUsChicago);
+        QCOMPARE(pUsChicago->country(), "US");
+        QCOMPARE(pUsChicago->name().getLanguageText({"ru"}), "Чикаго");
+    }
+
+    void testStringTable()
+    {
+        StringTable table;
+        std::string value{"us_chicago"};
+        auto interned = table.intern(value);
+        QCOMPARE(interned, core::StringSlice{"us_chicago"});
+        QVERIFY(interned.data() != value.data());
+        // Interning the same string again returns the same storage
+        QCOMPARE(table.intern("us_chicago").data(), interned.data());
+        QCOMPARE(table.size(), std::size_t{1});
+        QVERIFY(table.intern("").empty());
+
+        // Strings larger than a block are stored too, and don't disturb the
+        // strings already interned
+        std::string large(100000, 'x');
+        QCOMPARE(table.intern(large), core::StringSlice{large});
+        QCOMPARE(table.intern("us_denver"), core::StringSlice{"us_denver"});
+        QCOMPARE(interned, core::StringSlice{"us_chicago"});
+        QCOMPARE(table.size(), std::size_t{3});
+    }
+
+    void testSharedStorage()
+    {
+        QByteArray regionsv6 = TestResource::load(QStringLiteral(":/regions-v6.json"));
+        RegionList r{RegionList::PIAv6, regionsv6.data(), {}, {}, {}};
+        QVERIFY(!r.regions().empty());
+
+        // Copies share the same regions
+        RegionList copy{r};
+        QCOMPARE(copy.regions().data(), r.regions().data());
+
+        // Servers refer to their regions, and retaining a server retains the
+        // region
+        const Region *pRegion = r.getRegion("us_chicago");
+        QVERIFY(pRegion);
+        QVERIFY(!pRegion->servers().empty());
+        const Server *pServer = pRegion->servers()[0];
+        QCOMPARE(pServer->region(), pRegion);
+        pServer->retain();
+        r = {};
+        copy = {};
+        QCOMPARE(pServer->region()->id(), core::StringSlice{"us_chicago"});
+        pServer->release();
+    }
+
+    void testRegionServiceIndices()
+    {
+        QByteArray regionsv6 = TestResource::load(QStringLiteral(":/regions-v6.json"));
+        RegionList r{RegionList::PIAv6, regionsv6.data(), {}, {}, {}};
+
+        for(const Region *pRegion : r.regions())
+        {
+            // The region's per-service indices include exactly the servers
+            // with that service
+            for(auto service : {Service::WireGuard, Service::Shadowsocks})
+            {
+                std::size_t serviceCount{0};
+                for(const Server *pServer : pRegion->servers())
+                {
+                    if(pServer->hasService(service))
+                        ++serviceCount;
+                }
+                QCOMPARE(pRegion->serverIndicesFor(service).size(), serviceCount);
+                for(auto serverIdx : pRegion->serverIndicesFor(service))
+                    QVERIFY(pRegion->servers()[serverIdx]->hasService(service));
+                QCOMPARE(pRegion->hasService(service), serviceCount > 0);
+            }
+        }
+    }
+
+    void testServerTable()
+    {
+        QByteArray regionsv6 = TestResource::load(QStringLiteral(":/regions-v6.json"));
+        RegionList r{RegionList::PIAv6, regionsv6.data(), {}, {}, {}};
+        const ServerTable &table = *r.serverTable();
+        QCOMPARE(table.regions().size(), r.regions().size());
+
+        std::size_t serverCount{0};
+        for(std::size_t regionIdx=0; regionIdx<r.regions().size(); ++regionIdx)
+        {
+            const Region &region = *r.regions()[regionIdx];
+            QCOMPARE(table.regions()[regionIdx].get(), &region);
+            QCOMPARE(std::size_t{table.regionEnd(regionIdx) - table.regionBegin(regionIdx)},
+                     region.servers().size());
+            for(std::size_t i=0; i<region.servers().size(); ++i)
+            {
+                const Server &server = *region.servers()[i];
+                std::size_t serverIdx = table.regionBegin(regionIdx) + i;
+                QCOMPARE(&table.server(serverIdx), &server);
+                QCOMPARE(table.addresses()[serverIdx], server.address());
+                QCOMPARE(std::size_t{table.regionIndices()[serverIdx]}, regionIdx);
+                QCOMPARE(table.services()[serverIdx], server.services());
+                QVERIFY(table.serverPorts(serverIdx, Service::OpenVpnUdp) == server.openVpnUdpPorts());
+            }
+
+            // The region's part of the per-service and per-port indices
+            // includes exactly its servers with that service or port
+            auto wgServers = table.serversFor(Service::WireGuard, regionIdx);
+            auto wgIndices = region.serverIndicesFor(Service::WireGuard);
+            QCOMPARE(wgServers.size(), wgIndices.size());
+            for(std::size_t i=0; i<wgServers.size(); ++i)
+                QCOMPARE(wgServers[i], table.regionBegin(regionIdx) + wgIndices[i]);
+            for(auto port : {std::uint16_t{8080}, std::uint16_t{53}})
+            {
+                std::size_t portCount{0};
+                for(const Server *pServer : region.servers())
+                {
+                    const auto &ports = pServer->openVpnUdpPorts();
+                    if(std::find(ports.begin(), ports.end(), port) != ports.end())
+                        ++portCount;
+                }
+                auto portServers = table.serversForPort(Service::OpenVpnUdp, port, regionIdx);
+                QCOMPARE(portServers.size(), portCount);
+                for(auto serverIdx : portServers)
+                    QCOMPARE(std::size_t{table.regionIndices()[serverIdx]}, regionIdx);
+            }
+            serverCount += region.servers().size();
+        }
+        QCOMPARE(table.size(), serverCount);
+
+        // Per-service indices include exactly the servers with that service
+        std::size_t shadowsocksCount{0};
+        for(std::size_t i=0; i<table.size(); ++i)
+        {
+            if(table.server(i).hasShadowsocks())
+                ++shadowsocksCount;
+        }
+        QCOMPARE(table.serversFor(Service::Shadowsocks).size(), shadowsocksCount);
+        for(auto serverIdx : table.serversFor(Service::Shadowsocks))
+            QVERIFY(table.server(serverIdx).hasShadowsocks());
+        // Per-port indices are in table order and only include servers with
+        // that port
+        auto udp8080 = table.serversForPort(Service::OpenVpnUdp, 8080);
+        QVERIFY(!udp8080.empty());
+        QVERIFY(std::is_sorted(udp8080.begin(), udp8080.end()));
+        for(auto serverIdx : udp8080)
+        {
+            const auto &ports = table.serverPorts(serverIdx, Service::OpenVpnUdp);
+            QVERIFY(std::find(ports.begin(), ports.end(), 8080) != ports.end());
+        }
+        QVERIFY(table.serversForPort(Service::OpenVpnUdp, 1).empty());
+        // The regions list has only a few service groups, so only a few port
+        // sets
+        QVERIFY(table.portSetCount() < 10);
+    }
+
+    void testParallelBuild()
+    {
+        QByteArray regionsv6 = TestResource::load(QStringLiteral(":/regions-v6.json"));
+        auto json = nlohmann::json::parse(regionsv6.data());
+        auto &jsonRegions = json.at("regions");
+        QVERIFY(jsonRegions.size() > 10);
+        // Duplicate a region at the end, the first one should still be used
+        auto duplicate = jsonRegions[5];
+        duplicate["auto_region"] = !duplicate.at("auto_region").get<bool>();
+        jsonRegions.push_back(duplicate);
+        // Add an invalid region at the beginning, it's ignored
+        auto invalid = jsonRegions[6];
+        invalid.erase("servers");
+        jsonRegions.insert(jsonRegions.begin(), invalid);
+        std::string modified = json.dump();
+
+        RegionList serial{RegionList::PIAv6, modified, {}, {}, {}};
+        RegionList parallel{RegionList::PIAv6, modified, {}, {}, {},
+                            BuildOptions{4}};
+        QCOMPARE(parallel.regions().size(), serial.regions().size());
+        for(std::size_t i=0; i<serial.regions().size(); ++i)
+        {
+            const Region &serialRegion = *serial.regions()[i];
+            const Region &parallelRegion = *parallel.regions()[i];
+            QCOMPARE(parallelRegion.id(), serialRegion.id());
+            QCOMPARE(parallelRegion.autoSafe(), serialRegion.autoSafe());
+            QCOMPARE(parallelRegion.servers().size(), serialRegion.servers().size());
+            for(std::size_t s=0; s<serialRegion.servers().size(); ++s)
+            {
+                QCOMPARE(parallelRegion.servers()[s]->address(),
+                         serialRegion.servers()[s]->address());
+                QCOMPARE(parallelRegion.servers()[s]->region(), &parallelRegion);
+            }
+        }
+        QCOMPARE(parallel.serverTable()->size(), serial.serverTable()->size());
+
+        const Region *pDuplicated = parallel.getRegion(duplicate.at("id").get<std::string>());
+        QVERIFY(pDuplicated);
+        QCOMPARE(pDuplicated->autoSafe(), !duplicate.at("auto_region").get<bool>());
+    }
 };
 
 }
@@ -481,6 +481,37 @@ private slots:
           QCOMPARE(actualContent, expectedContent);
     }
   }
+
+  // Table indices are found by exact name, in etc and then each fallback
+  void testTableIndex()
+  {
+      QTemporaryFile etcFile;
+      QTemporaryFile libFile;
+      QVERIFY(etcFile.open() && libFile.open());
+      {
+          QTextStream outEtc(&etcFile);
+          outEtc << "# reserved values\n";
+          outEtc << "100\ttable1\n";
+          outEtc << "0x80 table2 # hex index\n";
+          outEtc << "not_an_index\ttable3\n";
+
+          QTextStream outLib(&libFile);
+          outLib << "200\ttable3\n";
+          outLib << "300\ttable1\n";
+      }
+
+      const auto entries = readRtTables(etcFile.fileName().toStdString());
+      QCOMPARE(entries.size(), std::size_t{2});
+      QCOMPARE(entries[1].index, 128);
+      QCOMPARE(entries[1].name, std::string{"table2"});
+
+      RtTablesInitializer::RtLocations locations{etcFile.fileName().toStdString(),
+                                                 {libFile.fileName().toStdString()}};
+      QCOMPARE(RtTablesInitializer::tableIndex(locations, "table1"), 100);
+      QCOMPARE(RtTablesInitializer::tableIndex(locations, "table2"), 128);
+      QCOMPARE(RtTablesInitializer::tableIndex(locations, "table3"), 200);
+      QCOMPARE(RtTablesInitializer::tableIndex(locations, "table"), -1);
+  }
 };
 }
 
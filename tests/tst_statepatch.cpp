@@ -0,0 +1,175 @@
+// Copyright (c) 2024 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include <common/src/common.h>
+#include <QtTest>
+
+#include "daemon/src/model/state.h"
+
+namespace
+{
+    using json = clientjson::json;
+
+    IntervalBandwidth measurement(quint64 i)
+    {
+        return {i * 1000, i * 100};
+    }
+
+    // A patch operation, as built by buildArrayAppendPatch()
+    json removeFirst()
+    {
+        return {{"op", "remove"}, {"path", "/0"}};
+    }
+    json append(json value)
+    {
+        return {{"op", "add"}, {"path", "/-"}, {"value", std::move(value)}};
+    }
+}
+
+class tst_statepatch : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    // When the history is full, appending discards the oldest measurement
+    void testHistoryWraparound()
+    {
+        IntervalBandwidthHistory history;
+        QVERIFY(history.empty());
+
+        const quint64 total = IntervalBandwidthHistory::Capacity + 5;
+        for(quint64 i=0; i<total; ++i)
+        {
+            history.append(measurement(i));
+            QCOMPARE(history.size(), std::min<std::size_t>(i+1, IntervalBandwidthHistory::Capacity));
+            QCOMPARE(history[history.size()-1], measurement(i));
+        }
+
+        QCOMPARE(history.sequence(), total);
+        // Oldest first - the first 5 were discarded
+        for(std::size_t i=0; i<history.size(); ++i)
+            QCOMPARE(history[i], measurement(i+5));
+    }
+
+    // clear() removes the measurements but keeps the sequence number
+    void testHistoryClear()
+    {
+        IntervalBandwidthHistory history;
+        history.append(measurement(1));
+        history.append(measurement(2));
+        history.append(measurement(3));
+
+        history.clear();
+        QVERIFY(history.empty());
+        QCOMPARE(history.sequence(), quint64{3});
+
+        history.append(measurement(4));
+        QCOMPARE(history.size(), std::size_t{1});
+        QCOMPARE(history[0], measurement(4));
+        QCOMPARE(history.sequence(), quint64{4});
+    }
+
+    void testHistoryCompare()
+    {
+        IntervalBandwidthHistory history;
+        history.append(measurement(1));
+        history.append(measurement(2));
+
+        IntervalBandwidthHistory copy{history};
+        QVERIFY(copy == history);
+        copy.append(measurement(3));
+        QVERIFY(copy != history);
+
+        // Same sequence number and size, but different measurements
+        IntervalBandwidthHistory refilled;
+        refilled.append(measurement(1));
+        refilled.append(measurement(9));
+        QCOMPARE(refilled.sequence(), history.sequence());
+        QCOMPARE(refilled.size(), history.size());
+        QVERIFY(refilled != history);
+    }
+
+    // The history is serialized oldest first
+    void testHistoryJson()
+    {
+        IntervalBandwidthHistory history;
+        history.append(measurement(1));
+        history.append(measurement(2));
+
+        json j = history;
+        QVERIFY(j.is_array());
+        QCOMPARE(j.size(), std::size_t{2});
+        QCOMPARE(j[0].at("received").get<quint64>(), quint64{1000});
+        QCOMPARE(j[1].at("sent").get<quint64>(), quint64{200});
+    }
+
+    void testArrayAppendPatch()
+    {
+        // Sliding window - one removed, one added
+        QCOMPARE(clientjson::buildArrayAppendPatch(json{1, 2, 3}, json{2, 3, 4}),
+                 (json{removeFirst(), append(4)}));
+        // Only appended
+        QCOMPARE(clientjson::buildArrayAppendPatch(json{1, 2}, json{1, 2, 3, 4}),
+                 (json{append(3), append(4)}));
+        // Only removed
+        QCOMPARE(clientjson::buildArrayAppendPatch(json{1, 2, 3}, json{3}),
+                 (json{removeFirst(), removeFirst()}));
+        // Unchanged - an empty patch
+        QCOMPARE(clientjson::buildArrayAppendPatch(json{1, 2}, json{1, 2}),
+                 json::array());
+        // The smallest shift is used when more than one works
+        QCOMPARE(clientjson::buildArrayAppendPatch(json{1, 1, 1}, json{1, 1, 1, 1}),
+                 (json{append(1)}));
+    }
+
+    // Values that aren't related by removing from the front and appending
+    // don't produce a patch
+    void testArrayAppendPatchUnrelated()
+    {
+        QVERIFY(clientjson::buildArrayAppendPatch(json{1, 2, 3}, json{7, 8}).is_null());
+        QVERIFY(clientjson::buildArrayAppendPatch(json{1, 2, 3}, json{1, 3}).is_null());
+        // Everything removed
+        QVERIFY(clientjson::buildArrayAppendPatch(json{1, 2}, json::array()).is_null());
+        // Nothing to remove from
+        QVERIFY(clientjson::buildArrayAppendPatch(json::array(), json{1}).is_null());
+        // Not arrays
+        QVERIFY(clientjson::buildArrayAppendPatch(json{{"a", 1}}, json{{"a", 2}}).is_null());
+        QVERIFY(clientjson::buildArrayAppendPatch(json{1}, json{}).is_null());
+    }
+
+    // A full history that gets a new measurement is patched with one removal
+    // and one addition
+    void testHistoryPatch()
+    {
+        IntervalBandwidthHistory history;
+        for(quint64 i=0; i<IntervalBandwidthHistory::Capacity; ++i)
+            history.append(measurement(i));
+        json oldValue = history;
+        history.append(measurement(IntervalBandwidthHistory::Capacity));
+        json newValue = history;
+
+        json patch = clientjson::buildArrayAppendPatch(oldValue, newValue);
+        QCOMPARE(patch.size(), std::size_t{2});
+        QCOMPARE(patch[0], removeFirst());
+        QCOMPARE(patch[1], append(newValue.back()));
+        QCOMPARE(oldValue.patch(patch), newValue);
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_statepatch)
+#include TEST_MOC